@@ -15,6 +15,26 @@ struct Params
 {
     std::string scene_description;
     std::string scene_filename;
+
+    // empty means disabled
+    std::string bvh_cache_dir;
+
+    // empty means disabled
+    std::string checkpoint_filename;
+    double checkpoint_interval = 600;
+    bool resume = false;
+
+    // empty means rendering the whole film
+    std::string partial_output;
+
+    // pixel rectangle [x_beg, x_end) * [y_beg, y_end)
+    bool has_tile = false;
+    int tile_x_beg = 0, tile_y_beg = 0;
+    int tile_x_end = 0, tile_y_end = 0;
+
+    // sample index range [beg, end). non-positive end means all samples
+    int sample_beg = 0;
+    int sample_end = 0;
 };
 
 /*
@@ -23,5 +43,22 @@ struct Params
         -d only: load scene desc from SceneDescriptionFilename
         -s only: use SceneDescription as scene desc and assume that it's loaded from './scene.txt'
         -d and -s: use SceneDescription as scene desc and assume that it's loaded from SceneDescriptionFilename
+
+    -c,--bvh-cache-dir BVHCacheDirectory
+
+        save built mesh bvhs to BVHCacheDirectory and reuse them in later runs
+
+    --checkpoint CheckpointFilename [--checkpoint-interval Seconds] [--resume]
+
+        periodically save rendering state to CheckpointFilename (every 600 seconds by default)
+        --resume: continue from CheckpointFilename if it exists
+        with multiple rendering sessions, session i uses CheckpointFilename.i
+
+    --partial-output OutputFilename [--tile XBeg,YBeg,XEnd,YEnd] [--samples Beg,End]
+
+        render pixels [XBeg, XEnd) * [YBeg, YEnd) and sample indices [Beg, End) of each pixel,
+        then save unnormalized buffers to OutputFilename instead of running post processors.
+        use atrc-merge to combine outputs of several processes.
+        with multiple rendering sessions, session i uses OutputFilename.i
 */
 std::optional<Params> parse_opts(int argc, char *argv[]);
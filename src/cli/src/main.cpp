@@ -51,9 +51,44 @@ void run(int argc, char *argv[])
     agz::tracer::factory::CreatingContext context;
     context.path_mapper = &path_mapper;
     context.reference_root = &scene_config;
+    context.bvh_cache_dir = params->bvh_cache_dir;
+    if(!context.bvh_cache_dir.empty())
+        AGZ_INFO("bvh cache directory: {}", context.bvh_cache_dir);
 
     auto scene = context.create<agz::tracer::Scene>(scene_config);
 
+    auto set_checkpoint = [&](
+        agz::tracer::RenderSession &session, const std::string &filename)
+    {
+        if(params->checkpoint_filename.empty())
+            return;
+
+        agz::tracer::RenderCheckpoint checkpoint;
+        checkpoint.filename = filename;
+        checkpoint.interval = static_cast<agz::tracer::real>(
+                                    params->checkpoint_interval);
+        checkpoint.resume   = params->resume;
+        session.render_settings->renderer->set_checkpoint(checkpoint);
+
+        AGZ_INFO("checkpoint: {}", filename);
+    };
+
+    agz::tracer::RenderPartition partition;
+    partition.has_tile     = params->has_tile;
+    partition.tile.low     = { params->tile_x_beg, params->tile_y_beg };
+    partition.tile.high    = { params->tile_x_end - 1, params->tile_y_end - 1 };
+    partition.sample_begin = params->sample_beg;
+    partition.sample_end   = params->sample_end;
+
+    auto execute = [&](
+        agz::tracer::RenderSession &session, const std::string &suffix)
+    {
+        if(params->partial_output.empty())
+            session.execute();
+        else
+            session.execute_partial(partition, params->partial_output + suffix);
+    };
+
     if(rendering_config.is_array())
     {
         const auto &rendering_config_arr = rendering_config.as_array();
@@ -63,14 +98,18 @@ void run(int argc, char *argv[])
             AGZ_INFO("processing rendering session [{}]", i);
             auto render_session = create_render_session(
                 scene, rendering_config_arr.at_group(i), context);
-            render_session.execute();
+            const std::string suffix = "." + std::to_string(i);
+            set_checkpoint(
+                render_session, params->checkpoint_filename + suffix);
+            execute(render_session, suffix);
         }
     }
     else
     {
         auto render_session = create_render_session(
             scene, rendering_config.as_group(), context);
-        render_session.execute();
+        set_checkpoint(render_session, params->checkpoint_filename);
+        execute(render_session, "");
     }
 }
 
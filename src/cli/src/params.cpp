@@ -9,6 +9,13 @@ std::optional<Params> parse_opts(int argc, char *argv[])
     opts.add_options("")
         ("s,scene", "scene description", cxxopts::value<std::string>())
         ("d,scene-filename", "scene description filename", cxxopts::value<std::string>())
+        ("c,bvh-cache-dir", "directory of cached mesh bvhs", cxxopts::value<std::string>())
+        ("checkpoint", "filename of rendering checkpoint", cxxopts::value<std::string>())
+        ("checkpoint-interval", "seconds between checkpoints", cxxopts::value<double>())
+        ("resume", "continue from the checkpoint")
+        ("partial-output", "save unnormalized buffers of a partial rendering", cxxopts::value<std::string>())
+        ("tile", "pixel rectangle x_beg,y_beg,x_end,y_end of partial rendering", cxxopts::value<std::vector<int>>())
+        ("samples", "sample index range beg,end of partial rendering", cxxopts::value<std::vector<int>>())
         ("h,help", "help information");
     auto parse_result = opts.parse(argc, argv);
 
@@ -39,5 +46,46 @@ std::optional<Params> parse_opts(int argc, char *argv[])
     else
         throw ParamParsingException("scene description is unspecified");
 
+    if(parse_result.count("bvh-cache-dir"))
+        ret.bvh_cache_dir = parse_result["bvh-cache-dir"].as<std::string>();
+
+    if(parse_result.count("checkpoint"))
+        ret.checkpoint_filename = parse_result["checkpoint"].as<std::string>();
+    if(parse_result.count("checkpoint-interval"))
+        ret.checkpoint_interval = parse_result["checkpoint-interval"].as<double>();
+    ret.resume = parse_result.count("resume") != 0;
+
+    if(ret.resume && ret.checkpoint_filename.empty())
+        throw ParamParsingException("--resume requires --checkpoint");
+
+    if(parse_result.count("partial-output"))
+        ret.partial_output = parse_result["partial-output"].as<std::string>();
+
+    if(parse_result.count("tile"))
+    {
+        const auto tile = parse_result["tile"].as<std::vector<int>>();
+        if(tile.size() != 4 || tile[0] >= tile[2] || tile[1] >= tile[3])
+            throw ParamParsingException("invalid tile: x_beg,y_beg,x_end,y_end expected");
+
+        ret.has_tile   = true;
+        ret.tile_x_beg = tile[0];
+        ret.tile_y_beg = tile[1];
+        ret.tile_x_end = tile[2];
+        ret.tile_y_end = tile[3];
+    }
+
+    if(parse_result.count("samples"))
+    {
+        const auto samples = parse_result["samples"].as<std::vector<int>>();
+        if(samples.size() != 2 || samples[0] < 0 || samples[0] >= samples[1])
+            throw ParamParsingException("invalid sample range: beg,end expected");
+
+        ret.sample_beg = samples[0];
+        ret.sample_end = samples[1];
+    }
+
+    if((ret.has_tile || parse_result.count("samples")) && ret.partial_output.empty())
+        throw ParamParsingException("--tile and --samples require --partial-output");
+
     return ret;
 }
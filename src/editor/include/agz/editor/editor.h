@@ -37,6 +37,8 @@ public:
 
     void on_change_aggregate();
 
+    void on_change_entity_transform();
+
     void add_to_resource_panel(QWidget *widget);
 
     void show_resource_panel(QWidget *widget, bool display_rsc_panel);
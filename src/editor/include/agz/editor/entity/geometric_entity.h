@@ -6,6 +6,7 @@
 #include <agz/editor/medium/medium.h>
 #include <agz/editor/ui/utility/vec_input.h>
 #include <agz/editor/ui/transform3d_widget.h>
+#include <agz/tracer/create/geometry.h>
 
 AGZ_EDITOR_BEGIN
 
@@ -40,6 +41,8 @@ public:
 
     void set_transform(const DirectTransform &transform) override;
 
+    void update_tracer_transform() override;
+
 protected:
 
     void update_tracer_object_impl() override;
@@ -48,6 +51,8 @@ private:
 
     void do_update_tracer_object();
 
+    void on_edit_transform();
+
     ObjectContext &obj_ctx_;
 
     GeometrySlot *geometry_ = nullptr;
@@ -60,6 +65,9 @@ private:
     Transform3DWidget *transform_ = nullptr;
 
     RealInput *power_ = nullptr;
+
+    RC<tracer::TransformWrapperGeometry> geometry_wrapper_;
+    bool tracer_transform_dirty_ = false;
 };
 
 class GeometricEntityWidgetCreator : public EntityWidgetCreator
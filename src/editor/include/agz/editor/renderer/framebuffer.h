@@ -39,6 +39,10 @@ public:
 
     void start();
 
+    // discard the accumulated image and schedule all tasks again.
+    // no task can be in rendering at that time
+    void reset();
+
     int get_tasks(int expected_task_count, std::vector<Task> &tasks);
 
     void merge_tasks(int task_count, Task *tasks);
@@ -21,6 +21,8 @@ public:
 
     Image2D<Spectrum> get_image() const override;
 
+    void restart(const std::function<void()> &edit_scene) override;
+
 protected:
 
     void stop_rendering();
@@ -43,6 +45,9 @@ private:
 
     Image2D<Spectrum> do_fast_rendering();
 
+    // start rendering workers and the thread computing output image
+    void start_workers();
+
     void exec_fast_render_task(
         Image2D<Spectrum> &target,
         const Vec2i &beg, const Vec2i &end, tracer::Sampler &sampler);
@@ -78,6 +83,7 @@ private:
 
     Box<tracer::FilmFilterApplier> film_filter_;
     tracer::Arena sampler_arena_;
+    std::vector<tracer::Sampler*> samplers_;
 
     std::atomic<int> global_particle_film_version_;
 };
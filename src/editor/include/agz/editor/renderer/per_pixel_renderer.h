@@ -20,6 +20,8 @@ public:
 
     Image2D<Spectrum> get_image() const override;
 
+    void restart(const std::function<void()> &edit_scene) override;
+
 protected:
 
     void stop_rendering();
@@ -36,6 +38,8 @@ private:
 
     Image2D<Spectrum> do_fast_rendering();
 
+    void start_workers();
+
     void exec_fast_render_task(
         Image2D<Spectrum> &target, const Vec2i &beg, const Vec2i &end,
         tracer::Sampler &sampler);
@@ -59,6 +63,7 @@ private:
     std::vector<std::thread> threads_;
 
     tracer::Arena sampler_arena_;
+    std::vector<tracer::Sampler*> samplers_;
 };
 
 AGZ_EDITOR_END
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include <QObject>
 
 #include <agz/editor/renderer/framebuffer.h>
@@ -28,6 +30,15 @@ public:
      * @brief get current rendered image
      */
     virtual Image2D<Spectrum> get_image() const = 0;
+
+    /**
+     * @brief stop workers, edit the scene and render it again from scratch
+     *
+     * edit_scene is called when no worker is using the scene. only the
+     * accumulated image is discarded, which is much cheaper than creating
+     * a new renderer for small edits like moving an entity
+     */
+    virtual void restart(const std::function<void()> &edit_scene) = 0;
 };
 
 AGZ_EDITOR_END
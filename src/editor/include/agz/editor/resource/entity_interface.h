@@ -28,6 +28,11 @@ public:
         transform_callback_ = std::move(callback);
     }
 
+    void set_tracer_transform_dirty_callback(std::function<void()> callback)
+    {
+        tracer_transform_callback_ = std::move(callback);
+    }
+
     virtual void set_transform(const DirectTransform &transform)
     {
         throw std::runtime_error(
@@ -46,6 +51,10 @@ public:
             "EntityInterface::get_vertices is unimplemented");
     }
 
+    // apply the transform edited after the last call to the tracer object.
+    // the tracer object must not be used by any renderer at that time
+    virtual void update_tracer_transform() { }
+
 protected:
 
     void set_geometry_vertices_dirty()
@@ -60,10 +69,19 @@ protected:
             transform_callback_();
     }
 
+    // only the transform of the tracer object is outdated, and it can be
+    // updated in place with update_tracer_transform
+    void set_tracer_transform_dirty()
+    {
+        if(tracer_transform_callback_)
+            tracer_transform_callback_();
+    }
+
 private:
 
     std::function<void()> geometry_callback_;
     std::function<void()> transform_callback_;
+    std::function<void()> tracer_transform_callback_;
 };
 
 AGZ_EDITOR_END
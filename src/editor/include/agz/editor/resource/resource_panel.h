@@ -44,6 +44,8 @@ public:
 
     void set_transform(const DirectTransform &transform) override;
 
+    void update_tracer_transform() override;
+
 private:
 
     void on_change_selected_type();
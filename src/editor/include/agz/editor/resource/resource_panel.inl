@@ -31,6 +31,10 @@ ResourcePanel<TracerObject>::ResourcePanel(
         {
             set_entity_transform_dirty();
         });
+        rsc_widget_->set_tracer_transform_dirty_callback([=]
+        {
+            set_tracer_transform_dirty();
+        });
 
         layout_->addWidget(rsc_widget_);
 
@@ -85,6 +89,10 @@ ResourcePanel<TracerObject>::ResourcePanel(
     {
         set_entity_transform_dirty();
     });
+    rsc_widget_->set_tracer_transform_dirty_callback([=]
+    {
+        set_tracer_transform_dirty();
+    });
 
     layout_ = new QVBoxLayout(this);
     layout_->addWidget(type_selector_);
@@ -160,6 +168,12 @@ void ResourcePanel<TracerObject>::set_transform(const DirectTransform &transform
     rsc_widget_->set_transform(transform);
 }
 
+template<typename TracerObject>
+void ResourcePanel<TracerObject>::update_tracer_transform()
+{
+    rsc_widget_->update_tracer_transform();
+}
+
 template<typename TracerObject>
 void ResourcePanel<TracerObject>::on_change_selected_type()
 {
@@ -183,6 +197,10 @@ void ResourcePanel<TracerObject>::on_change_selected_type()
     {
         set_entity_transform_dirty();
     });
+    rsc_widget_->set_tracer_transform_dirty_callback([=]
+    {
+        set_tracer_transform_dirty();
+    });
 
     layout_->addWidget(rsc_widget_);
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <set>
+
 #include <agz/editor/displayer/preview_window.h>
 #include <agz/editor/entity/entity.h>
 #include <agz/editor/scene/scene_mgr_ui.h>
@@ -27,6 +29,10 @@ public:
     RC<tracer::Aggregate> update_tracer_aggregate(
         std::vector<RC<tracer::Entity>> &entities);
 
+    // apply in-place transform edits of entities and refit the aggregate.
+    // must not be called during rendering
+    void update_tracer_transforms();
+
     void add_meshes(const std::vector<mesh::mesh_t> &meshes);
 
     void save_asset(AssetSaver &saver) const;
@@ -39,6 +45,10 @@ signals:
 
     void change_scene();
 
+    // only transforms of some entities are changed.
+    // see update_tracer_transforms
+    void change_entity_transform();
+
 private:
 
     bool is_valid_name(const QString &name) const;
@@ -78,6 +88,9 @@ private:
     SceneManagerWidget *ui_ = nullptr;
 
     RC<tracer::Aggregate> aggregate_;
+
+    // entities contained by aggregate_
+    std::set<const tracer::Entity*> aggregate_entities_;
 };
 
 AGZ_EDITOR_END
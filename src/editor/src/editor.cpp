@@ -133,6 +133,23 @@ void Editor::on_change_aggregate()
     launch_renderer(true);
 }
 
+void Editor::on_change_entity_transform()
+{
+    // the renderer keeps its workers and only discards the accumulated image
+
+    if(!renderer_)
+    {
+        scene_mgr_->update_tracer_transforms();
+        return;
+    }
+
+    renderer_->restart([&]
+    {
+        scene_mgr_->update_tracer_transforms();
+        scene_->start_rendering();
+    });
+}
+
 void Editor::add_to_resource_panel(QWidget *widget)
 {
     right_panel_->resource_tab_layout->addWidget(widget);
@@ -296,6 +313,11 @@ void Editor::init_scene_mgr()
     {
         on_change_aggregate();
     });
+
+    connect(scene_mgr_.get(), &SceneManager::change_entity_transform, [=]
+    {
+        on_change_entity_transform();
+    });
 }
 
 void Editor::init_renderer_panel()
@@ -69,8 +69,7 @@ GeometricEntityWidget::GeometricEntityWidget(
 
     connect(transform_, &Transform3DWidget::edit_transform, [=]
     {
-        set_entity_transform_dirty();
-        set_dirty_flag();
+        on_edit_transform();
     });
 
     connect(power_, &RealInput::edit_value, [=](real)
@@ -184,8 +183,16 @@ DirectTransform GeometricEntityWidget::get_transform() const
 void GeometricEntityWidget::set_transform(const DirectTransform &transform)
 {
     transform_->set_transform(transform);
-    set_entity_transform_dirty();
-    set_dirty_flag();
+    on_edit_transform();
+}
+
+void GeometricEntityWidget::update_tracer_transform()
+{
+    if(!tracer_transform_dirty_)
+        return;
+    geometry_wrapper_->set_transform(
+        tracer::Transform3(get_transform().compose()));
+    tracer_transform_dirty_ = false;
 }
 
 void GeometricEntityWidget::update_tracer_object_impl()
@@ -204,14 +211,31 @@ void GeometricEntityWidget::do_update_tracer_object()
 
     const Spectrum emit_radiance = emit_radiance_->get_value();
 
-    auto geometry_wrapper = create_transform_wrapper(
+    geometry_wrapper_ = create_transform_wrapper(
         geometry, tracer::Transform3(get_transform().compose()));
+    tracer_transform_dirty_ = false;
 
     tracer_object_ = create_geometric(
-        geometry_wrapper, material, med,
+        geometry_wrapper_, material, med,
         emit_radiance, false, power_->get_value());
 }
 
+void GeometricEntityWidget::on_edit_transform()
+{
+    set_entity_transform_dirty();
+
+    // area light of an emitting entity is built with its transformed area,
+    // so it must be recreated. otherwise only the wrapper is updated
+    if(!emit_radiance_->get_value().is_black())
+    {
+        set_dirty_flag();
+        return;
+    }
+
+    tracer_transform_dirty_ = true;
+    set_tracer_transform_dirty();
+}
+
 ResourceWidget<tracer::Entity> *GeometricEntityWidgetCreator::create_widget(
     ObjectContext &obj_ctx) const
 {
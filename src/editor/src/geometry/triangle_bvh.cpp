@@ -220,8 +220,16 @@ void TriangleBVHWidget::do_update_tracer_object()
         });
     }
 
+#ifdef USE_EMBREE
     tracer_object_ = tracer::create_triangle_bvh(
         std::move(triangles), {});
+#else
+    // meshes are rebuilt on every edit. prefer build speed to trace speed
+    tracer::TriangleBVHParams params;
+    params.build_quality = tracer::TriangleBVHParams::BuildQuality::Fast;
+    tracer_object_ = tracer::create_triangle_bvh_noembree(
+        std::move(triangles), {}, params);
+#endif
 }
 
 ResourceWidget<tracer::Geometry> *TriangleBVHWidgetCreator::create_widget(
@@ -49,6 +49,25 @@ void Framebuffer::start()
     });
 }
 
+void Framebuffer::reset()
+{
+    {
+        std::lock_guard lk(es_mutex_);
+        value_     .clear(Spectrum());
+        weight_    .clear(0);
+        pixel_size_.clear(0);
+    }
+
+    {
+        std::lock_guard lk(output_mutex_);
+        output_ = Image2D<Spectrum>();
+    }
+
+    std::lock_guard lk(queue_mutex_);
+    tasks_.clear();
+    build_task_queue();
+}
+
 int Framebuffer::get_tasks(int expected_task_count, std::vector<Task> &tasks)
 {
     std::lock_guard lk(queue_mutex_);
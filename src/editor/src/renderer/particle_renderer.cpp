@@ -34,6 +34,64 @@ ParticleRenderer::~ParticleRenderer()
 }
 
 Image2D<Spectrum> ParticleRenderer::start()
+{
+    const auto ret = do_fast_rendering();
+
+    const auto sampler_prototype = newRC<tracer::NativeSampler>(0, true);
+    const int worker_count = thread::actual_worker_count(worker_count_);
+
+    film_filter_ = newBox<tracer::FilmFilterApplier>(
+        framebuffer_width_, framebuffer_height_,
+        tracer::create_box_filter(real(0.5)));
+
+    particle_film_.resize(worker_count);
+    particle_film_mutex_ = newBox<std::mutex[]>(worker_count);
+
+    for(int i = 0; i < worker_count; ++i)
+        samplers_.push_back(sampler_prototype->clone(i, sampler_arena_));
+
+    start_workers();
+
+    framebuffer_.start();
+
+    return ret;
+}
+
+Image2D<Spectrum> ParticleRenderer::get_image() const
+{
+    std::lock_guard lk(output_img_mutex_);
+    return output_img_;
+}
+
+void ParticleRenderer::restart(const std::function<void()> &edit_scene)
+{
+    stop_rendering();
+
+    edit_scene();
+
+    framebuffer_.reset();
+    for(auto &film : particle_film_)
+        film = Image2D<Spectrum>();
+    total_particle_count_         = 0;
+    global_particle_film_version_ = 0;
+
+    stop_rendering_ = false;
+    start_workers();
+}
+
+void ParticleRenderer::stop_rendering()
+{
+    stop_rendering_ = true;
+    for(auto &t : threads_)
+    {
+        if(t.joinable())
+            t.join();
+    }
+    compute_img_thread_.join();
+    threads_.clear();
+}
+
+void ParticleRenderer::start_workers()
 {
     auto render_func = [this](tracer::Sampler *sampler, int thread_idx)
     {
@@ -78,27 +136,10 @@ Image2D<Spectrum> ParticleRenderer::start()
         }
     };
 
-    const auto ret = do_fast_rendering();
-
-    const auto sampler_prototype = newRC<tracer::NativeSampler>(0, true);
-    const int worker_count = thread::actual_worker_count(worker_count_);
-
-    film_filter_ = newBox<tracer::FilmFilterApplier>(
-        framebuffer_width_, framebuffer_height_,
-        tracer::create_box_filter(real(0.5)));
-
-    particle_film_.resize(worker_count);
-    particle_film_mutex_ = newBox<std::mutex[]>(worker_count);
-
-    for(int i = 0; i < worker_count; ++i)
-    {
-        auto sampler = sampler_prototype->clone(i, sampler_arena_);
-        threads_.emplace_back(render_func, sampler, i);
-    }
-
-    framebuffer_.start();
+    for(size_t i = 0; i < samplers_.size(); ++i)
+        threads_.emplace_back(render_func, samplers_[i], static_cast<int>(i));
 
-    auto compute_image_func = [=]
+    auto compute_image_func = [this]
     {
         const std::chrono::milliseconds wait_ms(20);
 
@@ -119,7 +160,7 @@ Image2D<Spectrum> ParticleRenderer::start()
                 continue;
 
             particle_output.clear(Spectrum());
-            for(int i = 0; i < worker_count; ++i)
+            for(size_t i = 0; i < particle_film_.size(); ++i)
             {
                 if(stop_rendering_)
                     return;
@@ -150,26 +191,6 @@ Image2D<Spectrum> ParticleRenderer::start()
     };
 
     compute_img_thread_ = std::thread(compute_image_func);
-
-    return ret;
-}
-
-Image2D<Spectrum> ParticleRenderer::get_image() const
-{
-    std::lock_guard lk(output_img_mutex_);
-    return output_img_;
-}
-
-void ParticleRenderer::stop_rendering()
-{
-    stop_rendering_ = true;
-    for(auto &t : threads_)
-    {
-        if(t.joinable())
-            t.join();
-    }
-    compute_img_thread_.join();
-    threads_.clear();
 }
 
 Image2D<Spectrum> ParticleRenderer::do_fast_rendering()
@@ -31,34 +31,14 @@ PerPixelRenderer::~PerPixelRenderer()
 
 Image2D<Spectrum> PerPixelRenderer::start()
 {
-    auto render_func = [this](tracer::Sampler *sampler)
-    {
-        std::vector<Framebuffer::Task> tasks;
-
-        for(;;)
-        {
-            if(stop_rendering_)
-                return;
-
-            tasks.clear();
-            const int task_count = framebuffer_.get_tasks(2, tasks);
-
-            for(int i = 0; i < task_count; ++i)
-                exec_render_task(tasks[i], sampler);
-
-            framebuffer_.merge_tasks(task_count, tasks.data());
-        }
-    };
-
     auto ret = do_fast_rendering();
 
     const auto sampler_prototype = newRC<tracer::NativeSampler>(0, true);
     const int worker_count = thread::actual_worker_count(worker_count_);
     for(int i = 0; i < worker_count; ++i)
-    {
-        auto sampler = sampler_prototype->clone(i, sampler_arena_);
-        threads_.emplace_back(render_func, sampler);
-    }
+        samplers_.push_back(sampler_prototype->clone(i, sampler_arena_));
+
+    start_workers();
 
     framebuffer_.start();
 
@@ -70,6 +50,17 @@ Image2D<Spectrum> PerPixelRenderer::get_image() const
     return framebuffer_.get_image();
 }
 
+void PerPixelRenderer::restart(const std::function<void()> &edit_scene)
+{
+    stop_rendering();
+
+    edit_scene();
+
+    framebuffer_.reset();
+    stop_rendering_ = false;
+    start_workers();
+}
+
 void PerPixelRenderer::stop_rendering()
 {
     stop_rendering_ = true;
@@ -81,6 +72,31 @@ void PerPixelRenderer::stop_rendering()
     threads_.clear();
 }
 
+void PerPixelRenderer::start_workers()
+{
+    auto render_func = [this](tracer::Sampler *sampler)
+    {
+        std::vector<Framebuffer::Task> tasks;
+
+        for(;;)
+        {
+            if(stop_rendering_)
+                return;
+
+            tasks.clear();
+            const int task_count = framebuffer_.get_tasks(2, tasks);
+
+            for(int i = 0; i < task_count; ++i)
+                exec_render_task(tasks[i], sampler);
+
+            framebuffer_.merge_tasks(task_count, tasks.data());
+        }
+    };
+
+    for(auto sampler : samplers_)
+        threads_.emplace_back(render_func, sampler);
+}
+
 Image2D<Spectrum> PerPixelRenderer::do_fast_rendering()
 {
     using namespace tracer;
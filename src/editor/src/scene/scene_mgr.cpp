@@ -82,7 +82,10 @@ SceneManager::SceneManager(
         model_importer->exec();
     });
 
-    aggregate_ = tracer::create_entity_bvh(4);
+    tracer::EntityBVHParams aggregate_params;
+    aggregate_params.build_quality = tracer::EntityBVHParams::BuildQuality::Fast;
+    aggregate_params.max_leaf_size = 4;
+    aggregate_ = tracer::create_entity_bvh(aggregate_params);
     aggregate_->build({});
 }
 
@@ -100,17 +103,37 @@ QWidget *SceneManager::get_widget()
 RC<tracer::Aggregate> SceneManager::update_tracer_aggregate(
     std::vector<RC<tracer::Entity>> &entities)
 {
-    std::vector<RC<const tracer::Entity>> entity_arr;
+    // usually only one or two entities are changed since last update.
+    // apply the difference instead of rebuilding the whole aggregate
+
+    std::set<const tracer::Entity*> new_aggregate_entities;
     for(auto &p : name2record_)
     {
         auto ent = p.second->panel->get_tracer_object();
-        entity_arr.push_back(ent);
         entities.push_back(ent);
+        new_aggregate_entities.insert(ent.get());
+
+        if(!aggregate_entities_.count(ent.get()))
+            aggregate_->insert(ent);
     }
-    aggregate_->build(entity_arr);
+
+    for(auto ent : aggregate_entities_)
+    {
+        if(!new_aggregate_entities.count(ent))
+            aggregate_->remove(ent);
+    }
+
+    aggregate_entities_ = std::move(new_aggregate_entities);
     return aggregate_;
 }
 
+void SceneManager::update_tracer_transforms()
+{
+    for(auto &p : name2record_)
+        p.second->panel->update_tracer_transform();
+    aggregate_->refit();
+}
+
 void SceneManager::add_meshes(const std::vector<mesh::mesh_t> &meshes)
 {
     for(auto &m : meshes)
@@ -314,6 +337,11 @@ void SceneManager::add_record(const ::QString &name, EntityPanel *entity_panel)
 
     entity_panel->set_dirty_callback([=] { emit change_scene(); });
 
+    entity_panel->set_tracer_transform_dirty_callback([=]
+    {
+        emit change_entity_transform();
+    });
+
     // add mesh to gl widget
 
     const auto geometry_data = entity_panel->get_vertices();
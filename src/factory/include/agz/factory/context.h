@@ -1,8 +1,12 @@
 #pragma once
 
 #include <filesystem>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 
@@ -114,6 +118,15 @@ public:
     const PathMapper *path_mapper;
     const ConfigGroup *reference_root;
 
+    // directory of cached mesh bvhs. empty means disabled
+    std::string bvh_cache_dir;
+
+    // bake transforms of single-placed geometries into their vertices
+    bool flatten_transforms = false;
+
+    // keys ("mesh_type:filename") of meshes used by only one mesh_instance
+    std::set<std::string> single_use_meshes;
+
     template<typename T>
     Factory<T> &factory() noexcept;
 
@@ -124,10 +137,110 @@ public:
     RC<T> create(const ConfigGroup &params, Args&&...args);
 };
 
+/**
+ * @brief detect circular references among referenced objects being created
+ *
+ * a thread creating a referenced object may wait for another object created
+ * by another thread. circular references in the scene file make a thread
+ * wait (directly or through other waiting threads) for an object it is
+ * creating itself, which is reported with CreatingObjectException instead
+ * of waiting forever
+ */
+class ReferenceCycleDetector
+{
+    static inline std::mutex mutex_;
+
+    // object being created -> creating thread
+    static inline std::unordered_map<const void*, std::thread::id> creating_;
+
+    // waiting thread -> object it is waiting for
+    static inline std::unordered_map<std::thread::id, const void*> waiting_;
+
+public:
+
+    /**
+     * @brief mark an object as being created by the calling thread
+     */
+    class CreatingScope : public misc::uncopyable_t
+    {
+        const void *obj_;
+
+    public:
+
+        explicit CreatingScope(const void *obj)
+            : obj_(obj)
+        {
+            std::lock_guard lk(mutex_);
+            creating_[obj_] = std::this_thread::get_id();
+        }
+
+        ~CreatingScope() { end(); }
+
+        /**
+         * @brief unmark the object before its result is published
+         */
+        void end()
+        {
+            if(!obj_)
+                return;
+            std::lock_guard lk(mutex_);
+            creating_.erase(obj_);
+            obj_ = nullptr;
+        }
+    };
+
+    /**
+     * @brief mark the calling thread as waiting for an object
+     *
+     * throws CreatingObjectException when the object is being created by
+     * the calling thread, or by a thread waiting for it
+     */
+    class WaitingScope : public misc::uncopyable_t
+    {
+    public:
+
+        explicit WaitingScope(const void *obj)
+        {
+            const auto self = std::this_thread::get_id();
+
+            std::lock_guard lk(mutex_);
+
+            const void *cur = obj;
+            for(size_t i = 0; i <= waiting_.size(); ++i)
+            {
+                const auto creator = creating_.find(cur);
+                if(creator == creating_.end())
+                    break;
+
+                if(creator->second == self)
+                {
+                    throw CreatingObjectException(
+                        "circular reference is found");
+                }
+
+                const auto next = waiting_.find(creator->second);
+                if(next == waiting_.end())
+                    break;
+                cur = next->second;
+            }
+
+            waiting_[self] = obj;
+        }
+
+        ~WaitingScope()
+        {
+            std::lock_guard lk(mutex_);
+            waiting_.erase(std::this_thread::get_id());
+        }
+    };
+};
+
 template<typename T>
 class ReferenceCreator : public Creator<T>
 {
-    mutable std::map<std::vector<std::string>, RC<T>> name2obj_;
+    mutable std::map<
+        std::vector<std::string>, std::shared_future<RC<T>>> name2obj_;
+    mutable std::mutex name2obj_mutex_;
 
 public:
 
@@ -140,7 +253,9 @@ public:
 template<>
 class ReferenceCreator<Camera> : public Creator<Camera>
 {
-    mutable std::map<std::vector<std::string>, RC<Camera>> name2obj_;
+    mutable std::map<
+        std::vector<std::string>, std::shared_future<RC<Camera>>> name2obj_;
+    mutable std::mutex name2obj_mutex_;
 
 public:
 
@@ -188,18 +303,59 @@ RC<T> ReferenceCreator<T>::create(
     for(size_t i = 0; i < name_arr.size(); ++i)
         names.push_back(name_arr.at(i).as_value().as_str());
 
-    if(auto it = name2obj_.find(names); it != name2obj_.end())
-        return it->second;
+    // the lock is only held for looking up and inserting, so that nested
+    // references and other loading threads are not blocked by the
+    // creation. threads referencing an object being created wait for it,
+    // unless the wait closes a cycle of circular references
 
-    const ConfigGroup *group = context.reference_root;
-    for(size_t i = 0; i < names.size() - 1; ++i)
-        group = &group->child_group(names[i]);
+    std::promise<RC<T>> creating;
+    std::shared_future<RC<T>> created;
+    bool is_creator = false;
 
-    const ConfigGroup &true_params = group->child_group(names.back());
-    auto ret = context.create<T>(true_params);
-    name2obj_[names] = ret;
+    // map nodes are never erased, so the address identifies the object
+    const void *object_key = nullptr;
 
-    return ret;
+    {
+        std::lock_guard lk(name2obj_mutex_);
+
+        auto it = name2obj_.find(names);
+        if(it == name2obj_.end())
+        {
+            it = name2obj_.emplace(
+                names, creating.get_future().share()).first;
+            is_creator = true;
+        }
+        created = it->second;
+        object_key = &it->second;
+    }
+
+    if(!is_creator)
+    {
+        ReferenceCycleDetector::WaitingScope waiting(object_key);
+        return created.get();
+    }
+
+    ReferenceCycleDetector::CreatingScope creating_scope(object_key);
+
+    try
+    {
+        const ConfigGroup *group = context.reference_root;
+        for(size_t i = 0; i < names.size() - 1; ++i)
+            group = &group->child_group(names[i]);
+
+        const ConfigGroup &true_params = group->child_group(names.back());
+        auto ret = context.create<T>(true_params);
+        creating_scope.end();
+        creating.set_value(ret);
+
+        return ret;
+    }
+    catch(...)
+    {
+        creating_scope.end();
+        creating.set_exception(std::current_exception());
+        throw;
+    }
 
     AGZ_HIERARCHY_WRAP("in creating referenced object")
 }
@@ -219,18 +375,59 @@ inline RC<Camera> ReferenceCreator<Camera>::create(
     for(size_t i = 0; i < name_arr.size(); ++i)
         names.push_back(name_arr.at(i).as_value().as_str());
 
-    if(auto it = name2obj_.find(names); it != name2obj_.end())
-        return it->second;
+    // the lock is only held for looking up and inserting, so that nested
+    // references and other loading threads are not blocked by the
+    // creation. threads referencing an object being created wait for it,
+    // unless the wait closes a cycle of circular references
+
+    std::promise<RC<Camera>> creating;
+    std::shared_future<RC<Camera>> created;
+    bool is_creator = false;
 
-    const ConfigGroup *group = context.reference_root;
-    for(size_t i = 0; i < names.size() - 1; ++i)
-        group = &group->child_group(names[i]);
+    // map nodes are never erased, so the address identifies the object
+    const void *object_key = nullptr;
 
-    const ConfigGroup &true_params = group->child_group(names.back());
-    auto ret = context.create<Camera>(true_params, film_aspect);
-    name2obj_[names] = ret;
+    {
+        std::lock_guard lk(name2obj_mutex_);
 
-    return ret;
+        auto it = name2obj_.find(names);
+        if(it == name2obj_.end())
+        {
+            it = name2obj_.emplace(
+                names, creating.get_future().share()).first;
+            is_creator = true;
+        }
+        created = it->second;
+        object_key = &it->second;
+    }
+
+    if(!is_creator)
+    {
+        ReferenceCycleDetector::WaitingScope waiting(object_key);
+        return created.get();
+    }
+
+    ReferenceCycleDetector::CreatingScope creating_scope(object_key);
+
+    try
+    {
+        const ConfigGroup *group = context.reference_root;
+        for(size_t i = 0; i < names.size() - 1; ++i)
+            group = &group->child_group(names[i]);
+
+        const ConfigGroup &true_params = group->child_group(names.back());
+        auto ret = context.create<Camera>(true_params, film_aspect);
+        creating_scope.end();
+        creating.set_value(ret);
+
+        return ret;
+    }
+    catch(...)
+    {
+        creating_scope.end();
+        creating.set_exception(std::current_exception());
+        throw;
+    }
 
     AGZ_HIERARCHY_WRAP("in creating referenced object")
 }
@@ -38,6 +38,15 @@ public:
 
     void execute();
 
+    /**
+     * @brief render a part of the film and save unnormalized buffers
+     *
+     * post processors are not executed. they are run after merging
+     * all parts of the film
+     */
+    void execute_partial(
+        const RenderPartition &partition, const std::string &filename);
+
     RC<Scene> scene;
     Box<RenderSetting> render_settings;
 };
@@ -47,6 +56,10 @@ RenderSession create_render_session(
     const ConfigGroup &rendering_setting_config,
     factory::CreatingContext &context);
 
+std::vector<RC<PostProcessor>> create_post_processors(
+    const ConfigGroup &rendering_setting_config,
+    factory::CreatingContext &context);
+
 std::vector<RenderSession> parse_render_sessions(
     const ConfigGroup &scene_config,
     const ConfigNode &rendering_setting_config,
@@ -18,8 +18,23 @@ namespace aggregate
         RC<Aggregate> create(
             const ConfigGroup &params, CreatingContext &context) const override
         {
-            const int max_leaf_size = params.child_int_or("max_leaf_size", 5);
-            return create_entity_bvh(max_leaf_size);
+            EntityBVHParams bvh_params;
+
+            const std::string build_quality = params.child_str_or(
+                "build_quality", "balanced");
+            if(build_quality == "fast")
+                bvh_params.build_quality = EntityBVHParams::BuildQuality::Fast;
+            else if(build_quality == "balanced")
+                bvh_params.build_quality = EntityBVHParams::BuildQuality::Balanced;
+            else if(build_quality == "high")
+                bvh_params.build_quality = EntityBVHParams::BuildQuality::High;
+            else
+                throw CreatingObjectException(
+                    "unknown entity bvh build quality: " + build_quality);
+
+            bvh_params.max_leaf_size = params.child_int_or("max_leaf_size", 5);
+
+            return create_entity_bvh(bvh_params);
         }
     };
 
@@ -39,12 +54,35 @@ namespace aggregate
         }
     };
 
+#ifdef USE_EMBREE
+
+    class EmbreeAggregateCreator : public Creator<Aggregate>
+    {
+    public:
+
+        std::string name() const override
+        {
+            return "embree";
+        }
+
+        RC<Aggregate> create(
+            const ConfigGroup &params, CreatingContext &context) const override
+        {
+            return create_embree_aggregate();
+        }
+    };
+
+#endif
+
 } // namespace aggregate
 
 void initialize_aggregate_factory(Factory<Aggregate> &factory)
 {
     factory.add_creator(newBox<aggregate::EntityBVHCreator>());
     factory.add_creator(newBox<aggregate::NativeAggregateCreator>());
+#ifdef USE_EMBREE
+    factory.add_creator(newBox<aggregate::EmbreeAggregateCreator>());
+#endif
 }
 
 AGZ_TRACER_FACTORY_END
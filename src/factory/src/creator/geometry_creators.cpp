@@ -1,3 +1,10 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+
 #include <agz/factory/creator/geometry_creators.h>
 #include <agz/factory/utility/bin_mesh.h>
 #include <agz/tracer/create/geometry.h>
@@ -14,6 +21,151 @@ namespace geometry
             return load_bin_mesh(filename);
         return mesh::load_from_file(filename);
     }
+
+    TriangleBVHParams parse_triangle_bvh_params(const ConfigGroup &params)
+    {
+        TriangleBVHParams ret;
+
+        const std::string build_quality = params.child_str_or(
+            "build_quality", "balanced");
+        if(build_quality == "fast")
+            ret.build_quality = TriangleBVHParams::BuildQuality::Fast;
+        else if(build_quality == "balanced")
+            ret.build_quality = TriangleBVHParams::BuildQuality::Balanced;
+        else if(build_quality == "high")
+            ret.build_quality = TriangleBVHParams::BuildQuality::High;
+        else
+            throw CreatingObjectException(
+                "unknown triangle bvh build quality: " + build_quality);
+
+        const std::string split_method = params.child_str_or(
+            "split_method", "middle");
+        if(split_method == "sah")
+            ret.split_method = TriangleBVHParams::SplitMethod::SAH;
+        else if(split_method == "middle")
+            ret.split_method = TriangleBVHParams::SplitMethod::Middle;
+        else
+            throw CreatingObjectException(
+                "unknown triangle bvh split method: " + split_method);
+
+        const std::string layout = params.child_str_or("layout", "binary");
+        if(layout == "binary")
+            ret.layout = TriangleBVHParams::Layout::Binary;
+        else if(layout == "bvh4")
+            ret.layout = TriangleBVHParams::Layout::BVH4;
+        else if(layout == "bvh8")
+            ret.layout = TriangleBVHParams::Layout::BVH8;
+        else if(layout == "compressed")
+            ret.layout = TriangleBVHParams::Layout::Compressed;
+        else if(layout == "auto")
+            ret.layout = TriangleBVHParams::Layout::Auto;
+        else
+            throw CreatingObjectException(
+                "unknown triangle bvh layout: " + layout);
+
+        ret.max_leaf_size = params.child_int_or("max_leaf_size", 5);
+        ret.half_attributes = params.child_int_or("half_attributes", 0) != 0;
+        ret.sah_bin_count = params.child_int_or("sah_bin_count", 16);
+        ret.sah_leaf_cost = params.child_real_or("sah_leaf_cost", 1);
+        ret.spatial_split_budget = params.child_real_or("spatial_split_budget", real(0.3));
+        ret.treelet_refinement = params.child_int_or("treelet_refinement", 0) != 0;
+
+        ret.build_worker_count = params.child_int_or("build_worker_count", 0);
+
+        return ret;
+    }
+
+    // 64-bit FNV-1a
+    class CacheKeyHasher
+    {
+        uint64_t hash_ = 14695981039346656037ull;
+
+    public:
+
+        void update(const void *data, size_t size) noexcept
+        {
+            auto bytes = static_cast<const unsigned char*>(data);
+            for(size_t i = 0; i < size; ++i)
+            {
+                hash_ ^= bytes[i];
+                hash_ *= 1099511628211ull;
+            }
+        }
+
+        template<typename T>
+        void update(const T &value) noexcept
+        {
+            update(&value, sizeof(T));
+        }
+
+        uint64_t hash() const noexcept
+        {
+            return hash_;
+        }
+    };
+
+    std::string triangle_bvh_cache_filename(
+        const std::string &cache_dir, const std::string &mesh_filename,
+        const Transform3 &local_to_world, const TriangleBVHParams &params)
+    {
+        CacheKeyHasher hasher;
+
+        std::ifstream fin(mesh_filename, std::ios::binary | std::ios::in);
+        if(!fin)
+            throw CreatingObjectException("failed to open file: " + mesh_filename);
+
+        std::vector<char> buffer(1 << 20);
+        while(fin)
+        {
+            fin.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            hasher.update(buffer.data(), static_cast<size_t>(fin.gcount()));
+        }
+
+        // build_worker_count doesn't affect the result
+
+        hasher.update(local_to_world);
+        hasher.update(params.build_quality);
+        hasher.update(params.split_method);
+        hasher.update(params.layout);
+        hasher.update(params.max_leaf_size);
+        hasher.update(params.half_attributes);
+        hasher.update(params.sah_bin_count);
+        hasher.update(params.sah_leaf_cost);
+        hasher.update(params.spatial_split_budget);
+        hasher.update(params.treelet_refinement);
+
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx",
+                      static_cast<unsigned long long>(hasher.hash()));
+
+        std::filesystem::create_directories(cache_dir);
+        return (std::filesystem::path(cache_dir) / (std::string(hex) + ".bvh")).string();
+    }
+
+    RC<Geometry> create_triangle_bvh_noembree_from_file(
+        const std::string &filename, const Transform3 &local_to_world,
+        const TriangleBVHParams &params, const CreatingContext &context)
+    {
+        auto load_triangles = [&]
+        {
+            AGZ_INFO("load mesh from {}", filename);
+            auto build_triangles = load_triangle_mesh_from_file(filename);
+            AGZ_INFO("triangle count: {}", build_triangles.size());
+            return build_triangles;
+        };
+
+        if(context.bvh_cache_dir.empty())
+        {
+            return create_triangle_bvh_noembree(
+                load_triangles(), local_to_world, params);
+        }
+
+        const auto cache_filename = triangle_bvh_cache_filename(
+            context.bvh_cache_dir, filename, local_to_world, params);
+
+        return create_cached_triangle_bvh_noembree(
+            cache_filename, load_triangles, local_to_world, params);
+    }
     
     class DiskCreator : public Creator<Geometry>
     {
@@ -138,6 +290,17 @@ namespace geometry
             const Vec2 t_b = params.child_vec2_or("tB", Vec2(0));
             const Vec2 t_c = params.child_vec2_or("tC", Vec2(0));
 
+            const bool flatten_transform = params.child_int_or(
+                "flatten_transform", context.flatten_transforms ? 1 : 0) != 0;
+            if(flatten_transform)
+            {
+                return create_triangle(
+                    local_to_world.apply_to_point(a),
+                    local_to_world.apply_to_point(b),
+                    local_to_world.apply_to_point(c),
+                    t_a, t_b, t_c, Transform3());
+            }
+
             return create_triangle(a, b, c, t_a, t_b, t_c, local_to_world);
         }
     };
@@ -156,13 +319,10 @@ namespace geometry
         {
             const auto local_to_world = params.child_transform3("transform");
             const auto filename = context.path_mapper->map(params.child_str("filename"));
+            const auto bvh_params = parse_triangle_bvh_params(params);
 
-            AGZ_INFO("load mesh from {}", filename);
-            auto build_triangles = load_triangle_mesh_from_file(filename);
-            AGZ_INFO("triangle count: {}", build_triangles.size());
-
-            return create_triangle_bvh_noembree(
-                std::move(build_triangles), local_to_world);
+            return create_triangle_bvh_noembree_from_file(
+                filename, local_to_world, bvh_params, context);
         }
     };
 
@@ -214,12 +374,128 @@ namespace geometry
 
 #endif
 
+    /**
+     * @brief triangle mesh placed with its own transform
+     *
+     * meshes are loaded and built only once for each (filename, mesh_type)
+     * and shared by all instances.
+     *
+     * an instance with flatten_transform gets its own mesh whose vertices
+     * are already in world space, so that rays needn't be transformed
+     */
+    class MeshInstanceCreator : public Creator<Geometry>
+    {
+        using SharedMesh = std::shared_future<RC<const Geometry>>;
+
+        mutable std::map<std::string, SharedMesh> filename2mesh_;
+        mutable std::mutex filename2mesh_mutex_;
+
+        static RC<Geometry> build_mesh(
+            const std::string &filename, const std::string &mesh_type,
+            const Transform3 &local_to_world,
+            const ConfigGroup &params, const CreatingContext &context)
+        {
+
+#ifdef USE_EMBREE
+            if(mesh_type == "triangle_bvh" || mesh_type == "triangle_bvh_embree")
+            {
+                AGZ_INFO("load mesh from {}", filename);
+                auto build_triangles = load_triangle_mesh_from_file(filename);
+                AGZ_INFO("triangle count: {}", build_triangles.size());
+
+                return create_triangle_bvh_embree(
+                    std::move(build_triangles), local_to_world);
+            }
+#else
+            if(mesh_type == "triangle_bvh")
+            {
+                return create_triangle_bvh_noembree_from_file(
+                    filename, local_to_world,
+                    parse_triangle_bvh_params(params), context);
+            }
+#endif
+
+            if(mesh_type == "triangle_bvh_noembree")
+            {
+                return create_triangle_bvh_noembree_from_file(
+                    filename, local_to_world,
+                    parse_triangle_bvh_params(params), context);
+            }
+
+            throw CreatingObjectException("unknown mesh type: " + mesh_type);
+        }
+
+    public:
+
+        std::string name() const override
+        {
+            return "mesh_instance";
+        }
+
+        RC<Geometry> create(
+            const ConfigGroup &params, CreatingContext &context) const override
+        {
+            const auto local_to_world = params.child_transform3("transform");
+            const auto filename = context.path_mapper->map(params.child_str("filename"));
+            const auto mesh_type = params.child_str_or("mesh_type", "triangle_bvh");
+            const std::string key = mesh_type + ":" + filename;
+
+            // a mesh placed only once gains nothing from sharing, so its
+            // transform can be baked into vertices by default
+
+            const bool is_single_use = context.flatten_transforms &&
+                context.single_use_meshes.count(key) != 0;
+            const bool flatten_transform = params.child_int_or(
+                "flatten_transform", is_single_use ? 1 : 0) != 0;
+            if(flatten_transform)
+            {
+                return build_mesh(
+                    filename, mesh_type, local_to_world, params, context);
+            }
+
+            // instances may be created by multiple threads.
+            // the first one builds the mesh and others wait for it
+
+            std::promise<RC<const Geometry>> mesh_promise;
+            SharedMesh mesh;
+            bool is_builder = false;
+
+            {
+                std::lock_guard lk(filename2mesh_mutex_);
+                if(auto it = filename2mesh_.find(key); it != filename2mesh_.end())
+                    mesh = it->second;
+                else
+                {
+                    mesh = mesh_promise.get_future().share();
+                    filename2mesh_[key] = mesh;
+                    is_builder = true;
+                }
+            }
+
+            if(is_builder)
+            {
+                try
+                {
+                    mesh_promise.set_value(
+                        build_mesh(filename, mesh_type, Transform3(), params, context));
+                }
+                catch(...)
+                {
+                    mesh_promise.set_exception(std::current_exception());
+                }
+            }
+
+            return create_transform_wrapper(mesh.get(), local_to_world);
+        }
+    };
+
 } // namespace geometry
 
 void initialize_geometry_factory(Factory<Geometry> &factory)
 {
     factory.add_creator(newBox<geometry::DiskCreator>());
     factory.add_creator(newBox<geometry::DoubleSidedGeometryCreator>());
+    factory.add_creator(newBox<geometry::MeshInstanceCreator>());
     factory.add_creator(newBox<geometry::QuadCreator>());
     factory.add_creator(newBox<geometry::SphereCreator>());
     factory.add_creator(newBox<geometry::TransformWrapperCreator>());
@@ -6,6 +6,71 @@ AGZ_TRACER_FACTORY_BEGIN
 namespace renderer
 {
 
+    AdaptiveSamplingParams parse_adaptive_sampling_params(
+        const ConfigGroup &params)
+    {
+        AdaptiveSamplingParams ret;
+
+        auto group = params.find_child_group("adaptive");
+        if(!group)
+            return ret;
+
+        ret.enabled         = true;
+        ret.init_spp        = group->child_int_or("init_spp", 16);
+        ret.pass_count      = group->child_int_or("pass_count", 8);
+        ret.error_threshold = group->child_real_or("error_threshold", real(0.01));
+
+        if(ret.init_spp < 2)
+            throw CreatingObjectException("adaptive init_spp must be at least 2");
+        if(ret.pass_count < 1)
+            throw CreatingObjectException("invalid adaptive pass count");
+
+        return ret;
+    }
+
+    SamplerType parse_sampler_type(const ConfigGroup &params)
+    {
+        const std::string name = params.child_str_or("sampler", "native");
+        if(name == "native")
+            return SamplerType::Native;
+        if(name == "counter")
+            return SamplerType::Counter;
+        if(name == "sobol")
+            return SamplerType::Sobol;
+        if(name == "halton")
+            return SamplerType::Halton;
+        if(name == "pmj02")
+            return SamplerType::PMJ02;
+        throw CreatingObjectException("unknown sampler type: " + name);
+    }
+
+    /**
+     * @brief read settings shared by all renderers and set them to the
+     *        renderer, including early termination criteria and thread
+     *        pinning
+     *
+     * target_error is only supported by renderers with per-pixel
+     * error estimations
+     */
+    RC<Renderer> with_common_settings(
+        RC<Renderer> renderer, const ConfigGroup &params,
+        bool allow_target_error)
+    {
+        RenderTermination termination;
+        termination.time_budget  = params.child_real_or("time_budget", 0);
+        termination.target_error = params.child_real_or("target_error", 0);
+
+        if(termination.target_error > 0 && !allow_target_error)
+        {
+            throw CreatingObjectException(
+                "target_error is not supported by this renderer");
+        }
+
+        renderer->set_termination(termination);
+        renderer->set_pin_threads(params.child_int_or("pin_threads", 0) != 0);
+        return renderer;
+    }
+
     class AORendererCreator : public Creator<Renderer>
     {
     public:
@@ -39,7 +104,11 @@ namespace renderer
 
             ao_params.spp = params.child_int("spp");
 
-            return create_ao_renderer(ao_params);
+            ao_params.adaptive = parse_adaptive_sampling_params(params);
+            ao_params.sampler  = parse_sampler_type(params);
+
+            return with_common_settings(
+                create_ao_renderer(ao_params), params, true);
         }
     };
 
@@ -71,7 +140,10 @@ namespace renderer
 
             bdpt_params.use_mis = params.child_int_or("use_mis", 1) != 0;
 
-            return create_vol_bdpt_renderer(bdpt_params);
+            bdpt_params.sampler = parse_sampler_type(params);
+
+            return with_common_settings(
+                create_vol_bdpt_renderer(bdpt_params), params, false);
         }
     };
 
@@ -108,7 +180,8 @@ namespace renderer
             renderer_params.forward_spp            =
                 params.child_int("forward_spp");
 
-            return create_adjoint_pt_renderer(renderer_params);
+            return with_common_settings(
+                create_adjoint_pt_renderer(renderer_params), params, false);
         }
     };
 
@@ -121,8 +194,7 @@ namespace renderer
             return "pt";
         }
 
-        RC<Renderer> create(
-            const ConfigGroup &params, CreatingContext &context) const override
+        static PTRendererParams parse_params(const ConfigGroup &params)
         {
             const int worker_count   = params.child_int_or("worker_count", 0);
             const int task_grid_size = params.child_int_or("task_grid_size", 32);
@@ -145,8 +217,47 @@ namespace renderer
             pt_params.cont_prob         = cont_prob;
             pt_params.use_mis           = use_mis;
             pt_params.specular_depth    = specular_depth;
+            pt_params.adaptive          = parse_adaptive_sampling_params(params);
+            pt_params.sampler           = parse_sampler_type(params);
 
-            return create_pt_renderer(pt_params);
+            return pt_params;
+        }
+
+        RC<Renderer> create(
+            const ConfigGroup &params, CreatingContext &context) const override
+        {
+            return with_common_settings(
+                create_pt_renderer(parse_params(params)), params, true);
+        }
+    };
+
+    class WavefrontPathTracingRendererCreator : public Creator<Renderer>
+    {
+    public:
+
+        std::string name() const override
+        {
+            return "wavefront_pt";
+        }
+
+        RC<Renderer> create(
+            const ConfigGroup &params, CreatingContext &context) const override
+        {
+            WavefrontPTRendererParams wf_params;
+            wf_params.pt = PathTracingRendererCreator::parse_params(params);
+            wf_params.path_state_count = params.child_int_or(
+                "path_state_count", 4096);
+
+            if(wf_params.path_state_count <= 0)
+                throw CreatingObjectException("invalid path state count");
+            if(wf_params.pt.sampler != SamplerType::Native)
+            {
+                throw CreatingObjectException(
+                    "wavefront_pt only supports the native sampler");
+            }
+
+            return with_common_settings(
+                create_wavefront_pt_renderer(wf_params), params, true);
         }
     };
 
@@ -185,7 +296,8 @@ namespace renderer
             p.chain_count          =
                 params.child_int_or("chain_count", p.chain_count);
 
-            return create_pssmlt_pt_renderer(p);
+            return with_common_settings(
+                create_pssmlt_pt_renderer(p), params, false);
         }
     };
 
@@ -228,7 +340,8 @@ namespace renderer
 
             p.grid_accel_resolution = params.child_int_or("grid_res", 64);
 
-            return create_sppm_renderer(p);
+            return with_common_settings(
+                create_sppm_renderer(p), params, false);
         }
     };
 
@@ -242,6 +355,7 @@ void initialize_renderer_factory(Factory<Renderer> &factory)
     factory.add_creator(newBox<renderer::PSSMLTPTCreator>());
     factory.add_creator(newBox<renderer::SPPMRendererCreator>());
     factory.add_creator(newBox<renderer::VolBDPTRendererCreator>());
+    factory.add_creator(newBox<renderer::WavefrontPathTracingRendererCreator>());
 }
 
 AGZ_TRACER_FACTORY_END
@@ -1,3 +1,6 @@
+#include <exception>
+#include <map>
+
 #include <agz/tracer/core/entity.h>
 #include <agz/tracer/core/light.h>
 #include <agz/tracer/core/scene.h>
@@ -5,12 +8,47 @@
 #include <agz/tracer/create/aggregate.h>
 #include <agz/tracer/create/scene.h>
 #include <agz/tracer/utility/logger.h>
+#include <agz/tracer/utility/nested_parallel.h>
+#include <agz/tracer/utility/parallel_grid.h>
 #include <agz/utility/string.h>
 
 AGZ_TRACER_FACTORY_BEGIN
 
 namespace scene
 {
+
+    /**
+     * @brief collect keys of meshes placed by exactly one mesh_instance
+     *
+     * only geometries directly owned by entities are counted. referenced
+     * ones may be shared in ways that can't be seen here and keep
+     * their transforms
+     */
+    std::set<std::string> find_single_use_meshes(
+        const ConfigArray &ent_arr, const CreatingContext &context)
+    {
+        std::map<std::string, int> key2count;
+        for(size_t i = 0; i < ent_arr.size(); ++i)
+        {
+            auto geometry = ent_arr.at_group(i).find_child_group("geometry");
+            if(!geometry || geometry->child_str("type") != "mesh_instance")
+                continue;
+
+            const auto filename = context.path_mapper->map(
+                geometry->child_str("filename"));
+            const auto mesh_type = geometry->child_str_or(
+                "mesh_type", "triangle_bvh");
+            ++key2count[mesh_type + ":" + filename];
+        }
+
+        std::set<std::string> ret;
+        for(auto &p : key2count)
+        {
+            if(p.second == 1)
+                ret.insert(p.first);
+        }
+        return ret;
+    }
     
     class DefaultSceneCreator : public Creator<Scene>
     {
@@ -26,24 +64,65 @@ namespace scene
         {
             DefaultSceneParams scene_params;
 
+            context.flatten_transforms =
+                params.child_int_or("flatten_transforms", 0) != 0;
+
             if(auto ent_arr = params.find_child_array("entities"))
             {
+                if(context.flatten_transforms)
+                {
+                    context.single_use_meshes =
+                        find_single_use_meshes(*ent_arr, context);
+                }
+
                 if(ent_arr->size() == 1)
                     AGZ_INFO("creating 1 entity");
                 else
                     AGZ_INFO("creating {} entities", ent_arr->size());
 
-                for(size_t i = 0; i < ent_arr->size(); ++i)
+                // entities are created parallelly so that independent meshes
+                // can be loaded and built at the same time. bvh builders
+                // started by a loading thread only use the hardware threads
+                // left over by other loading threads
+
+                const int worker_count = thread::actual_worker_count(
+                    params.child_int_or("loading_worker_count", 0));
+
+                std::vector<RC<Entity>> entities(ent_arr->size());
+                std::vector<std::exception_ptr> errors(ent_arr->size());
+
+                parallel_for_1d_grid(
+                    worker_count, static_cast<int>(ent_arr->size()), 1,
+                    [&](int, int i, int)
                 {
                     auto &group = ent_arr->at_group(i);
                     if(stdstr::ends_with(group.child_str("type"), "//"))
                     {
                         AGZ_INFO("skip entity with type ending with //");
-                        continue;
+                        return;
                     }
 
-                    auto ent = context.create<Entity>(group);
-                    scene_params.entities.push_back(ent);
+                    try
+                    {
+                        OuterWorkerScope outer_worker_scope;
+                        entities[i] = context.create<Entity>(group);
+                    }
+                    catch(...)
+                    {
+                        errors[i] = std::current_exception();
+                    }
+                });
+
+                for(auto &err : errors)
+                {
+                    if(err)
+                        std::rethrow_exception(err);
+                }
+
+                for(auto &ent : entities)
+                {
+                    if(ent)
+                        scene_params.entities.push_back(ent);
                 }
             }
 
@@ -61,6 +140,8 @@ namespace scene
                 const_entities.push_back(ent);
             scene_params.aggregate->build(const_entities);
 
+            scene_params.occluder_cache = params.child_int_or("occluder_cache", 1) != 0;
+
             return create_default_scene(scene_params);
         }
     };
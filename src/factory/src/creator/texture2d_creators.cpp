@@ -1,3 +1,5 @@
+#include <mutex>
+
 #include <agz/factory/creator/texture2d_creators.h>
 #include <agz/tracer/create/texture2d.h>
 #include <agz/utility/image.h>
@@ -68,6 +70,7 @@ namespace texture
     {
         mutable std::map<std::string, RC<const Image2D<math::color3f>>>
             filename2data_;
+        mutable std::mutex filename2data_mutex_;
 
     public:
 
@@ -85,6 +88,8 @@ namespace texture
             const auto sample =
                 params.child_str_or("sample", "linear");
 
+            std::lock_guard lk(filename2data_mutex_);
+
             RC<const Image2D<math::color3f>> data;
             if(auto it = filename2data_.find(filename);
                it != filename2data_.end())
@@ -108,6 +113,7 @@ namespace texture
     {
         mutable std::map<std::string, RC<const Image2D<math::color3b>>>
             filename2data_;
+        mutable std::mutex filename2data_mutex_;
 
     public:
 
@@ -125,6 +131,8 @@ namespace texture
             const auto sample =
                 params.child_str_or("sample", "linear");
 
+            std::lock_guard lk(filename2data_mutex_);
+
             RC<const Image2D<math::color3b>> data;
             if(auto it = filename2data_.find(filename);
                it != filename2data_.end())
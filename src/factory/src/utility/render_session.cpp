@@ -4,6 +4,7 @@
 #include <agz/factory/factory.h>
 #include <agz/tracer/create/film_filter.h>
 #include <agz/tracer/utility/logger.h>
+#include <agz/tracer/utility/partial_render.h>
 
 #include <agz/utility/string.h>
 
@@ -41,23 +42,8 @@ namespace
         const auto &reporter_params = rendering_config.child_group("reporter");
         settings->reporter = context.create<RendererInteractor>(reporter_params);
 
-        if(auto node = rendering_config.find_child("post_processors"))
-        {
-            AGZ_INFO("creating post processors");
-            const auto &arr = node->as_array();
-
-            settings->post_processors.reserve(arr.size());
-            for(size_t i = 0; i != arr.size(); ++i)
-            {
-                const auto &group = arr.at(i).as_group();
-                if(stdstr::ends_with(group.child_str("type"), "//"))
-                    continue;
-                const auto elem = context.create<PostProcessor>(group);
-                settings->post_processors.push_back(elem);
-            }
-        }
-        else
-            AGZ_INFO("no post processor");
+        settings->post_processors = create_post_processors(
+            rendering_config, context);
 
         if(auto node = rendering_config.find_child_value("eps"))
             settings->eps = node->as_real();
@@ -95,6 +81,29 @@ void RenderSession::execute()
         p->process(render_target);
 }
 
+void RenderSession::execute_partial(
+    const RenderPartition &partition, const std::string &filename)
+{
+    AGZ_INFO("start partial rendering");
+
+    set_eps(render_settings->eps);
+
+    scene->set_camera(render_settings->camera);
+    scene->start_rendering();
+
+    FilmFilterApplier filter_applier(
+        render_settings->width, render_settings->height,
+        render_settings->film_filter);
+
+    const PartialRenderTarget render_target =
+        render_settings->renderer->render_partial(
+            filter_applier, *scene, *render_settings->reporter, partition);
+
+    AGZ_INFO("saving partial render to {}", filename);
+
+    save_partial_render_target(filename, render_target);
+}
+
 RenderSession create_render_session(
     RC<Scene> scene,
     const ConfigGroup &rendering_setting_config,
@@ -104,6 +113,34 @@ RenderSession create_render_session(
     return RenderSession(std::move(scene), std::move(setting));
 }
 
+std::vector<RC<PostProcessor>> create_post_processors(
+    const ConfigGroup &rendering_setting_config,
+    factory::CreatingContext &context)
+{
+    std::vector<RC<PostProcessor>> ret;
+
+    auto node = rendering_setting_config.find_child("post_processors");
+    if(!node)
+    {
+        AGZ_INFO("no post processor");
+        return ret;
+    }
+
+    AGZ_INFO("creating post processors");
+    const auto &arr = node->as_array();
+
+    ret.reserve(arr.size());
+    for(size_t i = 0; i != arr.size(); ++i)
+    {
+        const auto &group = arr.at(i).as_group();
+        if(stdstr::ends_with(group.child_str("type"), "//"))
+            continue;
+        ret.push_back(context.create<PostProcessor>(group));
+    }
+
+    return ret;
+}
+
 std::vector<RenderSession> parse_render_sessions(
     const ConfigGroup &scene_config,
     const ConfigNode &rendering_setting_config,
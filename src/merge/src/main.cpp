@@ -0,0 +1,122 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <cxxopts.hpp>
+
+#include <agz/factory/factory.h>
+#include <agz/tracer/core/post_processor.h>
+#include <agz/tracer/tracer.h>
+#include <agz/tracer/utility/partial_render.h>
+
+#include <agz/utility/file.h>
+#include <agz/utility/misc.h>
+
+#define WORKING_DIR_PATH_NAME "${working-directory}"
+#define SCENE_DESC_PATH_NAME  "${scene-directory}"
+
+/*
+    atrc-merge -d SceneDescriptionFilename [--session SessionIndex] PartialOutput...
+
+        combine outputs of 'CLI --partial-output' into the final image,
+        then run post processors of the rendering session
+*/
+void run(int argc, char *argv[])
+{
+    cxxopts::Options opts("atrc-merge", "merge partial renders of agz offline renderer");
+    opts.add_options("")
+        ("d,scene-filename", "scene description filename", cxxopts::value<std::string>())
+        ("session", "index of rendering session", cxxopts::value<int>()->default_value("0"))
+        ("inputs", "partial render files", cxxopts::value<std::vector<std::string>>())
+        ("h,help", "help information");
+    opts.parse_positional({ "inputs" });
+    opts.positional_help("PartialOutput...");
+    auto parse_result = opts.parse(argc, argv);
+
+    if(parse_result.count("help"))
+    {
+        std::cout << opts.help({ "" }) << std::endl;
+        return;
+    }
+
+    if(!parse_result.count("scene-filename"))
+        throw std::runtime_error("scene description filename is unspecified");
+    if(!parse_result.count("inputs"))
+        throw std::runtime_error("no partial render is given");
+
+    const auto scene_filename = parse_result["scene-filename"].as<std::string>();
+    const auto inputs = parse_result["inputs"].as<std::vector<std::string>>();
+    const int session_index = parse_result["session"].as<int>();
+
+    // load and merge partial renders
+
+    std::vector<agz::tracer::PartialRenderTarget> parts;
+    for(auto &filename : inputs)
+    {
+        AGZ_INFO("loading partial render: {}", filename);
+        parts.push_back(agz::tracer::load_partial_render_target(filename));
+    }
+
+    AGZ_INFO("merging {} partial renders", parts.size());
+    agz::tracer::RenderTarget render_target =
+        agz::tracer::merge_partial_render_targets(parts);
+
+    // create post processors
+
+    agz::tracer::factory::BasicPathMapper path_mapper;
+    {
+        const auto working_dir = absolute(
+            std::filesystem::current_path()).lexically_normal().string();
+        path_mapper.add_replacer(WORKING_DIR_PATH_NAME, working_dir);
+
+        const auto scene_dir = absolute(
+            std::filesystem::path(scene_filename))
+                .parent_path().lexically_normal().string();
+        path_mapper.add_replacer(SCENE_DESC_PATH_NAME, scene_dir);
+    }
+
+    const auto root_params = agz::tracer::factory::json_to_config(
+        agz::tracer::factory::string_to_json(
+            agz::file::read_txt_file(scene_filename)));
+    const auto &scene_config = root_params.child_group("scene");
+    const auto &rendering_config = root_params.child("rendering");
+
+    agz::tracer::factory::CreatingContext context;
+    context.path_mapper = &path_mapper;
+    context.reference_root = &scene_config;
+
+    const auto &session_config = rendering_config.is_array() ?
+        rendering_config.as_array().at_group(session_index) :
+        rendering_config.as_group();
+
+    const auto post_processors = agz::tracer::create_post_processors(
+        session_config, context);
+
+    AGZ_INFO("running post processors");
+
+    for(auto &p : post_processors)
+        p->process(render_target);
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        run(argc, argv);
+        return 0;
+    }
+    catch(const std::exception &e)
+    {
+        std::vector<std::string> msgs;
+        agz::misc::extract_hierarchy_exceptions(e, std::back_inserter(msgs));
+        for(auto &m : msgs)
+            std::cout << m << std::endl;
+    }
+    catch(...)
+    {
+        std::cout << "an unknown error occurred" << std::endl;
+    }
+
+    return -1;
+}
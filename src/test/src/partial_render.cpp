@@ -0,0 +1,97 @@
+#include <catch.hpp>
+
+#include "./test_scene.h"
+
+using namespace agz::tracer;
+
+namespace
+{
+    constexpr int WIDTH  = 48;
+    constexpr int HEIGHT = 32;
+
+    // normalized image of partial outputs covering the whole film
+    Image2D<Spectrum> merge(const std::vector<PartialRenderTarget> &parts)
+    {
+        Image2D<Spectrum> value(HEIGHT, WIDTH);
+        Image2D<real>     weight(HEIGHT, WIDTH);
+
+        for(auto &part : parts)
+        {
+            for(int y = part.rect.low.y; y <= part.rect.high.y; ++y)
+            {
+                for(int x = part.rect.low.x; x <= part.rect.high.x; ++x)
+                {
+                    const int ly = y - part.rect.low.y;
+                    const int lx = x - part.rect.low.x;
+                    value (y, x) += part.value (ly, lx);
+                    weight(y, x) += part.weight(ly, lx);
+                }
+            }
+        }
+
+        Image2D<Spectrum> ret(HEIGHT, WIDTH);
+        for(int y = 0; y < HEIGHT; ++y)
+        {
+            for(int x = 0; x < WIDTH; ++x)
+            {
+                REQUIRE(weight(y, x) > 0);
+                ret(y, x) = value(y, x) / weight(y, x);
+            }
+        }
+        return ret;
+    }
+}
+
+TEST_CASE("merged tiles equal the whole film")
+{
+    auto scene = create_test_scene(real(WIDTH) / HEIGHT);
+
+    PTRendererParams params;
+    params.worker_count   = 2;
+    params.task_grid_size = 8;
+    params.spp            = 4;
+    auto renderer = create_pt_renderer(params);
+
+    // a wide filter so that samples are splatted across the tile border
+    FilmFilterApplier filter(
+        WIDTH, HEIGHT, create_gaussian_filter(real(1.5), 2));
+    auto reporter = create_noout_reporter();
+
+    RenderPartition whole;
+    const auto full = merge({
+        renderer->render_partial(filter, *scene, *reporter, whole) });
+
+    // split at a column not aligned with task grids
+
+    RenderPartition left, right;
+    left.has_tile  = true;
+    left.tile      = { { 0, 0 }, { 20, HEIGHT - 1 } };
+    right.has_tile = true;
+    right.tile     = { { 21, 0 }, { WIDTH - 1, HEIGHT - 1 } };
+
+    const auto left_part  = renderer->render_partial(
+        filter, *scene, *reporter, left);
+    const auto right_part = renderer->render_partial(
+        filter, *scene, *reporter, right);
+
+    REQUIRE(left_part.rect.low.x  == left.tile.low.x);
+    REQUIRE(left_part.rect.high.x == left.tile.high.x);
+    REQUIRE(right_part.rect.low.x  == right.tile.low.x);
+    REQUIRE(right_part.rect.high.x == right.tile.high.x);
+
+    const auto tiled = merge({ left_part, right_part });
+
+    // only the summation order of filtered samples differs
+
+    for(int y = 0; y < HEIGHT; ++y)
+    {
+        for(int x = 0; x < WIDTH; ++x)
+        {
+            for(int c = 0; c < SPECTRUM_COMPONENT_COUNT; ++c)
+            {
+                REQUIRE(tiled(y, x)[c] == Approx(full(y, x)[c])
+                                              .epsilon(1e-3).margin(1e-5));
+            }
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include <catch.hpp>
+
+#include "./test_scene.h"
+
+using namespace agz::tracer;
+
+namespace
+{
+    /**
+     * @brief blocks the first progress report at or above a given percent
+     *  until released
+     */
+    class BlockingRecorder : public ProgressRecorder
+    {
+        double block_percent_;
+
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        bool blocked_  = false;
+        bool released_ = false;
+
+    public:
+
+        explicit BlockingRecorder(double block_percent)
+            : block_percent_(block_percent)
+        {
+
+        }
+
+        void progress(double percent, const PreviewFunc &preview) override
+        {
+            ProgressRecorder::progress(percent, preview);
+
+            std::unique_lock lk(mutex_);
+            if(blocked_ || percent < block_percent_)
+                return;
+
+            blocked_ = true;
+            cond_.notify_all();
+            cond_.wait(lk, [&] { return released_; });
+        }
+
+        void wait_blocked()
+        {
+            std::unique_lock lk(mutex_);
+            cond_.wait(lk, [&] { return blocked_; });
+        }
+
+        void release()
+        {
+            std::lock_guard lk(mutex_);
+            released_ = true;
+            cond_.notify_all();
+        }
+    };
+
+    SPPMRendererParams sppm_params(int iteration_count)
+    {
+        // a single worker makes the first iteration deterministic
+        SPPMRendererParams params;
+        params.worker_count           = 1;
+        params.forward_task_grid_size = 16;
+        params.iteration_count        = iteration_count;
+        params.photons_per_iteration  = 10000;
+        return params;
+    }
+}
+
+TEST_CASE("stopped sppm equals its finished iterations")
+{
+    constexpr int WIDTH  = 32;
+    constexpr int HEIGHT = 24;
+    constexpr int ITERATION_COUNT = 10000;
+
+    auto scene = create_test_scene(real(WIDTH) / HEIGHT);
+    FilmFilterApplier filter(WIDTH, HEIGHT, create_box_filter(real(0.5)));
+
+    // reference: exactly one iteration
+
+    auto reference_renderer = create_sppm_renderer(sppm_params(1));
+    ProgressRecorder reference_reporter;
+    const RenderTarget reference = reference_renderer->render(
+        filter, *scene, reference_reporter);
+
+    // stop after the camera pass of the second iteration, which has
+    // already traced visible points and direct illumination
+
+    auto renderer = create_sppm_renderer(sppm_params(ITERATION_COUNT));
+    BlockingRecorder reporter(100 * 1.5 / ITERATION_COUNT * (1 - 1e-4));
+    renderer->render_async(filter, *scene, reporter);
+
+    reporter.wait_blocked();
+    auto stopped = std::async(std::launch::async, [&]
+    {
+        return renderer->stop_and_wait_async();
+    });
+
+    // stop_and_wait_async sets the stop flag before waiting
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    reporter.release();
+
+    const RenderTarget target = stopped.get();
+
+    REQUIRE(target.image.width()  == WIDTH);
+    REQUIRE(target.image.height() == HEIGHT);
+
+    bool has_radiance = false;
+    for(int y = 0; y < HEIGHT; ++y)
+    {
+        for(int x = 0; x < WIDTH; ++x)
+        {
+            REQUIRE(target.image(y, x).is_finite());
+            has_radiance |= !target.image(y, x).is_black();
+
+            for(int c = 0; c < SPECTRUM_COMPONENT_COUNT; ++c)
+            {
+                REQUIRE(target.image(y, x)[c] ==
+                        Approx(reference.image(y, x)[c]).margin(1e-5));
+                REQUIRE(target.albedo(y, x)[c] ==
+                        Approx(reference.albedo(y, x)[c]).margin(1e-5));
+            }
+            REQUIRE(target.denoise(y, x) ==
+                    Approx(reference.denoise(y, x)).margin(1e-5));
+        }
+    }
+    REQUIRE(has_radiance);
+}
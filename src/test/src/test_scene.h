@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+
+#include <agz/tracer/tracer.h>
+
+AGZ_TRACER_BEGIN
+
+/**
+ * @brief diffuse sphere under a sky, viewed by a pinhole camera
+ *
+ * start_rendering is already called on the returned scene
+ */
+inline RC<Scene> create_test_scene(real film_aspect)
+{
+    auto albedo = create_constant2d_texture({}, Spectrum(real(0.7)));
+    auto material = create_ideal_diffuse(std::move(albedo), nullptr);
+
+    MediumInterface med;
+    med.in  = create_void();
+    med.out = create_void();
+
+    auto sphere = create_geometric(
+        create_sphere(1, Transform3()), material, med, Spectrum(), false, -1);
+
+    DefaultSceneParams params;
+    params.entities    = { sphere };
+    params.envir_light = create_native_sky(Spectrum(1), Spectrum(real(0.2)));
+    params.aggregate   = create_native_aggregate();
+    params.aggregate->build({ sphere });
+
+    auto scene = create_default_scene(params);
+    scene->set_camera(create_thin_lens_camera(
+        film_aspect, { 0, -4, 0 }, { 0, 0, 0 }, { 0, 0, 1 },
+        PI_r / 3, 0, 1));
+    scene->start_rendering();
+
+    return scene;
+}
+
+/**
+ * @brief reporter recording the last reported progress
+ */
+class ProgressRecorder : public RendererInteractor
+{
+    std::atomic<double> percent_ = 0;
+
+public:
+
+    double percent() const noexcept { return percent_; }
+
+    bool need_image_preview() const noexcept override { return false; }
+
+    void progress(double percent, const PreviewFunc &) override
+    {
+        percent_ = percent;
+    }
+
+    void message(const std::string &) override { }
+
+    void begin() override { }
+
+    void end() override { }
+
+    void new_stage() override { percent_ = 0; }
+
+    void end_stage() override { }
+};
+
+AGZ_TRACER_END
@@ -8,6 +8,15 @@ AGZ_TRACER_BEGIN
 
 class Entity;
 
+/**
+ * @brief part of an entity blocking a shadow ray
+ */
+struct Occluder
+{
+    const Entity *entity = nullptr;
+    uint32_t primitive   = NO_OCCLUDER_PRIMITIVE;
+};
+
 /**
  * @brief acceleration data structure interface between entities
  */
@@ -26,16 +35,97 @@ public:
      */
     virtual void build(const std::vector<RC<const Entity>> &entities) = 0;
 
+    /**
+     * @brief add an entity to the built data structure
+     *
+     * cheaper than rebuilding for small changes of the entity set.
+     * must not be called during rendering
+     */
+    virtual void insert(RC<const Entity> entity) = 0;
+
+    /**
+     * @brief remove an entity from the built data structure
+     *
+     * do nothing when the entity is not contained.
+     * must not be called during rendering
+     */
+    virtual void remove(const Entity *entity) = 0;
+
+    /**
+     * @brief update the data structure after bounds of contained entities are changed
+     *
+     * must not be called during rendering
+     */
+    virtual void refit() = 0;
+
     /**
      * @brief test whether an intersection exists
      */
     virtual bool has_intersection(const Ray &r) const noexcept = 0;
 
+    /**
+     * @brief test whether an intersection exists, and find what blocks the ray
+     *
+     * @param occluder only modified when true is returned.
+     *  occluder->entity is nullptr when the aggregate cannot tell it
+     */
+    virtual bool find_occluder(const Ray &r, Occluder *occluder) const noexcept
+    {
+        if(!has_intersection(r))
+            return false;
+        *occluder = Occluder();
+        return true;
+    }
+
     /**
      * @brief find the closest intersection between ray and entities
      */
     virtual bool closest_intersection(
         const Ray &r, EntityIntersection *inct) const noexcept = 0;
+
+    /**
+     * @brief test intersections of a batch of rays
+     *
+     * coherent rays (e.g. primary rays of a tile, or shadow rays towards
+     * the same light source) share node visits
+     *
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept = 0;
+
+    /**
+     * @brief find closest intersections of a batch of rays
+     *
+     * @param incts intersections. incts[i] is only modified when result[i] is true
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept = 0;
+
+    /**
+     * @brief changed whenever entities may be destroyed (build or remove)
+     *
+     * caches holding raw entity pointers found in this aggregate, like the
+     * occluder cache of default scene, are stale when this changes
+     */
+    uint64_t entity_generation() const noexcept
+    {
+        return entity_generation_;
+    }
+
+protected:
+
+    // must be called by build and remove
+    void invalidate_entity_caches() noexcept
+    {
+        ++entity_generation_;
+    }
+
+private:
+
+    uint64_t entity_generation_ = 0;
 };
 
 AGZ_TRACER_END
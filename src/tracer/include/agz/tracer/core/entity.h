@@ -28,6 +28,30 @@ public:
     /** @brief is there an intersection with given ray? */
     virtual bool has_intersection(const Ray &r) const noexcept = 0;
 
+    /**
+     * @brief test whether an intersection exists, and find a primitive blocking the ray
+     *
+     * @param primitive only modified when true is returned.
+     *  NO_OCCLUDER_PRIMITIVE when no primitive can be tested separately
+     *
+     * see Geometry::find_occluder
+     */
+    virtual bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept
+    {
+        if(!has_intersection(r))
+            return false;
+        *primitive = NO_OCCLUDER_PRIMITIVE;
+        return true;
+    }
+
+    /**
+     * @brief test intersection between ray and a primitive found by find_occluder
+     */
+    virtual bool is_occluded_by(const Ray &r, uint32_t) const noexcept
+    {
+        return has_intersection(r);
+    }
+
     /**
      * @brief find closest intersection with given ray
      * 
@@ -39,6 +63,24 @@ public:
     virtual bool closest_intersection(
         const Ray &r, EntityIntersection *inct) const noexcept = 0;
 
+    /**
+     * @brief test intersections of a batch of rays
+     *
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept = 0;
+
+    /**
+     * @brief find closest intersections of a batch of rays
+     *
+     * @param incts intersections. incts[i] is only modified when result[i] is true
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept = 0;
+
     /**
      * @brief aabb in world space
      */
@@ -20,6 +20,31 @@ public:
      */
     virtual bool has_intersection(const Ray &r) const noexcept = 0;
 
+    /**
+     * @brief test whether an intersection exists, and find a primitive blocking the ray
+     *
+     * the primitive index is defined by the geometry and can be passed to
+     * is_occluded_by later, which is expected to be much cheaper than has_intersection
+     *
+     * @param primitive only modified when true is returned.
+     *  NO_OCCLUDER_PRIMITIVE when no primitive can be tested separately
+     */
+    virtual bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept
+    {
+        if(!has_intersection(r))
+            return false;
+        *primitive = NO_OCCLUDER_PRIMITIVE;
+        return true;
+    }
+
+    /**
+     * @brief test intersection between ray and a primitive found by find_occluder
+     */
+    virtual bool is_occluded_by(const Ray &r, uint32_t) const noexcept
+    {
+        return has_intersection(r);
+    }
+
     /**
      * @brief find closest intersection with given ray
      *
@@ -31,6 +56,36 @@ public:
     virtual bool closest_intersection(
         const Ray &r, GeometryIntersection *inct) const noexcept = 0;
 
+    /**
+     * @brief test intersections of a batch of rays
+     *
+     * @param rays ray array
+     * @param count ray count
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept
+    {
+        for(size_t i = 0; i < count; ++i)
+            result[i] = has_intersection(rays[i]);
+    }
+
+    /**
+     * @brief find closest intersections of a batch of rays
+     *
+     * @param rays ray array
+     * @param count ray count
+     * @param incts intersections. incts[i] is only modified when result[i] is true
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void closest_intersection_n(
+        const Ray *rays, size_t count,
+        GeometryIntersection *incts, bool *result) const noexcept
+    {
+        for(size_t i = 0; i < count; ++i)
+            result[i] = closest_intersection(rays[i], &incts[i]);
+    }
+
     /**
      * @brief aabb in world space
      */
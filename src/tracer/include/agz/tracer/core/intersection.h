@@ -1,9 +1,17 @@
 ﻿#pragma once
 
+#include <limits>
+
 #include <agz/tracer/common.h>
 
 AGZ_TRACER_BEGIN
 
+/**
+ * @brief primitive index meaning that the blocking part of a geometry
+ *        cannot be tested separately
+ */
+constexpr uint32_t NO_OCCLUDER_PRIMITIVE = std::numeric_limits<uint32_t>::max();
+
 /**
  * @brief point on geometry object
  */
@@ -6,6 +6,27 @@
 
 AGZ_TRACER_BEGIN
 
+/**
+ * @brief running mean and variance of sample luminances in a pixel
+ *
+ * updated with Welford's algorithm
+ */
+struct PixelVariance
+{
+    real count = 0;
+    real mean  = 0;
+    real m2    = 0;
+
+    void add(real x) noexcept;
+
+    /**
+     * @brief estimated standard error of the pixel mean relative to it
+     *
+     * returns REAL_INF when there are less than 2 samples
+     */
+    real relative_error() const noexcept;
+};
+
 namespace img_buf_impl
 {
     template<bool WITH_VALUE> struct ValueBuffer { void init(int w, int h) { } };
@@ -27,6 +48,10 @@ namespace img_buf_impl
     template<bool WITH_DENOISE> struct DenoiseBuffer { void init(int w, int h) { } };
     template<> struct DenoiseBuffer<true>
     { Image2D<real> denoise; void init(int w, int h) { denoise.initialize(h, w); } };
+
+    template<bool WITH_VARIANCE> struct VarianceBuffer { void init(int w, int h) { } };
+    template<> struct VarianceBuffer<true>
+    { Image2D<PixelVariance> variance; void init(int w, int h) { variance.initialize(h, w); } };
 }
 
 /**
@@ -38,18 +63,21 @@ namespace img_buf_impl
  * Image2D<Spectrum> albedo
  * Image2D<Vec3>     normal
  * Image2D<real>     denoise
+ * Image2D<PixelVariance> variance
  */
 template<bool WITH_VALUE,
          bool WITH_WEIGHT,
          bool WITH_ALBEDO,
          bool WITH_NORMAL,
-         bool WITH_DENOISE>
+         bool WITH_DENOISE,
+         bool WITH_VARIANCE = false>
 struct ImageBufferTemplate
-    : img_buf_impl::ValueBuffer  <WITH_VALUE>,
-      img_buf_impl::WeightBuffer <WITH_WEIGHT>,
-      img_buf_impl::AlbedoBuffer <WITH_ALBEDO>,
-      img_buf_impl::NormalBuffer <WITH_NORMAL>,
-      img_buf_impl::DenoiseBuffer<WITH_DENOISE>
+    : img_buf_impl::ValueBuffer   <WITH_VALUE>,
+      img_buf_impl::WeightBuffer  <WITH_WEIGHT>,
+      img_buf_impl::AlbedoBuffer  <WITH_ALBEDO>,
+      img_buf_impl::NormalBuffer  <WITH_NORMAL>,
+      img_buf_impl::DenoiseBuffer <WITH_DENOISE>,
+      img_buf_impl::VarianceBuffer<WITH_VARIANCE>
 {
     ImageBufferTemplate() = default;
 
@@ -73,6 +101,25 @@ struct RenderTarget
     bool is_valid() const noexcept;
 };
 
+/**
+ * @brief unnormalized output of rendering a part of the film
+ *
+ * buffers cover pixels [rect.low, rect.high] of a film with resolution
+ * full_res. parts of the same film are merged by summing their buffers and
+ * dividing value, albedo, normal and denoise by the summed weight
+ */
+struct PartialRenderTarget
+{
+    Vec2i  full_res;
+    Rect2i rect;
+
+    Image2D<Spectrum> value;
+    Image2D<real>     weight;
+    Image2D<Spectrum> albedo;
+    Image2D<Vec3>     normal;
+    Image2D<real>     denoise;
+};
+
 /**
  * @brief helper class for reconstructing the image buffer
  *  with given filter function and sample points
@@ -207,6 +254,11 @@ public:
          * @brief get sample pixel range
          */
         const Rect2i &sample_pixels() const noexcept;
+
+        /**
+         * @brief get pixels written by this view
+         */
+        const Rect2i &pixels() const noexcept;
     };
 
     FilmFilterApplier(
@@ -245,20 +297,38 @@ private:
     RC<const FilmFilter> film_filter_;
 };
 
+inline void PixelVariance::add(real x) noexcept
+{
+    count += 1;
+    const real delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+}
+
+inline real PixelVariance::relative_error() const noexcept
+{
+    if(count < 2)
+        return REAL_INF;
+    const real variance_of_mean = m2 / ((count - 1) * count);
+    return std::sqrt(variance_of_mean) / (std::abs(mean) + real(1e-3));
+}
+
 template<bool WITH_VALUE,
          bool WITH_WEIGHT,
          bool WITH_ALBEDO,
          bool WITH_NORMAL,
-         bool WITH_DENOISE>
+         bool WITH_DENOISE,
+         bool WITH_VARIANCE>
 ImageBufferTemplate<
-    WITH_VALUE, WITH_WEIGHT, WITH_ALBEDO, WITH_NORMAL, WITH_DENOISE>
+    WITH_VALUE, WITH_WEIGHT, WITH_ALBEDO, WITH_NORMAL, WITH_DENOISE, WITH_VARIANCE>
     ::ImageBufferTemplate(int width, int height)
 {
-    img_buf_impl::ValueBuffer  <WITH_VALUE>  ::init(width, height);
-    img_buf_impl::WeightBuffer <WITH_WEIGHT> ::init(width, height);
-    img_buf_impl::AlbedoBuffer <WITH_ALBEDO> ::init(width, height);
-    img_buf_impl::NormalBuffer <WITH_NORMAL> ::init(width, height);
-    img_buf_impl::DenoiseBuffer<WITH_DENOISE>::init(width, height);
+    img_buf_impl::ValueBuffer   <WITH_VALUE>   ::init(width, height);
+    img_buf_impl::WeightBuffer  <WITH_WEIGHT>  ::init(width, height);
+    img_buf_impl::AlbedoBuffer  <WITH_ALBEDO>  ::init(width, height);
+    img_buf_impl::NormalBuffer  <WITH_NORMAL>  ::init(width, height);
+    img_buf_impl::DenoiseBuffer <WITH_DENOISE> ::init(width, height);
+    img_buf_impl::VarianceBuffer<WITH_VARIANCE>::init(width, height);
 }
 
 inline bool RenderTarget::is_valid() const noexcept
@@ -501,6 +571,13 @@ const Rect2i &FilmFilterApplier::FilmGridView<TexelTypes...>
     return sample_pixels_;
 }
 
+template<typename...TexelTypes>
+const Rect2i &FilmFilterApplier::FilmGridView<TexelTypes...>
+    ::pixels() const noexcept
+{
+    return pixels_;
+}
+
 inline FilmFilterApplier::FilmFilterApplier(
     int width, int height, RC<const FilmFilter> film_filter) noexcept
     : width_(width), height_(height), film_filter_(std::move(film_filter))
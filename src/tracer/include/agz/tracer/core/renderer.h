@@ -1,15 +1,76 @@
 ﻿#pragma once
 
 #include <atomic>
+#include <chrono>
+#include <functional>
 #include <future>
+#include <string>
 
 #include <agz/tracer/core/render_target.h>
 
 AGZ_TRACER_BEGIN
 
+class CheckpointReader;
+class CheckpointWriter;
 class RendererInteractor;
 class Scene;
 
+/**
+ * @brief criteria for finishing rendering before the whole sample budget is used
+ *
+ * rendering stops when any of them is met
+ */
+struct RenderTermination
+{
+    // wall-clock time budget in seconds. non-positive means unlimited
+    real time_budget = 0;
+
+    // target average relative error of pixels. non-positive means disabled
+    real target_error = 0;
+
+    bool is_enabled() const noexcept
+    {
+        return time_budget > 0 || target_error > 0;
+    }
+};
+
+/**
+ * @brief periodical saving of rendering state for resuming interrupted renders
+ */
+struct RenderCheckpoint
+{
+    // checkpoint file. empty means disabled
+    std::string filename;
+
+    // seconds between two checkpoints
+    real interval = 600;
+
+    // continue from the checkpoint file if it exists
+    bool resume = false;
+
+    bool is_enabled() const noexcept
+    {
+        return !filename.empty();
+    }
+};
+
+/**
+ * @brief part of the rendering work of a film
+ *
+ * used to spread one film over several processes
+ */
+struct RenderPartition
+{
+    // sampled pixels [tile.low, tile.high]. whole film when has_tile is false
+    bool   has_tile = false;
+    Rect2i tile;
+
+    // sample indices [sample_begin, sample_end) of each pixel.
+    // non-positive sample_end means all samples of the renderer
+    int sample_begin = 0;
+    int sample_end   = 0;
+};
+
 /**
  * @brief rendering algorithm interface
  */
@@ -23,8 +84,83 @@ protected:
     bool is_waitable_ = false;
     std::future<RenderTarget> async_thread_;
 
+    RenderTermination termination_;
+
+    std::chrono::steady_clock::time_point render_start_time_;
+
+    /**
+     * @brief start timing for the time budget
+     *
+     * should be called at the beginning of render
+     */
+    void start_timer() noexcept;
+
+    /**
+     * @brief seconds since start_timer
+     */
+    double elapsed_seconds() const noexcept;
+
+    /**
+     * @brief will the time budget be exceeded after working for given seconds
+     */
+    bool exceeds_time_budget(double extra_seconds = 0) const noexcept;
+
+    RenderCheckpoint checkpoint_;
+
+    bool pin_threads_ = false;
+
+    std::chrono::steady_clock::time_point last_checkpoint_time_;
+
+    /**
+     * @brief open the checkpoint to resume from
+     *
+     * elapsed time recorded in the checkpoint is added to the timer,
+     * so start_timer should be called first
+     *
+     * @return nullptr when resuming is disabled or there is no checkpoint
+     */
+    Box<CheckpointReader> open_checkpoint(const std::string &tag);
+
+    /**
+     * @brief write a checkpoint if the interval has passed since the last one
+     *
+     * @param tag renderer name used to reject checkpoints of other renderers
+     * @param write_state write renderer-specific state
+     */
+    void save_checkpoint_if_due(
+        const std::string &tag,
+        const std::function<void(CheckpointWriter&)> &write_state);
+
 public:
 
+    /**
+     * @brief set early termination criteria
+     */
+    void set_termination(const RenderTermination &termination) noexcept
+    {
+        termination_ = termination;
+    }
+
+    /**
+     * @brief set checkpoint saving/resuming settings
+     */
+    void set_checkpoint(const RenderCheckpoint &checkpoint)
+    {
+        checkpoint_ = checkpoint;
+    }
+
+    /**
+     * @brief pin worker threads to cpus when rendering
+     *
+     * see utility/thread_affinity.h
+     */
+    void set_pin_threads(bool pin_threads) noexcept
+    {
+        pin_threads_ = pin_threads;
+    }
+
+    bool pin_threads() const noexcept { return pin_threads_; }
+
     virtual ~Renderer() { stop_async(); }
 
     /**
@@ -34,6 +170,15 @@ public:
         FilmFilterApplier filter, Scene &scene,
         RendererInteractor &reporter) = 0;
 
+    /**
+     * @brief blocking rendering of a part of the film
+     *
+     * throws when the renderer doesn't support partial rendering
+     */
+    virtual PartialRenderTarget render_partial(
+        FilmFilterApplier filter, Scene &scene,
+        RendererInteractor &reporter, const RenderPartition &partition);
+
     /**
      * @brief start the async rendering
      */
@@ -51,6 +196,11 @@ public:
      */
     RenderTarget wait_async();
 
+    /**
+     * @brief stop the async rendering and get what has been rendered
+     */
+    RenderTarget stop_and_wait_async();
+
     /**
      * @brief returns true after calling render_async and
      *  before calling stop_async/wait_async
@@ -13,6 +13,14 @@ public:
 
     virtual ~Sampler() = default;
 
+    /**
+     * @brief start the sample_index-th sample of given pixel
+     *
+     * low discrepancy samplers restart their dimension here. ignored by
+     * samplers independent of pixel and sample index
+     */
+    virtual void start_pixel_sample(const Vec2i &pixel, int sample_index) { }
+
     virtual Sample1 sample1() = 0;
     virtual Sample2 sample2() = 0;
     virtual Sample3 sample3() = 0;
@@ -20,6 +28,22 @@ public:
     virtual Sample5 sample5() = 0;
 };
 
+/**
+ * @brief hash (pixel, sample index) with the splitmix64 finalizer
+ *
+ * seeds derived from it make a sample independent of which thread or
+ * process renders it
+ */
+inline uint64_t hash_pixel_sample(const Vec2i &pixel, int sample_index) noexcept
+{
+    uint64_t h = (uint64_t(uint32_t(pixel.y)) << 32) | uint32_t(pixel.x);
+    h ^= uint64_t(uint32_t(sample_index)) * 0x9e3779b97f4a7c15ull;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
 class NativeSampler : public Sampler
 {
 public:
@@ -34,6 +58,11 @@ public:
      */
     NativeSampler *clone(int seed, Arena &arena) const;
 
+    /**
+     * @brief restart the random sequence with given seed
+     */
+    void set_seed(seed_t seed);
+
     Sample1 sample1() override;
     Sample2 sample2() override;
     Sample3 sample3() override;
@@ -74,6 +103,13 @@ inline NativeSampler *NativeSampler::clone(int seed, Arena &arena) const
     return arena.create<NativeSampler >(new_seed, false);
 }
 
+inline void NativeSampler::set_seed(seed_t seed)
+{
+    seed_ = seed;
+    rng_ = rng_t(seed_);
+    dis_.reset();
+}
+
 inline Sample1 NativeSampler::sample1()
 {
     return { dis_(rng_) };
@@ -79,6 +79,23 @@ public:
      */
     virtual bool visible(const Vec3 &A, const Vec3 &B) const noexcept = 0;
 
+    /**
+     * @brief is there an intersection with given shadow ray towards a light source
+     *
+     * same as has_intersection(r). when the occluder cache is enabled, the
+     * primitive blocking the last shadow ray towards the same light in
+     * current thread is tested first
+     */
+    virtual bool occluded(const Ray &r, const Light *light) const noexcept = 0;
+
+    /**
+     * @brief is there no intersection between a point and a point on light source
+     *
+     * same as visible(A, B), with the occluder cache of occluded(r, light)
+     */
+    virtual bool visible(
+        const Vec3 &A, const Vec3 &B, const Light *light) const noexcept = 0;
+
     /**
      * @brief find closest intersection with given ray
      *
@@ -89,6 +106,23 @@ public:
     virtual bool closest_intersection(
         const Ray &r, EntityIntersection *inct) const noexcept = 0;
 
+    /**
+     * @brief test intersections of a batch of rays
+     *
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept = 0;
+
+    /**
+     * @brief find closest intersections of a batch of rays
+     *
+     * @param result result[i] is set to whether rays[i] has an intersection
+     */
+    virtual void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept = 0;
+
     virtual AABB world_bound() const noexcept = 0;;
 
     /**
@@ -4,9 +4,32 @@
 
 AGZ_TRACER_BEGIN
 
+/**
+ * @brief building parameters of entity bvh
+ */
+struct EntityBVHParams
+{
+    enum class BuildQuality
+    {
+        Fast,     // split sorted morton codes at the highest differing bit
+        Balanced, // binned sah
+        High      // binned sah, then tree rotations
+    };
+
+    BuildQuality build_quality = BuildQuality::Balanced;
+
+    int max_leaf_size = 5;
+};
+
 RC<Aggregate> create_entity_bvh(
-    int max_leaf_size);
+    const EntityBVHParams &params = {});
 
 RC<Aggregate> create_native_aggregate();
 
+#ifdef USE_EMBREE
+
+RC<Aggregate> create_embree_aggregate();
+
+#endif
+
 AGZ_TRACER_END
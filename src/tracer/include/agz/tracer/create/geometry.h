@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include <agz/tracer/core/geometry.h>
 #include <agz/utility/mesh.h>
 
@@ -19,7 +21,23 @@ RC<Geometry> create_quad(
 RC<Geometry> create_sphere(
     real radius, const Transform3 &local_to_world);
 
-RC<Geometry> create_transform_wrapper(
+/**
+ * @brief geometry wrapper whose transform can be changed in place
+ */
+class TransformWrapperGeometry : public Geometry
+{
+public:
+
+    /**
+     * @brief replace the local-to-world transform
+     *
+     * aggregates containing this geometry must be refitted after this.
+     * must not be called during rendering
+     */
+    virtual void set_transform(const Transform3 &local_to_world) = 0;
+};
+
+RC<TransformWrapperGeometry> create_transform_wrapper(
     RC<const Geometry> internal, const Transform3 &local_to_world);
 
 RC<Geometry> create_triangle(
@@ -39,8 +57,80 @@ RC<Geometry> create_triangle_bvh_embree(
 
 #endif
 
+/**
+ * @brief building parameters of native triangle bvh
+ */
+struct TriangleBVHParams
+{
+    enum class SplitMethod
+    {
+        Middle, // centroid middle point, then triangle count median
+        SAH     // binned surface area heuristic
+    };
+
+    enum class BuildQuality
+    {
+        Fast,     // linear bvh with parallel radix sort of morton codes
+        Balanced, // object splits with split_method
+        High      // object splits and spatial splits (sbvh) with binned sah
+    };
+
+    enum class Layout
+    {
+        Binary,     // binary bvh with scalar traversal
+        BVH4,       // 4-wide bvh with sse traversal
+        BVH8,       // 8-wide bvh with avx2 traversal
+        Compressed, // binary bvh with 8-bit quantized child bounds
+        Auto        // widest layout supported by current cpu
+    };
+
+    BuildQuality build_quality = BuildQuality::Balanced;
+
+    SplitMethod split_method = SplitMethod::Middle;
+
+    // unsupported wide layout falls back to a narrower one
+    Layout layout = Layout::Binary;
+
+    int max_leaf_size = 5;
+
+    // store shading normals, uvs and frames in half precision
+    bool half_attributes = false;
+
+    // used by binned sah only
+
+    int  sah_bin_count = 16;
+    real sah_leaf_cost = 1; // cost of testing a triangle relative to a node
+
+    // used by high build quality only.
+    // max count of extra triangle references relative to triangle count
+    real spatial_split_budget = real(0.3);
+
+    // restructure treelets of the built tree for lower sah cost.
+    // mostly useful with fast build quality
+    bool treelet_refinement = false;
+
+    // <= 0 means hardware thread count + build_worker_count
+    int build_worker_count = 0;
+};
+
 RC<Geometry> create_triangle_bvh_noembree(
     std::vector<mesh::triangle_t> build_triangles,
-    const Transform3 &local_to_world);
+    const Transform3 &local_to_world,
+    const TriangleBVHParams &params = {});
+
+/**
+ * @brief native triangle bvh with an on-disk cache
+ *
+ * if cache_filename is a valid cache file, the bvh is memory-mapped from it
+ * and load_triangles is never called. otherwise, the bvh is built from
+ * triangles returned by load_triangles and then saved to cache_filename.
+ *
+ * cache_filename must be unique for each (mesh content, local_to_world, params)
+ */
+RC<Geometry> create_cached_triangle_bvh_noembree(
+    const std::string &cache_filename,
+    const std::function<std::vector<mesh::triangle_t>()> &load_triangles,
+    const Transform3 &local_to_world,
+    const TriangleBVHParams &params = {});
 
 AGZ_TRACER_END
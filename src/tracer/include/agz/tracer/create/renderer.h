@@ -2,9 +2,26 @@
 
 #include <agz/tracer/core/renderer.h>
 #include <agz/tracer/core/sampler.h>
+#include <agz/tracer/create/sampler.h>
 
 AGZ_TRACER_BEGIN
 
+// adaptive sampling of per-pixel renderers
+
+struct AdaptiveSamplingParams
+{
+    bool enabled = false;
+
+    // samples per pixel of the initial uniform pass
+    int init_spp = 16;
+
+    // number of passes distributing the remaining samples
+    int pass_count = 8;
+
+    // pixels whose relative error is below this are not sampled any more
+    real error_threshold = real(0.01);
+};
+
 // path tracing
 
 struct PTRendererParams
@@ -21,11 +38,30 @@ struct PTRendererParams
     int spp = 1;
 
     int specular_depth = 20;
+
+    AdaptiveSamplingParams adaptive;
+
+    // not supported by wavefront path tracing
+    SamplerType sampler = SamplerType::Native;
 };
 
 RC<Renderer> create_pt_renderer(
     const PTRendererParams &params);
 
+// wavefront path tracing
+
+struct WavefrontPTRendererParams
+{
+    // same meaning as in pt
+    PTRendererParams pt;
+
+    // number of path states kept by each thread
+    int path_state_count = 4096;
+};
+
+RC<Renderer> create_wavefront_pt_renderer(
+    const WavefrontPTRendererParams &params);
+
 // particle tracing
 
 struct AdjointPTRendererParams
@@ -65,6 +101,10 @@ struct AORendererParams
     Spectrum background_color = Spectrum(0);
 
     int spp = 1;
+
+    AdaptiveSamplingParams adaptive;
+
+    SamplerType sampler = SamplerType::Native;
 };
 
 RC<Renderer> create_ao_renderer(const AORendererParams &params);
@@ -82,6 +122,8 @@ struct VolBDPTRendererParams
     int spp = 1;
 
     bool use_mis = true;
+
+    SamplerType sampler = SamplerType::Native;
 };
 
 RC<Renderer> create_vol_bdpt_renderer(const VolBDPTRendererParams &params);
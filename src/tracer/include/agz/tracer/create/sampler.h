@@ -0,0 +1,26 @@
+#pragma once
+
+#include <agz/tracer/core/sampler.h>
+
+AGZ_TRACER_BEGIN
+
+enum class SamplerType
+{
+    Native,  // independent random numbers
+    Counter, // counter-based random numbers keyed by pixel and sample index
+    Sobol,   // owen-scrambled sobol
+    Halton,  // halton with random digit permutation
+    PMJ02    // progressive multi-jittered (0, 2)
+};
+
+/**
+ * @brief create a sampler indexed by pixel, sample index and dimension
+ *
+ * values of the created sampler only depend on arguments of the latest
+ * start_pixel_sample call and the number of values drawn since then.
+ *
+ * returns nullptr for SamplerType::Native
+ */
+Sampler *create_pixel_sampler(SamplerType type, Arena &arena);
+
+AGZ_TRACER_END
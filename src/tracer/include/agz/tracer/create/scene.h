@@ -9,6 +9,9 @@ struct DefaultSceneParams
     std::vector<RC<Entity>> entities;
     RC<EnvirLight>          envir_light;
     RC<Aggregate>           aggregate;
+
+    // test the last occluder of each light first for shadow rays
+    bool occluder_cache = true;
 };
 
 RC<Scene> create_default_scene(const DefaultSceneParams &params);
@@ -2,6 +2,7 @@
 
 #include <agz/tracer/render/common.h>
 #include <agz/tracer/core/render_target.h>
+#include <agz/tracer/utility/splat_film.h>
 
 AGZ_TRACER_RENDER_BEGIN
 
@@ -26,4 +27,15 @@ void trace_vol_particle(
     FilmFilterApplier::FilmGridView<Spectrum> &film,
     Arena &arena);
 
+/**
+ * @brief trace_vol_particle splatting into a SplatFilm
+ *
+ * splats are staged in the splatter and must be flushed before the film is read
+ */
+void trace_vol_particle(
+    const ParticleTraceParams &params,
+    const Scene &scene, Sampler &sampler,
+    SplatFilm::Splatter &splatter,
+    Arena &arena);
+
 AGZ_TRACER_RENDER_END
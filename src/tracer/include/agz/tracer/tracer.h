@@ -31,6 +31,7 @@
 #include <agz/tracer/create/post_processor.h>
 #include <agz/tracer/create/renderer.h>
 #include <agz/tracer/create/renderer_interactor.h>
+#include <agz/tracer/create/sampler.h>
 #include <agz/tracer/create/scene.h>
 #include <agz/tracer/create/texture2d.h>
 #include <agz/tracer/create/texture3d.h>
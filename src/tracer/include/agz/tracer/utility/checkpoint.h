@@ -0,0 +1,164 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <agz/tracer/core/sampler.h>
+#include <agz/utility/misc.h>
+
+AGZ_TRACER_BEGIN
+
+class CheckpointException : public std::runtime_error
+{
+public:
+
+    using runtime_error::runtime_error;
+};
+
+/*
+ * checkpoint file:
+ *
+ *  magic, version
+ *  renderer tag
+ *  fields written by the renderer, in the order they are written
+ *
+ * fields are stored in native byte order. checkpoints are meant to be
+ * resumed by the same build on the same machine kind
+ */
+
+/**
+ * @brief binary writer of rendering checkpoints and partial render outputs
+ *
+ * the file is written to a temporary path first and renamed by commit,
+ * so that a crash during writing never destroys the previous checkpoint
+ */
+class CheckpointWriter : public misc::uncopyable_t
+{
+    std::string filename_;
+    std::string tmp_filename_;
+    std::ofstream fout_;
+
+    void write_bytes(const void *data, size_t bytes);
+
+public:
+
+    CheckpointWriter(const std::string &filename, const std::string &tag);
+
+    template<typename T>
+    void write(const T &value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write_bytes(&value, sizeof(T));
+    }
+
+    template<typename T>
+    void write_vector(const std::vector<T> &vec)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(uint64_t(vec.size()));
+        write_bytes(vec.data(), sizeof(T) * vec.size());
+    }
+
+    template<typename T>
+    void write_image(const Image2D<T> &image)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(int32_t(image.width()));
+        write(int32_t(image.height()));
+        write_bytes(image.raw_data(),
+                    sizeof(T) * image.width() * image.height());
+    }
+
+    void write_str(const std::string &str);
+
+    void write_sampler(NativeSampler &sampler);
+
+    void write_samplers(const std::vector<NativeSampler*> &samplers);
+
+    /**
+     * @brief finish writing and replace the old checkpoint
+     *
+     * @return false when the file cannot be written
+     */
+    bool commit();
+};
+
+/**
+ * @brief binary reader of rendering checkpoints and partial render outputs
+ *
+ * throws CheckpointException when the file is missing, truncated or
+ * written by another renderer
+ */
+class CheckpointReader : public misc::uncopyable_t
+{
+    std::string filename_;
+    std::ifstream fin_;
+
+    void read_bytes(void *data, size_t bytes);
+
+public:
+
+    CheckpointReader(const std::string &filename, const std::string &tag);
+
+    template<typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T ret;
+        read_bytes(&ret, sizeof(T));
+        return ret;
+    }
+
+    template<typename T>
+    std::vector<T> read_vector()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        std::vector<T> ret(static_cast<size_t>(read<uint64_t>()));
+        read_bytes(ret.data(), sizeof(T) * ret.size());
+        return ret;
+    }
+
+    /**
+     * @brief read an image with the same size as the given one
+     */
+    template<typename T>
+    void read_image(Image2D<T> &image)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const int32_t width  = read<int32_t>();
+        const int32_t height = read<int32_t>();
+        if(width != image.width() || height != image.height())
+        {
+            throw CheckpointException(
+                "unmatched image size in checkpoint: " + filename_);
+        }
+        read_bytes(image.raw_data(), sizeof(T) * width * height);
+    }
+
+    std::string read_str();
+
+    void read_sampler(NativeSampler &sampler);
+
+    /**
+     * @brief read states of per-thread samplers
+     *
+     * when the checkpoint contains more samplers than the given ones,
+     * new_sampler(index) is called to create the missing ones. they are
+     * kept and saved again even if not used, so that their random
+     * sequences are never restarted by later resumes
+     */
+    template<typename NewSampler>
+    void read_samplers(
+        std::vector<NativeSampler*> &samplers, NewSampler &&new_sampler)
+    {
+        const size_t count = static_cast<size_t>(read<uint64_t>());
+        while(samplers.size() < count)
+            samplers.push_back(new_sampler(static_cast<int>(samplers.size())));
+        for(size_t i = 0; i < count; ++i)
+            read_sampler(*samplers[i]);
+    }
+};
+
+AGZ_TRACER_END
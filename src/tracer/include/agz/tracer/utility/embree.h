@@ -2,9 +2,9 @@
 
 #ifdef USE_EMBREE
 
-#include <embree3/rtcore_device.h>
+#include <embree3/rtcore.h>
 
-#include <agz/tracer/common.h>
+#include <agz/tracer/core/intersection.h>
 
 AGZ_TRACER_BEGIN
 
@@ -14,6 +14,62 @@ void destroy_embree_device();
 
 RTCDevice embree_device();
 
+/**
+ * @brief throw ObjectConstructionException describing the last error of embree device
+ */
+[[noreturn]] void throw_embree_error();
+
+/**
+ * @brief geometry object which can be instanced in an embree scene
+ */
+class EmbreeGeometry
+{
+public:
+
+    virtual ~EmbreeGeometry() = default;
+
+    /**
+     * @brief committed embree scene representing this geometry
+     *
+     * @param scene embree scene in the local space
+     * @param local_to_world transform from the space of scene to the world space
+     *
+     * @return false when this geometry cannot be represented by an embree scene
+     */
+    virtual bool embree_scene(
+        RTCScene *scene, Transform3 *local_to_world) const noexcept = 0;
+
+    /**
+     * @brief fill intersection from a hit of the embree scene
+     *
+     * @param r ray in the world space
+     * @param t ray parameter of the hit
+     * @param hit hit record reported by embree
+     */
+    virtual void embree_intersection(
+        const Ray &r, real t, const RTCHit &hit,
+        GeometryIntersection *inct) const noexcept = 0;
+};
+
+/**
+ * @brief entity which can be instanced in an embree scene
+ *
+ * see EmbreeGeometry
+ */
+class EmbreeEntity
+{
+public:
+
+    virtual ~EmbreeEntity() = default;
+
+    virtual bool embree_scene(
+        RTCScene *scene, Transform3 *local_to_world) const noexcept = 0;
+
+    virtual void embree_intersection(
+        const Ray &r, real t, const RTCHit &hit,
+        EntityIntersection *inct) const noexcept = 0;
+};
+
 AGZ_TRACER_END
 
 #endif // #ifdef USE_EMBREE
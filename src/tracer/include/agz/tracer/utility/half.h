@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <agz/tracer/common.h>
+
+AGZ_TRACER_BEGIN
+
+/**
+ * @brief convert float to ieee 754 half precision (round to nearest even)
+ *
+ * values exceeding the half range become infinity
+ */
+inline uint16_t float_to_half(float f) noexcept
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t abs  = x & 0x7fffffff;
+
+    // inf or nan
+    if(abs >= 0x7f800000)
+        return static_cast<uint16_t>(sign | (abs > 0x7f800000 ? 0x7e00 : 0x7c00));
+
+    // not less than 65520, which is rounded to inf
+    if(abs >= 0x477ff000)
+        return static_cast<uint16_t>(sign | 0x7c00);
+
+    // subnormal half or zero
+    if(abs < 0x38800000)
+    {
+        if(abs < 0x33000000)
+            return static_cast<uint16_t>(sign);
+
+        const uint32_t mant  = (abs & 0x7fffff) | 0x800000;
+        const uint32_t shift = 126 - (abs >> 23);
+        uint32_t h = mant >> shift;
+
+        const uint32_t rem     = mant & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if(rem > halfway || (rem == halfway && (h & 1)))
+            ++h;
+
+        return static_cast<uint16_t>(sign | h);
+    }
+
+    // rebias exponent. a carry from rounding goes into the exponent correctly
+    uint32_t h = (abs - 0x38000000) >> 13;
+    const uint32_t rem = abs & 0x1fff;
+    if(rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        ++h;
+
+    return static_cast<uint16_t>(sign | h);
+}
+
+/**
+ * @brief convert ieee 754 half precision to float
+ */
+inline float half_to_float(uint16_t h) noexcept
+{
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp  = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+
+    uint32_t x;
+    if(!exp)
+    {
+        if(!mant)
+            x = sign;
+        else
+        {
+            // normalize subnormal half
+            exp = 127 - 15 + 1;
+            while(!(mant & 0x400))
+            {
+                mant <<= 1;
+                --exp;
+            }
+            x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    }
+    else if(exp == 0x1f)
+        x = sign | 0x7f800000 | (mant << 13);
+    else
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+
+    float ret;
+    std::memcpy(&ret, &x, sizeof(ret));
+    return ret;
+}
+
+AGZ_TRACER_END
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+#include <agz/tracer/common.h>
+#include <agz/utility/misc.h>
+
+AGZ_TRACER_BEGIN
+
+/**
+ * @brief read-only memory-mapped file
+ */
+class MappedFile : public misc::uncopyable_t
+{
+    const void *data_ = nullptr;
+    size_t size_ = 0;
+
+#ifdef _WIN32
+    void *file_handle_    = nullptr;
+    void *mapping_handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+
+public:
+
+    MappedFile() = default;
+
+    ~MappedFile();
+
+    /**
+     * @brief map the whole file into memory
+     *
+     * @return false when the file cannot be opened or mapped
+     */
+    bool open(const std::string &filename);
+
+    void close() noexcept;
+
+    bool is_open() const noexcept;
+
+    const void *data() const noexcept;
+
+    size_t size() const noexcept;
+};
+
+AGZ_TRACER_END
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <agz/tracer/common.h>
+
+AGZ_TRACER_BEGIN
+
+/**
+ * @brief number of leading zero bits. x must be non-zero
+ */
+inline int count_leading_zeros(uint64_t x) noexcept
+{
+    assert(x);
+#ifdef _MSC_VER
+    unsigned long ret;
+    _BitScanReverse64(&ret, x);
+    return 63 - static_cast<int>(ret);
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+/**
+ * @brief insert two zero bits before each of the lowest 21 bits
+ */
+inline uint64_t expand_morton_bits(uint64_t v) noexcept
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+/**
+ * @brief 63-bit morton code of a point
+ *
+ * @param p point normalized to [0, 1]^3. values outside are clamped
+ */
+inline uint64_t morton_code(const Vec3 &p) noexcept
+{
+    constexpr real scale = real(1 << 21);
+
+    auto quantize = [=](real x)
+    {
+        return static_cast<uint64_t>(
+            (std::min)((std::max)(x * scale, real(0)), scale - 1));
+    };
+
+    return expand_morton_bits(quantize(p.x)) << 2 |
+           expand_morton_bits(quantize(p.y)) << 1 |
+           expand_morton_bits(quantize(p.z));
+}
+
+/**
+ * @brief map a point in bound to [0, 1]^3 for computing its morton code
+ *
+ * degenerated axes are mapped to 0
+ */
+inline Vec3 normalize_to_morton_space(const Vec3 &p, const AABB &bound) noexcept
+{
+    Vec3 ret;
+    for(int i = 0; i < 3; ++i)
+    {
+        const real extent = bound.high[i] - bound.low[i];
+        ret[i] = extent > 0 ? (p[i] - bound.low[i]) / extent : real(0);
+    }
+    return ret;
+}
+
+AGZ_TRACER_END
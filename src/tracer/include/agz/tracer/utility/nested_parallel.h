@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include <agz/tracer/common.h>
+#include <agz/utility/misc.h>
+#include <agz/utility/thread.h>
+
+AGZ_TRACER_BEGIN
+
+/*
+ * nested parallelism
+ *
+ * parallel work like bvh building may be started by workers of another
+ * parallel loop, e.g. parallel scene loading. workers of the outer loop
+ * mark themselves with OuterWorkerScope, and parallel work started by them
+ * only uses the hardware threads not occupied by other outer workers.
+ * so all levels together use about the hardware thread count instead of
+ * its square
+ */
+
+namespace nested_parallel_detail
+{
+    // number of threads currently in OuterWorkerScope
+    inline std::atomic<int> busy_outer_worker_count = 0;
+
+    inline thread_local bool is_outer_worker = false;
+
+} // namespace nested_parallel_detail
+
+/**
+ * @brief mark the calling thread as a worker of an outer parallel loop
+ *  in the lifetime of this object
+ */
+class OuterWorkerScope : public misc::uncopyable_t
+{
+    bool old_is_outer_worker_;
+
+public:
+
+    OuterWorkerScope() noexcept
+        : old_is_outer_worker_(nested_parallel_detail::is_outer_worker)
+    {
+        if(!old_is_outer_worker_)
+            ++nested_parallel_detail::busy_outer_worker_count;
+        nested_parallel_detail::is_outer_worker = true;
+    }
+
+    ~OuterWorkerScope()
+    {
+        nested_parallel_detail::is_outer_worker = old_is_outer_worker_;
+        if(!old_is_outer_worker_)
+            --nested_parallel_detail::busy_outer_worker_count;
+    }
+};
+
+/**
+ * @brief actual worker count of parallel work started by the calling thread
+ *
+ * same as thread::actual_worker_count, except that in an OuterWorkerScope
+ * the result is clamped to the hardware threads left over by other busy
+ * outer workers
+ */
+inline int nested_worker_count(int worker_count) noexcept
+{
+    const int ret = thread::actual_worker_count(worker_count);
+    if(!nested_parallel_detail::is_outer_worker)
+        return ret;
+
+    const int hw_count = static_cast<int>(
+        (std::max)(std::thread::hardware_concurrency(), 1u));
+    const int others =
+        nested_parallel_detail::busy_outer_worker_count.load() - 1;
+    return (std::max)(1, (std::min)(ret, hw_count - others));
+}
+
+AGZ_TRACER_END
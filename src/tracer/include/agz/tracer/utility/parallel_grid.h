@@ -1,52 +1,407 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <vector>
+
 #include <agz/tracer/common.h>
+#include <agz/tracer/utility/thread_affinity.h>
 #include <agz/utility/thread.h>
 
 AGZ_TRACER_BEGIN
 
+namespace parallel_grid_detail
+{
+
+    /**
+     * @brief convert distance along the hilbert curve filling a n * n grid
+     *        to the grid coordinate. n must be a power of 2
+     */
+    inline Vec2i hilbert_curve_point(int n, int64_t d) noexcept
+    {
+        int x = 0, y = 0;
+        for(int s = 1; s < n; s *= 2)
+        {
+            const int rx = static_cast<int>(1 & (d / 2));
+            const int ry = static_cast<int>(1 & (d ^ rx));
+            if(ry == 0)
+            {
+                if(rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+            d /= 4;
+        }
+        return { x, y };
+    }
+
+    /**
+     * @brief exec func on tasks parallelly with work stealing
+     *
+     * thread i starts from tasks [bounds[i], bounds[i + 1]). a thread running
+     * out of tasks steals the second half of the largest remaining range,
+     * so that neighboring tasks are mostly executed by the same thread and
+     * no thread idles while another one has more than one task left
+     *
+     * with pin_workers, each worker is pinned during the call.
+     * see WorkerPinningScope
+     *
+     * func interface: bool func(int thread_index, int task_index)
+     */
+    template<typename Func>
+    void parallel_for_stealing(
+        const std::vector<int> &bounds,
+        thread::thread_group_t &threads, bool pin_workers, Func &&func)
+    {
+        const int thread_count = static_cast<int>(bounds.size()) - 1;
+        if(thread_count <= 0)
+            return;
+
+        // [beg, end) packed as end << 32 | beg. a task index is never
+        // reused, so stale values can't be mistaken for current ones
+
+        auto pack = [](int beg, int end)
+        {
+            return (uint64_t(uint32_t(end)) << 32) | uint32_t(beg);
+        };
+        auto beg_of = [](uint64_t r) { return static_cast<int>(uint32_t(r)); };
+        auto end_of = [](uint64_t r) { return static_cast<int>(r >> 32); };
+
+        struct alignas(64) TaskRange
+        {
+            std::atomic<uint64_t> range;
+        };
+
+        std::vector<TaskRange> ranges(thread_count);
+        for(int i = 0; i < thread_count; ++i)
+            ranges[i].range = pack(bounds[i], bounds[i + 1]);
+
+        auto pop = [&](int thread_index, int &task)
+        {
+            auto &range = ranges[thread_index].range;
+            uint64_t r = range.load();
+            for(;;)
+            {
+                const int beg = beg_of(r), end = end_of(r);
+                if(beg >= end)
+                    return false;
+                if(range.compare_exchange_weak(r, pack(beg + 1, end)))
+                {
+                    task = beg;
+                    return true;
+                }
+            }
+        };
+
+        auto steal = [&](int thread_index, int &task)
+        {
+            for(;;)
+            {
+                int victim = -1, max_remain = 0;
+                uint64_t victim_range = 0;
+                for(int i = 0; i < thread_count; ++i)
+                {
+                    const uint64_t r = ranges[i].range.load();
+                    const int remain = end_of(r) - beg_of(r);
+                    if(remain > max_remain)
+                    {
+                        victim       = i;
+                        max_remain   = remain;
+                        victim_range = r;
+                    }
+                }
+
+                if(victim < 0)
+                    return false;
+
+                const int beg = beg_of(victim_range);
+                const int end = end_of(victim_range);
+                const int mid = end - (end - beg + 1) / 2;
+
+                if(!ranges[victim].range.compare_exchange_strong(
+                    victim_range, pack(beg, mid)))
+                    continue;
+
+                task = mid;
+                ranges[thread_index].range = pack(mid + 1, end);
+                return true;
+            }
+        };
+
+        auto worker_func = [&](int thread_index)
+        {
+            WorkerPinningScope pinning(pin_workers, thread_index);
+
+            int task;
+            while(pop(thread_index, task) || steal(thread_index, task))
+            {
+                if constexpr(
+                    std::is_convertible_v<
+                    decltype(func(thread_index, task)), bool>)
+                {
+                    if(!func(thread_index, task))
+                        return;
+                }
+                else
+                    func(thread_index, task);
+            }
+        };
+
+        threads.run(thread_count, worker_func);
+    }
+
+    /**
+     * @brief split [0, task_count) into thread_count contiguous ranges
+     */
+    inline std::vector<int> even_bounds(int thread_count, int task_count)
+    {
+        thread_count = (std::max)(1, (std::min)(thread_count, task_count));
+        std::vector<int> bounds(thread_count + 1);
+        for(int i = 0; i <= thread_count; ++i)
+            bounds[i] = static_cast<int>(int64_t(task_count) * i / thread_count);
+        return bounds;
+    }
+
+} // namespace parallel_grid_detail
+
 /**
  * @brief divide [0, total_width) to equal-sized ranges
  *  and exec func on them parallelly
  *
  * func interface: bool func(int thread_index, int beg, int end)
  *
+ * workers are pinned to cpus during the call if pin_workers is true.
+ * renderers pass their pin_threads setting for rendering passes
+ *
  * if any one func call returns false, that worker thread is stopped immediately
  */
 template<typename Func>
 void parallel_for_1d_grid(
     int thread_count, int total_width, int grid_size,
-    thread::thread_group_t &threads, Func &&func)
+    thread::thread_group_t &threads, bool pin_workers, Func &&func)
 {
     const int task_count = (total_width + grid_size - 1) / grid_size;
+    if(task_count <= 0)
+        return;
 
-    std::atomic<int> next_task = 0;
+    parallel_grid_detail::parallel_for_stealing(
+        parallel_grid_detail::even_bounds(thread_count, task_count),
+        threads, pin_workers,
+        [&](int thread_index, int task_idx)
+    {
+        const int beg = task_idx * grid_size;
+        const int end = (std::min)(beg + grid_size, total_width);
+
+        if constexpr(
+            std::is_convertible_v<
+            decltype(func(thread_index, beg, end)), bool>)
+            return static_cast<bool>(func(thread_index, beg, end));
+        else
+        {
+            func(thread_index, beg, end);
+            return true;
+        }
+    });
+}
 
-    auto worker_func = [&](int thread_index)
+/**
+ * @brief measured cost of the grids of a parallel_for_2d_grid pass
+ *
+ * progressive renderers run many passes over the same grids. given the
+ * history of the last pass, the next one assigns grids to threads by their
+ * measured time instead of their count, and splits expensive grids
+ */
+struct GridCostHistory
+{
+    // grid layout the costs are measured with
+    int width       = 0;
+    int height      = 0;
+    int grid_size_x = 0;
+    int grid_size_y = 0;
+
+    // seconds spent on each grid, in hilbert curve order. empty if unknown
+    std::vector<double> costs;
+};
+
+namespace parallel_grid_detail
+{
+
+    template<typename Func>
+    void parallel_for_2d_grid_impl(
+        int thread_count, int width, int height,
+        int grid_size_x, int grid_size_y,
+        thread::thread_group_t &threads, GridCostHistory *history,
+        bool pin_workers, Func &func)
     {
-        for(;;)
+        const int x_task_count = (width  + grid_size_x - 1) / grid_size_x;
+        const int y_task_count = (height + grid_size_y - 1) / grid_size_y;
+        const int total_task_count = x_task_count * y_task_count;
+        if(total_task_count <= 0)
+            return;
+
+        // grids along the hilbert curve
+
+        std::vector<Rect2i> grids;
+        grids.reserve(total_task_count);
+        {
+            int n = 1;
+            while(n < (std::max)(x_task_count, y_task_count))
+                n *= 2;
+
+            const int64_t curve_length = int64_t(n) * n;
+            for(int64_t d = 0; d < curve_length; ++d)
+            {
+                const Vec2i idx = hilbert_curve_point(n, d);
+                if(idx.x >= x_task_count || idx.y >= y_task_count)
+                    continue;
+
+                const int x_beg = idx.x * grid_size_x;
+                const int y_beg = idx.y * grid_size_y;
+                const int x_end = (std::min)(width,  x_beg + grid_size_x);
+                const int y_end = (std::min)(height, y_beg + grid_size_y);
+
+                grids.push_back({ { x_beg, y_beg }, { x_end, y_end } });
+            }
+        }
+
+        // costs measured in the last pass with the same grids
+
+        const double *costs = nullptr;
+        double total_cost = 0;
+        if(history &&
+           history->width == width && history->height == height &&
+           history->grid_size_x == grid_size_x &&
+           history->grid_size_y == grid_size_y &&
+           history->costs.size() == grids.size())
         {
-            const int task_idx = next_task++;
-            if(task_idx >= task_count)
-                return;
+            for(double c : history->costs)
+                total_cost += c;
+            if(total_cost > 0)
+                costs = history->costs.data();
+        }
 
-            const int beg = task_idx * grid_size;
-            const int end = (std::min)(beg + grid_size, total_width);
+        // contiguous grids of each thread. with costs, each part takes
+        // about the same time instead of having the same grid count
+
+        std::vector<int> bounds;
+        if(costs)
+        {
+            thread_count = (std::max)(
+                1, (std::min)(thread_count, total_task_count));
 
+            bounds.push_back(0);
+            double prefix_cost = 0;
+            int j = 0;
+            for(int i = 1; i < thread_count; ++i)
+            {
+                const double target = total_cost * i / thread_count;
+                while(j < total_task_count && prefix_cost < target)
+                    prefix_cost += costs[j++];
+                bounds.push_back(j);
+            }
+            bounds.push_back(total_task_count);
+        }
+        else
+            bounds = even_bounds(thread_count, total_task_count);
+
+        // split tail grids of each thread and grids costing more than
+        // twice the average
+
+        constexpr int MIN_SPLIT_SIZE = 8;
+
+        const double split_cost = 2 * total_cost / total_task_count;
+
+        std::vector<Rect2i> tasks;
+        std::vector<int> task_grids;
+        std::vector<int> task_bounds = { 0 };
+        tasks.reserve(2 * grids.size());
+        task_grids.reserve(2 * grids.size());
+
+        for(size_t i = 0; i + 1 < bounds.size(); ++i)
+        {
+            const int beg = bounds[i], end = bounds[i + 1];
+            const int split_beg = beg + (end - beg) * 3 / 4;
+
+            for(int j = beg; j < end; ++j)
+            {
+                const Rect2i &grid = grids[j];
+                const Vec2i size = grid.high - grid.low;
+
+                const bool split = j >= split_beg ||
+                                   (costs && costs[j] > split_cost);
+                const bool split_x = split && size.x >= 2 * MIN_SPLIT_SIZE;
+                const bool split_y = split && size.y >= 2 * MIN_SPLIT_SIZE;
+
+                const int mid_x = split_x ? grid.low.x + size.x / 2 : grid.high.x;
+                const int mid_y = split_y ? grid.low.y + size.y / 2 : grid.high.y;
+
+                tasks.push_back({ grid.low, { mid_x, mid_y } });
+                if(split_x)
+                    tasks.push_back({ { mid_x, grid.low.y }, { grid.high.x, mid_y } });
+                if(split_y)
+                    tasks.push_back({ { grid.low.x, mid_y }, { mid_x, grid.high.y } });
+                if(split_x && split_y)
+                    tasks.push_back({ { mid_x, mid_y }, grid.high });
+
+                task_grids.resize(tasks.size(), j);
+            }
+
+            task_bounds.push_back(static_cast<int>(tasks.size()));
+        }
+
+        // each task is timed only by the thread executing it
+
+        std::vector<double> task_seconds(history ? tasks.size() : 0, 0.0);
+        std::atomic<bool> stopped = false;
+
+        parallel_for_stealing(
+            task_bounds, threads, pin_workers,
+            [&](int thread_index, int task_idx)
+        {
+            const Rect2i &grid = tasks[task_idx];
+
+            using clock_t = std::chrono::steady_clock;
+            const auto start_time = history ? clock_t::now() : clock_t::time_point();
+
+            bool ret = true;
             if constexpr(
                 std::is_convertible_v<
-                decltype(func(thread_index, beg, end)), bool>)
+                decltype(func(thread_index, grid)), bool>)
+                ret = static_cast<bool>(func(thread_index, grid));
+            else
+                func(thread_index, grid);
+
+            if(history)
             {
-                if(!func(thread_index, beg, end))
-                    return;
+                task_seconds[task_idx] = std::chrono::duration<double>(
+                    clock_t::now() - start_time).count();
             }
-            else
-                func(thread_index, beg, end);
-        }
-    };
 
-    threads.run(thread_count, worker_func);
-}
+            if(!ret)
+                stopped = true;
+            return ret;
+        });
+
+        // an interrupted pass leaves the history unchanged
+
+        if(!history || stopped)
+            return;
+
+        history->width       = width;
+        history->height      = height;
+        history->grid_size_x = grid_size_x;
+        history->grid_size_y = grid_size_y;
+        history->costs.assign(grids.size(), 0.0);
+        for(size_t t = 0; t < tasks.size(); ++t)
+            history->costs[task_grids[t]] += task_seconds[t];
+    }
+
+} // namespace parallel_grid_detail
 
 /**
  * @brief divide [0, width) * [0, height) to equal-sized grids
@@ -54,51 +409,72 @@ void parallel_for_1d_grid(
  *
  * func interface: bool func(int thread_index, Rect2i grid)
  *
+ * grids are ordered along a hilbert curve and each thread starts from a
+ * contiguous part of them, which keeps the scene data touched by a thread
+ * coherent. the last quarter of grids in each part are split into smaller
+ * ones, so that the pass ends with small grids and threads don't idle
+ * while the last large grids are being rendered
+ *
+ * workers are pinned to cpus during the call if pin_workers is true.
+ * renderers pass their pin_threads setting for rendering passes
+ *
  * if any one func call returns false, that worker thread is stopped immediately
  */
 template<typename Func>
 void parallel_for_2d_grid(
     int thread_count, int width, int height,
     int grid_size_x, int grid_size_y,
-    thread::thread_group_t &threads, Func &&func)
+    thread::thread_group_t &threads, bool pin_workers, Func &&func)
 {
-    const int x_task_count = (width  + grid_size_x - 1) / grid_size_x;
-    const int y_task_count = (height + grid_size_y - 1) / grid_size_y;
-    const int total_task_count = x_task_count * y_task_count;
-
-    std::atomic<int> next_task = 0;
-
-    auto worker_func = [&](int thread_index)
-    {
-        for(;;)
-        {
-            const int task_idx = next_task++;
-            if(task_idx >= total_task_count)
-                return;
-
-            const int y_idx = task_idx / x_task_count;
-            const int x_idx = task_idx % x_task_count;
-
-            const int x_beg = x_idx * grid_size_x;
-            const int y_beg = y_idx * grid_size_y;
-            const int x_end = (std::min)(width,  x_beg + grid_size_x);
-            const int y_end = (std::min)(height, y_beg + grid_size_y);
+    parallel_grid_detail::parallel_for_2d_grid_impl(
+        thread_count, width, height, grid_size_x, grid_size_y,
+        threads, nullptr, pin_workers, func);
+}
 
-            const Rect2i grid = { { x_beg, y_beg }, { x_end, y_end } };
+/**
+ * @brief parallel_for_2d_grid balanced by the grid costs of the last pass
+ *
+ * threads are assigned parts of equal measured cost, and grids costing more
+ * than twice the average are split. the costs measured in this pass are
+ * written back to history unless the pass is stopped by func
+ */
+template<typename Func>
+void parallel_for_2d_grid(
+    int thread_count, int width, int height,
+    int grid_size_x, int grid_size_y,
+    thread::thread_group_t &threads, GridCostHistory &history,
+    bool pin_workers, Func &&func)
+{
+    parallel_grid_detail::parallel_for_2d_grid_impl(
+        thread_count, width, height, grid_size_x, grid_size_y,
+        threads, &history, pin_workers, func);
+}
 
-            if constexpr(
-                std::is_convertible_v<
-                decltype(func(thread_index, grid)), bool>)
-            {
-                if(!func(thread_index, grid))
-                    return;
-            }
-            else
-                func(thread_index, grid);
-        }
-    };
+/**
+ * @brief parallal_for_1d_grid without worker pinning
+ */
+template<typename Func>
+void parallel_for_1d_grid(
+    int thread_count, int total_width, int grid_size,
+    thread::thread_group_t &threads, Func &&func)
+{
+    parallel_for_1d_grid(
+        thread_count, total_width, grid_size,
+        threads, false, std::forward<Func>(func));
+}
 
-    threads.run(thread_count, worker_func);
+/**
+ * @brief parallal_for_2d_grid without worker pinning
+ */
+template<typename Func>
+void parallel_for_2d_grid(
+    int thread_count, int width, int height,
+    int grid_size_x, int grid_size_y,
+    thread::thread_group_t &threads, Func &&func)
+{
+    parallel_for_2d_grid(
+        thread_count, width, height, grid_size_x, grid_size_y,
+        threads, false, std::forward<Func>(func));
 }
 
 /**
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <agz/tracer/core/render_target.h>
+
+AGZ_TRACER_BEGIN
+
+/**
+ * @brief write unnormalized buffers of a partial rendering to a binary file
+ *
+ * throws CheckpointException when the file cannot be written
+ */
+void save_partial_render_target(
+    const std::string &filename, const PartialRenderTarget &target);
+
+/**
+ * @brief read a file written by save_partial_render_target
+ *
+ * throws CheckpointException when the file is invalid
+ */
+PartialRenderTarget load_partial_render_target(const std::string &filename);
+
+/**
+ * @brief sum buffers of parts of the same film and normalize them
+ *
+ * throws std::runtime_error when the parts have different resolutions
+ */
+RenderTarget merge_partial_render_targets(
+    const std::vector<PartialRenderTarget> &parts);
+
+AGZ_TRACER_END
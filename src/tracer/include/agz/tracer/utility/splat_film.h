@@ -0,0 +1,120 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <agz/tracer/core/render_target.h>
+#include <agz/utility/misc.h>
+
+AGZ_TRACER_BEGIN
+
+/**
+ * @brief film accumulating splats of light tracing paths
+ *
+ * light subpaths connected to the camera (t = 1) land at arbitrary pixels,
+ * so their splats cannot be confined to a task-owned film grid. instead of
+ * atomic adds on a shared image, splats are:
+ *
+ *  1. staged in a per-thread buffer (Splatter)
+ *  2. flushed in bulk into a full-res shard owned by that thread
+ *  3. summed over all shards when the image is read
+ *
+ * each thread has its own shard unless that exceeds the memory budget, in
+ * which case threads share shards round-robin. a shard is locked only by
+ * flushes and reads, and is allocated by the first flush into it, so that
+ * it is first touched on the numa node of its (pinned) worker
+ */
+class SplatFilm : public misc::uncopyable_t
+{
+public:
+
+    class Splatter;
+
+    SplatFilm(const FilmFilterApplier &filter, int thread_count);
+
+    ~SplatFilm();
+
+    /**
+     * @brief staging buffer of the given thread
+     *
+     * a splatter must be used by only one thread at a time
+     */
+    Splatter &splatter(int thread_index) noexcept;
+
+    /**
+     * @brief accumulate an image into the film
+     */
+    void add_image(const Image2D<Spectrum> &image);
+
+    /**
+     * @brief scale * sum of all shards
+     *
+     * splats still staged in splatters are not included. thread-safe
+     */
+    Image2D<Spectrum> get_image(real scale = 1) const;
+
+    int width() const noexcept;
+
+    int height() const noexcept;
+
+private:
+
+    struct alignas(64) Shard
+    {
+        mutable std::mutex mutex;
+        Image2D<Spectrum> image;
+    };
+
+    FilmFilterApplier filter_;
+    int thread_count_;
+
+    std::vector<Shard> shards_;
+    std::vector<Box<Splatter>> splatters_;
+};
+
+/**
+ * @brief per-thread staging buffer of a splat film
+ */
+class alignas(64) SplatFilm::Splatter : public misc::uncopyable_t
+{
+public:
+
+    Splatter(SplatFilm *film, Shard *shard);
+
+    /**
+     * @brief splat a value at given pixel coordinate with the film filter
+     */
+    void splat(const Vec2 &pixel_coord, const Spectrum &value);
+
+    /**
+     * @brief write all staged splats into the shard
+     *
+     * must be called before the film is read, e.g. at the end of each task
+     */
+    void flush();
+
+private:
+
+    static constexpr size_t STAGE_CAPACITY = 4096;
+
+    struct Splat
+    {
+        Vec2 pixel_coord;
+        Spectrum value;
+    };
+
+    SplatFilm *film_;
+    Shard     *shard_;
+
+    std::vector<Splat> staged_;
+};
+
+inline void SplatFilm::Splatter::splat(
+    const Vec2 &pixel_coord, const Spectrum &value)
+{
+    staged_.push_back({ pixel_coord, value });
+    if(staged_.size() >= STAGE_CAPACITY)
+        flush();
+}
+
+AGZ_TRACER_END
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include <agz/tracer/common.h>
+#include <agz/utility/misc.h>
+
+AGZ_TRACER_BEGIN
+
+/*
+ * worker pinning
+ *
+ * renderers with pin_threads pass pin_workers to their parallel_for_*_grid
+ * passes. in such a pass, the i-th worker thread is pinned to the i-th cpu
+ * of the process affinity mask and restored when the pass ends, so other
+ * parallel work and reused pool threads are not affected. cpus are ordered
+ * so that consecutive workers are spread over numa nodes and physical cores
+ * are used before their hyperthread siblings. memory first touched by a
+ * pinned worker (arenas, film grids, ...) is then allocated on its own node.
+ *
+ * only supported on linux. elsewhere pinning is silently ignored
+ */
+
+/**
+ * @brief pin the calling thread as the given worker in the lifetime of
+ *  this object
+ *
+ * the original affinity mask of the thread is restored on destruction.
+ * does nothing when enabled is false
+ */
+class WorkerPinningScope : public misc::uncopyable_t
+{
+    // cpus the thread was allowed to run on. empty if not pinned
+    std::vector<int> old_cpus_;
+
+public:
+
+    WorkerPinningScope(bool enabled, int worker_index);
+
+    ~WorkerPinningScope();
+};
+
+AGZ_TRACER_END
@@ -0,0 +1,414 @@
+#ifdef USE_EMBREE
+
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <embree3/rtcore.h>
+#include <embree3/rtcore_ray.h>
+
+#include <agz/tracer/core/aggregate.h>
+#include <agz/tracer/core/entity.h>
+#include <agz/tracer/utility/embree.h>
+#include <agz/utility/misc.h>
+
+AGZ_TRACER_BEGIN
+
+namespace
+{
+
+    /**
+     * @brief intersect context passed to callbacks of user geometries
+     *
+     * must begin with RTCIntersectContext so that embree can use it directly
+     */
+    struct IntersectContext
+    {
+        RTCIntersectContext context;
+
+        // closest intersections with user geometries, indexed by ray id
+        EntityIntersection *user_incts = nullptr;
+    };
+
+    RTCRay to_embree_ray(const Ray &r, unsigned id) noexcept
+    {
+        return {
+            r.o.x, r.o.y, r.o.z,
+            r.t_min,
+            r.d.x, r.d.y, r.d.z,
+            0,
+            r.t_max,
+            static_cast<unsigned>(-1), id, 0
+        };
+    }
+
+    void init_embree_hit(RTCHit &hit) noexcept
+    {
+        hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+        hit.geomID    = RTC_INVALID_GEOMETRY_ID;
+        hit.primID    = RTC_INVALID_GEOMETRY_ID;
+    }
+
+    Ray from_embree_ray(RTCRayN *rays, unsigned N, unsigned i) noexcept
+    {
+        return Ray(
+            Vec3(RTCRayN_org_x(rays, N, i),
+                 RTCRayN_org_y(rays, N, i),
+                 RTCRayN_org_z(rays, N, i)),
+            Vec3(RTCRayN_dir_x(rays, N, i),
+                 RTCRayN_dir_y(rays, N, i),
+                 RTCRayN_dir_z(rays, N, i)),
+            RTCRayN_tnear(rays, N, i),
+            RTCRayN_tfar(rays, N, i));
+    }
+
+    // entities not representable by embree scenes are wrapped as user geometries,
+    // each of which contains exactly one primitive
+
+    void user_geometry_bounds(const RTCBoundsFunctionArguments *args)
+    {
+        auto entity = static_cast<const Entity*>(args->geometryUserPtr);
+        const AABB bound = entity->world_bound();
+
+        RTCBounds *output = args->bounds_o;
+        output->lower_x = bound.low.x;
+        output->lower_y = bound.low.y;
+        output->lower_z = bound.low.z;
+        output->upper_x = bound.high.x;
+        output->upper_y = bound.high.y;
+        output->upper_z = bound.high.z;
+    }
+
+    void user_geometry_intersect(const RTCIntersectFunctionNArguments *args)
+    {
+        auto entity = static_cast<const Entity*>(args->geometryUserPtr);
+        auto context = reinterpret_cast<IntersectContext*>(args->context);
+
+        const unsigned N = args->N;
+        RTCRayN *rays = RTCRayHitN_RayN(args->rayhit, N);
+        RTCHitN *hits = RTCRayHitN_HitN(args->rayhit, N);
+
+        for(unsigned i = 0; i < N; ++i)
+        {
+            if(args->valid[i] != -1)
+                continue;
+
+            const Ray r = from_embree_ray(rays, N, i);
+            EntityIntersection &inct = context->user_incts[RTCRayN_id(rays, N, i)];
+            if(!entity->closest_intersection(r, &inct))
+                continue;
+
+            RTCRayN_tfar(rays, N, i) = inct.t;
+
+            RTCHit hit;
+            hit.Ng_x      = inct.geometry_coord.z.x;
+            hit.Ng_y      = inct.geometry_coord.z.y;
+            hit.Ng_z      = inct.geometry_coord.z.z;
+            hit.u         = 0;
+            hit.v         = 0;
+            hit.primID    = args->primID;
+            hit.geomID    = args->geomID;
+            hit.instID[0] = args->context->instID[0];
+            rtcCopyHitToHitN(hits, &hit, N, i);
+        }
+    }
+
+    void user_geometry_occluded(const RTCOccludedFunctionNArguments *args)
+    {
+        auto entity = static_cast<const Entity*>(args->geometryUserPtr);
+
+        const unsigned N = args->N;
+        for(unsigned i = 0; i < N; ++i)
+        {
+            if(args->valid[i] != -1)
+                continue;
+
+            if(entity->has_intersection(from_embree_ray(args->ray, N, i)))
+                RTCRayN_tfar(args->ray, N, i) = -std::numeric_limits<float>::infinity();
+        }
+    }
+
+} // namespace anonymous
+
+/**
+ * @brief a single embree scene containing all entities
+ *
+ * entities whose geometries are backed by embree scenes (e.g. triangle_bvh_embree
+ * and its instances) are attached as embree instances, so that rays never leave
+ * embree for them. other entities are attached as user geometries.
+ */
+class EmbreeAggregate : public Aggregate, public misc::uncopyable_t
+{
+    struct Record
+    {
+        RC<const Entity> entity;
+
+        // non-null when the entity is attached as an instance
+        const EmbreeEntity *instance = nullptr;
+    };
+
+    RTCScene scene_ = nullptr;
+
+    // embree geometry id -> record. ids of detached geometries are reused by embree
+    std::vector<Record> records_;
+    std::unordered_map<const Entity*, unsigned> entity2id_;
+
+    static void set_instance_transform(
+        RTCGeometry geometry, const Transform3 &local_to_world) noexcept
+    {
+        const Vec3 o  = local_to_world.apply_to_point({ 0, 0, 0 });
+        const Vec3 ex = local_to_world.apply_to_vector({ 1, 0, 0 });
+        const Vec3 ey = local_to_world.apply_to_vector({ 0, 1, 0 });
+        const Vec3 ez = local_to_world.apply_to_vector({ 0, 0, 1 });
+
+        const float xfm[12] = {
+            ex.x, ex.y, ex.z,
+            ey.x, ey.y, ey.z,
+            ez.x, ez.y, ez.z,
+            o.x,  o.y,  o.z
+        };
+        rtcSetGeometryTransform(
+            geometry, 0, RTC_FORMAT_FLOAT3X4_COLUMN_MAJOR, xfm);
+    }
+
+    void attach(RC<const Entity> entity)
+    {
+        RTCDevice device = embree_device();
+
+        RTCScene instanced_scene = nullptr;
+        Transform3 local_to_world;
+
+        auto instance = dynamic_cast<const EmbreeEntity*>(entity.get());
+        if(instance && !instance->embree_scene(&instanced_scene, &local_to_world))
+            instance = nullptr;
+
+        RTCGeometry geometry = rtcNewGeometry(
+            device, instance ? RTC_GEOMETRY_TYPE_INSTANCE : RTC_GEOMETRY_TYPE_USER);
+        if(!geometry)
+            throw_embree_error();
+        AGZ_SCOPE_GUARD({ rtcReleaseGeometry(geometry); });
+
+        if(instance)
+        {
+            rtcSetGeometryInstancedScene(geometry, instanced_scene);
+            set_instance_transform(geometry, local_to_world);
+        }
+        else
+        {
+            rtcSetGeometryUserPrimitiveCount(geometry, 1);
+            rtcSetGeometryUserData(geometry, const_cast<Entity*>(entity.get()));
+            rtcSetGeometryBoundsFunction(geometry, user_geometry_bounds, nullptr);
+            rtcSetGeometryIntersectFunction(geometry, user_geometry_intersect);
+            rtcSetGeometryOccludedFunction(geometry, user_geometry_occluded);
+        }
+
+        rtcCommitGeometry(geometry);
+
+        const unsigned id = rtcAttachGeometry(scene_, geometry);
+        if(id == RTC_INVALID_GEOMETRY_ID)
+            throw_embree_error();
+
+        if(id >= records_.size())
+            records_.resize(id + 1);
+        entity2id_[entity.get()] = id;
+        records_[id] = { std::move(entity), instance };
+    }
+
+    void commit()
+    {
+        rtcCommitScene(scene_);
+        if(rtcGetDeviceError(embree_device()) != RTC_ERROR_NONE)
+            throw_embree_error();
+    }
+
+    bool fill_intersection(
+        const Ray &r, const RTCRayHit &rayhit,
+        const EntityIntersection &user_inct,
+        EntityIntersection *inct) const noexcept
+    {
+        const RTCHit &hit = rayhit.hit;
+        if(hit.geomID == RTC_INVALID_GEOMETRY_ID)
+            return false;
+
+        // user geometries are attached to the top level scene directly
+
+        if(hit.instID[0] == RTC_INVALID_GEOMETRY_ID)
+        {
+            *inct = user_inct;
+            return true;
+        }
+
+        records_[hit.instID[0]].instance->embree_intersection(
+            r, rayhit.ray.tfar, hit, inct);
+        return true;
+    }
+
+public:
+
+    ~EmbreeAggregate()
+    {
+        if(scene_)
+            rtcReleaseScene(scene_);
+    }
+
+    void build(const std::vector<RC<const Entity>> &entities) override
+    {
+        invalidate_entity_caches();
+
+        if(scene_)
+        {
+            rtcReleaseScene(scene_);
+            scene_ = nullptr;
+        }
+        records_.clear();
+        entity2id_.clear();
+
+        scene_ = rtcNewScene(embree_device());
+        if(!scene_)
+            throw_embree_error();
+
+        // entities may be inserted or removed later
+        rtcSetSceneFlags(scene_, RTC_SCENE_FLAG_DYNAMIC);
+        rtcSetSceneBuildQuality(scene_, RTC_BUILD_QUALITY_HIGH);
+
+        for(auto &entity : entities)
+            attach(entity);
+
+        commit();
+    }
+
+    void insert(RC<const Entity> entity) override
+    {
+        attach(std::move(entity));
+        commit();
+    }
+
+    void remove(const Entity *entity) override
+    {
+        const auto it = entity2id_.find(entity);
+        if(it == entity2id_.end())
+            return;
+
+        invalidate_entity_caches();
+
+        rtcDetachGeometry(scene_, it->second);
+        records_[it->second] = {};
+        entity2id_.erase(it);
+
+        commit();
+    }
+
+    void refit() override
+    {
+        for(unsigned id = 0; id < records_.size(); ++id)
+        {
+            const Record &record = records_[id];
+            if(!record.entity)
+                continue;
+
+            RTCGeometry geometry = rtcGetGeometry(scene_, id);
+            if(record.instance)
+            {
+                RTCScene instanced_scene;
+                Transform3 local_to_world;
+                record.instance->embree_scene(&instanced_scene, &local_to_world);
+                set_instance_transform(geometry, local_to_world);
+            }
+
+            // bounds of user geometries are queried again when committed
+            rtcCommitGeometry(geometry);
+        }
+
+        commit();
+    }
+
+    bool has_intersection(const Ray &r) const noexcept override
+    {
+        RTCRay ray = to_embree_ray(r, 0);
+
+        IntersectContext context;
+        rtcInitIntersectContext(&context.context);
+        rtcOccluded1(scene_, &context.context, &ray);
+
+        return ray.tfar < 0 && std::isinf(ray.tfar);
+    }
+
+    bool closest_intersection(
+        const Ray &r, EntityIntersection *inct) const noexcept override
+    {
+        alignas(16) RTCRayHit rayhit;
+        rayhit.ray = to_embree_ray(r, 0);
+        init_embree_hit(rayhit.hit);
+
+        EntityIntersection user_inct;
+
+        IntersectContext context;
+        rtcInitIntersectContext(&context.context);
+        context.user_incts = &user_inct;
+        rtcIntersect1(scene_, &context.context, &rayhit);
+
+        return fill_intersection(r, rayhit, user_inct, inct);
+    }
+
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        thread_local std::vector<RTCRay> embree_rays;
+        embree_rays.resize(count);
+
+        for(size_t i = 0; i < count; ++i)
+            embree_rays[i] = to_embree_ray(rays[i], static_cast<unsigned>(i));
+
+        IntersectContext context;
+        rtcInitIntersectContext(&context.context);
+        rtcOccluded1M(
+            scene_, &context.context, embree_rays.data(),
+            static_cast<unsigned>(count), sizeof(RTCRay));
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            const float tfar = embree_rays[i].tfar;
+            result[i] = tfar < 0 && std::isinf(tfar);
+        }
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept override
+    {
+        thread_local std::vector<RTCRayHit> embree_rayhits;
+        thread_local std::vector<EntityIntersection> user_incts;
+        embree_rayhits.resize(count);
+        if(user_incts.size() < count)
+            user_incts.resize(count);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            embree_rayhits[i].ray = to_embree_ray(rays[i], static_cast<unsigned>(i));
+            init_embree_hit(embree_rayhits[i].hit);
+        }
+
+        IntersectContext context;
+        rtcInitIntersectContext(&context.context);
+        context.user_incts = user_incts.data();
+        rtcIntersect1M(
+            scene_, &context.context, embree_rayhits.data(),
+            static_cast<unsigned>(count), sizeof(RTCRayHit));
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            result[i] = fill_intersection(
+                rays[i], embree_rayhits[i], user_incts[i], &incts[i]);
+        }
+    }
+};
+
+RC<Aggregate> create_embree_aggregate()
+{
+    return newRC<EmbreeAggregate>();
+}
+
+AGZ_TRACER_END
+
+#endif // #ifdef USE_EMBREE
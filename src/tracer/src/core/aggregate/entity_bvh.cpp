@@ -1,35 +1,152 @@
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <unordered_map>
+
 #include <agz/tracer/core/aggregate.h>
 #include <agz/tracer/core/entity.h>
-#include <agz/utility/misc.h>
+#include <agz/tracer/create/aggregate.h>
+#include <agz/tracer/utility/morton.h>
+#include <agz/tracer/utility/nested_parallel.h>
+#include <agz/utility/thread.h>
+
+#include "./ray_stream.h"
 
 AGZ_TRACER_BEGIN
 
 namespace
 {
-    
-    struct Leaf;
-    struct Interior;
 
-    using Node = misc::variant_t<Leaf, Interior>;
+    constexpr uint32_t INVALID_NODE = std::numeric_limits<uint32_t>::max();
 
-    struct Leaf
-    {
-        AABB bound;
-        size_t start = 0, end = 0;
-    };
+    constexpr uint32_t LEAF_FLAG        = 1u << 31;
+    constexpr uint32_t SPLIT_AXIS_SHIFT = 29;
+    constexpr uint32_t CHILD_MASK       = (1u << SPLIT_AXIS_SHIFT) - 1;
 
-    struct Interior
+    // bvh node
+    //
+    // interior node: children are nodes[offset] and nodes[right()].
+    //                after a full build, the left child is the next node
+    // leaf node: entities are prims[offset, offset + prim_count())
+    struct Node
     {
-        AABB bound;
-        size_t left  = 0, right = 0;
+        real low[3], high[3];
+
+        uint32_t offset;
+
+        // leaf node:     LEAF_FLAG | entity count
+        // interior node: split axis << SPLIT_AXIS_SHIFT | right child
+        uint32_t info;
+
+        bool is_leaf() const noexcept
+        {
+            return (info & LEAF_FLAG) != 0;
+        }
+
+        uint32_t prim_count() const noexcept
+        {
+            return info & ~LEAF_FLAG;
+        }
+
+        uint32_t right() const noexcept
+        {
+            return info & CHILD_MASK;
+        }
+
+        int split_axis() const noexcept
+        {
+            return static_cast<int>((info >> SPLIT_AXIS_SHIFT) & 3);
+        }
+
+        void set_leaf(uint32_t first_prim, uint32_t count) noexcept
+        {
+            offset = first_prim;
+            info   = LEAF_FLAG | count;
+        }
+
+        void set_interior(uint32_t left, uint32_t right, int split_axis) noexcept
+        {
+            assert(left <= CHILD_MASK && right <= CHILD_MASK);
+            offset = left;
+            info   = (static_cast<uint32_t>(split_axis) << SPLIT_AXIS_SHIFT) | right;
+        }
+
+        AABB bound() const noexcept
+        {
+            return AABB(
+                Vec3(low[0],  low[1],  low[2]),
+                Vec3(high[0], high[1], high[2]));
+        }
+
+        void set_bound(const AABB &bound) noexcept
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                low[i]  = bound.low[i];
+                high[i] = bound.high[i];
+            }
+        }
+
+        bool intersect(
+            const Vec3 &ori, const Vec3 &inv_dir,
+            real t_min, real t_max) const noexcept
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                const real n = inv_dir[i] * (low[i]  - ori[i]);
+                const real f = inv_dir[i] * (high[i] - ori[i]);
+                t_min = (std::max)(t_min, (std::min)(n, f));
+                t_max = (std::min)(t_max, (std::max)(n, f));
+            }
+            return t_min <= t_max;
+        }
     };
 
+    static_assert(sizeof(Node) == 32);
+
     struct EntityRecord
     {
         const Entity *entity = nullptr;
         AABB bound;
+        Vec3 centroid;
+        uint64_t morton_code = 0; // used by fast build quality only
     };
 
+    // subtrees with less entities are built in a single thread
+    constexpr size_t PARALLEL_BUILD_THRESHOLD = 4096;
+
+    constexpr int SAH_BIN_COUNT = 16;
+
+    // cost of testing an entity relative to traversing a node
+    constexpr real SAH_ENTITY_COST = 1;
+
+    // always split at the median below this depth to bound traversal depth
+    constexpr int MAX_SAH_DEPTH = 64;
+
+    constexpr int TRAVERSAL_STACK_SIZE = 128;
+
+    // incremental updates fall back to a full rebuild when the tree
+    // becomes higher than this
+    constexpr uint32_t MAX_UPDATE_HEIGHT = TRAVERSAL_STACK_SIZE - 32;
+
+    // incremental updates fall back to a full rebuild when more prim slots
+    // than this (and half of all slots) are freed
+    constexpr size_t MIN_FREE_PRIM_REBUILD = 64;
+
+    real bound_surface_area(const AABB &bound) noexcept
+    {
+        const Vec3 extent = bound.high - bound.low;
+        return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    Node new_node(const AABB &bound) noexcept
+    {
+        Node ret = {};
+        ret.set_bound(bound);
+        return ret;
+    }
+
 } // namespace anonymous
 
 class EntityBVH : public Aggregate
@@ -39,185 +156,1050 @@ class EntityBVH : public Aggregate
     std::vector<Node> nodes_;
     std::vector<EntityPtr> prims_;
 
-    std::vector<RC<const Entity>> entities_;
-    
+    uint32_t root_ = INVALID_NODE;
+
+    // states for incremental updates
+
+    std::vector<uint32_t> parents_;  // INVALID_NODE for root
+    std::vector<uint32_t> heights_;  // 0 for leaf
+    std::vector<uint32_t> free_nodes_;
+
+    std::vector<RC<const Entity>> prim_owners_; // nullptr for free slots
+    std::vector<uint32_t> prim_leaves_;         // INVALID_NODE for free slots
+    size_t free_prim_count_ = 0;
+
+    std::unordered_map<EntityPtr, uint32_t> prim_slots_; // index in prims_
+
+    EntityBVHParams::BuildQuality build_quality_ = EntityBVHParams::BuildQuality::Balanced;
     int max_leaf_size_ = 5;
 
-    size_t build_aux(EntityRecord *entities, size_t count)
+    // append a separately built subtree to nodes & prims
+    static void append_subtree(
+        const std::vector<Node> &subtree_nodes,
+        const std::vector<EntityPtr> &subtree_prims,
+        std::vector<Node> &nodes, std::vector<EntityPtr> &prims)
     {
-        assert(count);
+        const uint32_t node_offset = static_cast<uint32_t>(nodes.size());
+        const uint32_t prim_offset = static_cast<uint32_t>(prims.size());
+
+        for(Node node : subtree_nodes)
+        {
+            if(node.is_leaf())
+                node.offset += prim_offset;
+            else
+            {
+                node.set_interior(
+                    node.offset + node_offset, node.right() + node_offset,
+                    node.split_axis());
+            }
+            nodes.push_back(node);
+        }
+
+        prims.insert(prims.end(), subtree_prims.begin(), subtree_prims.end());
+    }
 
-        if(count <= static_cast<size_t>(max_leaf_size_) || count < 2)
+    /**
+     * @brief find the best binned sah split of entities[0, count)
+     *
+     * @return split position in [1, count), or 0 when not splitting is better
+     */
+    size_t partition_sah(
+        EntityRecord *entities, size_t count,
+        const AABB &all_bound, const AABB &centroid_bound, int *split_axis) const
+    {
+        struct Bin
         {
-            const size_t start = prims_.size();
-            const size_t end   = start + count;
-            
             AABB bound;
+            size_t count = 0;
+        };
+
+        real best_cost = REAL_INF;
+        int best_axis = -1, best_bin = 0;
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            const real axis_low = centroid_bound.low[axis];
+            const real axis_len = centroid_bound.high[axis] - axis_low;
+            if(axis_len <= 0)
+                continue;
+
+            Bin bins[SAH_BIN_COUNT];
             for(size_t i = 0; i < count; ++i)
             {
-                prims_.push_back(entities[i].entity);
-                bound |= entities[i].bound;
+                const int bin_idx = (std::min)(SAH_BIN_COUNT - 1, static_cast<int>(
+                    SAH_BIN_COUNT * (entities[i].centroid[axis] - axis_low) / axis_len));
+                bins[bin_idx].bound |= entities[i].bound;
+                ++bins[bin_idx].count;
             }
 
-            const size_t ret = nodes_.size();
-            nodes_.emplace_back(Leaf{ bound, start, end });
-            return ret;
+            // right_cost[i]: cost of bins[i + 1, end)
+
+            real right_cost[SAH_BIN_COUNT];
+            AABB right_bound;
+            size_t right_count = 0;
+            for(int i = SAH_BIN_COUNT - 1; i > 0; --i)
+            {
+                right_bound |= bins[i].bound;
+                right_count += bins[i].count;
+                right_cost[i - 1] = right_count ?
+                    bound_surface_area(right_bound) * right_count : 0;
+            }
+
+            AABB left_bound;
+            size_t left_count = 0;
+            for(int i = 0; i < SAH_BIN_COUNT - 1; ++i)
+            {
+                left_bound |= bins[i].bound;
+                left_count += bins[i].count;
+                if(!left_count || left_count == count)
+                    continue;
+
+                const real cost = bound_surface_area(left_bound) * left_count
+                                + right_cost[i];
+                if(cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin  = i;
+                }
+            }
+        }
+
+        if(best_axis < 0)
+            return 0;
+
+        const real all_area = bound_surface_area(all_bound);
+        const real split_cost = all_area > 0 ?
+            1 + SAH_ENTITY_COST * best_cost / all_area : REAL_INF;
+        if(count <= static_cast<size_t>(max_leaf_size_) &&
+           split_cost >= SAH_ENTITY_COST * count)
+            return 0;
+
+        const real axis_low = centroid_bound.low[best_axis];
+        const real axis_len = centroid_bound.high[best_axis] - axis_low;
+        const EntityRecord *mid = std::partition(
+            entities, entities + count, [&](const EntityRecord &e)
+        {
+            const int bin_idx = (std::min)(SAH_BIN_COUNT - 1, static_cast<int>(
+                SAH_BIN_COUNT * (e.centroid[best_axis] - axis_low) / axis_len));
+            return bin_idx <= best_bin;
+        });
+
+        *split_axis = best_axis;
+        return static_cast<size_t>(mid - entities);
+    }
+
+    /**
+     * @brief partition entities[0, count) at the median of centroids along split_axis
+     */
+    static size_t partition_median(
+        EntityRecord *entities, size_t count, int split_axis)
+    {
+        const size_t split_idx = count / 2;
+        std::nth_element(entities, entities + split_idx, entities + count,
+            [split_axis](const EntityRecord &lhs, const EntityRecord &rhs)
+        {
+            return lhs.centroid[split_axis] < rhs.centroid[split_axis];
+        });
+        return split_idx;
+    }
+
+    /**
+     * @brief partition entities[0, count) sorted by morton codes at the
+     *        highest bit where the first and last codes differ
+     *
+     * entities with identical codes are split at the middle
+     */
+    static size_t partition_morton(
+        const EntityRecord *entities, size_t count, int *split_axis)
+    {
+        const uint64_t first_code = entities[0].morton_code;
+        const uint64_t last_code  = entities[count - 1].morton_code;
+        if(first_code == last_code)
+        {
+            *split_axis = 0;
+            return count / 2;
         }
 
-        // find splitting axis
+        // bits of x, y and z are interleaved from high to low
+        const int bit = 63 - count_leading_zeros(first_code ^ last_code);
+        *split_axis = 2 - bit % 3;
+
+        const uint64_t bit_mask = uint64_t(1) << bit;
+        const EntityRecord *mid = std::partition_point(
+            entities, entities + count, [&](const EntityRecord &e)
+        {
+            return !(e.morton_code & bit_mask);
+        });
+        return static_cast<size_t>(mid - entities);
+    }
+
+    /**
+     * @brief build bvh of entities[0, count) into nodes & prims
+     *
+     * the left subtree is built in another thread when parallel_depth > 0
+     * and there are sufficient entities
+     */
+    void build_aux(
+        EntityRecord *entities, size_t count, int depth, int parallel_depth,
+        std::vector<Node> &nodes, std::vector<EntityPtr> &prims) const
+    {
+        assert(count);
 
-        AABB all_bound;
+        AABB all_bound, centroid_bound;
         for(size_t i = 0; i < count; ++i)
-            all_bound |= entities[i].bound;
-        real split_axis_len = -1;
+        {
+            all_bound      |= entities[i].bound;
+            centroid_bound |= entities[i].centroid;
+        }
+
+        // find splitting position
+
         int split_axis = 0;
-        for(int i = 0; i < 3; ++i)
+        size_t split_idx = 0;
+
+        if(build_quality_ == EntityBVHParams::BuildQuality::Fast)
         {
-            const real axis_len = all_bound.high[i] - all_bound.low[i];
-            if(axis_len > split_axis_len)
+            if(count > static_cast<size_t>(max_leaf_size_))
+                split_idx = partition_morton(entities, count, &split_axis);
+        }
+        else if(count >= 2)
+        {
+            if(depth < MAX_SAH_DEPTH)
             {
-                split_axis_len = axis_len;
-                split_axis = i;
+                split_idx = partition_sah(
+                    entities, count, all_bound, centroid_bound, &split_axis);
+            }
+
+            // sah cannot split coincident centroids
+            if(!split_idx && count > static_cast<size_t>(max_leaf_size_))
+            {
+                real split_axis_len = -1;
+                for(int i = 0; i < 3; ++i)
+                {
+                    const real axis_len = centroid_bound.high[i] -
+                                          centroid_bound.low[i];
+                    if(axis_len > split_axis_len)
+                    {
+                        split_axis_len = axis_len;
+                        split_axis = i;
+                    }
+                }
+                split_idx = partition_median(entities, count, split_axis);
             }
         }
 
-        // sort entities according to centre[split_axis]
+        // leaf node
 
-        std::sort(entities, entities + count,
-            [split_axis](const EntityRecord &lhs, const EntityRecord &rhs)
+        if(!split_idx)
         {
-            const real L = lhs.bound.low[split_axis] +
-                           lhs.bound.high[split_axis];
-            const real R = rhs.bound.low[split_axis] +
-                           rhs.bound.high[split_axis];
-            return L < R;
-        });
+            Node leaf = new_node(all_bound);
+            leaf.set_leaf(
+                static_cast<uint32_t>(prims.size()), static_cast<uint32_t>(count));
+            nodes.push_back(leaf);
 
-        // push back new interior node
+            for(size_t i = 0; i < count; ++i)
+                prims.push_back(entities[i].entity);
+            return;
+        }
 
-        const size_t interior_idx = nodes_.size();
-        nodes_.emplace_back(Interior());
+        // interior node. left child is built right after it
 
-        // build left & right children
+        const uint32_t interior_idx = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(new_node(all_bound));
 
-        const size_t split_idx = count / 2;
-        const size_t left_idx  = build_aux(entities, split_idx);
-        const size_t right_idx = build_aux(
-            entities + split_idx, count - split_idx);
+        if(parallel_depth > 0 && count >= PARALLEL_BUILD_THRESHOLD)
+        {
+            std::vector<Node> left_nodes, right_nodes;
+            std::vector<EntityPtr> left_prims, right_prims;
 
-        // fill interior node
+            auto left_future = std::async(std::launch::async, [&]
+            {
+                build_aux(
+                    entities, split_idx, depth + 1, parallel_depth - 1,
+                    left_nodes, left_prims);
+            });
+
+            build_aux(
+                entities + split_idx, count - split_idx,
+                depth + 1, parallel_depth - 1, right_nodes, right_prims);
 
-        auto &interior = nodes_[interior_idx].as<Interior>();
-        interior.bound = all_bound;
-        interior.left  = left_idx;
-        interior.right = right_idx;
+            left_future.get();
 
-        return interior_idx;
+            append_subtree(left_nodes, left_prims, nodes, prims);
+            nodes[interior_idx].set_interior(
+                interior_idx + 1, static_cast<uint32_t>(nodes.size()), split_axis);
+            append_subtree(right_nodes, right_prims, nodes, prims);
+        }
+        else
+        {
+            build_aux(entities, split_idx, depth + 1, 0, nodes, prims);
+            nodes[interior_idx].set_interior(
+                interior_idx + 1, static_cast<uint32_t>(nodes.size()), split_axis);
+            build_aux(
+                entities + split_idx, count - split_idx,
+                depth + 1, 0, nodes, prims);
+        }
     }
 
-    bool has_intersection_aux(
-        const Vec3 &inv_dir, const Ray &r, const Node &node) const noexcept
+    /**
+     * @brief trace rays in stream.active[beg, end) through subtree of node
+     *
+     * rays hitting the node bound are appended to stream.active and
+     * passed to children together, so that each node is visited only once
+     * for the whole batch
+     */
+    void has_intersection_stream(
+        uint32_t node_idx, size_t beg, size_t end,
+        RayStream &stream, bool *result) const noexcept
     {
-        if(const Leaf *leaf = node.as_if<Leaf>())
+        const Node &node = nodes_[node_idx];
+
+        const size_t child_beg = stream.active.size();
+        for(size_t i = beg; i < end; ++i)
         {
-            if(!leaf->bound.intersect(r.o, inv_dir, r.t_min, r.t_max))
-                return false;
-            for(size_t i = leaf->start; i < leaf->end; ++i)
+            const uint32_t ray_idx = stream.active[i];
+            const Ray &r = stream.rays[ray_idx];
+            if(!result[ray_idx] && node.intersect(
+                r.o, stream.inv_dirs[ray_idx], r.t_min, r.t_max))
+                stream.active.push_back(ray_idx);
+        }
+        const size_t child_end = stream.active.size();
+
+        if(child_beg != child_end)
+        {
+            if(node.is_leaf())
+            {
+                for(uint32_t i = 0; i < node.prim_count(); ++i)
+                {
+                    stream.has_intersection(
+                        prims_[node.offset + i], child_beg, child_end, result);
+                }
+            }
+            else
             {
-                if(prims_[i]->has_intersection(r))
-                    return true;
+                has_intersection_stream(
+                    node.offset, child_beg, child_end, stream, result);
+                has_intersection_stream(
+                    node.right(), child_beg, child_end, stream, result);
             }
-            return false;
         }
 
-        const Interior &interior = node.as<Interior>();
-        if(!interior.bound.intersect(r.o, inv_dir, r.t_min, r.t_max))
-            return false;
-
-        return has_intersection_aux(inv_dir, r, nodes_[interior.left]) ||
-               has_intersection_aux(inv_dir, r, nodes_[interior.right]);
+        stream.active.resize(child_beg);
     }
 
-    bool closest_intersection_aux(
-        const Vec3 &inv_dir, Ray &r, const Node &node,
-        EntityIntersection *inct) const noexcept
+    void closest_intersection_stream(
+        uint32_t node_idx, size_t beg, size_t end, RayStream &stream,
+        EntityIntersection *incts, bool *result) const noexcept
     {
-        if(const Leaf *leaf = node.as_if<Leaf>())
+        const Node &node = nodes_[node_idx];
+
+        const size_t child_beg = stream.active.size();
+        for(size_t i = beg; i < end; ++i)
         {
-            if(!leaf->bound.intersect(r.o, inv_dir, r.t_min, r.t_max))
-                return false;
-            bool ret = false;
-            for(size_t i = leaf->start; i < leaf->end; ++i)
+            const uint32_t ray_idx = stream.active[i];
+            const Ray &r = stream.rays[ray_idx];
+            if(node.intersect(r.o, stream.inv_dirs[ray_idx], r.t_min, r.t_max))
+                stream.active.push_back(ray_idx);
+        }
+        const size_t child_end = stream.active.size();
+
+        if(child_beg != child_end)
+        {
+            if(node.is_leaf())
             {
-                const EntityPtr ent = prims_[i];
-                if(ent->closest_intersection(r, inct))
+                for(uint32_t i = 0; i < node.prim_count(); ++i)
                 {
-                    r.t_max = inct->t;
-                    ret = true;
+                    stream.closest_intersection(
+                        prims_[node.offset + i], child_beg, child_end,
+                        incts, result);
                 }
             }
+            else
+            {
+                // visit the near child first according to the first active ray
+
+                const uint32_t first_ray = stream.active[child_beg];
+                const bool dir_is_neg =
+                    stream.rays[first_ray].d[node.split_axis()] < 0;
+                const uint32_t near_child = dir_is_neg ? node.right() : node.offset;
+                const uint32_t far_child  = dir_is_neg ? node.offset : node.right();
+
+                closest_intersection_stream(
+                    near_child, child_beg, child_end, stream, incts, result);
+                closest_intersection_stream(
+                    far_child, child_beg, child_end, stream, incts, result);
+            }
+        }
+
+        stream.active.resize(child_beg);
+    }
+
+    // ---- incremental updates ----
+
+    uint32_t allocate_node()
+    {
+        if(!free_nodes_.empty())
+        {
+            const uint32_t ret = free_nodes_.back();
+            free_nodes_.pop_back();
             return ret;
         }
 
-        const Interior &interior = node.as<Interior>();
-        if(!interior.bound.intersect(r.o, inv_dir, r.t_min, r.t_max))
+        const uint32_t ret = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+        parents_.push_back(INVALID_NODE);
+        heights_.push_back(0);
+        return ret;
+    }
+
+    void free_node(uint32_t node_idx)
+    {
+        parents_[node_idx] = INVALID_NODE;
+        free_nodes_.push_back(node_idx);
+    }
+
+    /**
+     * @brief set children of an interior node and update its bound, split axis and height
+     *
+     * children may be swapped so that the left one is the lower one along the split axis,
+     * as assumed by near-first traversal
+     */
+    void link_interior(uint32_t node_idx, uint32_t left, uint32_t right)
+    {
+        AABB left_bound  = nodes_[left].bound();
+        AABB right_bound = nodes_[right].bound();
+
+        // split along the axis on which children are farthest apart
+        const Vec3 delta = (right_bound.low + right_bound.high)
+                         - (left_bound.low  + left_bound.high);
+        int split_axis = 0;
+        for(int i = 1; i < 3; ++i)
+        {
+            if(std::abs(delta[i]) > std::abs(delta[split_axis]))
+                split_axis = i;
+        }
+
+        if(delta[split_axis] < 0)
+        {
+            std::swap(left, right);
+            std::swap(left_bound, right_bound);
+        }
+
+        Node &node = nodes_[node_idx];
+        node.set_bound(left_bound | right_bound);
+        node.set_interior(left, right, split_axis);
+
+        parents_[left]  = node_idx;
+        parents_[right] = node_idx;
+        heights_[node_idx] = 1 + (std::max)(heights_[left], heights_[right]);
+    }
+
+    AABB leaf_bound(const Node &leaf) const noexcept
+    {
+        AABB ret;
+        for(uint32_t i = 0; i < leaf.prim_count(); ++i)
+            ret |= prims_[leaf.offset + i]->world_bound();
+        return ret;
+    }
+
+    /**
+     * @brief find the node with which a new leaf with given bound is paired
+     *
+     * descend from the root, and stop when creating a new parent at
+     * current node is cheaper than pushing the leaf further down
+     */
+    uint32_t find_best_sibling(const AABB &bound) const noexcept
+    {
+        uint32_t node_idx = root_;
+        while(!nodes_[node_idx].is_leaf())
+        {
+            const Node &node = nodes_[node_idx];
+
+            const real area          = bound_surface_area(node.bound());
+            const real combined_area = bound_surface_area(node.bound() | bound);
+
+            const real cost             = 2 * combined_area;
+            const real inheritance_cost = 2 * (combined_area - area);
+
+            auto descending_cost = [&](uint32_t child_idx)
+            {
+                const Node &child = nodes_[child_idx];
+                const real new_area = bound_surface_area(child.bound() | bound);
+                if(child.is_leaf())
+                    return new_area + inheritance_cost;
+                return new_area - bound_surface_area(child.bound()) + inheritance_cost;
+            };
+
+            const real left_cost  = descending_cost(node.offset);
+            const real right_cost = descending_cost(node.right());
+
+            if(cost < left_cost && cost < right_cost)
+                break;
+
+            node_idx = left_cost < right_cost ? node.offset : node.right();
+        }
+        return node_idx;
+    }
+
+    /**
+     * @brief swap a child of node with a grandchild on the other side
+     *        when it reduces the surface area of the modified child
+     */
+    void rotate(uint32_t node_idx)
+    {
+        const uint32_t left  = nodes_[node_idx].offset;
+        const uint32_t right = nodes_[node_idx].right();
+
+        enum class Rotation { None, LeftRightLeft, LeftRightRight, RightLeftLeft, RightLeftRight };
+
+        Rotation best = Rotation::None;
+        real best_gain = 0;
+
+        auto try_rotation = [&](Rotation rotation, real gain)
+        {
+            if(gain > best_gain)
+            {
+                best_gain = gain;
+                best      = rotation;
+            }
+        };
+
+        const AABB left_bound  = nodes_[left].bound();
+        const AABB right_bound = nodes_[right].bound();
+
+        if(!nodes_[right].is_leaf())
+        {
+            const real right_area = bound_surface_area(right_bound);
+            const AABB rl = nodes_[nodes_[right].offset].bound();
+            const AABB rr = nodes_[nodes_[right].right()].bound();
+            try_rotation(Rotation::LeftRightLeft,  right_area - bound_surface_area(left_bound | rr));
+            try_rotation(Rotation::LeftRightRight, right_area - bound_surface_area(left_bound | rl));
+        }
+
+        if(!nodes_[left].is_leaf())
+        {
+            const real left_area = bound_surface_area(left_bound);
+            const AABB ll = nodes_[nodes_[left].offset].bound();
+            const AABB lr = nodes_[nodes_[left].right()].bound();
+            try_rotation(Rotation::RightLeftLeft,  left_area - bound_surface_area(right_bound | lr));
+            try_rotation(Rotation::RightLeftRight, left_area - bound_surface_area(right_bound | ll));
+        }
+
+        switch(best)
+        {
+        case Rotation::LeftRightLeft:
+        {
+            const uint32_t rl = nodes_[right].offset, rr = nodes_[right].right();
+            link_interior(right, left, rr);
+            link_interior(node_idx, rl, right);
+            break;
+        }
+        case Rotation::LeftRightRight:
+        {
+            const uint32_t rl = nodes_[right].offset, rr = nodes_[right].right();
+            link_interior(right, rl, left);
+            link_interior(node_idx, rr, right);
+            break;
+        }
+        case Rotation::RightLeftLeft:
+        {
+            const uint32_t ll = nodes_[left].offset, lr = nodes_[left].right();
+            link_interior(left, right, lr);
+            link_interior(node_idx, left, ll);
+            break;
+        }
+        case Rotation::RightLeftRight:
+        {
+            const uint32_t ll = nodes_[left].offset, lr = nodes_[left].right();
+            link_interior(left, ll, right);
+            link_interior(node_idx, left, lr);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // refit and re-optimize node_idx and all its ancestors
+    void update_ancestors(uint32_t node_idx)
+    {
+        while(node_idx != INVALID_NODE)
+        {
+            const Node &node = nodes_[node_idx];
+            link_interior(node_idx, node.offset, node.right());
+            rotate(node_idx);
+            node_idx = parents_[node_idx];
+        }
+    }
+
+    void replace_child(uint32_t parent, uint32_t old_child, uint32_t new_child)
+    {
+        const Node &node = nodes_[parent];
+        if(node.offset == old_child)
+            link_interior(parent, new_child, node.right());
+        else
+        {
+            assert(node.right() == old_child);
+            link_interior(parent, node.offset, new_child);
+        }
+    }
+
+    void remove_leaf(uint32_t leaf)
+    {
+        const uint32_t parent = parents_[leaf];
+        free_node(leaf);
+
+        if(parent == INVALID_NODE)
+        {
+            root_ = INVALID_NODE;
+            return;
+        }
+
+        const uint32_t sibling = nodes_[parent].offset == leaf ?
+                                 nodes_[parent].right() : nodes_[parent].offset;
+        const uint32_t grandparent = parents_[parent];
+        free_node(parent);
+
+        parents_[sibling] = grandparent;
+        if(grandparent == INVALID_NODE)
+        {
+            root_ = sibling;
+            return;
+        }
+
+        replace_child(grandparent, parent, sibling);
+        update_ancestors(grandparent);
+    }
+
+    // rebuild the whole tree when incremental updates have degraded it
+    void rebuild_if_degraded()
+    {
+        const bool too_high = root_ != INVALID_NODE &&
+                              heights_[root_] > MAX_UPDATE_HEIGHT;
+        const bool too_sparse = free_prim_count_ > MIN_FREE_PRIM_REBUILD &&
+                                free_prim_count_ > prims_.size() / 2;
+        if(!too_high && !too_sparse)
+            return;
+
+        std::vector<RC<const Entity>> entities;
+        for(auto &owner : prim_owners_)
+        {
+            if(owner)
+                entities.push_back(owner);
+        }
+        build(entities);
+    }
+
+    void init_update_states(const std::vector<RC<const Entity>> &entities)
+    {
+        root_ = nodes_.empty() ? INVALID_NODE : 0;
+
+        parents_.assign(nodes_.size(), INVALID_NODE);
+        heights_.assign(nodes_.size(), 0);
+        free_nodes_.clear();
+
+        prim_leaves_.assign(prims_.size(), INVALID_NODE);
+        free_prim_count_ = 0;
+
+        // children are always after their parent in a fully built tree
+
+        for(uint32_t i = 0; i < nodes_.size(); ++i)
+        {
+            const Node &node = nodes_[i];
+            if(node.is_leaf())
+            {
+                for(uint32_t j = 0; j < node.prim_count(); ++j)
+                    prim_leaves_[node.offset + j] = i;
+            }
+            else
+            {
+                parents_[node.offset] = i;
+                parents_[node.right()] = i;
+            }
+        }
+
+        for(size_t i = nodes_.size(); i-- > 0;)
+        {
+            const Node &node = nodes_[i];
+            if(!node.is_leaf())
+            {
+                heights_[i] = 1 + (std::max)(
+                    heights_[node.offset], heights_[node.right()]);
+            }
+        }
+
+        std::unordered_map<EntityPtr, const RC<const Entity>*> ptr2owner;
+        for(auto &entity : entities)
+            ptr2owner[entity.get()] = &entity;
+
+        prim_owners_.resize(prims_.size());
+        prim_slots_.clear();
+        for(size_t i = 0; i < prims_.size(); ++i)
+        {
+            prim_owners_[i] = *ptr2owner[prims_[i]];
+            prim_slots_[prims_[i]] = static_cast<uint32_t>(i);
+        }
+    }
+
+    void refit_subtree(uint32_t node_idx)
+    {
+        Node &node = nodes_[node_idx];
+        if(node.is_leaf())
+        {
+            node.set_bound(leaf_bound(node));
+            return;
+        }
+
+        refit_subtree(node.offset);
+        refit_subtree(node.right());
+        link_interior(node_idx, node.offset, node.right());
+    }
+
+    /**
+     * @brief traverse the tree until test_entity(entity) returns true
+     *
+     * any intersection is enough for shadow rays
+     */
+    template<typename TestEntity>
+    bool any_hit(const Ray &r, const TestEntity &test_entity) const noexcept
+    {
+        if(root_ == INVALID_NODE)
             return false;
 
-        const bool left  = closest_intersection_aux(
-            inv_dir, r, nodes_[interior.left], inct);
-        const bool right = closest_intersection_aux(
-            inv_dir, r, nodes_[interior.right], inct);
+        const Vec3 inv_dir(1 / r.d.x, 1 / r.d.y, 1 / r.d.z);
+        const bool dir_is_neg[3] = { r.d.x < 0, r.d.y < 0, r.d.z < 0 };
+
+        uint32_t stack[TRAVERSAL_STACK_SIZE];
+        int top = 0;
+        uint32_t node_idx = root_;
+
+        for(;;)
+        {
+            const Node &node = nodes_[node_idx];
+
+            if(node.intersect(r.o, inv_dir, r.t_min, r.t_max))
+            {
+                if(node.is_leaf())
+                {
+                    for(uint32_t i = 0; i < node.prim_count(); ++i)
+                    {
+                        if(test_entity(prims_[node.offset + i]))
+                            return true;
+                    }
+                }
+                else
+                {
+                    assert(top < TRAVERSAL_STACK_SIZE);
+                    if(dir_is_neg[node.split_axis()])
+                    {
+                        stack[top++] = node.offset;
+                        node_idx = node.right();
+                    }
+                    else
+                    {
+                        stack[top++] = node.right();
+                        node_idx = node.offset;
+                    }
+                    continue;
+                }
+            }
+
+            if(!top)
+                break;
+            node_idx = stack[--top];
+        }
 
-        return left || right;
+        return false;
     }
 
 public:
 
-    explicit EntityBVH(int max_leaf_size)
+    explicit EntityBVH(const EntityBVHParams &params)
     {
-        max_leaf_size_ = max_leaf_size;
-        if(max_leaf_size < 1)
+        build_quality_ = params.build_quality;
+        max_leaf_size_ = params.max_leaf_size;
+        if(max_leaf_size_ < 1 ||
+           max_leaf_size_ > std::numeric_limits<uint16_t>::max())
             throw ObjectConstructionException("invalid max_leaf_size value");
     }
 
     void build(const std::vector<RC<const Entity>> &entities) override
     {
+        invalidate_entity_caches();
+
         nodes_.clear();
         prims_.clear();
 
         if(entities.empty())
         {
-            nodes_.emplace_back(Leaf{ AABB{ Vec3(0), Vec3(1) }, 0, 0 });
+            init_update_states(entities);
             return;
         }
 
         std::vector<EntityRecord> records(entities.size());
         prims_.reserve(entities.size());
         for(size_t i = 0; i < entities.size(); ++i)
-            records[i] = { entities[i].get(), entities[i]->world_bound() };
+        {
+            const AABB bound = entities[i]->world_bound();
+            records[i] = {
+                entities[i].get(), bound, real(0.5) * (bound.low + bound.high)
+            };
+        }
+
+        if(build_quality_ == EntityBVHParams::BuildQuality::Fast)
+        {
+            AABB centroid_bound;
+            for(auto &record : records)
+                centroid_bound |= record.centroid;
+
+            for(auto &record : records)
+            {
+                record.morton_code = morton_code(
+                    normalize_to_morton_space(record.centroid, centroid_bound));
+            }
+
+            std::sort(records.begin(), records.end(),
+                [](const EntityRecord &lhs, const EntityRecord &rhs)
+            {
+                return lhs.morton_code < rhs.morton_code;
+            });
+        }
+
+        // spawn build tasks at top levels until all threads are used
+
+        const int thread_count = nested_worker_count(0);
+        int parallel_depth = 0;
+        while((1 << parallel_depth) < thread_count)
+            ++parallel_depth;
+
+        build_aux(
+            records.data(), records.size(), 0, parallel_depth, nodes_, prims_);
+
+        init_update_states(entities);
+
+        if(build_quality_ == EntityBVHParams::BuildQuality::High)
+        {
+            // children are after their parent in a fully built tree.
+            // rotated nodes stay in the subtree, so the reverse order
+            // still visits nodes bottom-up
+            for(size_t i = nodes_.size(); i-- > 0;)
+            {
+                if(!nodes_[i].is_leaf())
+                    rotate(static_cast<uint32_t>(i));
+            }
+
+            // rotations may raise the tree beyond the traversal stack.
+            // the median fallback of build_aux bounds the height of an
+            // unrotated tree, so rebuild without rotations in that case
+
+            if(heights_[root_] > MAX_UPDATE_HEIGHT)
+            {
+                nodes_.clear();
+                prims_.clear();
+                build_aux(
+                    records.data(), records.size(), 0, parallel_depth,
+                    nodes_, prims_);
+                init_update_states(entities);
+            }
+        }
+    }
+
+    void insert(RC<const Entity> entity) override
+    {
+        const AABB bound = entity->world_bound();
+
+        // new entity is put in a new leaf
+
+        const uint32_t leaf = allocate_node();
+        nodes_[leaf].set_bound(bound);
+        nodes_[leaf].set_leaf(static_cast<uint32_t>(prims_.size()), 1);
+        heights_[leaf] = 0;
+
+        prim_slots_[entity.get()] = static_cast<uint32_t>(prims_.size());
+        prims_.push_back(entity.get());
+        prim_owners_.push_back(std::move(entity));
+        prim_leaves_.push_back(leaf);
+
+        if(root_ == INVALID_NODE)
+        {
+            root_ = leaf;
+            parents_[leaf] = INVALID_NODE;
+            return;
+        }
+
+        const uint32_t sibling    = find_best_sibling(bound);
+        const uint32_t old_parent = parents_[sibling];
+
+        const uint32_t new_parent = allocate_node();
+        parents_[new_parent] = old_parent;
+        link_interior(new_parent, sibling, leaf);
+
+        if(old_parent == INVALID_NODE)
+            root_ = new_parent;
+        else
+        {
+            replace_child(old_parent, sibling, new_parent);
+            update_ancestors(old_parent);
+        }
+
+        rebuild_if_degraded();
+    }
+
+    void remove(const Entity *entity) override
+    {
+        const auto it = prim_slots_.find(entity);
+        if(it == prim_slots_.end())
+            return;
 
-        entities_ = entities;
-        build_aux(records.data(), records.size());
+        invalidate_entity_caches();
+
+        const uint32_t prim_idx = it->second;
+        const uint32_t leaf = prim_leaves_[prim_idx];
+        prim_slots_.erase(it);
+        Node &node = nodes_[leaf];
+
+        // move the last entity of the leaf to the removed slot
+        // and free the last slot
+
+        const uint32_t last_idx = node.offset + node.prim_count() - 1;
+        std::swap(prims_[prim_idx], prims_[last_idx]);
+        std::swap(prim_owners_[prim_idx], prim_owners_[last_idx]);
+        if(prim_idx != last_idx)
+            prim_slots_[prims_[prim_idx]] = prim_idx;
+
+        prims_[last_idx] = nullptr;
+        prim_owners_[last_idx].reset();
+        prim_leaves_[last_idx] = INVALID_NODE;
+        ++free_prim_count_;
+
+        if(node.prim_count() > 1)
+        {
+            node.set_leaf(node.offset, node.prim_count() - 1);
+            node.set_bound(leaf_bound(node));
+            update_ancestors(parents_[leaf]);
+        }
+        else
+            remove_leaf(leaf);
+
+        rebuild_if_degraded();
+    }
+
+    void refit() override
+    {
+        if(root_ != INVALID_NODE)
+            refit_subtree(root_);
     }
 
     bool has_intersection(const Ray &r) const noexcept override
     {
-        const Vec3 inv_dir(1 / r.d.x, 1 / r.d.y, 1 / r.d.z);
-        return has_intersection_aux(inv_dir, r, nodes_[0]);
+        return any_hit(r, [&](EntityPtr entity)
+        {
+            return entity->has_intersection(r);
+        });
+    }
+
+    bool find_occluder(const Ray &r, Occluder *occluder) const noexcept override
+    {
+        return any_hit(r, [&](EntityPtr entity)
+        {
+            if(!entity->find_occluder(r, &occluder->primitive))
+                return false;
+            occluder->entity = entity;
+            return true;
+        });
     }
 
     bool closest_intersection(
         const Ray &r, EntityIntersection *inct) const noexcept override
     {
-        Vec3 inv_dir(1 / r.d.x, 1 / r.d.y, 1 / r.d.z);
+        if(root_ == INVALID_NODE)
+            return false;
+
+        const Vec3 inv_dir(1 / r.d.x, 1 / r.d.y, 1 / r.d.z);
+        const bool dir_is_neg[3] = { r.d.x < 0, r.d.y < 0, r.d.z < 0 };
+
         Ray ray = r;
-        return closest_intersection_aux(inv_dir, ray, nodes_[0], inct);
+        bool ret = false;
+
+        uint32_t stack[TRAVERSAL_STACK_SIZE];
+        int top = 0;
+        uint32_t node_idx = root_;
+
+        for(;;)
+        {
+            const Node &node = nodes_[node_idx];
+
+            if(node.intersect(ray.o, inv_dir, ray.t_min, ray.t_max))
+            {
+                if(node.is_leaf())
+                {
+                    for(uint32_t i = 0; i < node.prim_count(); ++i)
+                    {
+                        if(prims_[node.offset + i]->closest_intersection(ray, inct))
+                        {
+                            ray.t_max = inct->t;
+                            ret = true;
+                        }
+                    }
+                }
+                else
+                {
+                    // visit the near child first, so that the far one is
+                    // more likely to be culled by the shrunk t_max
+
+                    assert(top < TRAVERSAL_STACK_SIZE);
+                    if(dir_is_neg[node.split_axis()])
+                    {
+                        stack[top++] = node.offset;
+                        node_idx = node.right();
+                    }
+                    else
+                    {
+                        stack[top++] = node.right();
+                        node_idx = node.offset;
+                    }
+                    continue;
+                }
+            }
+
+            if(!top)
+                break;
+            node_idx = stack[--top];
+        }
+
+        return ret;
+    }
+
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        std::fill(result, result + count, false);
+        if(root_ == INVALID_NODE)
+            return;
+
+        auto &stream = thread_local_ray_stream();
+        stream.reset(rays, count);
+        has_intersection_stream(root_, 0, count, stream, result);
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept override
+    {
+        std::fill(result, result + count, false);
+        if(root_ == INVALID_NODE)
+            return;
+
+        auto &stream = thread_local_ray_stream();
+        stream.reset(rays, count);
+        closest_intersection_stream(root_, 0, count, stream, incts, result);
     }
 };
 
-RC<Aggregate> create_entity_bvh(int max_leaf_size)
+RC<Aggregate> create_entity_bvh(const EntityBVHParams &params)
 {
-    return newRC<EntityBVH>(max_leaf_size);
+    return newRC<EntityBVH>(params);
 }
 
 AGZ_TRACER_END
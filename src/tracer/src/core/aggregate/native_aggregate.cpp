@@ -1,6 +1,10 @@
+#include <algorithm>
+
 #include <agz/tracer/core/aggregate.h>
 #include <agz/tracer/core/entity.h>
 
+#include "./ray_stream.h"
+
 AGZ_TRACER_BEGIN
 
 class NativeAggregate : public Aggregate
@@ -12,12 +16,38 @@ public:
 
     void build(const std::vector<RC<const Entity>> &entities) override
     {
+        invalidate_entity_caches();
+
         raw_entities_.clear();
         entities_ = entities;
         for(size_t i = 0; i < entities.size(); ++i)
             raw_entities_.push_back(entities[i].get());
     }
 
+    void insert(RC<const Entity> entity) override
+    {
+        raw_entities_.push_back(entity.get());
+        entities_.push_back(std::move(entity));
+    }
+
+    void remove(const Entity *entity) override
+    {
+        const auto it = std::find(raw_entities_.begin(), raw_entities_.end(), entity);
+        if(it == raw_entities_.end())
+            return;
+
+        invalidate_entity_caches();
+
+        const auto idx = it - raw_entities_.begin();
+        raw_entities_.erase(it);
+        entities_.erase(entities_.begin() + idx);
+    }
+
+    void refit() override
+    {
+        // nothing to do
+    }
+
     bool has_intersection(const Ray &r) const noexcept override
     {
         for(auto ent : raw_entities_)
@@ -28,6 +58,19 @@ public:
         return false;
     }
 
+    bool find_occluder(const Ray &r, Occluder *occluder) const noexcept override
+    {
+        for(auto ent : raw_entities_)
+        {
+            if(ent->find_occluder(r, &occluder->primitive))
+            {
+                occluder->entity = ent;
+                return true;
+            }
+        }
+        return false;
+    }
+
     bool closest_intersection(
         const Ray &r, EntityIntersection *inct) const noexcept override
     {
@@ -43,6 +86,31 @@ public:
         }
         return ret;
     }
+
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        std::fill(result, result + count, false);
+
+        auto &stream = thread_local_ray_stream();
+        stream.reset(rays, count);
+
+        for(auto ent : raw_entities_)
+            stream.has_intersection(ent, 0, count, result);
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept override
+    {
+        std::fill(result, result + count, false);
+
+        auto &stream = thread_local_ray_stream();
+        stream.reset(rays, count);
+
+        for(auto ent : raw_entities_)
+            stream.closest_intersection(ent, 0, count, incts, result);
+    }
 };
 
 RC<Aggregate> create_native_aggregate()
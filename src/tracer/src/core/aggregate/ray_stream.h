@@ -0,0 +1,156 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <agz/tracer/core/entity.h>
+#include <agz/utility/misc.h>
+
+AGZ_TRACER_BEGIN
+
+/**
+ * @brief per-thread state of tracing a batch of rays through an aggregate
+ *
+ * active ray lists of nested traversal levels are stacked in 'active'.
+ * each level appends its list to the back and truncates it when finished.
+ */
+class RayStream : public misc::uncopyable_t
+{
+    std::vector<Ray>                gathered_rays_;
+    std::vector<uint32_t>           gathered_indices_;
+    std::vector<EntityIntersection> gathered_incts_;
+    std::unique_ptr<bool[]>         gathered_result_;
+    size_t                          gathered_result_capacity_ = 0;
+
+    size_t gather(size_t beg, size_t end, const bool *skip)
+    {
+        gathered_rays_.clear();
+        gathered_indices_.clear();
+
+        for(size_t i = beg; i < end; ++i)
+        {
+            const uint32_t ray_idx = active[i];
+            if(skip && skip[ray_idx])
+                continue;
+            gathered_rays_.push_back(rays[ray_idx]);
+            gathered_indices_.push_back(ray_idx);
+        }
+
+        const size_t count = gathered_rays_.size();
+        if(gathered_result_capacity_ < count)
+        {
+            gathered_result_ = std::make_unique<bool[]>(count);
+            gathered_result_capacity_ = count;
+        }
+
+        return count;
+    }
+
+public:
+
+    // copies of input rays. t_max is shrunk when closer intersection is found
+    std::vector<Ray>  rays;
+    std::vector<Vec3> inv_dirs;
+
+    std::vector<uint32_t> active;
+
+    /**
+     * @brief start a new stream. active is set to [0, count)
+     */
+    void reset(const Ray *input_rays, size_t count)
+    {
+        rays.assign(input_rays, input_rays + count);
+
+        inv_dirs.resize(count);
+        active.resize(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            const Vec3 &d = input_rays[i].d;
+            inv_dirs[i] = Vec3(1 / d.x, 1 / d.y, 1 / d.z);
+            active[i] = static_cast<uint32_t>(i);
+        }
+    }
+
+    /**
+     * @brief test rays in active[beg, end) with an entity
+     *
+     * rays with result[idx] == true are skipped
+     */
+    void has_intersection(
+        const Entity *entity, size_t beg, size_t end, bool *result)
+    {
+        const size_t count = gather(beg, end, result);
+        if(!count)
+            return;
+
+        if(count == 1)
+        {
+            result[gathered_indices_[0]] = entity->has_intersection(
+                gathered_rays_[0]);
+            return;
+        }
+
+        entity->has_intersection_n(
+            gathered_rays_.data(), count, gathered_result_.get());
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(gathered_result_[i])
+                result[gathered_indices_[i]] = true;
+        }
+    }
+
+    /**
+     * @brief find closest intersections of rays in active[beg, end) with an entity
+     *
+     * incts, result and t_max of rays are updated for closer intersections
+     */
+    void closest_intersection(
+        const Entity *entity, size_t beg, size_t end,
+        EntityIntersection *incts, bool *result)
+    {
+        const size_t count = gather(beg, end, nullptr);
+        if(!count)
+            return;
+
+        if(count == 1)
+        {
+            const uint32_t ray_idx = gathered_indices_[0];
+            if(entity->closest_intersection(rays[ray_idx], &incts[ray_idx]))
+            {
+                rays[ray_idx].t_max = incts[ray_idx].t;
+                result[ray_idx] = true;
+            }
+            return;
+        }
+
+        if(gathered_incts_.size() < count)
+            gathered_incts_.resize(count);
+
+        entity->closest_intersection_n(
+            gathered_rays_.data(), count,
+            gathered_incts_.data(), gathered_result_.get());
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(!gathered_result_[i])
+                continue;
+
+            const uint32_t ray_idx = gathered_indices_[i];
+            incts[ray_idx] = gathered_incts_[i];
+            rays[ray_idx].t_max = gathered_incts_[i].t;
+            result[ray_idx] = true;
+        }
+    }
+};
+
+/**
+ * @brief ray stream state of current thread
+ */
+inline RayStream &thread_local_ray_stream()
+{
+    thread_local RayStream ret;
+    return ret;
+}
+
+AGZ_TRACER_END
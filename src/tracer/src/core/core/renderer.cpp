@@ -1,7 +1,85 @@
+#include <filesystem>
+
 #include <agz/tracer/core/renderer.h>
+#include <agz/tracer/utility/checkpoint.h>
+#include <agz/tracer/utility/logger.h>
 
 AGZ_TRACER_BEGIN
 
+void Renderer::start_timer() noexcept
+{
+    render_start_time_ = std::chrono::steady_clock::now();
+    last_checkpoint_time_ = render_start_time_;
+}
+
+double Renderer::elapsed_seconds() const noexcept
+{
+    const auto duration = std::chrono::steady_clock::now() - render_start_time_;
+    return std::chrono::duration<double>(duration).count();
+}
+
+bool Renderer::exceeds_time_budget(double extra_seconds) const noexcept
+{
+    if(termination_.time_budget <= 0)
+        return false;
+    return elapsed_seconds() + extra_seconds > termination_.time_budget;
+}
+
+Box<CheckpointReader> Renderer::open_checkpoint(const std::string &tag)
+{
+    if(!checkpoint_.is_enabled() || !checkpoint_.resume)
+        return nullptr;
+
+    if(!std::filesystem::exists(checkpoint_.filename))
+    {
+        AGZ_INFO("no checkpoint found at {}. start from scratch",
+                 checkpoint_.filename);
+        return nullptr;
+    }
+
+    AGZ_INFO("resume from checkpoint: {}", checkpoint_.filename);
+
+    auto reader = newBox<CheckpointReader>(checkpoint_.filename, tag);
+
+    const double saved_elapsed = reader->read<double>();
+    render_start_time_ -= std::chrono::duration_cast<
+        std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(saved_elapsed));
+
+    return reader;
+}
+
+void Renderer::save_checkpoint_if_due(
+    const std::string &tag,
+    const std::function<void(CheckpointWriter&)> &write_state)
+{
+    // a stopped iteration may be partially done
+    if(!checkpoint_.is_enabled() || stop_rendering_)
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    if(std::chrono::duration<double>(now - last_checkpoint_time_).count()
+        < checkpoint_.interval)
+        return;
+    last_checkpoint_time_ = now;
+
+    CheckpointWriter writer(checkpoint_.filename, tag);
+    writer.write(elapsed_seconds());
+    write_state(writer);
+
+    if(writer.commit())
+        AGZ_INFO("checkpoint saved: {}", checkpoint_.filename);
+    else
+        AGZ_ERROR("failed to save checkpoint: {}", checkpoint_.filename);
+}
+
+PartialRenderTarget Renderer::render_partial(
+    FilmFilterApplier, Scene &, RendererInteractor &, const RenderPartition &)
+{
+    throw std::runtime_error(
+        "partial rendering is not supported by this renderer");
+}
+
 void Renderer::render_async(
     FilmFilterApplier filter, Scene &scene, RendererInteractor &reporter)
 {
@@ -35,4 +113,12 @@ RenderTarget Renderer::wait_async()
     return async_thread_.get();
 }
 
+RenderTarget Renderer::stop_and_wait_async()
+{
+    assert(is_waitable_);
+    stop_rendering_ = true;
+    AGZ_SCOPE_GUARD({ stop_rendering_ = false; is_waitable_ = false; });
+    return async_thread_.get();
+}
+
 AGZ_TRACER_END
@@ -1,13 +1,19 @@
+#include <vector>
+
 #include <agz/tracer/core/entity.h>
 #include <agz/tracer/core/geometry.h>
 #include <agz/tracer/core/material.h>
 #include <agz/tracer/core/medium.h>
+#include <agz/tracer/utility/embree.h>
 
 #include "area_light/geometry_to_diffuse_light.h"
 
 AGZ_TRACER_BEGIN
 
 class GeometricEntity : public Entity
+#ifdef USE_EMBREE
+                      , public EmbreeEntity
+#endif
 {
     RC<const Geometry> geometry_;
     RC<const Material> material_;
@@ -15,6 +21,19 @@ class GeometricEntity : public Entity
 
     Box<GeometryToDiffuseLight> diffuse_light_;
 
+#ifdef USE_EMBREE
+    const EmbreeGeometry *embree_geometry_ = nullptr;
+#endif
+
+    void fill_entity_fields(EntityIntersection *inct) const noexcept
+    {
+        inct->entity     = this;
+        inct->material   = material_.get();
+
+        inct->medium_in  = medium_interface_.in.get();
+        inct->medium_out = medium_interface_.out.get();
+    }
+
 public:
 
     GeometricEntity(
@@ -36,6 +55,10 @@ public:
             diffuse_light_ = newBox<GeometryToDiffuseLight>(
                 geometry_.get(), emit_radiance, user_specified_power);
         }
+
+#ifdef USE_EMBREE
+        embree_geometry_ = dynamic_cast<const EmbreeGeometry*>(geometry_.get());
+#endif
     }
 
     bool has_intersection(const Ray &r) const noexcept override
@@ -43,18 +66,53 @@ public:
         return geometry_->has_intersection(r);
     }
 
+    bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept override
+    {
+        return geometry_->find_occluder(r, primitive);
+    }
+
+    bool is_occluded_by(const Ray &r, uint32_t primitive) const noexcept override
+    {
+        return geometry_->is_occluded_by(r, primitive);
+    }
+
     bool closest_intersection(
         const Ray &r, EntityIntersection *inct) const noexcept override
     {
         if(!geometry_->closest_intersection(r, inct))
             return false;
-        inct->entity     = this;
-        inct->material   = material_.get();
+        fill_entity_fields(inct);
+        return true;
+    }
 
-        inct->medium_in  = medium_interface_.in.get();
-        inct->medium_out = medium_interface_.out.get();
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        geometry_->has_intersection_n(rays, count, result);
+    }
 
-        return true;
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept override
+    {
+        // geometry intersections cannot be written into entity
+        // intersection array directly due to different strides
+        thread_local std::vector<GeometryIntersection> geometry_incts;
+        if(geometry_incts.size() < count)
+            geometry_incts.resize(count);
+
+        geometry_->closest_intersection_n(
+            rays, count, geometry_incts.data(), result);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(!result[i])
+                continue;
+
+            EntityIntersection &inct = incts[i];
+            static_cast<GeometryIntersection&>(inct) = geometry_incts[i];
+            fill_entity_fields(&inct);
+        }
     }
 
     AABB world_bound() const noexcept override
@@ -71,6 +129,25 @@ public:
     {
         return diffuse_light_.get();
     }
+
+#ifdef USE_EMBREE
+
+    bool embree_scene(
+        RTCScene *scene, Transform3 *local_to_world) const noexcept override
+    {
+        return embree_geometry_ &&
+               embree_geometry_->embree_scene(scene, local_to_world);
+    }
+
+    void embree_intersection(
+        const Ray &r, real t, const RTCHit &hit,
+        EntityIntersection *inct) const noexcept override
+    {
+        embree_geometry_->embree_intersection(r, t, hit, inct);
+        fill_entity_fields(inct);
+    }
+
+#endif
 };
 
 RC<Entity> create_geometric(
@@ -19,6 +19,16 @@ public:
         return internal_->has_intersection(r);
     }
 
+    bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept override
+    {
+        return internal_->find_occluder(r, primitive);
+    }
+
+    bool is_occluded_by(const Ray &r, uint32_t primitive) const noexcept override
+    {
+        return internal_->is_occluded_by(r, primitive);
+    }
+
     bool closest_intersection(
         const Ray &r, GeometryIntersection *inct) const noexcept override
     {
@@ -35,6 +45,32 @@ public:
         return true;
     }
 
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        internal_->has_intersection_n(rays, count, result);
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        GeometryIntersection *incts, bool *result) const noexcept override
+    {
+        internal_->closest_intersection_n(rays, count, incts, result);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(!result[i])
+                continue;
+
+            GeometryIntersection &inct = incts[i];
+            if(dot(inct.geometry_coord.z, inct.wr) < 0)
+            {
+                inct.geometry_coord = -inct.geometry_coord;
+                inct.user_coord     = -inct.user_coord;
+            }
+        }
+    }
+
     AABB world_bound() const noexcept override
     {
         return internal_->world_bound();
@@ -27,6 +27,26 @@ public:
                has_intersection_with_triangle(r, a_, c_a_, d_a_);
     }
 
+    bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept override
+    {
+        for(uint32_t i = 0; i < 2; ++i)
+        {
+            if(is_occluded_by(r, i))
+            {
+                *primitive = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool is_occluded_by(const Ray &r, uint32_t primitive) const noexcept override
+    {
+        return primitive == 0 ?
+            has_intersection_with_triangle(r, a_, b_a_, c_a_) :
+            has_intersection_with_triangle(r, a_, c_a_, d_a_);
+    }
+
     bool closest_intersection(
         const Ray &r, GeometryIntersection *inct) const noexcept override
     {
@@ -1,11 +1,21 @@
-#include <agz/tracer/core/geometry.h>
+#include <vector>
+
+#include <agz/tracer/create/geometry.h>
+#include <agz/tracer/utility/embree.h>
 
 AGZ_TRACER_BEGIN
 
-class TransformWrapper : public Geometry
+class TransformWrapper : public TransformWrapperGeometry
+#ifdef USE_EMBREE
+                       , public EmbreeGeometry
+#endif
 {
     RC<const Geometry> internal_;
 
+#ifdef USE_EMBREE
+    const EmbreeGeometry *embree_internal_ = nullptr;
+#endif
+
     Transform3 local_to_world_;
     real scale_ratio_ = 1;
 
@@ -29,6 +39,19 @@ class TransformWrapper : public Geometry
         world_bound_ |= local_to_world_.apply_to_point({ H.x, H.y, H.z });
     }
 
+    void to_local(
+        const Ray *rays, size_t count, std::vector<Ray> &local_rays) const
+    {
+        local_rays.resize(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            local_rays[i] = Ray(
+                local_to_world_.apply_inverse_to_point(rays[i].o),
+                local_to_world_.apply_inverse_to_vector(rays[i].d),
+                rays[i].t_min, rays[i].t_max);
+        }
+    }
+
 public:
 
     TransformWrapper(
@@ -36,6 +59,15 @@ public:
         : internal_(std::move(internal))
     {
         init_transform(local_to_world);
+
+#ifdef USE_EMBREE
+        embree_internal_ = dynamic_cast<const EmbreeGeometry*>(internal_.get());
+#endif
+    }
+
+    void set_transform(const Transform3 &local_to_world) override
+    {
+        init_transform(local_to_world);
     }
 
     bool has_intersection(const Ray &r) const noexcept override
@@ -48,6 +80,26 @@ public:
         return internal_->has_intersection(local_r);
     }
 
+    bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept override
+    {
+        const Ray local_r(
+            local_to_world_.apply_inverse_to_point(r.o),
+            local_to_world_.apply_inverse_to_vector(r.d),
+            r.t_min, r.t_max);
+
+        return internal_->find_occluder(local_r, primitive);
+    }
+
+    bool is_occluded_by(const Ray &r, uint32_t primitive) const noexcept override
+    {
+        const Ray local_r(
+            local_to_world_.apply_inverse_to_point(r.o),
+            local_to_world_.apply_inverse_to_vector(r.d),
+            r.t_min, r.t_max);
+
+        return internal_->is_occluded_by(local_r, primitive);
+    }
+
     bool closest_intersection(
         const Ray &r, GeometryIntersection *inct) const noexcept override
     {
@@ -67,6 +119,35 @@ public:
         return true;
     }
 
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        thread_local std::vector<Ray> local_rays;
+        to_local(rays, count, local_rays);
+        internal_->has_intersection_n(local_rays.data(), count, result);
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        GeometryIntersection *incts, bool *result) const noexcept override
+    {
+        thread_local std::vector<Ray> local_rays;
+        to_local(rays, count, local_rays);
+        internal_->closest_intersection_n(local_rays.data(), count, incts, result);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(!result[i])
+                continue;
+
+            GeometryIntersection &inct = incts[i];
+            inct.pos            = local_to_world_.apply_to_point(inct.pos);
+            inct.geometry_coord = local_to_world_.apply_to_coord(inct.geometry_coord);
+            inct.user_coord     = local_to_world_.apply_to_coord(inct.user_coord);
+            inct.wr             = -rays[i].d;
+        }
+    }
+
     AABB world_bound() const noexcept override
     {
         return world_bound_;
@@ -118,9 +199,43 @@ public:
             local_to_world_.apply_inverse_to_point(pos))
             / (scale_ratio_ * scale_ratio_);
     }
+
+#ifdef USE_EMBREE
+
+    bool embree_scene(
+        RTCScene *scene, Transform3 *local_to_world) const noexcept override
+    {
+        Transform3 internal_to_local;
+        if(!embree_internal_ ||
+           !embree_internal_->embree_scene(scene, &internal_to_local))
+            return false;
+
+        *local_to_world = local_to_world_;
+        *local_to_world *= internal_to_local;
+        return true;
+    }
+
+    void embree_intersection(
+        const Ray &r, real t, const RTCHit &hit,
+        GeometryIntersection *inct) const noexcept override
+    {
+        const Ray local_r(
+            local_to_world_.apply_inverse_to_point(r.o),
+            local_to_world_.apply_inverse_to_vector(r.d),
+            r.t_min, r.t_max);
+
+        embree_internal_->embree_intersection(local_r, t, hit, inct);
+
+        inct->pos            = local_to_world_.apply_to_point(inct->pos);
+        inct->geometry_coord = local_to_world_.apply_to_coord(inct->geometry_coord);
+        inct->user_coord     = local_to_world_.apply_to_coord(inct->user_coord);
+        inct->wr             = -r.d;
+    }
+
+#endif
 };
 
-RC<Geometry> create_transform_wrapper(
+RC<TransformWrapperGeometry> create_transform_wrapper(
     RC<const Geometry> internal, const Transform3 &local_to_world)
 {
     return newRC<TransformWrapper>(std::move(internal), local_to_world);
@@ -23,9 +23,25 @@ protected:
     Transform3 local_to_world_;
     real local_to_world_ratio_ = 1;
 
+    // geometries whose transform has been flattened into their local data
+    // get an identity transform, with which rays and intersections are
+    // passed through without being transformed
+    bool is_identity_ = false;
+
 public:
 
     using Geometry::Geometry;
+
+    // transformed geometries are single primitives, which are
+    // cheap enough to be tested again as a whole
+
+    bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept override
+    {
+        if(!has_intersection(r))
+            return false;
+        *primitive = 0;
+        return true;
+    }
 };
 
 inline void TransformedGeometry::init_transform(const Transform3 &local_to_world)
@@ -35,6 +51,15 @@ inline void TransformedGeometry::init_transform(const Transform3 &local_to_world
     local_to_world_ = local_to_world;
     local_to_world_ratio_ = local_to_world_.apply_to_vector({ 1, 0, 0 }).length();
 
+    const auto is_same = [](const Vec3 &a, const Vec3 &b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    };
+    is_identity_ = is_same(local_to_world_.apply_to_point ({ 0, 0, 0 }), { 0, 0, 0 })
+                && is_same(local_to_world_.apply_to_vector({ 1, 0, 0 }), { 1, 0, 0 })
+                && is_same(local_to_world_.apply_to_vector({ 0, 1, 0 }), { 0, 1, 0 })
+                && is_same(local_to_world_.apply_to_vector({ 0, 0, 1 }), { 0, 0, 1 });
+
     AGZ_HIERARCHY_WRAP("in initializing transformed geometry")
 }
 
@@ -45,6 +70,8 @@ inline void TransformedGeometry::update_ratio() noexcept
 
 inline Ray TransformedGeometry::to_local(const Ray &world_ray) const noexcept
 {
+    if(is_identity_)
+        return world_ray;
     const Vec3 local_o = local_to_world_.apply_inverse_to_point(world_ray.o);
     const Vec3 local_d = local_to_world_.apply_inverse_to_vector(world_ray.d);
     return Ray(local_o, local_d, world_ray.t_min, world_ray.t_max);
@@ -53,6 +80,8 @@ inline Ray TransformedGeometry::to_local(const Ray &world_ray) const noexcept
 inline void TransformedGeometry::to_world(SurfacePoint *spt) const noexcept
 {
     assert(spt);
+    if(is_identity_)
+        return;
     spt->pos                = local_to_world_.apply_to_point(spt->pos);
     spt->geometry_coord     = local_to_world_.apply_to_coord(spt->geometry_coord);
     spt->user_coord         = local_to_world_.apply_to_coord(spt->user_coord);
@@ -60,12 +89,17 @@ inline void TransformedGeometry::to_world(SurfacePoint *spt) const noexcept
 
 inline void TransformedGeometry::to_world(GeometryIntersection *inct) const noexcept
 {
+    if(is_identity_)
+        return;
     to_world(static_cast<SurfacePoint*>(inct));
     inct->wr = local_to_world_.apply_to_vector(inct->wr);
 }
 
 inline AABB TransformedGeometry::to_world(const AABB &local_aabb) const noexcept
 {
+    if(is_identity_)
+        return local_aabb;
+
     const auto [low, high] = local_aabb;
 
     AABB ret;
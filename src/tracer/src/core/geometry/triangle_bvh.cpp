@@ -1,163 +1,296 @@
-﻿#include <limits>
+﻿#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
 #include <queue>
 #include <stack>
 #include <vector>
 
+#include <agz/tracer/utility/half.h>
 #include <agz/tracer/utility/logger.h>
+#include <agz/tracer/utility/nested_parallel.h>
+#include <agz/tracer/utility/parallel_grid.h>
 #include <agz/tracer/utility/triangle_aux.h>
 
 #include <agz/utility/mesh.h>
 #include <agz/utility/misc.h>
 
 #include "./transformed_geometry.h"
+#include "./triangle_bvh_common.h"
+#include "./triangle_bvh_wide.h"
 
 AGZ_TRACER_BEGIN
 
 namespace
 {
 
+    using namespace tri_bvh;
+
     // stack for traversal the bvh tree
-    constexpr int TRAVERSAL_STACK_SIZE = 128;
     thread_local uint32_t traversal_stack[TRAVERSAL_STACK_SIZE];
 
-    // triangle in bvh
-    struct Primitive
-    {
-        Vec3 a_, b_a_, c_a_;
-    };
-
-    // triangle info in bvh
-    struct PrimitiveInfo
+    /**
+     * @brief build the linking bvh tree
+     *
+     * top-level nodes are split with parallel bounding/binning/partitioning.
+     * subtrees smaller than PARALLEL_SUBTREE_THRESHOLD are then built as
+     * independent single-thread tasks
+     */
+    class BVHBuilder
     {
-        Vec3 n_a_, n_b_a_, n_c_a_;
-        Vec2 t_a_, t_b_a_, t_c_a_;
-        Vec3 x_, z_;
-    };
+        struct BuildingTask
+        {
+            BuildingNode **fillback_ptr;
+            uint32_t start, end;
+            uint32_t depth;
+        };
 
-    // node in triangle bvh
-    struct Node
-    {
-        real low[3], high[3];
+        BuildingTriangle *triangles_;
+        const TriangleBVHParams &params_;
+        uint32_t depth_threshold_;
+        uint32_t bin_count_;
+        bool use_sah_;
 
-        // internal node when start == uint32_t.max; otherwise, leaf node
-        uint32_t start, end_or_right_offset;
+        int thread_count_;
+        thread::thread_group_t threads_;
 
-        static Node new_leaf(
-            const real *low, const real *high, uint32_t start, uint32_t end)
+        int parallel_grid_size(uint32_t n) const noexcept
         {
-            const Node ret = {
-                { low[0],  low[1],  low[2] },
-				{ high[0], high[1], high[2] },
-				start, end
-            };
-            assert(ret.is_leaf());
-            return ret;
+            return static_cast<int>((std::max)(
+                n / static_cast<uint32_t>(4 * thread_count_), 4096u));
         }
 
-        static Node new_interior(
-            const real *low, const real *high, uint32_t right_offset)
+        void compute_bounding(
+            const BuildingTask &task, bool parallel,
+            AABB *all_bound, AABB *centroid_bound)
         {
-            const Node ret = {
-                { low[0],  low[1],  low[2] },
-				{ high[0], high[1], high[2] },
-                std::numeric_limits<uint32_t>::max(),
-                right_offset
+            auto accumulate = [&](uint32_t beg, uint32_t end, AABB &all, AABB &cen)
+            {
+                for(uint32_t i = beg; i < end; ++i)
+                {
+                    auto &tri = triangles_[i];
+                    all |= tri.vtx[0].position;
+                    all |= tri.vtx[1].position;
+                    all |= tri.vtx[2].position;
+                    cen |= tri.centroid;
+                }
             };
-            assert(!ret.is_leaf());
-            return ret;
-        }
 
-        bool is_leaf() const noexcept
-        {
-            return start < std::numeric_limits<uint32_t>::max();
+            *all_bound = AABB();
+            *centroid_bound = AABB();
+
+            if(!parallel)
+            {
+                accumulate(task.start, task.end, *all_bound, *centroid_bound);
+                return;
+            }
+
+            std::vector<AABB> thread_all(thread_count_), thread_cen(thread_count_);
+
+            const uint32_t n = task.end - task.start;
+            parallel_for_1d_grid(
+                thread_count_, static_cast<int>(n), parallel_grid_size(n),
+                threads_, [&](int thread_index, int beg, int end)
+            {
+                accumulate(
+                    task.start + beg, task.start + end,
+                    thread_all[thread_index], thread_cen[thread_index]);
+            });
+
+            for(int i = 0; i < thread_count_; ++i)
+            {
+                *all_bound      |= thread_all[i];
+                *centroid_bound |= thread_cen[i];
+            }
         }
 
-        bool has_intersection(
-            const real *ori, const real *inv_dir,
-            real t_min, real t_max, real *inct_t) const noexcept
+        // partition triangles in [start, end) with pred
+        // returns the start of the second group
+        template<typename Pred>
+        uint32_t partition(
+            uint32_t start, uint32_t end, bool parallel, const Pred &pred)
         {
-            const real nx = inv_dir[0] * (low[0] - ori[0]);
-            const real ny = inv_dir[1] * (low[1] - ori[1]);
-            const real nz = inv_dir[2] * (low[2] - ori[2]);
+            if(!parallel)
+            {
+                return static_cast<uint32_t>(std::partition(
+                    triangles_ + start, triangles_ + end, pred) - triangles_);
+            }
 
-            const real fx = inv_dir[0] * (high[0] - ori[0]);
-            const real fy = inv_dir[1] * (high[1] - ori[1]);
-            const real fz = inv_dir[2] * (high[2] - ori[2]);
+            const uint32_t n = end - start;
+            const int grid_size = parallel_grid_size(n);
+            const uint32_t chunk_size = static_cast<uint32_t>(grid_size);
+            const uint32_t chunk_count = (n + chunk_size - 1) / chunk_size;
 
-            t_min = (std::max)(t_min, (std::min)(nx, fx));
-            t_min = (std::max)(t_min, (std::min)(ny, fy));
-            t_min = (std::max)(t_min, (std::min)(nz, fz));
+            // count left triangles in each chunk
 
-            t_max = (std::min)(t_max, (std::max)(nx, fx));
-            t_max = (std::min)(t_max, (std::max)(ny, fy));
-            t_max = (std::min)(t_max, (std::max)(nz, fz));
+            std::vector<uint32_t> left_counts(chunk_count);
+            parallel_for_1d_grid(
+                thread_count_, static_cast<int>(n), grid_size,
+                threads_, [&](int, int beg, int end)
+            {
+                uint32_t count = 0;
+                for(int i = beg; i < end; ++i)
+                {
+                    if(pred(triangles_[start + i]))
+                        ++count;
+                }
+                left_counts[beg / chunk_size] = count;
+            });
 
-            *inct_t = t_min;
-            return t_min <= t_max;
-        }
-    };
+            // compute output offsets of each chunk
 
-    // linking node used in building bvh
-    // leaf node when left == nullptr. otherwise, internal node
-    struct BuildingNode
-    {
-        AABB bounding;
-        BuildingNode *left = nullptr, *right = nullptr;
-        uint32_t start = 0, end = 0;
-    };
+            std::vector<uint32_t> left_offsets(chunk_count);
+            std::vector<uint32_t> right_offsets(chunk_count);
 
-    // triangle used in building bvh
-    struct BuildingTriangle
-    {
-        const mesh::vertex_t *vtx = nullptr;
-        Vec3 centroid;
-    };
+            uint32_t left_total = 0;
+            for(uint32_t i = 0; i < chunk_count; ++i)
+            {
+                left_offsets[i] = left_total;
+                left_total += left_counts[i];
+            }
 
-    struct BuildingResult
-    {
-        BuildingNode *root;
-        uint32_t node_count;
-    };
+            uint32_t right_total = left_total;
+            for(uint32_t i = 0; i < chunk_count; ++i)
+            {
+                const uint32_t chunk_n = (std::min)(
+                    chunk_size, n - i * chunk_size);
+                right_offsets[i] = right_total;
+                right_total += chunk_n - left_counts[i];
+            }
 
-    BuildingResult build_bvh(
-        BuildingTriangle *triangles, uint32_t triangle_count,
-        uint32_t leaf_size_threshold, uint32_t depth_threshold, Arena &arena)
-    {
-        struct BuildingTask
-        {
-            BuildingNode **fillback_ptr;
-            uint32_t start, end;
-            uint32_t depth;
-        };
+            // scatter to buffer and copy back
 
-        BuildingResult ret = { nullptr, 0 };
+            std::vector<BuildingTriangle> buffer(n);
+            parallel_for_1d_grid(
+                thread_count_, static_cast<int>(n), grid_size,
+                threads_, [&](int, int beg, int end)
+            {
+                const uint32_t chunk_idx = beg / chunk_size;
+                uint32_t left_idx  = left_offsets[chunk_idx];
+                uint32_t right_idx = right_offsets[chunk_idx];
+                for(int i = beg; i < end; ++i)
+                {
+                    const auto &tri = triangles_[start + i];
+                    if(pred(tri))
+                        buffer[left_idx++] = tri;
+                    else
+                        buffer[right_idx++] = tri;
+                }
+            });
 
-        std::queue<BuildingTask> tasks;
-        tasks.push({ &ret.root, 0, triangle_count, 0 });
+            parallel_for_1d_grid(
+                thread_count_, static_cast<int>(n), grid_size,
+                threads_, [&](int, int beg, int end)
+            {
+                std::copy(
+                    buffer.begin() + beg, buffer.begin() + end,
+                    triangles_ + start + beg);
+            });
 
-        while(!tasks.empty())
+            return start + left_total;
+        }
+
+        // find split position with binned sah
+        //
+        // returns false when making a leaf is cheaper than splitting (only
+        // when n <= max_leaf_size) or no valid split exists
+        bool find_sah_split(
+            const BuildingTask &task, bool parallel,
+            const AABB &all_bound, const AABB &centroid_bound,
+            std::vector<SAHBin> &bins, uint32_t *split_middle)
         {
-            const BuildingTask task = tasks.front();
-            tasks.pop();
+            const uint32_t n = task.end - task.start;
+            const uint32_t axis_bin_count = 3 * bin_count_;
+
+            if(!parallel)
+            {
+                bins.assign(axis_bin_count, SAHBin());
+                fill_sah_bins(
+                    triangles_, task.start, task.end,
+                    centroid_bound, bin_count_, bins.data());
+            }
+            else
+            {
+                std::vector<SAHBin> thread_bins(thread_count_ * axis_bin_count);
+                parallel_for_1d_grid(
+                    thread_count_, static_cast<int>(n), parallel_grid_size(n),
+                    threads_, [&](int thread_index, int beg, int end)
+                {
+                    fill_sah_bins(
+                        triangles_, task.start + beg, task.start + end,
+                        centroid_bound, bin_count_,
+                        &thread_bins[thread_index * axis_bin_count]);
+                });
+
+                bins.assign(axis_bin_count, SAHBin());
+                for(int t = 0; t < thread_count_; ++t)
+                {
+                    for(uint32_t i = 0; i < axis_bin_count; ++i)
+                    {
+                        const SAHBin &src = thread_bins[t * axis_bin_count + i];
+                        bins[i].bounding |= src.bounding;
+                        bins[i].count    += src.count;
+                    }
+                }
+            }
 
+            int best_axis; uint32_t best_bin; real best_cost;
+            if(!evaluate_sah_bins(
+                bins.data(), bin_count_, n, all_bound, centroid_bound,
+                params_.sah_leaf_cost, &best_axis, &best_bin, &best_cost))
+                return false;
+
+            if(n <= static_cast<uint32_t>(params_.max_leaf_size) &&
+               n * params_.sah_leaf_cost <= best_cost)
+                return false;
+
+            const uint32_t bin_count = bin_count_;
+            *split_middle = partition(
+                task.start, task.end, parallel,
+                [&](const BuildingTriangle &tri)
+            {
+                return sah_bin_index(
+                    tri.centroid, best_axis,
+                    centroid_bound, bin_count) <= best_bin;
+            });
+
+            return task.start < *split_middle && *split_middle < task.end;
+        }
+
+        // create a leaf or an interior node for the task
+        // returns true and fills the children tasks for interior node
+        bool build_node(
+            const BuildingTask &task, bool parallel, Arena &arena,
+            std::vector<SAHBin> &bins,
+            BuildingTask *left_task, BuildingTask *right_task)
+        {
             assert(task.start < task.end);
 
             AABB all_bound, centroid_bound;
-            for(uint32_t i = task.start; i < task.end; ++i)
+            compute_bounding(task, parallel, &all_bound, &centroid_bound);
+
+            const uint32_t n = task.end - task.start;
+
+            // find split position with binned sah when the tree is not
+            // too deep. sah may decide to make a leaf here
+
+            uint32_t split_middle = task.start;
+            bool sah_split = false;
+            bool make_leaf = n <= static_cast<uint32_t>(params_.max_leaf_size);
+
+            if(use_sah_ && n > 1 && task.depth < depth_threshold_)
             {
-                auto &tri = triangles[i];
-                all_bound |= tri.vtx[0].position;
-                all_bound |= tri.vtx[1].position;
-                all_bound |= tri.vtx[2].position;
-                centroid_bound |= tri.centroid;
+                sah_split = find_sah_split(
+                    task, parallel, all_bound, centroid_bound,
+                    bins, &split_middle);
+                make_leaf = !sah_split && make_leaf;
             }
 
             // construct leaf node when triangle count is sufficiently low
-            const uint32_t n = task.end - task.start;
-            if(n <= leaf_size_threshold)
+            if(make_leaf)
             {
-                ++ret.node_count;
-
                 auto leaf = arena.create<BuildingNode>();
                 leaf->bounding = all_bound;
                 leaf->left     = nullptr;
@@ -167,42 +300,47 @@ namespace
 
                 *task.fillback_ptr = leaf;
 
-                continue;
+                return false;
             }
 
-            // select the split axis with max extent
-            const Vec3 centroid_delta = centroid_bound.high - centroid_bound.low;
-            const int split_axis = centroid_delta[0] > centroid_delta[1] ?
-                (centroid_delta[0] > centroid_delta[2] ? 0 : 2) :
-                (centroid_delta[1] > centroid_delta[2] ? 1 : 2);
-
-            // divide the axis with centroid position when recursive depth is
-            // small. otherwise, divide with triangle count
-            uint32_t split_middle;
-            if(task.depth < depth_threshold)
+            if(!sah_split)
             {
-                const real split_pos = real(0.5) * (
-                    centroid_bound.high[split_axis] + centroid_bound.low[split_axis]);
-                split_middle = task.start;
-                for(uint32_t i = task.start; i < task.end; ++i)
+                // select the split axis with max extent
+                const Vec3 centroid_delta = centroid_bound.high - centroid_bound.low;
+                const int split_axis = centroid_delta[0] > centroid_delta[1] ?
+                    (centroid_delta[0] > centroid_delta[2] ? 0 : 2) :
+                    (centroid_delta[1] > centroid_delta[2] ? 1 : 2);
+
+                // divide the axis with centroid position when recursive depth
+                // is small. otherwise, divide with triangle count
+                if(!use_sah_ && task.depth < depth_threshold_)
                 {
-                    if(triangles[i].centroid[split_axis] < split_pos)
-                        std::swap(triangles[i], triangles[split_middle++]);
-                }
+                    const real split_pos = real(0.5) * (
+                        centroid_bound.high[split_axis] +
+                        centroid_bound.low[split_axis]);
 
-                if(split_middle == task.start || split_middle == task.end)
-                    split_middle = task.start + n / 2;
-            }
-            else
-            {
-                std::sort(
-                    triangles + task.start, triangles + task.end,
-                    [axis = split_axis]
-                    (const BuildingTriangle &L, const BuildingTriangle &R)
+                    split_middle = partition(
+                        task.start, task.end, parallel,
+                        [&](const BuildingTriangle &tri)
+                    {
+                        return tri.centroid[split_axis] < split_pos;
+                    });
+
+                    if(split_middle == task.start || split_middle == task.end)
+                        split_middle = task.start + n / 2;
+                }
+                else
                 {
-                    return L.centroid[axis] < R.centroid[axis];
-                });
-                split_middle = task.start + n / 2;
+                    split_middle = task.start + n / 2;
+                    std::nth_element(
+                        triangles_ + task.start, triangles_ + split_middle,
+                        triangles_ + task.end,
+                        [axis = split_axis]
+                        (const BuildingTriangle &L, const BuildingTriangle &R)
+                    {
+                        return L.centroid[axis] < R.centroid[axis];
+                    });
+                }
             }
 
             auto interior = arena.create<BuildingNode>();
@@ -213,13 +351,152 @@ namespace
             interior->end      = 0;
 
             *task.fillback_ptr = interior;
-            ++ret.node_count;
 
-            tasks.push({ &interior->left, task.start, split_middle, task.depth + 1 });
-            tasks.push({ &interior->right, split_middle, task.end, task.depth + 1 });
+            *left_task  = { &interior->left,  task.start, split_middle, task.depth + 1 };
+            *right_task = { &interior->right, split_middle, task.end,   task.depth + 1 };
+
+            return true;
         }
 
-        return ret;
+        // build a subtree in current thread. returns node count
+        uint32_t build_subtree(
+            const BuildingTask &root_task, Arena &arena,
+            std::vector<SAHBin> &bins)
+        {
+            uint32_t node_count = 0;
+
+            std::queue<BuildingTask> tasks;
+            tasks.push(root_task);
+
+            while(!tasks.empty())
+            {
+                const BuildingTask task = tasks.front();
+                tasks.pop();
+
+                ++node_count;
+
+                BuildingTask left, right;
+                if(build_node(task, false, arena, bins, &left, &right))
+                {
+                    tasks.push(left);
+                    tasks.push(right);
+                }
+            }
+
+            return node_count;
+        }
+
+    public:
+
+        BVHBuilder(
+            BuildingTriangle *triangles, const TriangleBVHParams &params,
+            uint32_t depth_threshold)
+            : triangles_(triangles), params_(params),
+              depth_threshold_(depth_threshold)
+        {
+            bin_count_ = static_cast<uint32_t>(params.sah_bin_count);
+            use_sah_   = params.split_method ==
+                         TriangleBVHParams::SplitMethod::SAH;
+
+            thread_count_ = nested_worker_count(params.build_worker_count);
+        }
+
+        /**
+         * @brief build the bvh of triangles in [0, triangle_count)
+         *
+         * arenas.size() must be equal to thread_count(). created nodes are
+         * allocated in these arenas
+         */
+        BuildingResult build(uint32_t triangle_count, std::vector<Arena> &arenas)
+        {
+            assert(arenas.size() == static_cast<size_t>(thread_count_));
+
+            BuildingResult ret = { nullptr, 0 };
+
+            std::vector<SAHBin> bins;
+
+            // split top-level nodes with parallel operations
+
+            std::vector<BuildingTask> subtree_tasks;
+
+            std::queue<BuildingTask> tasks;
+            tasks.push({ &ret.root, 0, triangle_count, 0 });
+
+            while(!tasks.empty())
+            {
+                const BuildingTask task = tasks.front();
+                tasks.pop();
+
+                if(thread_count_ <= 1 ||
+                   task.end - task.start < PARALLEL_SUBTREE_THRESHOLD)
+                {
+                    subtree_tasks.push_back(task);
+                    continue;
+                }
+
+                ++ret.node_count;
+
+                BuildingTask left, right;
+                if(build_node(task, true, arenas[0], bins, &left, &right))
+                {
+                    tasks.push(left);
+                    tasks.push(right);
+                }
+            }
+
+            // build subtrees parallelly. larger subtrees go first
+
+            std::sort(subtree_tasks.begin(), subtree_tasks.end(),
+                [](const BuildingTask &L, const BuildingTask &R)
+            {
+                return L.end - L.start > R.end - R.start;
+            });
+
+            if(thread_count_ <= 1 || subtree_tasks.size() <= 1)
+            {
+                for(auto &task : subtree_tasks)
+                    ret.node_count += build_subtree(task, arenas[0], bins);
+                return ret;
+            }
+
+            std::atomic<size_t> next_task = 0;
+            std::atomic<uint32_t> subtree_node_count = 0;
+
+            threads_.run(thread_count_, [&](int thread_index)
+            {
+                std::vector<SAHBin> thread_bins;
+                uint32_t thread_node_count = 0;
+
+                for(;;)
+                {
+                    const size_t task_idx = next_task++;
+                    if(task_idx >= subtree_tasks.size())
+                        break;
+
+                    thread_node_count += build_subtree(
+                        subtree_tasks[task_idx],
+                        arenas[thread_index], thread_bins);
+                }
+
+                subtree_node_count += thread_node_count;
+            });
+
+            ret.node_count += subtree_node_count;
+            return ret;
+        }
+
+        int thread_count() const noexcept
+        {
+            return thread_count_;
+        }
+    };
+
+    uint32_t max_building_depth(const BuildingNode *node) noexcept
+    {
+        if(!node->left)
+            return 0;
+        return 1 + (std::max)(
+            max_building_depth(node->left), max_building_depth(node->right));
     }
 
     void compact_bvh(
@@ -303,69 +580,648 @@ namespace
         }
     }
 
+    /**
+     * @brief store triangles of a binary bvh leaf into blocks of W triangles
+     *
+     * unused lanes of the last block are filled with degenerated triangles,
+     * which are never intersected
+     *
+     * @return encoded leaf child
+     */
+    template<int W>
+    uint32_t emit_wide_leaf(
+        const Node &leaf, const Primitive *prims,
+        std::vector<tri_bvh_wide::TriangleBlock<W>> &blocks)
+    {
+        assert(leaf.is_leaf() && leaf.start < leaf.end_or_right_offset);
+
+        const uint32_t first_block = static_cast<uint32_t>(blocks.size());
+
+        for(uint32_t i = leaf.start; i < leaf.end_or_right_offset; i += W)
+        {
+            tri_bvh_wide::TriangleBlock<W> block = {};
+
+            for(int j = 0; j < W; ++j)
+            {
+                const uint32_t prim_idx = i + static_cast<uint32_t>(j);
+                if(prim_idx >= leaf.end_or_right_offset)
+                {
+                    block.prim_idx[j] = tri_bvh_wide::INVALID_PRIM;
+                    continue;
+                }
+
+                const Primitive &prim = prims[prim_idx];
+
+                block.a_x[j] = prim.a_.x;
+                block.a_y[j] = prim.a_.y;
+                block.a_z[j] = prim.a_.z;
+
+                block.b_a_x[j] = prim.b_a_.x;
+                block.b_a_y[j] = prim.b_a_.y;
+                block.b_a_z[j] = prim.b_a_.z;
+
+                block.c_a_x[j] = prim.c_a_.x;
+                block.c_a_y[j] = prim.c_a_.y;
+                block.c_a_z[j] = prim.c_a_.z;
+
+                block.prim_idx[j] = prim_idx;
+            }
+
+            blocks.push_back(block);
+        }
+
+        const uint32_t block_count =
+            static_cast<uint32_t>(blocks.size()) - first_block;
+        assert(block_count <= tri_bvh_wide::MAX_LEAF_BLOCKS);
+        assert(first_block + block_count <= tri_bvh_wide::LEAF_BLOCK_MASK);
+
+        return tri_bvh_wide::LEAF_FLAG
+             | ((block_count - 1) << tri_bvh_wide::LEAF_COUNT_SHIFT)
+             | first_block;
+    }
+
+    template<int W>
+    void set_wide_child(
+        tri_bvh_wide::WideNode<W> &wide_node, int slot,
+        const Node &child, uint32_t encoded_child) noexcept
+    {
+        wide_node.low_x[slot]  = child.low[0];
+        wide_node.low_y[slot]  = child.low[1];
+        wide_node.low_z[slot]  = child.low[2];
+        wide_node.high_x[slot] = child.high[0];
+        wide_node.high_y[slot] = child.high[1];
+        wide_node.high_z[slot] = child.high[2];
+        wide_node.child[slot]  = encoded_child;
+    }
+
+    template<int W>
+    tri_bvh_wide::WideNode<W> new_empty_wide_node() noexcept
+    {
+        tri_bvh_wide::WideNode<W> ret = {};
+        for(int i = 0; i < W; ++i)
+            ret.child[i] = tri_bvh_wide::EMPTY_CHILD;
+        return ret;
+    }
+
+    /**
+     * @brief collapse binary subtree rooted at node_idx into wide nodes
+     *
+     * interior children with the largest surface area are opened until
+     * there are W children
+     *
+     * @return index of the created wide node
+     */
+    template<int W>
+    uint32_t collapse_to_wide(
+        uint32_t node_idx,
+        const Node *nodes, const Primitive *prims,
+        std::vector<tri_bvh_wide::WideNode<W>> &wide_nodes,
+        std::vector<tri_bvh_wide::TriangleBlock<W>> &blocks)
+    {
+        assert(!nodes[node_idx].is_leaf());
+
+        uint32_t children[W];
+        int child_count = 0;
+        children[child_count++] = node_idx + 1;
+        children[child_count++] = nodes[node_idx].end_or_right_offset;
+
+        while(child_count < W)
+        {
+            int best_child = -1;
+            real best_area = -1;
+
+            for(int i = 0; i < child_count; ++i)
+            {
+                const Node &child = nodes[children[i]];
+                if(child.is_leaf())
+                    continue;
+
+                const real area = aabb_surface_area(AABB(
+                    Vec3(child.low[0],  child.low[1],  child.low[2]),
+                    Vec3(child.high[0], child.high[1], child.high[2])));
+                if(area > best_area)
+                {
+                    best_area  = area;
+                    best_child = i;
+                }
+            }
+
+            if(best_child < 0)
+                break;
+
+            const uint32_t opened = children[best_child];
+            children[best_child]    = opened + 1;
+            children[child_count++] = nodes[opened].end_or_right_offset;
+        }
+
+        const uint32_t wide_idx = static_cast<uint32_t>(wide_nodes.size());
+        wide_nodes.emplace_back();
+
+        auto wide_node = new_empty_wide_node<W>();
+        for(int i = 0; i < child_count; ++i)
+        {
+            const Node &child = nodes[children[i]];
+            const uint32_t encoded_child = child.is_leaf() ?
+                emit_wide_leaf<W>(child, prims, blocks) :
+                collapse_to_wide<W>(children[i], nodes, prims, wide_nodes, blocks);
+            set_wide_child(wide_node, i, child, encoded_child);
+        }
+
+        wide_nodes[wide_idx] = wide_node;
+        return wide_idx;
+    }
+
+    template<int W>
+    void build_wide_bvh(
+        const Node *nodes, const Primitive *prims,
+        std::vector<tri_bvh_wide::WideNode<W>> &wide_nodes,
+        std::vector<tri_bvh_wide::TriangleBlock<W>> &blocks)
+    {
+        wide_nodes.clear();
+        blocks.clear();
+
+        // traversal always starts from wide node 0,
+        // so a leaf root is wrapped into a wide node
+        if(nodes[0].is_leaf())
+        {
+            auto root = new_empty_wide_node<W>();
+            set_wide_child(root, 0, nodes[0], emit_wide_leaf<W>(nodes[0], prims, blocks));
+            wide_nodes.push_back(root);
+        }
+        else
+            collapse_to_wide<W>(0, nodes, prims, wide_nodes, blocks);
+
+        wide_nodes.shrink_to_fit();
+        blocks.shrink_to_fit();
+    }
+
+    /**
+     * @brief downgrade the requested layout to one supported by current cpu
+     */
+    TriangleBVHParams::Layout select_layout(
+        TriangleBVHParams::Layout layout, int max_leaf_size,
+        uint32_t triangle_count)
+    {
+        using Layout = TriangleBVHParams::Layout;
+        using namespace tri_bvh_wide;
+
+        const Layout requested = layout;
+
+        if(layout == Layout::Compressed &&
+           (max_leaf_size > COMPRESSED_MAX_LEAF_SIZE ||
+            triangle_count > COMPRESSED_LEAF_START_MASK))
+            layout = Layout::Binary;
+
+        if(layout == Layout::Auto)
+            layout = Layout::BVH8;
+
+        if(layout == Layout::BVH8 &&
+           (!is_bvh8_supported() || max_leaf_size > int(MAX_LEAF_BLOCKS * 8)))
+            layout = Layout::BVH4;
+
+        if(layout == Layout::BVH4 &&
+           (!is_bvh4_supported() || max_leaf_size > int(MAX_LEAF_BLOCKS * 4)))
+            layout = Layout::Binary;
+
+        if(requested != Layout::Auto && requested != layout)
+        {
+            AGZ_INFO("triangle bvh layout is unavailable. fall back to {}",
+                     layout == Layout::BVH4 ? "bvh4" : "binary");
+        }
+
+        return layout;
+    }
+
     // local triangle bvh
-    class UntransformedTriangleBVH
+    class UntransformedTriangleBVH : public misc::uncopyable_t
     {
-        std::vector<Primitive> prims_;
-        std::vector<PrimitiveInfo> prim_info_;
-        std::vector<Node> nodes_;
+        TriangleBVHData data_;
 
         math::distribution::alias_sampler_t<real> prim_sampler_;
 
-        real surface_area_ = 0;
-        AABB local_bound_;
-
     public:
 
-        void initialize(const mesh::triangle_t *triangles, uint32_t triangle_count)
+        void initialize(
+            const mesh::triangle_t *triangles, uint32_t triangle_count,
+            const TriangleBVHParams &params)
         {
             assert(triangles && triangle_count);
 
-            surface_area_ = 0;
-            local_bound_ = AABB();
+            data_.surface_area = 0;
+            data_.local_bound = AABB();
 
-            std::vector<BuildingTriangle> build_triangles(triangle_count);
             for(uint32_t i = 0; i < triangle_count; ++i)
             {
-                build_triangles[i].vtx = triangles[i].vertices;
-                build_triangles[i].centroid = (
-                    triangles[i].vertices[0].position +
-                    triangles[i].vertices[1].position +
-                    triangles[i].vertices[2].position) / real(3);
-                surface_area_ += triangle_area(
+                data_.surface_area += triangle_area(
                     triangles[i].vertices[1].position - triangles[i].vertices[0].position,
                     triangles[i].vertices[2].position - triangles[i].vertices[0].position);
-                local_bound_ |= triangles[i].vertices[0].position;
-                local_bound_ |= triangles[i].vertices[1].position;
-                local_bound_ |= triangles[i].vertices[2].position;
+                data_.local_bound |= triangles[i].vertices[0].position;
+                data_.local_bound |= triangles[i].vertices[1].position;
+                data_.local_bound |= triangles[i].vertices[2].position;
             }
 
-            Arena arena;
-            auto [root, node_count] = build_bvh(
-                build_triangles.data(), triangle_count, 5, TRAVERSAL_STACK_SIZE / 2, arena);
+            // with spatial splits, a triangle may be referenced by multiple
+            // leaves and is stored once for each of them
+
+            std::vector<BuildingTriangle> build_triangles;
+            std::vector<Arena> arenas;
+            BuildingResult build_result = { nullptr, 0 };
 
-            nodes_.resize(node_count);
-            prims_.resize(triangle_count);
-            prim_info_.resize(triangle_count);
+            if(params.build_quality == TriangleBVHParams::BuildQuality::High)
+            {
+                build_result = build_spatial_split_bvh(
+                    triangles, triangle_count, params, TRAVERSAL_STACK_SIZE / 2,
+                    arenas, build_triangles);
+
+                AGZ_INFO("spatial split bvh: {} references for {} triangles",
+                         build_triangles.size(), triangle_count);
+            }
+            else
+            {
+                build_triangles.resize(triangle_count);
+                for(uint32_t i = 0; i < triangle_count; ++i)
+                {
+                    build_triangles[i].vtx = triangles[i].vertices;
+                    build_triangles[i].centroid = (
+                        triangles[i].vertices[0].position +
+                        triangles[i].vertices[1].position +
+                        triangles[i].vertices[2].position) / real(3);
+                }
+
+                if(params.build_quality == TriangleBVHParams::BuildQuality::Fast)
+                {
+                    build_result = build_linear_bvh(
+                        build_triangles.data(), triangle_count, params, arenas);
+                }
+                else
+                {
+                    BVHBuilder builder(
+                        build_triangles.data(), params, TRAVERSAL_STACK_SIZE / 2);
+                    arenas = std::vector<Arena>(builder.thread_count());
+                    build_result = builder.build(triangle_count, arenas);
+                }
+            }
+
+            if(params.treelet_refinement)
+            {
+                optimize_treelets(build_result.root, params);
+
+                // restructuring may move leaves deeper. give up when
+                // the tree becomes too deep for traversal
+                if(max_building_depth(build_result.root) >= TRAVERSAL_STACK_SIZE - 8)
+                {
+                    AGZ_INFO("treelet refinement makes triangle bvh too deep. rebuild without it");
+                    TriangleBVHParams unrefined_params = params;
+                    unrefined_params.treelet_refinement = false;
+                    initialize(triangles, triangle_count, unrefined_params);
+                    return;
+                }
+            }
+
+            const auto [root, node_count] = build_result;
+            const uint32_t prim_count = static_cast<uint32_t>(build_triangles.size());
+            data_.duplicated_prims = prim_count != triangle_count;
+
+            std::vector<Node> nodes(node_count);
+            std::vector<Primitive> prims(prim_count);
+            std::vector<PrimitiveInfo> prim_info(prim_count);
 
             compact_bvh(
                 root, build_triangles.data(),
-                nodes_.data(), prims_.data(), prim_info_.data());
+                nodes.data(), prims.data(), prim_info.data());
 
-            std::vector<real> area_arr(triangle_count);
-            for(uint32_t i = 0; i < triangle_count; ++i)
-                area_arr[i] = triangle_area(prims_[i].b_a_, prims_[i].c_a_);
+            data_.layout = select_layout(
+                params.layout, params.max_leaf_size, prim_count);
+            if(data_.layout == TriangleBVHParams::Layout::Compressed)
+            {
+                std::vector<CompressedNode> compressed_nodes;
+                build_compressed_bvh(nodes.data(), compressed_nodes);
+                data_.compressed_nodes.assign(std::move(compressed_nodes));
+            }
+            else if(data_.layout == TriangleBVHParams::Layout::BVH8)
+            {
+                std::vector<tri_bvh_wide::WideNode<8>> wide_nodes;
+                std::vector<tri_bvh_wide::TriangleBlock<8>> blocks;
+                build_wide_bvh<8>(nodes.data(), prims.data(), wide_nodes, blocks);
+                data_.bvh8_nodes.assign(std::move(wide_nodes));
+                data_.bvh8_blocks.assign(std::move(blocks));
+            }
+            else if(data_.layout == TriangleBVHParams::Layout::BVH4)
+            {
+                std::vector<tri_bvh_wide::WideNode<4>> wide_nodes;
+                std::vector<tri_bvh_wide::TriangleBlock<4>> blocks;
+                build_wide_bvh<4>(nodes.data(), prims.data(), wide_nodes, blocks);
+                data_.bvh4_nodes.assign(std::move(wide_nodes));
+                data_.bvh4_blocks.assign(std::move(blocks));
+            }
 
-            prim_sampler_.initialize(
-                area_arr.data(), static_cast<int>(triangle_count));
+            // binary nodes are no longer used by other layouts
+            if(data_.layout == TriangleBVHParams::Layout::Binary)
+                data_.nodes.assign(std::move(nodes));
+
+            data_.prims.assign(std::move(prims));
+
+            if(params.half_attributes)
+            {
+                std::vector<HalfPrimitiveInfo> half_prim_info(prim_count);
+                for(uint32_t i = 0; i < prim_count; ++i)
+                    half_prim_info[i] = encode_prim_info(prim_info[i]);
+                data_.half_prim_info.assign(std::move(half_prim_info));
+            }
+            else
+                data_.prim_info.assign(std::move(prim_info));
+
+            initialize_prim_sampler();
+
+            log_memory_usage(node_count);
+        }
+
+        /**
+         * @brief size of node arrays and triangle blocks in bytes
+         */
+        size_t node_bytes() const noexcept
+        {
+            return data_.nodes.byte_size() + data_.compressed_nodes.byte_size() +
+                   data_.bvh4_nodes.byte_size() + data_.bvh4_blocks.byte_size() +
+                   data_.bvh8_nodes.byte_size() + data_.bvh8_blocks.byte_size();
+        }
+
+        /**
+         * @brief print memory usage and the size with binary layout and float attributes
+         */
+        void log_memory_usage(uint32_t binary_node_count) const
+        {
+            constexpr double MB = 1024.0 * 1024.0;
+
+            const size_t nodes     = node_bytes();
+            const size_t triangles = data_.prims.byte_size();
+            const size_t attribs   = data_.prim_info.byte_size() + data_.half_prim_info.byte_size();
+            const size_t total     = nodes + triangles + attribs;
+
+            const size_t uncompressed =
+                binary_node_count * sizeof(Node) +
+                data_.prims.size() * (sizeof(Primitive) + sizeof(PrimitiveInfo));
+
+            AGZ_INFO("triangle bvh memory: {:.2f} MB "
+                     "(nodes: {:.2f} MB, triangles: {:.2f} MB, attributes: {:.2f} MB). "
+                     "uncompressed: {:.2f} MB",
+                     total / MB, nodes / MB, triangles / MB, attribs / MB,
+                     uncompressed / MB);
+        }
+
+        /**
+         * @brief map bvh data from a cache file written by save_cache
+         *
+         * @return false when the file doesn't exist or cannot be used
+         */
+        bool load_cache(const std::string &filename)
+        {
+            if(!load_triangle_bvh_cache(filename, data_))
+                return false;
+            initialize_prim_sampler();
+            return true;
+        }
+
+        /**
+         * @brief write bvh data to a cache file
+         *
+         * @return false when the file cannot be written
+         */
+        bool save_cache(const std::string &filename) const
+        {
+            return save_triangle_bvh_cache(filename, data_);
         }
 
         bool has_intersection(const Ray &r) const noexcept
+        {
+            uint32_t prim_idx;
+            return find_occluder(r, &prim_idx);
+        }
+
+        // any-hit traversal. prim_idx is an index into data_.prims
+        bool find_occluder(const Ray &r, uint32_t *prim_idx) const noexcept
+        {
+            switch(data_.layout)
+            {
+            case TriangleBVHParams::Layout::BVH8:
+                return tri_bvh_wide::bvh8_has_intersection(
+                    data_.bvh8_nodes.data(), data_.bvh8_blocks.data(), to_wide_ray(r), prim_idx);
+            case TriangleBVHParams::Layout::BVH4:
+                return tri_bvh_wide::bvh4_has_intersection(
+                    data_.bvh4_nodes.data(), data_.bvh4_blocks.data(), to_wide_ray(r), prim_idx);
+            case TriangleBVHParams::Layout::Compressed:
+                return has_intersection_compressed(r, prim_idx);
+            default:
+                return has_intersection_binary(r, prim_idx);
+            }
+        }
+
+        bool is_occluded_by(const Ray &r, uint32_t prim_idx) const noexcept
+        {
+            if(prim_idx >= data_.prims.size())
+                return false;
+            const Primitive &prim = data_.prims[prim_idx];
+            return has_intersection_with_triangle(r, prim.a_, prim.b_a_, prim.c_a_);
+        }
+
+        bool closest_intersection(const Ray &r, GeometryIntersection *inct) const noexcept
+        {
+            tri_bvh_wide::WideHit hit;
+
+            switch(data_.layout)
+            {
+            case TriangleBVHParams::Layout::BVH8:
+                if(!tri_bvh_wide::bvh8_closest_intersection(
+                    data_.bvh8_nodes.data(), data_.bvh8_blocks.data(), to_wide_ray(r), &hit))
+                    return false;
+                break;
+            case TriangleBVHParams::Layout::BVH4:
+                if(!tri_bvh_wide::bvh4_closest_intersection(
+                    data_.bvh4_nodes.data(), data_.bvh4_blocks.data(), to_wide_ray(r), &hit))
+                    return false;
+                break;
+            case TriangleBVHParams::Layout::Compressed:
+                if(!closest_intersection_compressed(r, &hit))
+                    return false;
+                break;
+            default:
+                if(!closest_intersection_binary(r, &hit))
+                    return false;
+                break;
+            }
+
+            fill_intersection(r, hit, inct);
+            return true;
+        }
+
+        // layout dispatching is done once for the whole batch
+
+        void has_intersection_n(
+            const Ray *rays, size_t count, bool *result) const noexcept
+        {
+            uint32_t prim_idx;
+
+            switch(data_.layout)
+            {
+            case TriangleBVHParams::Layout::BVH8:
+                for(size_t i = 0; i < count; ++i)
+                {
+                    result[i] = tri_bvh_wide::bvh8_has_intersection(
+                        data_.bvh8_nodes.data(), data_.bvh8_blocks.data(),
+                        to_wide_ray(rays[i]), &prim_idx);
+                }
+                break;
+            case TriangleBVHParams::Layout::BVH4:
+                for(size_t i = 0; i < count; ++i)
+                {
+                    result[i] = tri_bvh_wide::bvh4_has_intersection(
+                        data_.bvh4_nodes.data(), data_.bvh4_blocks.data(),
+                        to_wide_ray(rays[i]), &prim_idx);
+                }
+                break;
+            case TriangleBVHParams::Layout::Compressed:
+                for(size_t i = 0; i < count; ++i)
+                    result[i] = has_intersection_compressed(rays[i], &prim_idx);
+                break;
+            default:
+                for(size_t i = 0; i < count; ++i)
+                    result[i] = has_intersection_binary(rays[i], &prim_idx);
+                break;
+            }
+        }
+
+        void closest_intersection_n(
+            const Ray *rays, size_t count,
+            GeometryIntersection *incts, bool *result) const noexcept
+        {
+            tri_bvh_wide::WideHit hit;
+
+            switch(data_.layout)
+            {
+            case TriangleBVHParams::Layout::BVH8:
+                for(size_t i = 0; i < count; ++i)
+                {
+                    result[i] = tri_bvh_wide::bvh8_closest_intersection(
+                        data_.bvh8_nodes.data(), data_.bvh8_blocks.data(),
+                        to_wide_ray(rays[i]), &hit);
+                    if(result[i])
+                        fill_intersection(rays[i], hit, &incts[i]);
+                }
+                break;
+            case TriangleBVHParams::Layout::BVH4:
+                for(size_t i = 0; i < count; ++i)
+                {
+                    result[i] = tri_bvh_wide::bvh4_closest_intersection(
+                        data_.bvh4_nodes.data(), data_.bvh4_blocks.data(),
+                        to_wide_ray(rays[i]), &hit);
+                    if(result[i])
+                        fill_intersection(rays[i], hit, &incts[i]);
+                }
+                break;
+            case TriangleBVHParams::Layout::Compressed:
+                for(size_t i = 0; i < count; ++i)
+                {
+                    result[i] = closest_intersection_compressed(rays[i], &hit);
+                    if(result[i])
+                        fill_intersection(rays[i], hit, &incts[i]);
+                }
+                break;
+            default:
+                for(size_t i = 0; i < count; ++i)
+                {
+                    result[i] = closest_intersection_binary(rays[i], &hit);
+                    if(result[i])
+                        fill_intersection(rays[i], hit, &incts[i]);
+                }
+                break;
+            }
+        }
+
+    private:
+
+        static tri_bvh_wide::WideRay to_wide_ray(const Ray &r) noexcept
+        {
+            return {
+                { r.o.x, r.o.y, r.o.z },
+                { r.d.x, r.d.y, r.d.z },
+                r.t_min, r.t_max
+            };
+        }
+
+        void fill_intersection(
+            const Ray &r, const tri_bvh_wide::WideHit &hit,
+            GeometryIntersection *inct) const noexcept
+        {
+            const PrimitiveInfo prim_info = get_prim_info(hit.prim_idx);
+
+            inct->pos            = r.at(hit.t);
+            inct->geometry_coord = Coord(prim_info.x_, cross(
+                prim_info.z_, prim_info.x_), prim_info.z_);
+            inct->uv             = prim_info.t_a_ + hit.u * prim_info.t_b_a_
+                                                  + hit.v * prim_info.t_c_a_;
+            inct->t              = hit.t;
+
+            const Vec3 user_z = prim_info.n_a_ + hit.u * prim_info.n_b_a_
+                                               + hit.v * prim_info.n_c_a_;
+            inct->user_coord = inct->geometry_coord.rotate_to_new_z(user_z);
+
+            inct->wr = -r.d;
+        }
+
+        PrimitiveInfo get_prim_info(size_t prim_idx) const noexcept
+        {
+            if(data_.half_prim_info.size())
+                return decode_prim_info(data_.half_prim_info[prim_idx]);
+            return data_.prim_info[prim_idx];
+        }
+
+        void initialize_prim_sampler()
+        {
+            std::vector<real> area_arr(data_.prims.size());
+            for(size_t i = 0; i < data_.prims.size(); ++i)
+                area_arr[i] = triangle_area(data_.prims[i].b_a_, data_.prims[i].c_a_);
+
+            // each of the k copies of a triangle gets 1/k of its area.
+            // identical triangles in the input mesh are treated as copies too
+
+            if(data_.duplicated_prims)
+            {
+                auto compare = [&](uint32_t L, uint32_t R)
+                {
+                    return std::memcmp(&data_.prims[L], &data_.prims[R], sizeof(Primitive));
+                };
+
+                std::vector<uint32_t> order(data_.prims.size());
+                std::iota(order.begin(), order.end(), 0u);
+                std::sort(order.begin(), order.end(), [&](uint32_t L, uint32_t R)
+                {
+                    return compare(L, R) < 0;
+                });
+
+                for(size_t i = 0; i < order.size();)
+                {
+                    size_t j = i + 1;
+                    while(j < order.size() && !compare(order[i], order[j]))
+                        ++j;
+
+                    const real inv_copy_count = real(1) / real(j - i);
+                    for(size_t k = i; k < j; ++k)
+                        area_arr[order[k]] *= inv_copy_count;
+
+                    i = j;
+                }
+            }
+
+            prim_sampler_.initialize(
+                area_arr.data(), static_cast<int>(area_arr.size()));
+        }
+
+        bool has_intersection_binary(const Ray &r, uint32_t *prim_idx) const noexcept
         {
             const real inv_dir[3] = { 1 / r.d.x, 1 / r.d.y, 1 / r.d.z };
             real t;
 
-            if(!nodes_[0].has_intersection(&r.o[0], inv_dir, r.t_min, r.t_max, &t))
+            if(!data_.nodes[0].has_intersection(&r.o[0], inv_dir, r.t_min, r.t_max, &t))
                 return false;
 
             int top = 0;
@@ -374,24 +1230,27 @@ namespace
             while(top)
             {
                 const uint32_t task_node_idx = traversal_stack[--top];
-                const Node &node = nodes_[task_node_idx];
+                const Node &node = data_.nodes[task_node_idx];
 
                 if(node.is_leaf())
                 {
                     for(uint32_t i = node.start; i < node.end_or_right_offset; ++i)
                     {
-                        const Primitive &prim = prims_[i];
+                        const Primitive &prim = data_.prims[i];
                         if(has_intersection_with_triangle(r, prim.a_, prim.b_a_, prim.c_a_))
+                        {
+                            *prim_idx = i;
                             return true;
+                        }
                     }
                 }
                 else
                 {
                     assert(top + 2 < TRAVERSAL_STACK_SIZE);
-                    if(nodes_[task_node_idx + 1].has_intersection(
+                    if(data_.nodes[task_node_idx + 1].has_intersection(
                         &r.o[0], inv_dir, r.t_min, r.t_max, &t))
                         traversal_stack[top++] = task_node_idx + 1;
-                    if(nodes_[node.end_or_right_offset].has_intersection(
+                    if(data_.nodes[node.end_or_right_offset].has_intersection(
                         &r.o[0], inv_dir, r.t_min, r.t_max, &t))
                         traversal_stack[top++] = node.end_or_right_offset;
                 }
@@ -400,14 +1259,14 @@ namespace
             return false;
         }
 
-        bool closest_intersection(Ray r, GeometryIntersection *inct) const noexcept
+        bool closest_intersection_binary(Ray r, tri_bvh_wide::WideHit *hit) const noexcept
         {
             const real ori[3]     = { r.o.x,     r.o.y,     r.o.z };
             const real inv_dir[3] = { 1 / r.d.x, 1 / r.d.y, 1 / r.d.z };
 
             int top = 0;
             real tmp_t;
-            if(!nodes_[0].has_intersection(ori, inv_dir, r.t_min, r.t_max, &tmp_t))
+            if(!data_.nodes[0].has_intersection(ori, inv_dir, r.t_min, r.t_max, &tmp_t))
                 return false;
 
             traversal_stack[top++] = 0;
@@ -419,13 +1278,13 @@ namespace
             while(top)
             {
                 const uint32_t task_node_idx = traversal_stack[--top];
-                const Node &node = nodes_[task_node_idx];
+                const Node &node = data_.nodes[task_node_idx];
 
                 if(node.is_leaf())
                 {
                     for(uint32_t i = node.start; i < node.end_or_right_offset; ++i)
                     {
-                        const Primitive &prim = prims_[i];
+                        const Primitive &prim = data_.prims[i];
                         if(closest_intersection_with_triangle(
                             r, prim.a_, prim.b_a_, prim.c_a_, &tmp_rcd))
                         {
@@ -439,9 +1298,9 @@ namespace
                 {
                     real t_left, t_right;
 
-                    const bool add_left  = nodes_[task_node_idx + 1]
+                    const bool add_left  = data_.nodes[task_node_idx + 1]
                         .has_intersection(ori, inv_dir, r.t_min, r.t_max, &t_left);
-                    const bool add_right = nodes_[node.end_or_right_offset]
+                    const bool add_right = data_.nodes[node.end_or_right_offset]
                         .has_intersection(ori, inv_dir, r.t_min, r.t_max, &t_right);
 
                     assert(top + 2 <= TRAVERSAL_STACK_SIZE);
@@ -469,35 +1328,141 @@ namespace
             if(std::isinf(rcd.t_ray))
                 return false;
 
-            const PrimitiveInfo &prim_info = prim_info_[final_prim_idx];
+            hit->t        = rcd.t_ray;
+            hit->u        = rcd.uv.x;
+            hit->v        = rcd.uv.y;
+            hit->prim_idx = final_prim_idx;
 
-            inct->pos            = r.at(rcd.t_ray);
-            inct->geometry_coord = Coord(prim_info.x_, cross(
-                prim_info.z_, prim_info.x_), prim_info.z_);
-            inct->uv             = prim_info.t_a_ + rcd.uv.x * prim_info.t_b_a_
-                                                  + rcd.uv.y * prim_info.t_c_a_;
-            inct->t              = rcd.t_ray;
+            return true;
+        }
 
-            const Vec3 user_z = prim_info.n_a_ + rcd.uv.x * prim_info.n_b_a_
-                                               + rcd.uv.y * prim_info.n_c_a_;
-            inct->user_coord = inct->geometry_coord.rotate_to_new_z(user_z);
+        bool has_intersection_compressed(const Ray &r, uint32_t *prim_idx) const noexcept
+        {
+            const real ori[3]     = { r.o.x,     r.o.y,     r.o.z };
+            const real inv_dir[3] = { 1 / r.d.x, 1 / r.d.y, 1 / r.d.z };
+            real t;
 
-            inct->wr = -r.d;
+            int top = 0;
+            traversal_stack[top++] = 0;
+
+            while(top)
+            {
+                const uint32_t child = traversal_stack[--top];
+
+                if(child & COMPRESSED_LEAF_FLAG)
+                {
+                    const uint32_t start = child & COMPRESSED_LEAF_START_MASK;
+                    const uint32_t end = start + 1 +
+                        ((child >> COMPRESSED_LEAF_COUNT_SHIFT) & COMPRESSED_LEAF_COUNT_MASK);
+                    for(uint32_t i = start; i < end; ++i)
+                    {
+                        const Primitive &prim = data_.prims[i];
+                        if(has_intersection_with_triangle(r, prim.a_, prim.b_a_, prim.c_a_))
+                        {
+                            *prim_idx = i;
+                            return true;
+                        }
+                    }
+                    continue;
+                }
+
+                const CompressedNode &node = data_.compressed_nodes[child];
+                for(int c = 0; c < 2; ++c)
+                {
+                    if(node.child[c] != COMPRESSED_EMPTY_CHILD &&
+                       node.has_intersection(c, ori, inv_dir, r.t_min, r.t_max, &t))
+                    {
+                        assert(top < TRAVERSAL_STACK_SIZE);
+                        traversal_stack[top++] = node.child[c];
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        bool closest_intersection_compressed(Ray r, tri_bvh_wide::WideHit *hit) const noexcept
+        {
+            const real ori[3]     = { r.o.x,     r.o.y,     r.o.z };
+            const real inv_dir[3] = { 1 / r.d.x, 1 / r.d.y, 1 / r.d.z };
+
+            int top = 0;
+            traversal_stack[top++] = 0;
+
+            TriangleIntersectionRecord rcd, tmp_rcd;
+            rcd.t_ray = std::numeric_limits<real>::infinity();
+            uint32_t final_prim_idx = 0;
+
+            while(top)
+            {
+                const uint32_t child = traversal_stack[--top];
+
+                if(child & COMPRESSED_LEAF_FLAG)
+                {
+                    const uint32_t start = child & COMPRESSED_LEAF_START_MASK;
+                    const uint32_t end = start + 1 +
+                        ((child >> COMPRESSED_LEAF_COUNT_SHIFT) & COMPRESSED_LEAF_COUNT_MASK);
+                    for(uint32_t i = start; i < end; ++i)
+                    {
+                        const Primitive &prim = data_.prims[i];
+                        if(closest_intersection_with_triangle(
+                            r, prim.a_, prim.b_a_, prim.c_a_, &tmp_rcd))
+                        {
+                            rcd = tmp_rcd;
+                            r.t_max = tmp_rcd.t_ray;
+                            final_prim_idx = i;
+                        }
+                    }
+                    continue;
+                }
+
+                const CompressedNode &node = data_.compressed_nodes[child];
+
+                real t[2];
+                bool add[2];
+                for(int c = 0; c < 2; ++c)
+                {
+                    add[c] = node.child[c] != COMPRESSED_EMPTY_CHILD &&
+                             node.has_intersection(
+                                 c, ori, inv_dir, r.t_min, r.t_max, &t[c]);
+                }
+
+                assert(top + 2 <= TRAVERSAL_STACK_SIZE);
+
+                // push the farther child first
+                const int near_child = add[0] && add[1] ?
+                    (t[0] < t[1] ? 0 : 1) : (add[0] ? 0 : 1);
+                const int far_child = 1 - near_child;
+                if(add[far_child])
+                    traversal_stack[top++] = node.child[far_child];
+                if(add[near_child])
+                    traversal_stack[top++] = node.child[near_child];
+            }
+
+            if(std::isinf(rcd.t_ray))
+                return false;
+
+            hit->t        = rcd.t_ray;
+            hit->u        = rcd.uv.x;
+            hit->v        = rcd.uv.y;
+            hit->prim_idx = final_prim_idx;
 
             return true;
         }
 
+    public:
+
         real surface_area() const noexcept
         {
-            return surface_area_;
+            return data_.surface_area;
         }
 
         SurfacePoint sample(real *pdf, const Sample3 &sam) const noexcept
         {
             const int prim_idx = prim_sampler_.sample(sam.u);
-            assert(0 <= prim_idx && static_cast<size_t>(prim_idx) < prims_.size());
-            const Primitive &prim = prims_[prim_idx];
-            const PrimitiveInfo &prim_info = prim_info_[prim_idx];
+            assert(0 <= prim_idx && static_cast<size_t>(prim_idx) < data_.prims.size());
+            const Primitive &prim = data_.prims[prim_idx];
+            const PrimitiveInfo prim_info = get_prim_info(prim_idx);
 
             const Vec2 uv = math::distribution::uniform_on_triangle(sam.v, sam.w);
 
@@ -512,14 +1477,14 @@ namespace
                                                + uv.y * prim_info.n_c_a_;
             spt.user_coord = spt.geometry_coord.rotate_to_new_z(user_z);
 
-            *pdf = 1 / surface_area_;
+            *pdf = 1 / data_.surface_area;
 
             return spt;
         }
 
-        const std::vector<Primitive> &get_prims() const noexcept
+        const BVHArray<Primitive> &get_prims() const noexcept
         {
-            return prims_;
+            return data_.prims;
         }
     };
 
@@ -531,7 +1496,8 @@ class TriangleBVH : public Geometry
     AABB world_bound_;
 
     static Box<const UntransformedTriangleBVH> load(
-        std::vector<mesh::triangle_t> build_triangles, const Transform3 &local_to_world)
+        std::vector<mesh::triangle_t> build_triangles,
+        const Transform3 &local_to_world, const TriangleBVHParams &params)
     {
         for(auto &tri : build_triangles)
         {
@@ -552,21 +1518,13 @@ class TriangleBVH : public Geometry
         auto ret = newBox<UntransformedTriangleBVH>();
         ret->initialize(
             build_triangles.data(),
-            static_cast<uint32_t>(build_triangles.size()));
+            static_cast<uint32_t>(build_triangles.size()), params);
 
         return ret;
     }
 
-public:
-
-    TriangleBVH(
-        std::vector<mesh::triangle_t> build_triangles,
-        const Transform3 &local_to_world)
+    void init_world_bound()
     {
-        AGZ_HIERARCHY_TRY
-
-        untransformed_ = load(std::move(build_triangles), local_to_world);
-
         world_bound_ = AABB();
         for(auto &prim : untransformed_->get_prims())
         {
@@ -581,21 +1539,86 @@ public:
                 world_bound_.low[i] = world_bound_.high[i] -
                                       real(0.1) * std::abs(world_bound_.high[i]);
         }
+    }
+
+public:
+
+    TriangleBVH(
+        std::vector<mesh::triangle_t> build_triangles,
+        const Transform3 &local_to_world,
+        const TriangleBVHParams &params)
+    {
+        AGZ_HIERARCHY_TRY
+
+        if(params.max_leaf_size < 1)
+            throw ObjectConstructionException(
+                "invalid max_leaf_size value: " +
+                std::to_string(params.max_leaf_size));
+        if(params.sah_bin_count < 2)
+            throw ObjectConstructionException(
+                "invalid sah_bin_count value: " +
+                std::to_string(params.sah_bin_count));
+        if(params.sah_leaf_cost <= 0)
+            throw ObjectConstructionException(
+                "invalid sah_leaf_cost value: " +
+                std::to_string(params.sah_leaf_cost));
+        if(params.spatial_split_budget < 0)
+            throw ObjectConstructionException(
+                "invalid spatial_split_budget value: " +
+                std::to_string(params.spatial_split_budget));
+
+        untransformed_ = load(
+            std::move(build_triangles), local_to_world, params);
+        init_world_bound();
 
         AGZ_HIERARCHY_WRAP("in initializing triangle_bvh geometry object")
     }
 
+    explicit TriangleBVH(Box<const UntransformedTriangleBVH> untransformed)
+        : untransformed_(std::move(untransformed))
+    {
+        init_world_bound();
+    }
+
+    bool save_cache(const std::string &filename) const
+    {
+        return untransformed_->save_cache(filename);
+    }
+
     bool has_intersection(const Ray &r) const noexcept override
     {
         return untransformed_->has_intersection(r);
     }
 
+    bool find_occluder(const Ray &r, uint32_t *primitive) const noexcept override
+    {
+        return untransformed_->find_occluder(r, primitive);
+    }
+
+    bool is_occluded_by(const Ray &r, uint32_t primitive) const noexcept override
+    {
+        return untransformed_->is_occluded_by(r, primitive);
+    }
+
     bool closest_intersection(
         const Ray &r, GeometryIntersection *inct) const noexcept override
     {
         return untransformed_->closest_intersection(r, inct);
     }
 
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        untransformed_->has_intersection_n(rays, count, result);
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        GeometryIntersection *incts, bool *result) const noexcept override
+    {
+        untransformed_->closest_intersection_n(rays, count, incts, result);
+    }
+
     AABB world_bound() const noexcept override
     {
         return world_bound_;
@@ -630,9 +1653,34 @@ public:
 
 RC<Geometry> create_triangle_bvh_noembree(
     std::vector<mesh::triangle_t> build_triangles,
-    const Transform3 &local_to_world)
+    const Transform3 &local_to_world,
+    const TriangleBVHParams &params)
 {
-    return newRC<TriangleBVH>(std::move(build_triangles), local_to_world);
+    return newRC<TriangleBVH>(
+        std::move(build_triangles), local_to_world, params);
+}
+
+RC<Geometry> create_cached_triangle_bvh_noembree(
+    const std::string &cache_filename,
+    const std::function<std::vector<mesh::triangle_t>()> &load_triangles,
+    const Transform3 &local_to_world,
+    const TriangleBVHParams &params)
+{
+    auto cached = newBox<UntransformedTriangleBVH>();
+    if(cached->load_cache(cache_filename))
+    {
+        AGZ_INFO("load triangle bvh from cache: {}", cache_filename);
+        return newRC<TriangleBVH>(std::move(cached));
+    }
+
+    auto ret = newRC<TriangleBVH>(load_triangles(), local_to_world, params);
+
+    if(ret->save_cache(cache_filename))
+        AGZ_INFO("save triangle bvh to cache: {}", cache_filename);
+    else
+        AGZ_INFO("failed to save triangle bvh to cache: {}", cache_filename);
+
+    return ret;
 }
 
 #ifndef USE_EMBREE
@@ -0,0 +1,104 @@
+/*
+ * this file is compiled with avx2 enabled when AGZ_TRI_BVH_AVX2 is defined.
+ * functions here must only be called after checking is_bvh8_supported()
+ */
+
+#include "./triangle_bvh_wide.h"
+
+#ifdef AGZ_TRI_BVH_AVX2
+
+#include <immintrin.h>
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+namespace
+{
+
+    struct SIMD8
+    {
+        static constexpr int W = 8;
+
+        using vfloat = __m256;
+
+        static vfloat load(const float *p) noexcept { return _mm256_load_ps(p); }
+        static vfloat set1(float f) noexcept { return _mm256_set1_ps(f); }
+        static void store(float *p, vfloat a) noexcept { _mm256_store_ps(p, a); }
+
+        static vfloat add(vfloat a, vfloat b) noexcept { return _mm256_add_ps(a, b); }
+        static vfloat sub(vfloat a, vfloat b) noexcept { return _mm256_sub_ps(a, b); }
+        static vfloat mul(vfloat a, vfloat b) noexcept { return _mm256_mul_ps(a, b); }
+        static vfloat div(vfloat a, vfloat b) noexcept { return _mm256_div_ps(a, b); }
+        static vfloat min(vfloat a, vfloat b) noexcept { return _mm256_min_ps(a, b); }
+        static vfloat max(vfloat a, vfloat b) noexcept { return _mm256_max_ps(a, b); }
+
+        static vfloat le (vfloat a, vfloat b) noexcept { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        static vfloat ge (vfloat a, vfloat b) noexcept { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        static vfloat neq(vfloat a, vfloat b) noexcept { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+
+        static vfloat and_(vfloat a, vfloat b) noexcept { return _mm256_and_ps(a, b); }
+
+        static int movemask(vfloat a) noexcept { return _mm256_movemask_ps(a); }
+    };
+
+} // namespace anonymous
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
+
+#include "./triangle_bvh_wide.inl"
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+bool bvh8_has_intersection(
+    const WideNode<8> *nodes, const TriangleBlock<8> *blocks,
+    const WideRay &ray, uint32_t *prim_idx) noexcept
+{
+    return has_intersection_impl<SIMD8>(nodes, blocks, ray, prim_idx);
+}
+
+bool bvh8_closest_intersection(
+    const WideNode<8> *nodes, const TriangleBlock<8> *blocks,
+    const WideRay &ray, WideHit *hit) noexcept
+{
+    return closest_intersection_impl<SIMD8>(nodes, blocks, ray, hit);
+}
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
+
+#else // #ifdef AGZ_TRI_BVH_AVX2
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+bool bvh8_has_intersection(
+    const WideNode<8>*, const TriangleBlock<8>*, const WideRay&, uint32_t*) noexcept
+{
+    return false;
+}
+
+bool bvh8_closest_intersection(
+    const WideNode<8>*, const TriangleBlock<8>*,
+    const WideRay&, WideHit*) noexcept
+{
+    return false;
+}
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
+
+#endif // #ifdef AGZ_TRI_BVH_AVX2
@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "./triangle_bvh_common.h"
+
+AGZ_TRACER_BEGIN
+
+namespace tri_bvh
+{
+
+namespace
+{
+
+    bool is_layout_supported(TriangleBVHParams::Layout layout) noexcept
+    {
+        switch(layout)
+        {
+        case TriangleBVHParams::Layout::Binary:     return true;
+        case TriangleBVHParams::Layout::Compressed: return true;
+        case TriangleBVHParams::Layout::BVH4:       return tri_bvh_wide::is_bvh4_supported();
+        case TriangleBVHParams::Layout::BVH8:       return tri_bvh_wide::is_bvh8_supported();
+        default:                                    return false;
+        }
+    }
+
+    /*
+     * bvh cache file:
+     *
+     *  CacheHeader
+     *  Primitive     [triangle_count]
+     *  PrimitiveInfo or HalfPrimitiveInfo [triangle_count]
+     *  binary, compressed or wide nodes [node_count]
+     *  triangle blocks [block_count] (wide layout only)
+     *
+     * each array starts at a CACHE_ALIGNMENT-aligned offset
+     */
+
+    constexpr char     CACHE_MAGIC[8]  = { 'A', 'T', 'R', 'C', 'B', 'V', 'H', '\0' };
+    constexpr uint32_t CACHE_VERSION   = 3;
+    constexpr uint64_t CACHE_ALIGNMENT = 64;
+
+    struct CacheHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t layout;
+        uint32_t half_attributes;
+        uint32_t duplicated_prims;
+
+        // detect caches written by incompatible builds
+        uint32_t sizeof_primitive;
+        uint32_t sizeof_prim_info;
+        uint32_t sizeof_node;
+        uint32_t sizeof_block;
+
+        uint64_t triangle_count;
+        uint64_t node_count;
+        uint64_t block_count;
+
+        uint64_t prims_offset;
+        uint64_t prim_info_offset;
+        uint64_t nodes_offset;
+        uint64_t blocks_offset;
+
+        real surface_area;
+        real local_bound_low[3];
+        real local_bound_high[3];
+    };
+
+    uint64_t align_cache_offset(uint64_t offset) noexcept
+    {
+        return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+    }
+
+    /**
+     * @brief temporary path for writing a cache file
+     *
+     * unique for each writer, so that threads or processes building the same
+     * mesh never write into the same temporary file
+     */
+    std::string unique_cache_tmp_filename(const std::string &filename)
+    {
+        std::random_device rd;
+        const uint64_t bits =
+            ((uint64_t(rd()) << 32) | rd()) ^
+            std::hash<std::thread::id>()(std::this_thread::get_id());
+
+        std::ostringstream ret;
+        ret << filename << "." << std::hex << bits << ".tmp";
+        return ret.str();
+    }
+
+    /*
+     * node links read from a cache file are checked before use, so that a
+     * corrupted cache is rejected instead of reading out of bounds:
+     *
+     *  - children lie after their parents (all layouts are written in
+     *    preorder), so traversal always terminates
+     *  - leaves reference existing triangles or triangle blocks
+     *  - the tree is shallow enough for the fixed-size traversal stack
+     */
+
+    bool check_cached_nodes(
+        const Node *nodes, size_t node_count, size_t prim_count)
+    {
+        std::vector<uint32_t> depth(node_count, 0);
+        for(size_t i = 0; i < node_count; ++i)
+        {
+            const Node &node = nodes[i];
+            if(node.is_leaf())
+            {
+                if(node.start >= node.end_or_right_offset ||
+                   node.end_or_right_offset > prim_count)
+                    return false;
+                continue;
+            }
+
+            const size_t left = i + 1, right = node.end_or_right_offset;
+            if(right <= left || right >= node_count ||
+               depth[i] + 2 >= uint32_t(TRAVERSAL_STACK_SIZE))
+                return false;
+
+            depth[left]  = (std::max)(depth[left],  depth[i] + 1);
+            depth[right] = (std::max)(depth[right], depth[i] + 1);
+        }
+        return true;
+    }
+
+    bool check_cached_nodes(
+        const CompressedNode *nodes, size_t node_count, size_t prim_count)
+    {
+        std::vector<uint32_t> depth(node_count, 0);
+        for(size_t i = 0; i < node_count; ++i)
+        {
+            if(depth[i] + 2 >= uint32_t(TRAVERSAL_STACK_SIZE))
+                return false;
+
+            for(uint32_t child : nodes[i].child)
+            {
+                if(child == COMPRESSED_EMPTY_CHILD)
+                    continue;
+
+                if(child & COMPRESSED_LEAF_FLAG)
+                {
+                    const size_t start = child & COMPRESSED_LEAF_START_MASK;
+                    const size_t count = 1 + ((child >> COMPRESSED_LEAF_COUNT_SHIFT)
+                                                     & COMPRESSED_LEAF_COUNT_MASK);
+                    if(start + count > prim_count)
+                        return false;
+                    continue;
+                }
+
+                if(child <= i || child >= node_count)
+                    return false;
+                depth[child] = (std::max)(depth[child], depth[i] + 1);
+            }
+        }
+        return true;
+    }
+
+    template<int W>
+    bool check_cached_nodes(
+        const tri_bvh_wide::WideNode<W> *nodes, size_t node_count,
+        const tri_bvh_wide::TriangleBlock<W> *blocks, size_t block_count,
+        size_t prim_count)
+    {
+        using namespace tri_bvh_wide;
+
+        std::vector<uint32_t> depth(node_count, 0);
+        for(size_t i = 0; i < node_count; ++i)
+        {
+            if((size_t(depth[i]) + 1) * (W - 1) + 1 > size_t(WIDE_TRAVERSAL_STACK_SIZE))
+                return false;
+
+            for(uint32_t child : nodes[i].child)
+            {
+                if(child == EMPTY_CHILD)
+                    continue;
+
+                if(child & LEAF_FLAG)
+                {
+                    const size_t first = child & LEAF_BLOCK_MASK;
+                    const size_t count = 1 + ((child >> LEAF_COUNT_SHIFT)
+                                                     & LEAF_COUNT_MASK);
+                    if(first + count > block_count)
+                        return false;
+                    continue;
+                }
+
+                if(child <= i || child >= node_count)
+                    return false;
+                depth[child] = (std::max)(depth[child], depth[i] + 1);
+            }
+        }
+
+        for(size_t i = 0; i < block_count; ++i)
+        {
+            for(uint32_t prim_idx : blocks[i].prim_idx)
+            {
+                if(prim_idx != INVALID_PRIM && prim_idx >= prim_count)
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+} // namespace anonymous
+
+bool load_triangle_bvh_cache(const std::string &filename, TriangleBVHData &data)
+{
+    auto file = newBox<MappedFile>();
+    if(!file->open(filename) || file->size() < sizeof(CacheHeader))
+        return false;
+
+    CacheHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    if(std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+       header.version != CACHE_VERSION ||
+       header.sizeof_primitive != sizeof(Primitive) ||
+       header.sizeof_prim_info != (header.half_attributes ?
+            sizeof(HalfPrimitiveInfo) : sizeof(PrimitiveInfo)) ||
+       !header.triangle_count || !header.node_count)
+        return false;
+
+    const auto layout = static_cast<TriangleBVHParams::Layout>(header.layout);
+    if(layout == TriangleBVHParams::Layout::Auto || !is_layout_supported(layout))
+        return false;
+
+    // arrays must lie inside the file
+
+    const auto *bytes = static_cast<const unsigned char*>(file->data());
+    const uint64_t file_size = file->size();
+
+    auto check_array = [&](uint64_t offset, uint64_t count, uint64_t elem_size)
+    {
+        return offset % CACHE_ALIGNMENT == 0 &&
+               offset <= file_size &&
+               count <= (file_size - offset) / elem_size;
+    };
+
+    if(!check_array(header.prims_offset, header.triangle_count, sizeof(Primitive)) ||
+       !check_array(header.prim_info_offset, header.triangle_count, header.sizeof_prim_info))
+        return false;
+
+    const size_t triangle_count = static_cast<size_t>(header.triangle_count);
+    const size_t node_count     = static_cast<size_t>(header.node_count);
+    const size_t block_count    = static_cast<size_t>(header.block_count);
+
+    if(layout == TriangleBVHParams::Layout::Binary)
+    {
+        if(header.sizeof_node != sizeof(Node) ||
+           !check_array(header.nodes_offset, node_count, sizeof(Node)) ||
+           !check_cached_nodes(reinterpret_cast<const Node*>(
+                bytes + header.nodes_offset), node_count, triangle_count))
+            return false;
+        data.nodes.map(reinterpret_cast<const Node*>(
+            bytes + header.nodes_offset), node_count);
+    }
+    else if(layout == TriangleBVHParams::Layout::Compressed)
+    {
+        if(header.sizeof_node != sizeof(CompressedNode) ||
+           !check_array(header.nodes_offset, node_count, sizeof(CompressedNode)) ||
+           !check_cached_nodes(reinterpret_cast<const CompressedNode*>(
+                bytes + header.nodes_offset), node_count, triangle_count))
+            return false;
+        data.compressed_nodes.map(reinterpret_cast<const CompressedNode*>(
+            bytes + header.nodes_offset), node_count);
+    }
+    else if(layout == TriangleBVHParams::Layout::BVH4)
+    {
+        using WNode  = tri_bvh_wide::WideNode<4>;
+        using WBlock = tri_bvh_wide::TriangleBlock<4>;
+        if(header.sizeof_node != sizeof(WNode) ||
+           header.sizeof_block != sizeof(WBlock) ||
+           !check_array(header.nodes_offset, node_count, sizeof(WNode)) ||
+           !check_array(header.blocks_offset, block_count, sizeof(WBlock)) ||
+           !check_cached_nodes(
+                reinterpret_cast<const WNode*>(bytes + header.nodes_offset), node_count,
+                reinterpret_cast<const WBlock*>(bytes + header.blocks_offset), block_count,
+                triangle_count))
+            return false;
+        data.bvh4_nodes.map(reinterpret_cast<const WNode*>(
+            bytes + header.nodes_offset), node_count);
+        data.bvh4_blocks.map(reinterpret_cast<const WBlock*>(
+            bytes + header.blocks_offset), block_count);
+    }
+    else
+    {
+        using WNode  = tri_bvh_wide::WideNode<8>;
+        using WBlock = tri_bvh_wide::TriangleBlock<8>;
+        if(header.sizeof_node != sizeof(WNode) ||
+           header.sizeof_block != sizeof(WBlock) ||
+           !check_array(header.nodes_offset, node_count, sizeof(WNode)) ||
+           !check_array(header.blocks_offset, block_count, sizeof(WBlock)) ||
+           !check_cached_nodes(
+                reinterpret_cast<const WNode*>(bytes + header.nodes_offset), node_count,
+                reinterpret_cast<const WBlock*>(bytes + header.blocks_offset), block_count,
+                triangle_count))
+            return false;
+        data.bvh8_nodes.map(reinterpret_cast<const WNode*>(
+            bytes + header.nodes_offset), node_count);
+        data.bvh8_blocks.map(reinterpret_cast<const WBlock*>(
+            bytes + header.blocks_offset), block_count);
+    }
+
+    data.prims.map(reinterpret_cast<const Primitive*>(
+        bytes + header.prims_offset), triangle_count);
+    if(header.half_attributes)
+    {
+        data.half_prim_info.map(reinterpret_cast<const HalfPrimitiveInfo*>(
+            bytes + header.prim_info_offset), triangle_count);
+    }
+    else
+    {
+        data.prim_info.map(reinterpret_cast<const PrimitiveInfo*>(
+            bytes + header.prim_info_offset), triangle_count);
+    }
+
+    data.layout           = layout;
+    data.duplicated_prims = header.duplicated_prims != 0;
+    data.surface_area     = header.surface_area;
+    data.local_bound      = AABB(
+        Vec3(header.local_bound_low[0],  header.local_bound_low[1],  header.local_bound_low[2]),
+        Vec3(header.local_bound_high[0], header.local_bound_high[1], header.local_bound_high[2]));
+
+    data.cache_file = std::move(file);
+
+    return true;
+}
+
+/*
+ * the file is written to a temporary path unique to this writer and then
+ * renamed, so that concurrent writers never interleave and readers never
+ * see a partially written cache
+ */
+bool save_triangle_bvh_cache(
+    const std::string &filename, const TriangleBVHData &data)
+{
+    CacheHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version          = CACHE_VERSION;
+    header.layout           = static_cast<uint32_t>(data.layout);
+    header.half_attributes  = data.half_prim_info.size() ? 1 : 0;
+    header.duplicated_prims = data.duplicated_prims ? 1 : 0;
+    header.sizeof_primitive = sizeof(Primitive);
+    header.sizeof_prim_info = header.half_attributes ?
+                              sizeof(HalfPrimitiveInfo) : sizeof(PrimitiveInfo);
+    header.triangle_count   = data.prims.size();
+    header.surface_area     = data.surface_area;
+    for(int i = 0; i < 3; ++i)
+    {
+        header.local_bound_low[i]  = data.local_bound.low[i];
+        header.local_bound_high[i] = data.local_bound.high[i];
+    }
+
+    const void *prim_info_data = header.half_attributes ?
+        static_cast<const void*>(data.half_prim_info.data()) :
+        static_cast<const void*>(data.prim_info.data());
+    const uint64_t prim_info_bytes =
+        data.prim_info.byte_size() + data.half_prim_info.byte_size();
+
+    const void *nodes_data = nullptr, *blocks_data = nullptr;
+    uint64_t nodes_bytes = 0, blocks_bytes = 0;
+
+    switch(data.layout)
+    {
+    case TriangleBVHParams::Layout::BVH8:
+        header.sizeof_node  = sizeof(tri_bvh_wide::WideNode<8>);
+        header.sizeof_block = sizeof(tri_bvh_wide::TriangleBlock<8>);
+        header.node_count   = data.bvh8_nodes.size();
+        header.block_count  = data.bvh8_blocks.size();
+        nodes_data   = data.bvh8_nodes.data();
+        nodes_bytes  = data.bvh8_nodes.byte_size();
+        blocks_data  = data.bvh8_blocks.data();
+        blocks_bytes = data.bvh8_blocks.byte_size();
+        break;
+    case TriangleBVHParams::Layout::BVH4:
+        header.sizeof_node  = sizeof(tri_bvh_wide::WideNode<4>);
+        header.sizeof_block = sizeof(tri_bvh_wide::TriangleBlock<4>);
+        header.node_count   = data.bvh4_nodes.size();
+        header.block_count  = data.bvh4_blocks.size();
+        nodes_data   = data.bvh4_nodes.data();
+        nodes_bytes  = data.bvh4_nodes.byte_size();
+        blocks_data  = data.bvh4_blocks.data();
+        blocks_bytes = data.bvh4_blocks.byte_size();
+        break;
+    case TriangleBVHParams::Layout::Compressed:
+        header.sizeof_node = sizeof(CompressedNode);
+        header.node_count  = data.compressed_nodes.size();
+        nodes_data  = data.compressed_nodes.data();
+        nodes_bytes = data.compressed_nodes.byte_size();
+        break;
+    default:
+        header.sizeof_node = sizeof(Node);
+        header.node_count  = data.nodes.size();
+        nodes_data  = data.nodes.data();
+        nodes_bytes = data.nodes.byte_size();
+        break;
+    }
+
+    header.prims_offset     = align_cache_offset(sizeof(CacheHeader));
+    header.prim_info_offset = align_cache_offset(header.prims_offset + data.prims.byte_size());
+    header.nodes_offset     = align_cache_offset(header.prim_info_offset + prim_info_bytes);
+    header.blocks_offset    = align_cache_offset(header.nodes_offset + nodes_bytes);
+
+    const std::string tmp_filename = unique_cache_tmp_filename(filename);
+
+    {
+        std::ofstream fout(tmp_filename, std::ios::binary | std::ios::trunc);
+        if(!fout)
+            return false;
+
+        uint64_t written = 0;
+        auto write_at = [&](uint64_t offset, const void *data, uint64_t bytes)
+        {
+            static const char zeros[CACHE_ALIGNMENT] = {};
+            assert(offset >= written && offset - written < CACHE_ALIGNMENT);
+            fout.write(zeros, static_cast<std::streamsize>(offset - written));
+            fout.write(static_cast<const char*>(data),
+                       static_cast<std::streamsize>(bytes));
+            written = offset + bytes;
+        };
+
+        write_at(0, &header, sizeof(header));
+        write_at(header.prims_offset, data.prims.data(), data.prims.byte_size());
+        write_at(header.prim_info_offset, prim_info_data, prim_info_bytes);
+        write_at(header.nodes_offset, nodes_data, nodes_bytes);
+        if(blocks_bytes)
+            write_at(header.blocks_offset, blocks_data, blocks_bytes);
+
+        if(!fout)
+            return false;
+    }
+
+    std::error_code err;
+    std::filesystem::rename(tmp_filename, filename, err);
+    if(err)
+    {
+        std::filesystem::remove(tmp_filename, err);
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace tri_bvh
+
+AGZ_TRACER_END
@@ -0,0 +1,505 @@
+#pragma once
+
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <agz/tracer/create/geometry.h>
+#include <agz/tracer/utility/half.h>
+#include <agz/tracer/utility/mapped_file.h>
+#include <agz/utility/mesh.h>
+
+#include "./triangle_bvh_wide.h"
+
+/*
+ * types and helpers shared by translation units of the native triangle bvh
+ *
+ *  triangle_bvh.cpp            : default sah builder, compaction and traversal
+ *  triangle_bvh_sbvh.cpp       : spatial split builder
+ *  triangle_bvh_lbvh.cpp       : linear builder and treelet restructuring
+ *  triangle_bvh_compressed.cpp : conversion to compressed nodes
+ *  triangle_bvh_cache.cpp      : cache file serialization
+ */
+
+AGZ_TRACER_BEGIN
+
+namespace tri_bvh
+{
+
+    // stack size for traversal the bvh tree
+    constexpr int TRAVERSAL_STACK_SIZE = 128;
+
+    // triangle in bvh
+    struct Primitive
+    {
+        Vec3 a_, b_a_, c_a_;
+    };
+
+    // triangle info in bvh
+    struct PrimitiveInfo
+    {
+        Vec3 n_a_, n_b_a_, n_c_a_;
+        Vec2 t_a_, t_b_a_, t_c_a_;
+        Vec3 x_, z_;
+    };
+
+    // triangle info stored in half precision
+    struct HalfPrimitiveInfo
+    {
+        uint16_t n_a_[3], n_b_a_[3], n_c_a_[3];
+        uint16_t t_a_[2], t_b_a_[2], t_c_a_[2];
+        uint16_t x_[3], z_[3];
+    };
+
+    template<int N, typename V>
+    void encode_half(const V &v, uint16_t (&out)[N]) noexcept
+    {
+        for(int i = 0; i < N; ++i)
+            out[i] = float_to_half(static_cast<float>(v[i]));
+    }
+
+    template<int N>
+    Vec3 decode_half3(const uint16_t (&h)[N]) noexcept
+    {
+        return Vec3(half_to_float(h[0]), half_to_float(h[1]), half_to_float(h[2]));
+    }
+
+    template<int N>
+    Vec2 decode_half2(const uint16_t (&h)[N]) noexcept
+    {
+        return Vec2(half_to_float(h[0]), half_to_float(h[1]));
+    }
+
+    inline HalfPrimitiveInfo encode_prim_info(const PrimitiveInfo &info) noexcept
+    {
+        HalfPrimitiveInfo ret;
+        encode_half(info.n_a_,   ret.n_a_);
+        encode_half(info.n_b_a_, ret.n_b_a_);
+        encode_half(info.n_c_a_, ret.n_c_a_);
+        encode_half(info.t_a_,   ret.t_a_);
+        encode_half(info.t_b_a_, ret.t_b_a_);
+        encode_half(info.t_c_a_, ret.t_c_a_);
+        encode_half(info.x_,     ret.x_);
+        encode_half(info.z_,     ret.z_);
+        return ret;
+    }
+
+    inline PrimitiveInfo decode_prim_info(const HalfPrimitiveInfo &info) noexcept
+    {
+        PrimitiveInfo ret;
+        ret.n_a_   = decode_half3(info.n_a_);
+        ret.n_b_a_ = decode_half3(info.n_b_a_);
+        ret.n_c_a_ = decode_half3(info.n_c_a_);
+        ret.t_a_   = decode_half2(info.t_a_);
+        ret.t_b_a_ = decode_half2(info.t_b_a_);
+        ret.t_c_a_ = decode_half2(info.t_c_a_);
+
+        // rounding breaks orthogonality of the geometry frame
+        ret.z_ = decode_half3(info.z_).normalize();
+        const Vec3 x = decode_half3(info.x_);
+        ret.x_ = (x - dot(x, ret.z_) * ret.z_).normalize();
+
+        return ret;
+    }
+
+    // ray-aabb slab test
+    inline bool intersect_aabb(
+        const real *low, const real *high,
+        const real *ori, const real *inv_dir,
+        real t_min, real t_max, real *inct_t) noexcept
+    {
+        const real nx = inv_dir[0] * (low[0] - ori[0]);
+        const real ny = inv_dir[1] * (low[1] - ori[1]);
+        const real nz = inv_dir[2] * (low[2] - ori[2]);
+
+        const real fx = inv_dir[0] * (high[0] - ori[0]);
+        const real fy = inv_dir[1] * (high[1] - ori[1]);
+        const real fz = inv_dir[2] * (high[2] - ori[2]);
+
+        t_min = (std::max)(t_min, (std::min)(nx, fx));
+        t_min = (std::max)(t_min, (std::min)(ny, fy));
+        t_min = (std::max)(t_min, (std::min)(nz, fz));
+
+        t_max = (std::min)(t_max, (std::max)(nx, fx));
+        t_max = (std::min)(t_max, (std::max)(ny, fy));
+        t_max = (std::min)(t_max, (std::max)(nz, fz));
+
+        *inct_t = t_min;
+        return t_min <= t_max;
+    }
+
+    // node in triangle bvh
+    struct Node
+    {
+        real low[3], high[3];
+
+        // internal node when start == uint32_t.max; otherwise, leaf node
+        uint32_t start, end_or_right_offset;
+
+        static Node new_leaf(
+            const real *low, const real *high, uint32_t start, uint32_t end)
+        {
+            const Node ret = {
+                { low[0],  low[1],  low[2] },
+				{ high[0], high[1], high[2] },
+				start, end
+            };
+            assert(ret.is_leaf());
+            return ret;
+        }
+
+        static Node new_interior(
+            const real *low, const real *high, uint32_t right_offset)
+        {
+            const Node ret = {
+                { low[0],  low[1],  low[2] },
+				{ high[0], high[1], high[2] },
+                std::numeric_limits<uint32_t>::max(),
+                right_offset
+            };
+            assert(!ret.is_leaf());
+            return ret;
+        }
+
+        bool is_leaf() const noexcept
+        {
+            return start < std::numeric_limits<uint32_t>::max();
+        }
+
+        bool has_intersection(
+            const real *ori, const real *inv_dir,
+            real t_min, real t_max, real *inct_t) const noexcept
+        {
+            return intersect_aabb(low, high, ori, inv_dir, t_min, t_max, inct_t);
+        }
+    };
+
+    // children of compressed node
+    constexpr uint32_t COMPRESSED_LEAF_FLAG        = 0x80000000;
+    constexpr uint32_t COMPRESSED_LEAF_COUNT_SHIFT = 27;
+    constexpr uint32_t COMPRESSED_LEAF_COUNT_MASK  = 0xf;
+    constexpr uint32_t COMPRESSED_LEAF_START_MASK  = (1u << COMPRESSED_LEAF_COUNT_SHIFT) - 1;
+    constexpr uint32_t COMPRESSED_EMPTY_CHILD      = 0xffffffff;
+    constexpr int      COMPRESSED_MAX_LEAF_SIZE    = int(COMPRESSED_LEAF_COUNT_MASK) + 1;
+
+    /**
+     * @brief interior node of binary bvh with 8-bit quantized child bounds
+     *
+     * child bound on axis k is [dequantize(child_low[c][k]), dequantize(child_high[c][k])]
+     * with 'origin[k] + q * 2^scale_exp[k]', which always contains the exact bound.
+     * leaf children are stored inline as (LEAF_FLAG | count - 1 | first triangle)
+     */
+    struct CompressedNode
+    {
+        real origin[3];
+        int8_t scale_exp[3];
+        uint8_t pad;
+
+        uint8_t child_low[2][3];
+        uint8_t child_high[2][3];
+
+        uint32_t child[2];
+
+        static real exp_to_scale(int exp) noexcept
+        {
+            assert(-126 <= exp && exp <= 127);
+            const uint32_t bits = static_cast<uint32_t>(exp + 127) << 23;
+            float ret;
+            std::memcpy(&ret, &bits, sizeof(ret));
+            return ret;
+        }
+
+        static real dequantize(real origin, uint8_t q, real scale) noexcept
+        {
+            return origin + real(q) * scale;
+        }
+
+        bool has_intersection(
+            int c, const real *ori, const real *inv_dir,
+            real t_min, real t_max, real *inct_t) const noexcept
+        {
+            real low[3], high[3];
+            for(int k = 0; k < 3; ++k)
+            {
+                const real scale = exp_to_scale(scale_exp[k]);
+                low[k]  = dequantize(origin[k], child_low[c][k],  scale);
+                high[k] = dequantize(origin[k], child_high[c][k], scale);
+            }
+            return intersect_aabb(low, high, ori, inv_dir, t_min, t_max, inct_t);
+        }
+    };
+
+    // linking node used in building bvh
+    // leaf node when left == nullptr. otherwise, internal node
+    struct BuildingNode
+    {
+        AABB bounding;
+        BuildingNode *left = nullptr, *right = nullptr;
+        uint32_t start = 0, end = 0;
+
+        // used by treelet restructuring only
+        real sah_cost = 0;
+    };
+
+    // triangle used in building bvh
+    struct BuildingTriangle
+    {
+        const mesh::vertex_t *vtx = nullptr;
+        Vec3 centroid;
+    };
+
+    struct BuildingResult
+    {
+        BuildingNode *root;
+        uint32_t node_count;
+    };
+
+    // subtrees with less triangles are built in a single thread
+    constexpr uint32_t PARALLEL_SUBTREE_THRESHOLD = 1 << 16;
+
+    // surface area of aabb. bound must be valid
+    inline real aabb_surface_area(const AABB &bound) noexcept
+    {
+        const Vec3 delta = bound.high - bound.low;
+        return 2 * (delta.x * delta.y + delta.y * delta.z + delta.z * delta.x);
+    }
+
+    // bin used in binned sah
+    struct SAHBin
+    {
+        AABB bounding;
+        uint32_t count = 0;
+
+        // count * area of the right part when splitting after this bin
+        real right_cost = 0;
+    };
+
+    inline uint32_t sah_bin_index(
+        const Vec3 &centroid, int axis,
+        const AABB &centroid_bound, uint32_t bin_count) noexcept
+    {
+        const real axis_low = centroid_bound.low[axis];
+        const real axis_len = centroid_bound.high[axis] - axis_low;
+        if(axis_len <= 0)
+            return 0;
+        const real bin_scale = bin_count / axis_len;
+        return (std::min)(
+            bin_count - 1,
+            static_cast<uint32_t>((centroid[axis] - axis_low) * bin_scale));
+    }
+
+    // accumulate triangles in [start, end) into bins of all three axes
+    //
+    // bins[axis * bin_count + i] is the ith bin on the axis
+    inline void fill_sah_bins(
+        const BuildingTriangle *triangles, uint32_t start, uint32_t end,
+        const AABB &centroid_bound, uint32_t bin_count, SAHBin *bins) noexcept
+    {
+        for(uint32_t i = start; i < end; ++i)
+        {
+            const auto &tri = triangles[i];
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                const uint32_t bin_idx = sah_bin_index(
+                    tri.centroid, axis, centroid_bound, bin_count);
+
+                auto &bin = bins[axis * bin_count + bin_idx];
+                ++bin.count;
+                bin.bounding |= tri.vtx[0].position;
+                bin.bounding |= tri.vtx[1].position;
+                bin.bounding |= tri.vtx[2].position;
+            }
+        }
+    }
+
+    // find the best split position with filled bins
+    //
+    // split after bins[*best_bin] on *best_axis
+    // returns false when no valid split exists
+    inline bool evaluate_sah_bins(
+        SAHBin *bins, uint32_t bin_count, uint32_t n,
+        const AABB &all_bound, const AABB &centroid_bound, real leaf_cost,
+        int *best_axis, uint32_t *best_bin, real *best_cost) noexcept
+    {
+        const real all_area = aabb_surface_area(all_bound);
+
+        *best_axis = -1;
+        *best_bin  = 0;
+        *best_cost = REAL_INF;
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            if(centroid_bound.high[axis] <= centroid_bound.low[axis])
+                continue;
+
+            SAHBin *axis_bins = bins + axis * bin_count;
+
+            // sweep from right to left to get the area * count of
+            // the right part of each split position
+
+            AABB right_bound;
+            uint32_t right_count = 0;
+            for(uint32_t i = bin_count - 1; i > 0; --i)
+            {
+                right_bound |= axis_bins[i].bounding;
+                right_count += axis_bins[i].count;
+                axis_bins[i - 1].right_cost = right_count ?
+                    right_count * aabb_surface_area(right_bound) : real(0);
+            }
+
+            // sweep from left to right and evaluate split cost
+
+            AABB left_bound;
+            uint32_t left_count = 0;
+            for(uint32_t i = 0; i + 1 < bin_count; ++i)
+            {
+                left_bound |= axis_bins[i].bounding;
+                left_count += axis_bins[i].count;
+                if(!left_count || left_count == n)
+                    continue;
+
+                const real cost = 1 + leaf_cost *
+                    (left_count * aabb_surface_area(left_bound) +
+                     axis_bins[i].right_cost) / all_area;
+
+                if(cost < *best_cost)
+                {
+                    *best_cost = cost;
+                    *best_axis = axis;
+                    *best_bin  = i;
+                }
+            }
+        }
+
+        return *best_axis >= 0;
+    }
+
+    /**
+     * @brief array owned by the bvh or mapped from a cache file
+     */
+    template<typename T>
+    class BVHArray
+    {
+        std::vector<T> owned_;
+        const T *data_ = nullptr;
+        size_t size_ = 0;
+
+    public:
+
+        void assign(std::vector<T> data)
+        {
+            owned_ = std::move(data);
+            data_  = owned_.data();
+            size_  = owned_.size();
+        }
+
+        void map(const T *data, size_t size) noexcept
+        {
+            owned_ = std::vector<T>();
+            data_  = data;
+            size_  = size;
+        }
+
+        const T *data() const noexcept { return data_; }
+
+        size_t size() const noexcept { return size_; }
+
+        size_t byte_size() const noexcept { return size_ * sizeof(T); }
+
+        const T &operator[](size_t idx) const noexcept
+        {
+            assert(idx < size_);
+            return data_[idx];
+        }
+
+        const T *begin() const noexcept { return data_; }
+
+        const T *end() const noexcept { return data_ + size_; }
+    };
+
+    /**
+     * @brief arrays and properties of a local triangle bvh
+     */
+    struct TriangleBVHData
+    {
+        BVHArray<Primitive> prims;
+        BVHArray<Node> nodes;
+
+        // only one of them is filled
+        BVHArray<PrimitiveInfo>     prim_info;
+        BVHArray<HalfPrimitiveInfo> half_prim_info;
+
+        // some triangles are stored more than once (spatial splits)
+        bool duplicated_prims = false;
+
+        TriangleBVHParams::Layout layout = TriangleBVHParams::Layout::Binary;
+
+        BVHArray<CompressedNode> compressed_nodes;
+
+        BVHArray<tri_bvh_wide::WideNode<4>>      bvh4_nodes;
+        BVHArray<tri_bvh_wide::TriangleBlock<4>> bvh4_blocks;
+
+        BVHArray<tri_bvh_wide::WideNode<8>>      bvh8_nodes;
+        BVHArray<tri_bvh_wide::TriangleBlock<8>> bvh8_blocks;
+
+        // keeps the mapped arrays alive when loaded from cache
+        Box<MappedFile> cache_file;
+
+        real surface_area = 0;
+        AABB local_bound;
+    };
+
+    /**
+     * @brief build the linking bvh tree with object and spatial splits
+     *
+     * arenas are resized to the number of build threads and own the created
+     * nodes. triangle references of leaves are stored in output
+     */
+    BuildingResult build_spatial_split_bvh(
+        const mesh::triangle_t *triangles, uint32_t triangle_count,
+        const TriangleBVHParams &params, uint32_t depth_threshold,
+        std::vector<Arena> &arenas, std::vector<BuildingTriangle> &output);
+
+    /**
+     * @brief build the linking bvh tree with sorted morton codes
+     *
+     * triangles are reordered. arenas are resized to the number of build
+     * threads and own the created nodes
+     */
+    BuildingResult build_linear_bvh(
+        BuildingTriangle *triangles, uint32_t triangle_count,
+        const TriangleBVHParams &params, std::vector<Arena> &arenas);
+
+    /**
+     * @brief restructure treelets of a built tree to reduce its sah cost
+     */
+    void optimize_treelets(BuildingNode *root, const TriangleBVHParams &params);
+
+    /**
+     * @brief convert compacted binary nodes to compressed nodes
+     *
+     * leaves must have no more than COMPRESSED_MAX_LEAF_SIZE triangles
+     */
+    void build_compressed_bvh(
+        const Node *nodes, std::vector<CompressedNode> &compressed_nodes);
+
+
+    /**
+     * @brief map bvh data from a cache file written by save_triangle_bvh_cache
+     *
+     * @return false when the file doesn't exist or cannot be used
+     */
+    bool load_triangle_bvh_cache(const std::string &filename, TriangleBVHData &data);
+
+    /**
+     * @brief write bvh data to a cache file
+     *
+     * @return false when the file cannot be written
+     */
+    bool save_triangle_bvh_cache(
+        const std::string &filename, const TriangleBVHData &data);
+
+} // namespace tri_bvh
+
+AGZ_TRACER_END
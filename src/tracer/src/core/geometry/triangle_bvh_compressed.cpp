@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "./triangle_bvh_common.h"
+
+AGZ_TRACER_BEGIN
+
+namespace tri_bvh
+{
+
+namespace
+{
+
+    uint32_t encode_compressed_leaf(const Node &leaf) noexcept
+    {
+        const uint32_t count = leaf.end_or_right_offset - leaf.start;
+        assert(0 < count && count <= uint32_t(COMPRESSED_MAX_LEAF_SIZE));
+        assert(leaf.end_or_right_offset <= COMPRESSED_LEAF_START_MASK);
+        return COMPRESSED_LEAF_FLAG |
+               ((count - 1) << COMPRESSED_LEAF_COUNT_SHIFT) | leaf.start;
+    }
+
+    /**
+     * @brief quantize bounds of children relative to the bound of parent
+     *
+     * children must be contained in parent. children[1] can be nullptr
+     */
+    void quantize_children(
+        const Node &parent, const Node *children[2], CompressedNode &node) noexcept
+    {
+        for(int k = 0; k < 3; ++k)
+        {
+            const real low  = parent.low[k];
+            const real high = parent.high[k];
+
+            // smallest power-of-two scale that covers [low, high] with 255 steps
+
+            int exp = -126;
+            if(high > low)
+            {
+                std::frexp((high - low) / 255, &exp);
+                exp = (std::max)(exp - 1, -126);
+            }
+            while(exp < 127 && CompressedNode::dequantize(
+                low, 255, CompressedNode::exp_to_scale(exp)) < high)
+                ++exp;
+
+            const real scale = CompressedNode::exp_to_scale(exp);
+            node.origin[k]    = low;
+            node.scale_exp[k] = static_cast<int8_t>(exp);
+
+            for(int c = 0; c < 2; ++c)
+            {
+                if(!children[c])
+                {
+                    node.child_low[c][k]  = 0;
+                    node.child_high[c][k] = 0;
+                    continue;
+                }
+
+                // round outwards and fix the rounding error of float division
+
+                const real child_low  = children[c]->low[k];
+                const real child_high = children[c]->high[k];
+
+                int q_low = static_cast<int>(std::floor((child_low - low) / scale));
+                q_low = math::clamp(q_low, 0, 255);
+                while(q_low > 0 && CompressedNode::dequantize(
+                    low, static_cast<uint8_t>(q_low), scale) > child_low)
+                    --q_low;
+
+                int q_high = static_cast<int>(std::ceil((child_high - low) / scale));
+                q_high = math::clamp(q_high, 0, 255);
+                while(q_high < 255 && CompressedNode::dequantize(
+                    low, static_cast<uint8_t>(q_high), scale) < child_high)
+                    ++q_high;
+
+                node.child_low[c][k]  = static_cast<uint8_t>(q_low);
+                node.child_high[c][k] = static_cast<uint8_t>(q_high);
+            }
+        }
+    }
+
+    /**
+     * @brief convert binary subtree rooted at interior node_idx to compressed nodes
+     *
+     * @return index of the created compressed node
+     */
+    uint32_t compress_subtree(
+        uint32_t node_idx, const Node *nodes,
+        std::vector<CompressedNode> &compressed_nodes)
+    {
+        const Node &node = nodes[node_idx];
+        assert(!node.is_leaf());
+
+        const uint32_t child_indices[2] = { node_idx + 1, node.end_or_right_offset };
+        const Node *children[2] = {
+            &nodes[child_indices[0]], &nodes[child_indices[1]]
+        };
+
+        const uint32_t ret = static_cast<uint32_t>(compressed_nodes.size());
+        compressed_nodes.emplace_back();
+
+        CompressedNode compressed = {};
+        quantize_children(node, children, compressed);
+
+        for(int c = 0; c < 2; ++c)
+        {
+            compressed.child[c] = children[c]->is_leaf() ?
+                encode_compressed_leaf(*children[c]) :
+                compress_subtree(child_indices[c], nodes, compressed_nodes);
+        }
+
+        compressed_nodes[ret] = compressed;
+        return ret;
+    }
+
+} // namespace anonymous
+
+void build_compressed_bvh(
+    const Node *nodes, std::vector<CompressedNode> &compressed_nodes)
+{
+    compressed_nodes.clear();
+
+    // traversal always starts from compressed node 0,
+    // so a leaf root is wrapped into a compressed node
+    if(nodes[0].is_leaf())
+    {
+        const Node *children[2] = { &nodes[0], nullptr };
+
+        CompressedNode root = {};
+        quantize_children(nodes[0], children, root);
+        root.child[0] = encode_compressed_leaf(nodes[0]);
+        root.child[1] = COMPRESSED_EMPTY_CHILD;
+        compressed_nodes.push_back(root);
+    }
+    else
+        compress_subtree(0, nodes, compressed_nodes);
+
+    compressed_nodes.shrink_to_fit();
+}
+
+} // namespace tri_bvh
+
+AGZ_TRACER_END
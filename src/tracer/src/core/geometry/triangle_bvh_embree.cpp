@@ -16,21 +16,6 @@ AGZ_TRACER_BEGIN
 namespace tri_bvh_embree_ws
 {
 
-    std::string embree_err_str(RTCError err)
-    {
-        switch(err)
-        {
-        case RTC_ERROR_NONE:              return "no error occurred";
-        case RTC_ERROR_UNKNOWN:           return "an unknown error has occurred";
-        case RTC_ERROR_INVALID_ARGUMENT:  return "an invalid argument was specified";
-        case RTC_ERROR_INVALID_OPERATION: return "the operation is not allowed for the specified object";
-        case RTC_ERROR_OUT_OF_MEMORY:     return "there is not enough memory left to complete the operation";
-        case RTC_ERROR_UNSUPPORTED_CPU:   return "the CPU is not supported as it does not support the lowest ISA Embree is compiled for";
-        case RTC_ERROR_CANCELLED:         return "the operation got canceled by a memory monitor callback or progress monitor callback function";
-        default:                          return "unknown embree error code: " + std::to_string(err);
-        }
-    }
-
     /**
      * @brief 向embree传递的顶点格式
      */
@@ -56,12 +41,6 @@ namespace tri_bvh_embree_ws
         Vec3 x, z;
     };
 
-    [[noreturn]] void throw_embree_error()
-    {
-        const RTCError err = rtcGetDeviceError(embree_device());
-        throw ObjectConstructionException(embree_err_str(err));
-    }
-
     class UntransformedTriangleBVH : public misc::uncopyable_t
     {
         RTCScene scene_ = nullptr;
@@ -228,22 +207,62 @@ namespace tri_bvh_embree_ws
             if(rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
                 return false;
 
-            const real t_val = rayhit.ray.tfar;
-            const real u = rayhit.hit.u;
-            const real v = rayhit.hit.v;
-            const PrimitiveInfo &info = prim_info_[rayhit.hit.primID];
+            fill_intersection(r, rayhit.ray.tfar, rayhit.hit, inct);
+            return true;
+        }
 
-            inct->pos = r.at(t_val);
-            inct->geometry_coord = Coord(info.x, cross(info.z, info.x), info.z);
-            inct->uv = info.t_a + u * info.t_b_a + v * info.t_c_a;
-            inct->t = t_val;
+        void has_intersection_n(
+            const Ray *rays, size_t count, bool *result) const noexcept
+        {
+            thread_local std::vector<RTCRay> embree_rays;
+            embree_rays.resize(count);
 
-            const Vec3 user_z = info.n_a + u * info.n_b_a + v * info.n_c_a;
-            inct->user_coord = inct->geometry_coord.rotate_to_new_z(user_z);
+            for(size_t i = 0; i < count; ++i)
+                embree_rays[i] = to_embree_ray(rays[i]);
 
-            inct->wr = -r.d;
+            RTCIntersectContext inct_ctx{};
+            rtcInitIntersectContext(&inct_ctx);
+            rtcOccluded1M(
+                scene_, &inct_ctx, embree_rays.data(),
+                static_cast<unsigned>(count), sizeof(RTCRay));
 
-            return true;
+            for(size_t i = 0; i < count; ++i)
+            {
+                const float tfar = embree_rays[i].tfar;
+                result[i] = tfar < 0 && std::isinf(tfar);
+            }
+        }
+
+        void closest_intersection_n(
+            const Ray *rays, size_t count,
+            GeometryIntersection *incts, bool *result) const noexcept
+        {
+            thread_local std::vector<RTCRayHit> embree_rayhits;
+            embree_rayhits.resize(count);
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                RTCRayHit &rayhit = embree_rayhits[i];
+                rayhit.ray = to_embree_ray(rays[i]);
+                rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+                rayhit.hit.geomID    = RTC_INVALID_GEOMETRY_ID;
+                rayhit.hit.primID    = RTC_INVALID_GEOMETRY_ID;
+            }
+
+            RTCIntersectContext inct_ctx{};
+            rtcInitIntersectContext(&inct_ctx);
+            rtcIntersect1M(
+                scene_, &inct_ctx, embree_rayhits.data(),
+                static_cast<unsigned>(count), sizeof(RTCRayHit));
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                const RTCRayHit &rayhit = embree_rayhits[i];
+                result[i] = rayhit.hit.geomID != RTC_INVALID_GEOMETRY_ID;
+                if(result[i])
+                    fill_intersection(
+                        rays[i], rayhit.ray.tfar, rayhit.hit, &incts[i]);
+            }
         }
 
         SurfacePoint uniformly_sample(const Sample3 &sam) const noexcept
@@ -277,6 +296,46 @@ namespace tri_bvh_embree_ws
             return prims_;
         }
 
+        void fill_intersection(
+            const Ray &r, real t, const RTCHit &hit,
+            GeometryIntersection *inct) const noexcept
+        {
+            const real u = hit.u;
+            const real v = hit.v;
+            const PrimitiveInfo &info = prim_info_[hit.primID];
+
+            inct->pos = r.at(t);
+            inct->geometry_coord = Coord(info.x, cross(info.z, info.x), info.z);
+            inct->uv = info.t_a + u * info.t_b_a + v * info.t_c_a;
+            inct->t = t;
+
+            const Vec3 user_z = info.n_a + u * info.n_b_a + v * info.n_c_a;
+            inct->user_coord = inct->geometry_coord.rotate_to_new_z(user_z);
+
+            inct->wr = -r.d;
+        }
+
+        RTCScene scene() const noexcept
+        {
+            return scene_;
+        }
+
+    private:
+
+        static RTCRay to_embree_ray(const Ray &r) noexcept
+        {
+            return {
+                r.o.x, r.o.y, r.o.z,
+                r.t_min,
+                r.d.x, r.d.y, r.d.z,
+                0,
+                r.t_max,
+                static_cast<unsigned>(-1), 0, 0
+            };
+        }
+
+    public:
+
         real surface_area() const noexcept
         {
             return surface_area_;
@@ -290,7 +349,7 @@ namespace tri_bvh_embree_ws
 
 } // namespace tri_bvh_embree
 
-class TriangleBVHEmbree : public Geometry
+class TriangleBVHEmbree : public Geometry, public EmbreeGeometry
 {
     Box<const tri_bvh_embree_ws::UntransformedTriangleBVH> untransformed_;
     AABB world_bound_;
@@ -364,6 +423,19 @@ public:
         return untransformed_->closest_intersection(r, inct);
     }
 
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        untransformed_->has_intersection_n(rays, count, result);
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        GeometryIntersection *incts, bool *result) const noexcept override
+    {
+        untransformed_->closest_intersection_n(rays, count, incts, result);
+    }
+
     AABB world_bound() const noexcept override
     {
         return world_bound_;
@@ -395,6 +467,22 @@ public:
     {
         return pdf(sample);
     }
+
+    bool embree_scene(
+        RTCScene *scene, Transform3 *local_to_world) const noexcept override
+    {
+        // triangles are already transformed into the world space
+        *scene = untransformed_->scene();
+        *local_to_world = Transform3();
+        return true;
+    }
+
+    void embree_intersection(
+        const Ray &r, real t, const RTCHit &hit,
+        GeometryIntersection *inct) const noexcept override
+    {
+        untransformed_->fill_intersection(r, t, hit, inct);
+    }
 };
 
 RC<Geometry> create_triangle_bvh_embree(
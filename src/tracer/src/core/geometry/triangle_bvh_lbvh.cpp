@@ -0,0 +1,663 @@
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <agz/tracer/utility/morton.h>
+#include <agz/tracer/utility/nested_parallel.h>
+#include <agz/tracer/utility/parallel_grid.h>
+#include <agz/utility/thread.h>
+
+#include "./triangle_bvh_common.h"
+
+AGZ_TRACER_BEGIN
+
+namespace tri_bvh
+{
+
+namespace
+{
+
+    // triangle count of each parallel task in linear bvh building
+    constexpr int LBVH_GRID_SIZE = 1 << 14;
+
+    /**
+     * @brief linear bvh builder
+     *
+     * triangles are sorted by 63-bit morton codes of their centroids with a
+     * parallel radix sort. then the binary radix tree of sorted codes (karras
+     * 2012) is emitted for all interior nodes in parallel, and subtrees with
+     * no more than max_leaf_size triangles are collapsed into leaves
+     */
+    class LinearBVHBuilder
+    {
+        // radix tree children with this bit are indices of sorted triangles
+        static constexpr uint32_t RADIX_LEAF_BIT = 1u << 31;
+
+        // interior node of radix tree. covers sorted triangles [first, last]
+        struct RadixNode
+        {
+            uint32_t first, last;
+            uint32_t left, right;
+        };
+
+        struct ConvertingTask
+        {
+            uint32_t radix_child;
+            BuildingNode **fillback_ptr;
+        };
+
+        BuildingTriangle *triangles_;
+        const TriangleBVHParams &params_;
+
+        int thread_count_;
+        thread::thread_group_t threads_;
+
+        std::vector<uint64_t> codes_;
+        std::vector<RadixNode> radix_nodes_;
+
+        template<typename Func>
+        void parallel_for(uint32_t n, const Func &func)
+        {
+            parallel_for_1d_grid(
+                thread_count_, static_cast<int>(n), LBVH_GRID_SIZE, threads_,
+                [&](int thread_index, int beg, int end)
+            {
+                func(thread_index,
+                     static_cast<uint32_t>(beg), static_cast<uint32_t>(end));
+            });
+        }
+
+        void compute_codes(uint32_t n)
+        {
+            std::vector<AABB> thread_bounds(thread_count_);
+            parallel_for(n, [&](int thread_index, uint32_t beg, uint32_t end)
+            {
+                for(uint32_t i = beg; i < end; ++i)
+                    thread_bounds[thread_index] |= triangles_[i].centroid;
+            });
+
+            AABB centroid_bound;
+            for(auto &bound : thread_bounds)
+                centroid_bound |= bound;
+
+            codes_.resize(n);
+            parallel_for(n, [&](int, uint32_t beg, uint32_t end)
+            {
+                for(uint32_t i = beg; i < end; ++i)
+                {
+                    codes_[i] = morton_code(normalize_to_morton_space(
+                        triangles_[i].centroid, centroid_bound));
+                }
+            });
+        }
+
+        // lsd radix sort of triangles by codes_ with 8-bit digits
+        void sort_by_codes(uint32_t n)
+        {
+            constexpr int DIGIT_BITS   = 8;
+            constexpr int BUCKET_COUNT = 1 << DIGIT_BITS;
+
+            const uint32_t chunk_count = (n + LBVH_GRID_SIZE - 1) / LBVH_GRID_SIZE;
+
+            std::vector<uint64_t> codes_buffer(n);
+            std::vector<BuildingTriangle> triangles_buffer(n);
+
+            uint64_t *src_codes = codes_.data();
+            uint64_t *dst_codes = codes_buffer.data();
+            BuildingTriangle *src_triangles = triangles_;
+            BuildingTriangle *dst_triangles = triangles_buffer.data();
+
+            // histograms[chunk * BUCKET_COUNT + digit]
+            std::vector<uint32_t> histograms(chunk_count * BUCKET_COUNT);
+
+            for(int shift = 0; shift < 63; shift += DIGIT_BITS)
+            {
+                parallel_for(n, [&](int, uint32_t beg, uint32_t end)
+                {
+                    uint32_t *histogram = &histograms[beg / LBVH_GRID_SIZE * BUCKET_COUNT];
+                    std::fill(histogram, histogram + BUCKET_COUNT, 0u);
+                    for(uint32_t i = beg; i < end; ++i)
+                        ++histogram[(src_codes[i] >> shift) & (BUCKET_COUNT - 1)];
+                });
+
+                // skip this digit when it is the same for all triangles
+
+                bool all_same = false;
+                for(int digit = 0; digit < BUCKET_COUNT && !all_same; ++digit)
+                {
+                    uint32_t total = 0;
+                    for(uint32_t chunk = 0; chunk < chunk_count; ++chunk)
+                        total += histograms[chunk * BUCKET_COUNT + digit];
+                    all_same = total == n;
+                }
+                if(all_same)
+                    continue;
+
+                // turn counts into output offsets of each (digit, chunk)
+
+                uint32_t offset = 0;
+                for(int digit = 0; digit < BUCKET_COUNT; ++digit)
+                {
+                    for(uint32_t chunk = 0; chunk < chunk_count; ++chunk)
+                    {
+                        uint32_t &h = histograms[chunk * BUCKET_COUNT + digit];
+                        const uint32_t count = h;
+                        h = offset;
+                        offset += count;
+                    }
+                }
+
+                parallel_for(n, [&](int, uint32_t beg, uint32_t end)
+                {
+                    uint32_t *offsets = &histograms[beg / LBVH_GRID_SIZE * BUCKET_COUNT];
+                    for(uint32_t i = beg; i < end; ++i)
+                    {
+                        const uint32_t dst = offsets[
+                            (src_codes[i] >> shift) & (BUCKET_COUNT - 1)]++;
+                        dst_codes[dst]     = src_codes[i];
+                        dst_triangles[dst] = src_triangles[i];
+                    }
+                });
+
+                std::swap(src_codes, dst_codes);
+                std::swap(src_triangles, dst_triangles);
+            }
+
+            if(src_triangles != triangles_)
+            {
+                parallel_for(n, [&](int, uint32_t beg, uint32_t end)
+                {
+                    std::copy(src_codes + beg, src_codes + end, dst_codes + beg);
+                    std::copy(src_triangles + beg, src_triangles + end, triangles_ + beg);
+                });
+            }
+        }
+
+        // length of common prefix of code i and code j.
+        // equal codes are distinguished by indices
+        int common_prefix(uint32_t n, int64_t i, int64_t j) const noexcept
+        {
+            if(j < 0 || j >= static_cast<int64_t>(n))
+                return -1;
+
+            const uint64_t a = codes_[i], b = codes_[j];
+            if(a != b)
+                return count_leading_zeros(a ^ b);
+            return 64 + count_leading_zeros(static_cast<uint64_t>(i ^ j));
+        }
+
+        RadixNode emit_radix_node(uint32_t n, int64_t i) const noexcept
+        {
+            // direction of the range covered by node i
+
+            const int d = common_prefix(n, i, i + 1) >
+                          common_prefix(n, i, i - 1) ? 1 : -1;
+
+            // find the other end of the range with exponential & binary search
+
+            const int min_prefix = common_prefix(n, i, i - d);
+
+            int64_t max_len = 2;
+            while(common_prefix(n, i, i + max_len * d) > min_prefix)
+                max_len *= 2;
+
+            int64_t len = 0;
+            for(int64_t t = max_len / 2; t >= 1; t /= 2)
+            {
+                if(common_prefix(n, i, i + (len + t) * d) > min_prefix)
+                    len += t;
+            }
+            const int64_t j = i + len * d;
+
+            // find the split position with binary search
+
+            const int node_prefix = common_prefix(n, i, j);
+
+            int64_t split = 0, t = len;
+            do
+            {
+                t = (t + 1) / 2;
+                if(common_prefix(n, i, i + (split + t) * d) > node_prefix)
+                    split += t;
+            } while(t > 1);
+
+            const int64_t gamma = i + split * d + (std::min)(d, 0);
+
+            RadixNode ret;
+            ret.first = static_cast<uint32_t>((std::min)(i, j));
+            ret.last  = static_cast<uint32_t>((std::max)(i, j));
+            ret.left  = static_cast<uint32_t>(gamma);
+            ret.right = static_cast<uint32_t>(gamma + 1);
+            if(ret.first == ret.left)
+                ret.left |= RADIX_LEAF_BIT;
+            if(ret.last == gamma + 1)
+                ret.right |= RADIX_LEAF_BIT;
+            return ret;
+        }
+
+        void radix_range(uint32_t child, uint32_t *first, uint32_t *last) const noexcept
+        {
+            if(child & RADIX_LEAF_BIT)
+                *first = *last = child & ~RADIX_LEAF_BIT;
+            else
+            {
+                *first = radix_nodes_[child].first;
+                *last  = radix_nodes_[child].last;
+            }
+        }
+
+        BuildingNode *new_leaf(uint32_t first, uint32_t last, Arena &arena) const
+        {
+            auto leaf = arena.create<BuildingNode>();
+            leaf->bounding = AABB();
+            for(uint32_t i = first; i <= last; ++i)
+            {
+                leaf->bounding |= triangles_[i].vtx[0].position;
+                leaf->bounding |= triangles_[i].vtx[1].position;
+                leaf->bounding |= triangles_[i].vtx[2].position;
+            }
+            leaf->left  = nullptr;
+            leaf->right = nullptr;
+            leaf->start = first;
+            leaf->end   = last + 1;
+            return leaf;
+        }
+
+        BuildingNode *new_interior(Arena &arena) const
+        {
+            auto interior = arena.create<BuildingNode>();
+            interior->left  = nullptr;
+            interior->right = nullptr;
+            interior->start = 0;
+            interior->end   = 0;
+            return interior;
+        }
+
+        // convert radix subtree to building nodes. returns node count
+        uint32_t convert_subtree(
+            uint32_t radix_child, BuildingNode **fillback_ptr, Arena &arena) const
+        {
+            uint32_t first, last;
+            radix_range(radix_child, &first, &last);
+
+            if(last - first < static_cast<uint32_t>(params_.max_leaf_size))
+            {
+                *fillback_ptr = new_leaf(first, last, arena);
+                return 1;
+            }
+
+            const RadixNode &radix_node = radix_nodes_[radix_child];
+            BuildingNode *interior = new_interior(arena);
+            *fillback_ptr = interior;
+
+            const uint32_t node_count = 1
+                + convert_subtree(radix_node.left,  &interior->left,  arena)
+                + convert_subtree(radix_node.right, &interior->right, arena);
+
+            interior->bounding = interior->left->bounding | interior->right->bounding;
+            return node_count;
+        }
+
+        // convert top levels of the radix tree, and collect large subtrees
+        // into tasks. bounds of created interior nodes are left unset
+        uint32_t convert_top(
+            uint32_t radix_child, BuildingNode **fillback_ptr, Arena &arena,
+            std::vector<ConvertingTask> &tasks,
+            std::vector<BuildingNode*> &top_interiors) const
+        {
+            uint32_t first, last;
+            radix_range(radix_child, &first, &last);
+
+            if(last - first < PARALLEL_SUBTREE_THRESHOLD ||
+               last - first < static_cast<uint32_t>(params_.max_leaf_size))
+            {
+                tasks.push_back({ radix_child, fillback_ptr });
+                return 0;
+            }
+
+            const RadixNode &radix_node = radix_nodes_[radix_child];
+            BuildingNode *interior = new_interior(arena);
+            *fillback_ptr = interior;
+            top_interiors.push_back(interior);
+
+            return 1
+                + convert_top(radix_node.left, &interior->left, arena, tasks, top_interiors)
+                + convert_top(radix_node.right, &interior->right, arena, tasks, top_interiors);
+        }
+
+    public:
+
+        LinearBVHBuilder(BuildingTriangle *triangles, const TriangleBVHParams &params)
+            : triangles_(triangles), params_(params)
+        {
+            thread_count_ = nested_worker_count(params.build_worker_count);
+        }
+
+        /**
+         * @brief build the bvh of triangles in [0, triangle_count)
+         *
+         * triangles are reordered. arenas.size() must be equal to thread_count()
+         */
+        BuildingResult build(uint32_t triangle_count, std::vector<Arena> &arenas)
+        {
+            assert(arenas.size() == static_cast<size_t>(thread_count_));
+
+            compute_codes(triangle_count);
+            sort_by_codes(triangle_count);
+
+            BuildingResult ret = { nullptr, 0 };
+
+            if(triangle_count == 1)
+            {
+                ret.root = new_leaf(0, 0, arenas[0]);
+                ret.node_count = 1;
+                return ret;
+            }
+
+            radix_nodes_.resize(triangle_count - 1);
+            parallel_for(triangle_count - 1, [&](int, uint32_t beg, uint32_t end)
+            {
+                for(uint32_t i = beg; i < end; ++i)
+                    radix_nodes_[i] = emit_radix_node(triangle_count, i);
+            });
+
+            // the root of radix tree is interior node 0
+
+            std::vector<ConvertingTask> tasks;
+            std::vector<BuildingNode*> top_interiors;
+            ret.node_count = convert_top(0, &ret.root, arenas[0], tasks, top_interiors);
+
+            std::atomic<size_t> next_task = 0;
+            std::atomic<uint32_t> subtree_node_count = 0;
+
+            threads_.run(thread_count_, [&](int thread_index)
+            {
+                uint32_t thread_node_count = 0;
+                for(;;)
+                {
+                    const size_t task_idx = next_task++;
+                    if(task_idx >= tasks.size())
+                        break;
+
+                    thread_node_count += convert_subtree(
+                        tasks[task_idx].radix_child, tasks[task_idx].fillback_ptr,
+                        arenas[thread_index]);
+                }
+                subtree_node_count += thread_node_count;
+            });
+
+            ret.node_count += subtree_node_count;
+
+            // children are created after their parents
+
+            for(auto it = top_interiors.rbegin(); it != top_interiors.rend(); ++it)
+                (*it)->bounding = (*it)->left->bounding | (*it)->right->bounding;
+
+            codes_ = std::vector<uint64_t>();
+            radix_nodes_ = std::vector<RadixNode>();
+
+            return ret;
+        }
+
+        int thread_count() const noexcept
+        {
+            return thread_count_;
+        }
+    };
+
+    /**
+     * @brief treelet restructuring (karras & aila 2013)
+     *
+     * visit interior nodes bottom-up. each visited node and its descendants
+     * with largest surface areas form a treelet with up to 7 leaves, which is
+     * rebuilt with the topology of minimal sah cost found by dynamic programming.
+     * leaf nodes are never changed
+     */
+    class TreeletOptimizer
+    {
+        static constexpr int MAX_TREELET_LEAF_COUNT = 7;
+        static constexpr int SUBSET_COUNT = 1 << MAX_TREELET_LEAF_COUNT;
+
+        real leaf_cost_;
+
+        int thread_count_;
+        thread::thread_group_t threads_;
+
+        // nodes above this depth are optimized after the parallel part
+        int parallel_depth_ = 0;
+
+        struct Treelet
+        {
+            BuildingNode *leaves[MAX_TREELET_LEAF_COUNT];
+            BuildingNode *interiors[MAX_TREELET_LEAF_COUNT - 1];
+            int leaf_count = 0;
+
+            real  cost[SUBSET_COUNT];
+            uint8_t partition[SUBSET_COUNT];
+
+            int next_interior = 0;
+        };
+
+        real leaf_sah_cost(const BuildingNode *leaf) const noexcept
+        {
+            return aabb_surface_area(leaf->bounding) * leaf_cost_ *
+                   static_cast<real>(leaf->end - leaf->start);
+        }
+
+        static real interior_sah_cost(const BuildingNode *node) noexcept
+        {
+            return aabb_surface_area(node->bounding)
+                 + node->left->sah_cost + node->right->sah_cost;
+        }
+
+        static BuildingNode *rebuild_treelet(Treelet &treelet, uint32_t subset)
+        {
+            if(!(subset & (subset - 1)))
+            {
+                int leaf_idx = 0;
+                while(!(subset & (1u << leaf_idx)))
+                    ++leaf_idx;
+                return treelet.leaves[leaf_idx];
+            }
+
+            // preorder assignment keeps the treelet root unchanged
+            BuildingNode *node = treelet.interiors[treelet.next_interior++];
+
+            const uint32_t left_subset = treelet.partition[subset];
+            node->left     = rebuild_treelet(treelet, left_subset);
+            node->right    = rebuild_treelet(treelet, subset ^ left_subset);
+            node->bounding = node->left->bounding | node->right->bounding;
+            node->sah_cost = treelet.cost[subset];
+
+            return node;
+        }
+
+        void optimize_treelet(BuildingNode *root) const
+        {
+            Treelet treelet;
+
+            treelet.leaves[0] = root->left;
+            treelet.leaves[1] = root->right;
+            treelet.leaf_count = 2;
+            treelet.interiors[0] = root;
+            int interior_count = 1;
+
+            // expand the treelet leaf with the largest surface area
+
+            while(treelet.leaf_count < MAX_TREELET_LEAF_COUNT)
+            {
+                int expanded = -1;
+                real expanded_area = -1;
+                for(int i = 0; i < treelet.leaf_count; ++i)
+                {
+                    const BuildingNode *leaf = treelet.leaves[i];
+                    if(!leaf->left)
+                        continue;
+
+                    const real area = aabb_surface_area(leaf->bounding);
+                    if(area > expanded_area)
+                    {
+                        expanded = i;
+                        expanded_area = area;
+                    }
+                }
+
+                if(expanded < 0)
+                    break;
+
+                BuildingNode *node = treelet.leaves[expanded];
+                treelet.interiors[interior_count++] = node;
+                treelet.leaves[expanded] = node->left;
+                treelet.leaves[treelet.leaf_count++] = node->right;
+            }
+
+            if(treelet.leaf_count < 3)
+                return;
+
+            // optimal cost of each leaf subset. subsets of a set are
+            // always numerically smaller than it
+
+            const uint32_t full_set = (1u << treelet.leaf_count) - 1;
+
+            for(uint32_t subset = 1; subset <= full_set; ++subset)
+            {
+                if(!(subset & (subset - 1)))
+                {
+                    int leaf_idx = 0;
+                    while(!(subset & (1u << leaf_idx)))
+                        ++leaf_idx;
+                    treelet.cost[subset] = treelet.leaves[leaf_idx]->sah_cost;
+                    continue;
+                }
+
+                AABB bound;
+                for(int i = 0; i < treelet.leaf_count; ++i)
+                {
+                    if(subset & (1u << i))
+                        bound |= treelet.leaves[i]->bounding;
+                }
+
+                // enumerate partitions whose left part contains the lowest bit,
+                // so that each partition is tested only once
+
+                const uint32_t lowest_bit = subset & (~subset + 1);
+
+                real best_cost = REAL_INF;
+                uint32_t best_left = lowest_bit;
+
+                for(uint32_t left = (subset - 1) & subset; left; left = (left - 1) & subset)
+                {
+                    if(!(left & lowest_bit))
+                        continue;
+
+                    const real cost = treelet.cost[left] + treelet.cost[subset ^ left];
+                    if(cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_left = left;
+                    }
+                }
+
+                treelet.cost[subset]      = aabb_surface_area(bound) + best_cost;
+                treelet.partition[subset] = static_cast<uint8_t>(best_left);
+            }
+
+            if(treelet.cost[full_set] >= root->sah_cost * real(0.9999))
+                return;
+
+            rebuild_treelet(treelet, full_set);
+            assert(treelet.next_interior == interior_count);
+        }
+
+        // optimize a subtree bottom-up
+        void optimize_subtree(BuildingNode *node) const
+        {
+            if(!node->left)
+            {
+                node->sah_cost = leaf_sah_cost(node);
+                return;
+            }
+
+            optimize_subtree(node->left);
+            optimize_subtree(node->right);
+
+            node->sah_cost = interior_sah_cost(node);
+            optimize_treelet(node);
+        }
+
+        void collect_subtrees(
+            BuildingNode *node, int depth, std::vector<BuildingNode*> &subtrees) const
+        {
+            if(depth >= parallel_depth_ || !node->left)
+            {
+                subtrees.push_back(node);
+                return;
+            }
+            collect_subtrees(node->left, depth + 1, subtrees);
+            collect_subtrees(node->right, depth + 1, subtrees);
+        }
+
+        void optimize_top(BuildingNode *node, int depth) const
+        {
+            if(depth >= parallel_depth_ || !node->left)
+                return;
+
+            optimize_top(node->left, depth + 1);
+            optimize_top(node->right, depth + 1);
+
+            node->sah_cost = interior_sah_cost(node);
+            optimize_treelet(node);
+        }
+
+    public:
+
+        explicit TreeletOptimizer(const TriangleBVHParams &params)
+        {
+            leaf_cost_ = params.sah_leaf_cost;
+            thread_count_ = nested_worker_count(params.build_worker_count);
+
+            // several subtrees for each thread
+            while((1 << parallel_depth_) < 8 * thread_count_)
+                ++parallel_depth_;
+        }
+
+        void optimize(BuildingNode *root)
+        {
+            std::vector<BuildingNode*> subtrees;
+            collect_subtrees(root, 0, subtrees);
+
+            std::atomic<size_t> next_subtree = 0;
+            threads_.run(thread_count_, [&](int)
+            {
+                for(;;)
+                {
+                    const size_t idx = next_subtree++;
+                    if(idx >= subtrees.size())
+                        break;
+                    optimize_subtree(subtrees[idx]);
+                }
+            });
+
+            optimize_top(root, 0);
+        }
+    };
+
+} // namespace anonymous
+
+BuildingResult build_linear_bvh(
+    BuildingTriangle *triangles, uint32_t triangle_count,
+    const TriangleBVHParams &params, std::vector<Arena> &arenas)
+{
+    LinearBVHBuilder builder(triangles, params);
+    arenas = std::vector<Arena>(builder.thread_count());
+    return builder.build(triangle_count, arenas);
+}
+
+void optimize_treelets(BuildingNode *root, const TriangleBVHParams &params)
+{
+    TreeletOptimizer(params).optimize(root);
+}
+
+} // namespace tri_bvh
+
+AGZ_TRACER_END
@@ -0,0 +1,681 @@
+#include <algorithm>
+#include <atomic>
+#include <queue>
+#include <stack>
+#include <vector>
+
+#include <agz/tracer/utility/nested_parallel.h>
+#include <agz/utility/thread.h>
+
+#include "./triangle_bvh_common.h"
+
+AGZ_TRACER_BEGIN
+
+namespace tri_bvh
+{
+
+namespace
+{
+
+    // reference to a triangle in spatial split bvh.
+    // bound may be clipped by spatial split planes
+    struct SpatialRef
+    {
+        uint32_t tri;
+        AABB bound;
+    };
+
+    // bin used in spatial split
+    struct SpatialBin
+    {
+        AABB bounding;
+        uint32_t enter = 0, exit = 0;
+
+        // references and bound of the right part when splitting after this bin
+        AABB right_bounding;
+        uint32_t right_count = 0;
+    };
+
+    bool is_valid_aabb(const AABB &bound) noexcept
+    {
+        return bound.low.x <= bound.high.x &&
+               bound.low.y <= bound.high.y &&
+               bound.low.z <= bound.high.z;
+    }
+
+    AABB aabb_intersection(const AABB &a, const AABB &b) noexcept
+    {
+        return AABB(
+            Vec3((std::max)(a.low.x, b.low.x),
+                 (std::max)(a.low.y, b.low.y),
+                 (std::max)(a.low.z, b.low.z)),
+            Vec3((std::min)(a.high.x, b.high.x),
+                 (std::min)(a.high.y, b.high.y),
+                 (std::min)(a.high.z, b.high.z)));
+    }
+
+    // bound of the part of triangle between two planes perpendicular to axis
+    AABB clip_triangle(
+        const mesh::vertex_t *vtx, int axis,
+        real plane_low, real plane_high) noexcept
+    {
+        AABB ret;
+        for(int i = 0; i < 3; ++i)
+        {
+            const Vec3 &a = vtx[i].position;
+            const Vec3 &b = vtx[(i + 1) % 3].position;
+            const real pa = a[axis], pb = b[axis];
+
+            if(plane_low <= pa && pa <= plane_high)
+                ret |= a;
+
+            for(const real plane : { plane_low, plane_high })
+            {
+                if((pa < plane && plane < pb) || (pb < plane && plane < pa))
+                {
+                    Vec3 p = a + (plane - pa) / (pb - pa) * (b - a);
+                    p[axis] = plane;
+                    ret |= p;
+                }
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * @brief build the linking bvh tree with object and spatial splits (sbvh)
+     *
+     * when children of the best object split overlap, split planes at bin
+     * boundaries of the node bound are also evaluated. references straddling
+     * the chosen plane are clipped into both children until the number of
+     * extra references reaches the duplication budget.
+     *
+     * top-level nodes are split in the calling thread. subtrees smaller than
+     * PARALLEL_SUBTREE_THRESHOLD are then built as independent tasks
+     */
+    class SpatialBVHBuilder
+    {
+        // spatial splits are tried only when children of the object split
+        // overlap more than this (relative to the root area)
+        static constexpr real MIN_OVERLAP_RATIO = real(1e-5);
+
+        struct Scratch
+        {
+            std::vector<SAHBin> object_bins;
+            std::vector<SpatialBin> spatial_bins;
+        };
+
+        struct ObjectSplit
+        {
+            int axis = -1;
+            uint32_t bin = 0;
+            real cost = REAL_INF;
+            real overlap_area = 0;
+        };
+
+        struct SpatialSplit
+        {
+            int axis = -1;
+            real plane = 0;
+            real cost = REAL_INF;
+            AABB left, right;
+            uint32_t left_count = 0, right_count = 0;
+        };
+
+        struct SubtreeTask
+        {
+            BuildingNode **fillback_ptr;
+            std::vector<SpatialRef> refs;
+            AABB bound;
+            uint32_t depth;
+            size_t budget;
+
+            // leaf start/end are relative to this before being merged
+            std::vector<BuildingTriangle> output;
+            uint32_t node_count;
+        };
+
+        const mesh::triangle_t *triangles_;
+        const TriangleBVHParams &params_;
+        uint32_t depth_threshold_;
+        uint32_t bin_count_;
+        real min_overlap_area_ = 0;
+
+        int thread_count_;
+        thread::thread_group_t threads_;
+
+        static AABB refs_bound(const std::vector<SpatialRef> &refs) noexcept
+        {
+            AABB ret;
+            for(auto &ref : refs)
+                ret |= ref.bound;
+            return ret;
+        }
+
+        static Vec3 ref_centroid(const SpatialRef &ref) noexcept
+        {
+            return real(0.5) * (ref.bound.low + ref.bound.high);
+        }
+
+        ObjectSplit find_object_split(
+            const std::vector<SpatialRef> &refs, const AABB &bound,
+            const AABB &centroid_bound, Scratch &scratch) const
+        {
+            auto &bins = scratch.object_bins;
+            bins.assign(3 * bin_count_, SAHBin());
+
+            for(auto &ref : refs)
+            {
+                const Vec3 centroid = ref_centroid(ref);
+                for(int axis = 0; axis < 3; ++axis)
+                {
+                    auto &bin = bins[axis * bin_count_ + sah_bin_index(
+                        centroid, axis, centroid_bound, bin_count_)];
+                    ++bin.count;
+                    bin.bounding |= ref.bound;
+                }
+            }
+
+            ObjectSplit ret;
+            if(!evaluate_sah_bins(
+                bins.data(), bin_count_, static_cast<uint32_t>(refs.size()),
+                bound, centroid_bound, params_.sah_leaf_cost,
+                &ret.axis, &ret.bin, &ret.cost))
+                return ret;
+
+            AABB left, right;
+            for(uint32_t i = 0; i < bin_count_; ++i)
+            {
+                const AABB &bin_bound = bins[ret.axis * bin_count_ + i].bounding;
+                if(i <= ret.bin)
+                    left |= bin_bound;
+                else
+                    right |= bin_bound;
+            }
+
+            const AABB overlap = aabb_intersection(left, right);
+            if(is_valid_aabb(overlap))
+                ret.overlap_area = aabb_surface_area(overlap);
+
+            return ret;
+        }
+
+        SpatialSplit find_spatial_split(
+            const std::vector<SpatialRef> &refs, const AABB &bound,
+            Scratch &scratch) const
+        {
+            const real all_area = aabb_surface_area(bound);
+            auto &bins = scratch.spatial_bins;
+
+            SpatialSplit ret;
+
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                const real axis_low = bound.low[axis];
+                const real axis_len = bound.high[axis] - axis_low;
+                if(axis_len <= 0)
+                    continue;
+
+                const real bin_width = axis_len / bin_count_;
+                auto plane_of = [&](uint32_t i)
+                {
+                    return i >= bin_count_ ? bound.high[axis] : axis_low + i * bin_width;
+                };
+                auto bin_of = [&](real pos)
+                {
+                    const real f = (pos - axis_low) / bin_width;
+                    return f <= 0 ? 0u : (std::min)(
+                        bin_count_ - 1, static_cast<uint32_t>(f));
+                };
+
+                // chop references into bins
+
+                bins.assign(bin_count_, SpatialBin());
+
+                for(auto &ref : refs)
+                {
+                    const uint32_t first = bin_of(ref.bound.low[axis]);
+                    const uint32_t last  = bin_of(ref.bound.high[axis]);
+                    ++bins[first].enter;
+                    ++bins[last].exit;
+
+                    if(first == last)
+                    {
+                        bins[first].bounding |= ref.bound;
+                        continue;
+                    }
+
+                    const mesh::vertex_t *vtx = triangles_[ref.tri].vertices;
+                    for(uint32_t i = first; i <= last; ++i)
+                    {
+                        const AABB part = aabb_intersection(
+                            clip_triangle(vtx, axis, plane_of(i), plane_of(i + 1)),
+                            ref.bound);
+                        if(is_valid_aabb(part))
+                            bins[i].bounding |= part;
+                    }
+                }
+
+                // sweep from right to left, then evaluate from left to right
+
+                AABB right_bound;
+                uint32_t right_count = 0;
+                for(uint32_t i = bin_count_ - 1; i > 0; --i)
+                {
+                    right_bound |= bins[i].bounding;
+                    right_count += bins[i].exit;
+                    bins[i - 1].right_bounding = right_bound;
+                    bins[i - 1].right_count    = right_count;
+                }
+
+                AABB left_bound;
+                uint32_t left_count = 0;
+                for(uint32_t i = 0; i + 1 < bin_count_; ++i)
+                {
+                    left_bound |= bins[i].bounding;
+                    left_count += bins[i].enter;
+
+                    const SpatialBin &bin = bins[i];
+                    if(!left_count || !bin.right_count ||
+                       !is_valid_aabb(left_bound) || !is_valid_aabb(bin.right_bounding))
+                        continue;
+
+                    const real cost = 1 + params_.sah_leaf_cost *
+                        (left_count * aabb_surface_area(left_bound) +
+                         bin.right_count * aabb_surface_area(bin.right_bounding)) / all_area;
+
+                    if(cost < ret.cost)
+                    {
+                        ret.axis        = axis;
+                        ret.plane       = plane_of(i + 1);
+                        ret.cost        = cost;
+                        ret.left        = left_bound;
+                        ret.right       = bin.right_bounding;
+                        ret.left_count  = left_count;
+                        ret.right_count = bin.right_count;
+                    }
+                }
+            }
+
+            return ret;
+        }
+
+        void apply_object_split(
+            std::vector<SpatialRef> &refs, const AABB &centroid_bound,
+            const ObjectSplit &split,
+            std::vector<SpatialRef> &left, std::vector<SpatialRef> &right) const
+        {
+            for(auto &ref : refs)
+            {
+                const uint32_t bin = sah_bin_index(
+                    ref_centroid(ref), split.axis, centroid_bound, bin_count_);
+                (bin <= split.bin ? left : right).push_back(ref);
+            }
+        }
+
+        // references straddling the plane are either clipped into both sides,
+        // or moved into one side entirely when it is cheaper (reference unsplitting)
+        void apply_spatial_split(
+            std::vector<SpatialRef> &refs, const SpatialSplit &split,
+            size_t &budget,
+            std::vector<SpatialRef> &left, std::vector<SpatialRef> &right) const
+        {
+            const int axis = split.axis;
+
+            const real left_area  = aabb_surface_area(split.left);
+            const real right_area = aabb_surface_area(split.right);
+            const real split_cost = left_area  * split.left_count +
+                                    right_area * split.right_count;
+
+            for(auto &ref : refs)
+            {
+                if(ref.bound.high[axis] <= split.plane)
+                {
+                    left.push_back(ref);
+                    continue;
+                }
+
+                if(ref.bound.low[axis] >= split.plane)
+                {
+                    right.push_back(ref);
+                    continue;
+                }
+
+                const real to_left_cost =
+                    aabb_surface_area(split.left | ref.bound) * split.left_count +
+                    right_area * (real(split.right_count) - 1);
+                const real to_right_cost =
+                    left_area * (real(split.left_count) - 1) +
+                    aabb_surface_area(split.right | ref.bound) * split.right_count;
+
+                if(budget && split_cost < (std::min)(to_left_cost, to_right_cost))
+                {
+                    const mesh::vertex_t *vtx = triangles_[ref.tri].vertices;
+
+                    const AABB left_part = aabb_intersection(clip_triangle(
+                        vtx, axis, ref.bound.low[axis], split.plane), ref.bound);
+                    const AABB right_part = aabb_intersection(clip_triangle(
+                        vtx, axis, split.plane, ref.bound.high[axis]), ref.bound);
+
+                    if(is_valid_aabb(left_part) && is_valid_aabb(right_part))
+                    {
+                        left.push_back({ ref.tri, left_part });
+                        right.push_back({ ref.tri, right_part });
+                        --budget;
+                        continue;
+                    }
+                }
+
+                (to_left_cost <= to_right_cost ? left : right).push_back(ref);
+            }
+        }
+
+        // split references of a node into two children
+        // returns false when the node should be a leaf
+        bool split_node(
+            std::vector<SpatialRef> &refs, const AABB &bound, uint32_t depth,
+            size_t &budget, Scratch &scratch,
+            std::vector<SpatialRef> &left, std::vector<SpatialRef> &right) const
+        {
+            const size_t n = refs.size();
+            const bool can_be_leaf = n <= static_cast<size_t>(params_.max_leaf_size);
+
+            AABB centroid_bound;
+            for(auto &ref : refs)
+                centroid_bound |= ref_centroid(ref);
+
+            left.clear();
+            right.clear();
+
+            if(n > 1 && depth < depth_threshold_)
+            {
+                const ObjectSplit object_split = find_object_split(
+                    refs, bound, centroid_bound, scratch);
+
+                SpatialSplit spatial_split;
+                if(budget && (object_split.axis < 0 ||
+                              object_split.overlap_area > min_overlap_area_))
+                    spatial_split = find_spatial_split(refs, bound, scratch);
+
+                const real best_cost = (std::min)(object_split.cost, spatial_split.cost);
+                if(can_be_leaf && n * params_.sah_leaf_cost <= best_cost)
+                    return false;
+
+                if(spatial_split.axis >= 0 && spatial_split.cost < object_split.cost)
+                    apply_spatial_split(refs, spatial_split, budget, left, right);
+                else if(object_split.axis >= 0)
+                    apply_object_split(refs, centroid_bound, object_split, left, right);
+
+                if(!left.empty() && !right.empty())
+                    return true;
+
+                left.clear();
+                right.clear();
+            }
+
+            if(can_be_leaf)
+                return false;
+
+            // fall back to median split of references
+
+            const Vec3 centroid_delta = centroid_bound.high - centroid_bound.low;
+            const int split_axis = centroid_delta[0] > centroid_delta[1] ?
+                (centroid_delta[0] > centroid_delta[2] ? 0 : 2) :
+                (centroid_delta[1] > centroid_delta[2] ? 1 : 2);
+
+            const auto middle = refs.begin() + n / 2;
+            std::nth_element(refs.begin(), middle, refs.end(),
+                [axis = split_axis](const SpatialRef &L, const SpatialRef &R)
+            {
+                return ref_centroid(L)[axis] < ref_centroid(R)[axis];
+            });
+
+            left.assign(refs.begin(), middle);
+            right.assign(middle, refs.end());
+            return true;
+        }
+
+        BuildingNode *new_node(const AABB &bound, Arena &arena) const
+        {
+            auto node = arena.create<BuildingNode>();
+            node->bounding = bound;
+            node->left     = nullptr;
+            node->right    = nullptr;
+            node->start    = 0;
+            node->end      = 0;
+            return node;
+        }
+
+        // build a subtree in current thread. returns node count
+        uint32_t build_subtree(
+            std::vector<SpatialRef> refs, const AABB &bound, uint32_t depth,
+            size_t &budget, BuildingNode **fillback_ptr,
+            std::vector<BuildingTriangle> &output,
+            Arena &arena, Scratch &scratch) const
+        {
+            std::vector<SpatialRef> left, right;
+            if(!split_node(refs, bound, depth, budget, scratch, left, right))
+            {
+                auto leaf = new_node(bound, arena);
+                leaf->start = static_cast<uint32_t>(output.size());
+                for(auto &ref : refs)
+                {
+                    const auto &tri = triangles_[ref.tri];
+                    output.push_back({ tri.vertices, ref_centroid(ref) });
+                }
+                leaf->end = static_cast<uint32_t>(output.size());
+
+                *fillback_ptr = leaf;
+                return 1;
+            }
+
+            refs = std::vector<SpatialRef>();
+
+            auto interior = new_node(bound, arena);
+            *fillback_ptr = interior;
+
+            const AABB left_bound  = refs_bound(left);
+            const AABB right_bound = refs_bound(right);
+
+            uint32_t ret = 1;
+            ret += build_subtree(
+                std::move(left), left_bound, depth + 1, budget,
+                &interior->left, output, arena, scratch);
+            ret += build_subtree(
+                std::move(right), right_bound, depth + 1, budget,
+                &interior->right, output, arena, scratch);
+
+            return ret;
+        }
+
+        static void offset_leaves(BuildingNode *root, uint32_t offset)
+        {
+            std::stack<BuildingNode*> nodes;
+            nodes.push(root);
+            while(!nodes.empty())
+            {
+                BuildingNode *node = nodes.top();
+                nodes.pop();
+
+                if(node->left)
+                {
+                    nodes.push(node->left);
+                    nodes.push(node->right);
+                }
+                else
+                {
+                    node->start += offset;
+                    node->end   += offset;
+                }
+            }
+        }
+
+    public:
+
+        SpatialBVHBuilder(
+            const mesh::triangle_t *triangles, const TriangleBVHParams &params,
+            uint32_t depth_threshold)
+            : triangles_(triangles), params_(params),
+              depth_threshold_(depth_threshold)
+        {
+            bin_count_ = static_cast<uint32_t>(params.sah_bin_count);
+            thread_count_ = nested_worker_count(params.build_worker_count);
+        }
+
+        /**
+         * @brief build the bvh of triangles in [0, triangle_count)
+         *
+         * arenas.size() must be equal to thread_count(). triangle references
+         * of leaves are stored in output
+         */
+        BuildingResult build(
+            uint32_t triangle_count, std::vector<Arena> &arenas,
+            std::vector<BuildingTriangle> &output)
+        {
+            assert(arenas.size() == static_cast<size_t>(thread_count_));
+
+            BuildingResult ret = { nullptr, 0 };
+
+            std::vector<SpatialRef> root_refs(triangle_count);
+            for(uint32_t i = 0; i < triangle_count; ++i)
+            {
+                root_refs[i].tri = i;
+                for(auto &vtx : triangles_[i].vertices)
+                    root_refs[i].bound |= vtx.position;
+            }
+
+            const AABB root_bound = refs_bound(root_refs);
+            min_overlap_area_ = MIN_OVERLAP_RATIO * aabb_surface_area(root_bound);
+
+            // reference indices must fit in uint32_t
+
+            const double max_budget = (std::max)(
+                0.0, static_cast<double>(params_.spatial_split_budget)) * triangle_count;
+            size_t budget = static_cast<size_t>((std::min)(
+                max_budget,
+                static_cast<double>(std::numeric_limits<uint32_t>::max() - triangle_count)));
+
+            // split top-level nodes in current thread
+
+            std::vector<SubtreeTask> subtree_tasks;
+            Scratch scratch;
+
+            std::queue<SubtreeTask> tasks;
+            tasks.push({ &ret.root, std::move(root_refs), root_bound, 0, 0, {}, 0 });
+
+            while(!tasks.empty())
+            {
+                SubtreeTask task = std::move(tasks.front());
+                tasks.pop();
+
+                if(thread_count_ <= 1 || task.refs.size() < PARALLEL_SUBTREE_THRESHOLD)
+                {
+                    subtree_tasks.push_back(std::move(task));
+                    continue;
+                }
+
+                std::vector<SpatialRef> left, right;
+                if(!split_node(task.refs, task.bound, task.depth, budget, scratch, left, right))
+                {
+                    subtree_tasks.push_back(std::move(task));
+                    continue;
+                }
+
+                ++ret.node_count;
+
+                auto interior = new_node(task.bound, arenas[0]);
+                *task.fillback_ptr = interior;
+
+                const AABB left_bound  = refs_bound(left);
+                const AABB right_bound = refs_bound(right);
+
+                tasks.push({ &interior->left,  std::move(left),  left_bound,  task.depth + 1, 0, {}, 0 });
+                tasks.push({ &interior->right, std::move(right), right_bound, task.depth + 1, 0, {}, 0 });
+            }
+
+            // divide the remaining budget among subtrees by reference count
+
+            size_t subtree_ref_count = 0;
+            for(auto &task : subtree_tasks)
+                subtree_ref_count += task.refs.size();
+            for(auto &task : subtree_tasks)
+            {
+                task.budget = static_cast<size_t>(
+                    static_cast<double>(budget) * task.refs.size() / subtree_ref_count);
+            }
+
+            // build subtrees parallelly. larger subtrees go first
+
+            std::vector<size_t> task_order(subtree_tasks.size());
+            for(size_t i = 0; i < task_order.size(); ++i)
+                task_order[i] = i;
+            std::sort(task_order.begin(), task_order.end(), [&](size_t L, size_t R)
+            {
+                return subtree_tasks[L].refs.size() > subtree_tasks[R].refs.size();
+            });
+
+            auto run_task = [&](SubtreeTask &task, Arena &arena, Scratch &task_scratch)
+            {
+                task.node_count = build_subtree(
+                    std::move(task.refs), task.bound, task.depth, task.budget,
+                    task.fillback_ptr, task.output, arena, task_scratch);
+            };
+
+            if(thread_count_ <= 1 || subtree_tasks.size() <= 1)
+            {
+                for(auto &task : subtree_tasks)
+                    run_task(task, arenas[0], scratch);
+            }
+            else
+            {
+                std::atomic<size_t> next_task = 0;
+                threads_.run(thread_count_, [&](int thread_index)
+                {
+                    Scratch thread_scratch;
+                    for(;;)
+                    {
+                        const size_t task_idx = next_task++;
+                        if(task_idx >= task_order.size())
+                            break;
+                        run_task(
+                            subtree_tasks[task_order[task_idx]],
+                            arenas[thread_index], thread_scratch);
+                    }
+                });
+            }
+
+            // merge references of subtrees
+
+            output.clear();
+            for(auto &task : subtree_tasks)
+            {
+                offset_leaves(*task.fillback_ptr, static_cast<uint32_t>(output.size()));
+                output.insert(output.end(), task.output.begin(), task.output.end());
+                ret.node_count += task.node_count;
+                task.output = std::vector<BuildingTriangle>();
+            }
+
+            return ret;
+        }
+
+        int thread_count() const noexcept
+        {
+            return thread_count_;
+        }
+    };
+
+} // namespace anonymous
+
+BuildingResult build_spatial_split_bvh(
+    const mesh::triangle_t *triangles, uint32_t triangle_count,
+    const TriangleBVHParams &params, uint32_t depth_threshold,
+    std::vector<Arena> &arenas, std::vector<BuildingTriangle> &output)
+{
+    SpatialBVHBuilder builder(triangles, params, depth_threshold);
+    arenas = std::vector<Arena>(builder.thread_count());
+    return builder.build(triangle_count, arenas, output);
+}
+
+} // namespace tri_bvh
+
+AGZ_TRACER_END
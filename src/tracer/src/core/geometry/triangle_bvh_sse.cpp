@@ -0,0 +1,146 @@
+#include "./triangle_bvh_wide.h"
+
+#ifdef AGZ_TRI_BVH_WIDE_X86
+
+#include <xmmintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+namespace
+{
+
+    struct SIMD4
+    {
+        static constexpr int W = 4;
+
+        using vfloat = __m128;
+
+        static vfloat load(const float *p) noexcept { return _mm_load_ps(p); }
+        static vfloat set1(float f) noexcept { return _mm_set1_ps(f); }
+        static void store(float *p, vfloat a) noexcept { _mm_store_ps(p, a); }
+
+        static vfloat add(vfloat a, vfloat b) noexcept { return _mm_add_ps(a, b); }
+        static vfloat sub(vfloat a, vfloat b) noexcept { return _mm_sub_ps(a, b); }
+        static vfloat mul(vfloat a, vfloat b) noexcept { return _mm_mul_ps(a, b); }
+        static vfloat div(vfloat a, vfloat b) noexcept { return _mm_div_ps(a, b); }
+        static vfloat min(vfloat a, vfloat b) noexcept { return _mm_min_ps(a, b); }
+        static vfloat max(vfloat a, vfloat b) noexcept { return _mm_max_ps(a, b); }
+
+        static vfloat le (vfloat a, vfloat b) noexcept { return _mm_cmple_ps(a, b); }
+        static vfloat ge (vfloat a, vfloat b) noexcept { return _mm_cmpge_ps(a, b); }
+        static vfloat neq(vfloat a, vfloat b) noexcept { return _mm_cmpneq_ps(a, b); }
+
+        static vfloat and_(vfloat a, vfloat b) noexcept { return _mm_and_ps(a, b); }
+
+        static int movemask(vfloat a) noexcept { return _mm_movemask_ps(a); }
+    };
+
+} // namespace anonymous
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
+
+#include "./triangle_bvh_wide.inl"
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+bool is_bvh4_supported() noexcept
+{
+    return true;
+}
+
+bool is_bvh8_supported() noexcept
+{
+#ifdef AGZ_TRI_BVH_AVX2
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7)
+        return false;
+
+    // avx & osxsave
+    __cpuid(info, 1);
+    if((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return false;
+
+    // os saves ymm registers
+    if((_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+#else
+    return false;
+#endif
+}
+
+bool bvh4_has_intersection(
+    const WideNode<4> *nodes, const TriangleBlock<4> *blocks,
+    const WideRay &ray, uint32_t *prim_idx) noexcept
+{
+    return has_intersection_impl<SIMD4>(nodes, blocks, ray, prim_idx);
+}
+
+bool bvh4_closest_intersection(
+    const WideNode<4> *nodes, const TriangleBlock<4> *blocks,
+    const WideRay &ray, WideHit *hit) noexcept
+{
+    return closest_intersection_impl<SIMD4>(nodes, blocks, ray, hit);
+}
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
+
+#else // #ifdef AGZ_TRI_BVH_WIDE_X86
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+bool is_bvh4_supported() noexcept
+{
+    return false;
+}
+
+bool is_bvh8_supported() noexcept
+{
+    return false;
+}
+
+bool bvh4_has_intersection(
+    const WideNode<4>*, const TriangleBlock<4>*, const WideRay&, uint32_t*) noexcept
+{
+    return false;
+}
+
+bool bvh4_closest_intersection(
+    const WideNode<4>*, const TriangleBlock<4>*,
+    const WideRay&, WideHit*) noexcept
+{
+    return false;
+}
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
+
+#endif // #ifdef AGZ_TRI_BVH_WIDE_X86
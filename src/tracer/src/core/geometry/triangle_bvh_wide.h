@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * multi-branching bvh for native triangle mesh
+ *
+ * wide bvh is collapsed from the binary bvh in triangle_bvh.cpp. child bounds
+ * of a node and triangles in a leaf block are stored in SoA layout so that
+ * one ray can be tested against 4 (SSE) or 8 (AVX2) of them at once.
+ *
+ * traversal functions are implemented in triangle_bvh_sse.cpp and
+ * triangle_bvh_avx2.cpp. the latter is compiled with avx2 enabled, so only
+ * plain float arrays are passed between them and other translation units,
+ * and this header must not define any inline function or include headers
+ * that do (like agz/tracer/common.h): the linker may pick their avx2
+ * instances for callers running on cpus without avx2. for the same reason,
+ * namespaces are opened without the AGZ_TRACER_BEGIN macro.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AGZ_TRI_BVH_WIDE_X86
+#endif
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+    // child[i] == EMPTY_CHILD means the ith slot is unused
+    constexpr uint32_t EMPTY_CHILD = 0xffffffff;
+
+    // leaf child: LEAF_FLAG | ((block_count - 1) << LEAF_COUNT_SHIFT) | first_block
+    constexpr uint32_t LEAF_FLAG        = 0x80000000;
+    constexpr uint32_t LEAF_COUNT_SHIFT = 27;
+    constexpr uint32_t LEAF_COUNT_MASK  = 0xf;
+    constexpr uint32_t LEAF_BLOCK_MASK  = (1u << LEAF_COUNT_SHIFT) - 1;
+    constexpr uint32_t MAX_LEAF_BLOCKS  = LEAF_COUNT_MASK + 1;
+
+    // prim_idx of unused triangle lanes
+    constexpr uint32_t INVALID_PRIM = 0xffffffff;
+
+    // max number of pending children in traversal
+    constexpr int WIDE_TRAVERSAL_STACK_SIZE = 1024;
+
+    template<int W>
+    struct alignas(4 * W) WideNode
+    {
+        float low_x[W],  low_y[W],  low_z[W];
+        float high_x[W], high_y[W], high_z[W];
+
+        // interior child: index of child node
+        // leaf child: see LEAF_FLAG
+        uint32_t child[W];
+    };
+
+    template<int W>
+    struct alignas(4 * W) TriangleBlock
+    {
+        float a_x[W],   a_y[W],   a_z[W];
+        float b_a_x[W], b_a_y[W], b_a_z[W];
+        float c_a_x[W], c_a_y[W], c_a_z[W];
+
+        // index of the triangle in primitive info array
+        uint32_t prim_idx[W];
+    };
+
+    struct WideRay
+    {
+        float o[3];
+        float d[3];
+        float t_min;
+        float t_max;
+    };
+
+    struct WideHit
+    {
+        float t;
+        float u, v;
+        uint32_t prim_idx;
+    };
+
+    /** @brief is bvh4 traversal supported by current cpu */
+    bool is_bvh4_supported() noexcept;
+
+    /** @brief is bvh8 traversal supported by current cpu */
+    bool is_bvh8_supported() noexcept;
+
+    /**
+     * @brief test whether the ray intersects any triangle
+     *
+     * @param prim_idx set to the index of a blocking triangle when returning true
+     */
+    bool bvh4_has_intersection(
+        const WideNode<4> *nodes, const TriangleBlock<4> *blocks,
+        const WideRay &ray, uint32_t *prim_idx) noexcept;
+
+    bool bvh4_closest_intersection(
+        const WideNode<4> *nodes, const TriangleBlock<4> *blocks,
+        const WideRay &ray, WideHit *hit) noexcept;
+
+    bool bvh8_has_intersection(
+        const WideNode<8> *nodes, const TriangleBlock<8> *blocks,
+        const WideRay &ray, uint32_t *prim_idx) noexcept;
+
+    bool bvh8_closest_intersection(
+        const WideNode<8> *nodes, const TriangleBlock<8> *blocks,
+        const WideRay &ray, WideHit *hit) noexcept;
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
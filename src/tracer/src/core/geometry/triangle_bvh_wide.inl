@@ -0,0 +1,348 @@
+#pragma once
+
+/*
+ * traversal of wide triangle bvh
+ *
+ * included by triangle_bvh_sse.cpp and triangle_bvh_avx2.cpp after defining
+ * the simd operation set S:
+ *
+ *  struct S
+ *  {
+ *      static constexpr int W;
+ *      using vfloat;
+ *      vfloat load(const float*); vfloat set1(float); void store(float*, vfloat);
+ *      vfloat add/sub/mul/div/min/max(vfloat, vfloat);
+ *      vfloat le/ge/neq(vfloat, vfloat); vfloat and_(vfloat, vfloat);
+ *      int movemask(vfloat);
+ *  };
+ *
+ * everything here has internal linkage, so that code compiled with different
+ * instruction sets are never merged by the linker.
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "./triangle_bvh_wide.h"
+
+namespace agz::tracer
+{
+
+namespace tri_bvh_wide
+{
+
+namespace
+{
+
+    inline int first_bit(int mask) noexcept
+    {
+#ifdef _MSC_VER
+        unsigned long ret;
+        _BitScanForward(&ret, static_cast<unsigned long>(mask));
+        return static_cast<int>(ret);
+#else
+        return __builtin_ctz(static_cast<unsigned>(mask));
+#endif
+    }
+
+    /**
+     * @brief keep a direction component away from zero
+     *
+     * with d == 0, (low - o) / d in the slab test may be 0 * inf = nan. simd
+     * min/max don't drop nan operands like the std::min/max sequence of
+     * the binary traversal does, so the child would be missed
+     *
+     * the sign is read from the bits instead of calling inline std::abs or
+     * std::signbit, whose avx2 instances could be picked by the linker
+     */
+    inline float clamp_dir_component(float d) noexcept
+    {
+        constexpr float MIN_ABS_DIR = 1e-20f;
+        if(d >= MIN_ABS_DIR || d <= -MIN_ABS_DIR)
+            return d;
+
+        uint32_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        return (bits >> 31) ? -MIN_ABS_DIR : MIN_ABS_DIR;
+    }
+
+    template<typename S>
+    struct WideRaySIMD
+    {
+        using vfloat = typename S::vfloat;
+
+        vfloat o[3];
+        vfloat d[3];
+        vfloat inv_d[3];
+        vfloat t_min;
+
+        explicit WideRaySIMD(const WideRay &r) noexcept
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                o[i]     = S::set1(r.o[i]);
+                d[i]     = S::set1(r.d[i]);
+                inv_d[i] = S::set1(1 / clamp_dir_component(r.d[i]));
+            }
+            t_min = S::set1(r.t_min);
+        }
+    };
+
+    /**
+     * @brief test ray with all child bounds of node
+     *
+     * @return bit i is set when the ith child is intersected
+     */
+    template<typename S>
+    int intersect_children(
+        const WideNode<S::W> &node, const WideRaySIMD<S> &r,
+        float t_max, float *t_near_out) noexcept
+    {
+        using vfloat = typename S::vfloat;
+
+        const vfloat t0x = S::mul(S::sub(S::load(node.low_x),  r.o[0]), r.inv_d[0]);
+        const vfloat t0y = S::mul(S::sub(S::load(node.low_y),  r.o[1]), r.inv_d[1]);
+        const vfloat t0z = S::mul(S::sub(S::load(node.low_z),  r.o[2]), r.inv_d[2]);
+
+        const vfloat t1x = S::mul(S::sub(S::load(node.high_x), r.o[0]), r.inv_d[0]);
+        const vfloat t1y = S::mul(S::sub(S::load(node.high_y), r.o[1]), r.inv_d[1]);
+        const vfloat t1z = S::mul(S::sub(S::load(node.high_z), r.o[2]), r.inv_d[2]);
+
+        const vfloat t_near = S::max(
+            S::max(S::min(t0x, t1x), S::min(t0y, t1y)),
+            S::max(S::min(t0z, t1z), r.t_min));
+
+        const vfloat t_far = S::min(
+            S::min(S::max(t0x, t1x), S::max(t0y, t1y)),
+            S::min(S::max(t0z, t1z), S::set1(t_max)));
+
+        S::store(t_near_out, t_near);
+        return S::movemask(S::le(t_near, t_far));
+    }
+
+    /**
+     * @brief test ray with all triangles in a block (Moller-Trumbore)
+     *
+     * @return bit i is set when the ith triangle is intersected
+     */
+    template<typename S>
+    int intersect_block(
+        const TriangleBlock<S::W> &block, const WideRaySIMD<S> &r,
+        float t_max, float *t_out, float *u_out, float *v_out) noexcept
+    {
+        using vfloat = typename S::vfloat;
+
+        const vfloat b_a_x = S::load(block.b_a_x);
+        const vfloat b_a_y = S::load(block.b_a_y);
+        const vfloat b_a_z = S::load(block.b_a_z);
+
+        const vfloat c_a_x = S::load(block.c_a_x);
+        const vfloat c_a_y = S::load(block.c_a_y);
+        const vfloat c_a_z = S::load(block.c_a_z);
+
+        // s1 = cross(d, c_a)
+
+        const vfloat s1_x = S::sub(S::mul(r.d[1], c_a_z), S::mul(r.d[2], c_a_y));
+        const vfloat s1_y = S::sub(S::mul(r.d[2], c_a_x), S::mul(r.d[0], c_a_z));
+        const vfloat s1_z = S::sub(S::mul(r.d[0], c_a_y), S::mul(r.d[1], c_a_x));
+
+        const vfloat div = S::add(
+            S::add(S::mul(s1_x, b_a_x), S::mul(s1_y, b_a_y)), S::mul(s1_z, b_a_z));
+        const vfloat inv_div = S::div(S::set1(1), div);
+
+        const vfloat o_a_x = S::sub(r.o[0], S::load(block.a_x));
+        const vfloat o_a_y = S::sub(r.o[1], S::load(block.a_y));
+        const vfloat o_a_z = S::sub(r.o[2], S::load(block.a_z));
+
+        const vfloat alpha = S::mul(S::add(
+            S::add(S::mul(o_a_x, s1_x), S::mul(o_a_y, s1_y)),
+            S::mul(o_a_z, s1_z)), inv_div);
+
+        // s2 = cross(o_a, b_a)
+
+        const vfloat s2_x = S::sub(S::mul(o_a_y, b_a_z), S::mul(o_a_z, b_a_y));
+        const vfloat s2_y = S::sub(S::mul(o_a_z, b_a_x), S::mul(o_a_x, b_a_z));
+        const vfloat s2_z = S::sub(S::mul(o_a_x, b_a_y), S::mul(o_a_y, b_a_x));
+
+        const vfloat beta = S::mul(S::add(
+            S::add(S::mul(r.d[0], s2_x), S::mul(r.d[1], s2_y)),
+            S::mul(r.d[2], s2_z)), inv_div);
+
+        const vfloat t = S::mul(S::add(
+            S::add(S::mul(c_a_x, s2_x), S::mul(c_a_y, s2_y)),
+            S::mul(c_a_z, s2_z)), inv_div);
+
+        const vfloat zero = S::set1(0);
+
+        vfloat mask = S::neq(div, zero);
+        mask = S::and_(mask, S::ge(alpha, zero));
+        mask = S::and_(mask, S::ge(beta, zero));
+        mask = S::and_(mask, S::le(S::add(alpha, beta), S::set1(1)));
+        mask = S::and_(mask, S::ge(t, r.t_min));
+        mask = S::and_(mask, S::le(t, S::set1(t_max)));
+
+        S::store(t_out, t);
+        S::store(u_out, alpha);
+        S::store(v_out, beta);
+
+        return S::movemask(mask);
+    }
+
+    template<typename S>
+    bool has_intersection_impl(
+        const WideNode<S::W> *nodes, const TriangleBlock<S::W> *blocks,
+        const WideRay &ray, uint32_t *prim_idx) noexcept
+    {
+        constexpr int W = S::W;
+
+        const WideRaySIMD<S> r(ray);
+
+        alignas(4 * W) float t_near[W];
+        alignas(4 * W) float tri_t[W], tri_u[W], tri_v[W];
+
+        uint32_t stack[WIDE_TRAVERSAL_STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+
+        while(top)
+        {
+            const uint32_t child = stack[--top];
+
+            if(child & LEAF_FLAG)
+            {
+                const uint32_t first = child & LEAF_BLOCK_MASK;
+                const uint32_t count = ((child >> LEAF_COUNT_SHIFT) & LEAF_COUNT_MASK) + 1;
+                for(uint32_t i = first; i < first + count; ++i)
+                {
+                    const int hit_mask = intersect_block<S>(
+                        blocks[i], r, ray.t_max, tri_t, tri_u, tri_v);
+                    if(hit_mask)
+                    {
+                        *prim_idx = blocks[i].prim_idx[first_bit(hit_mask)];
+                        return true;
+                    }
+                }
+                continue;
+            }
+
+            const WideNode<W> &node = nodes[child];
+            int mask = intersect_children<S>(node, r, ray.t_max, t_near);
+
+            while(mask)
+            {
+                const int i = first_bit(mask);
+                mask &= mask - 1;
+                if(node.child[i] != EMPTY_CHILD)
+                {
+                    assert(top < WIDE_TRAVERSAL_STACK_SIZE);
+                    stack[top++] = node.child[i];
+                }
+            }
+        }
+
+        return false;
+    }
+
+    template<typename S>
+    bool closest_intersection_impl(
+        const WideNode<S::W> *nodes, const TriangleBlock<S::W> *blocks,
+        const WideRay &ray, WideHit *hit) noexcept
+    {
+        constexpr int W = S::W;
+
+        const WideRaySIMD<S> r(ray);
+        float t_max = ray.t_max;
+        bool ret = false;
+
+        alignas(4 * W) float t_near[W];
+        alignas(4 * W) float tri_t[W], tri_u[W], tri_v[W];
+
+        uint32_t stack_child[WIDE_TRAVERSAL_STACK_SIZE];
+        float    stack_t    [WIDE_TRAVERSAL_STACK_SIZE];
+        int top = 0;
+
+        stack_child[top] = 0;
+        stack_t[top++]   = ray.t_min;
+
+        while(top)
+        {
+            --top;
+            const uint32_t child = stack_child[top];
+            if(stack_t[top] > t_max)
+                continue;
+
+            if(child & LEAF_FLAG)
+            {
+                const uint32_t first = child & LEAF_BLOCK_MASK;
+                const uint32_t count = ((child >> LEAF_COUNT_SHIFT) & LEAF_COUNT_MASK) + 1;
+                for(uint32_t i = first; i < first + count; ++i)
+                {
+                    int mask = intersect_block<S>(
+                        blocks[i], r, t_max, tri_t, tri_u, tri_v);
+                    while(mask)
+                    {
+                        const int j = first_bit(mask);
+                        mask &= mask - 1;
+                        if(tri_t[j] <= t_max)
+                        {
+                            t_max = tri_t[j];
+                            hit->t        = tri_t[j];
+                            hit->u        = tri_u[j];
+                            hit->v        = tri_v[j];
+                            hit->prim_idx = blocks[i].prim_idx[j];
+                            ret = true;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            const WideNode<W> &node = nodes[child];
+            int mask = intersect_children<S>(node, r, t_max, t_near);
+
+            // sort intersected children by distance in descending order,
+            // so that the nearest one is popped first
+
+            uint32_t hit_child[W];
+            float hit_t[W];
+            int hit_count = 0;
+
+            while(mask)
+            {
+                const int i = first_bit(mask);
+                mask &= mask - 1;
+                if(node.child[i] == EMPTY_CHILD)
+                    continue;
+
+                int j = hit_count++;
+                while(j > 0 && hit_t[j - 1] < t_near[i])
+                {
+                    hit_child[j] = hit_child[j - 1];
+                    hit_t[j]     = hit_t[j - 1];
+                    --j;
+                }
+                hit_child[j] = node.child[i];
+                hit_t[j]     = t_near[i];
+            }
+
+            assert(top + hit_count <= WIDE_TRAVERSAL_STACK_SIZE);
+            for(int i = 0; i < hit_count; ++i)
+            {
+                stack_child[top] = hit_child[i];
+                stack_t[top++]   = hit_t[i];
+            }
+        }
+
+        return ret;
+    }
+
+} // namespace anonymous
+
+} // namespace tri_bvh_wide
+
+} // namespace agz::tracer
@@ -14,6 +14,8 @@
 #include <agz/tracer/create/renderer.h>
 #include <agz/tracer/render/particle_tracing.h>
 #include <agz/tracer/utility/parallel_grid.h>
+#include <agz/tracer/utility/splat_film.h>
+#include <agz/tracer/utility/thread_affinity.h>
 #include <agz/utility/thread.h>
 
 AGZ_TRACER_BEGIN
@@ -37,6 +39,8 @@ public:
     {
         reporter.begin();
 
+        start_timer();
+
         // backward rendering
 
         reporter.message("start backward rendering");
@@ -133,10 +137,11 @@ private:
         ImageBufferTemplate<true, true, true, true, true> image_buffer(
             filter.width(), filter.height());
 
+        thread::thread_group_t threads;
         parallel_for_2d_grid(
             thread_count, filter.width(), filter.height(),
             params_.forward_task_grid_size, params_.forward_task_grid_size,
-            [&](int thread_index, const Rect2i &rect)
+            threads, pin_threads_, [&](int thread_index, const Rect2i &rect)
         {
             auto sampler = perthread_sampler[thread_index];
 
@@ -247,15 +252,14 @@ private:
 
         std::atomic<uint64_t> total_particle_count = 0;
 
-        Box<std::mutex[]> output_img_mutex;
-        std::vector<Image2D<Spectrum>> output_img;
+        SplatFilm particle_film(filter, worker_count);
 
-        auto backward_func =
-            [&](Sampler *sampler, Image2D<Spectrum> *image, int i)
+        auto backward_func = [&](Sampler *sampler, int i)
         {
-            auto film_grid = filter.create_subgrid_view(
-                { { 0, 0 }, { filter.width() - 1, filter.height() - 1 } },
-                *image);
+            WorkerPinningScope pinning(pin_threads_, i);
+
+            SplatFilm::Splatter &splatter = particle_film.splatter(i);
+            AGZ_SCOPE_GUARD({ splatter.flush(); });
 
             for(;;)
             {
@@ -266,57 +270,55 @@ private:
                 if(task_id >= params_.particle_task_count)
                     break;
 
+                // out of time budget. the forward pass is always done
+                // completely so only particle tasks are skipped
+
+                if(task_id > 0 && exceeds_time_budget())
+                    break;
+
                 Arena arena;
                 int task_particle_count = 0;
                 for(int j = 0; j < params_.particles_per_task; ++j)
                 {
                     ++task_particle_count;
                     trace_vol_particle(
-                        particle_params_, scene, *sampler, film_grid, arena);
+                        particle_params_, scene, *sampler, splatter, arena);
                     arena.release();
 
+                    // splats of an interrupted task are still flushed by
+                    // the scope guard, so its particles must be counted
+
                     if(stop_rendering_)
+                    {
+                        total_particle_count += task_particle_count;
                         return;
+                    }
                 }
 
+                // particles of a finished task are counted only after
+                // their splats are in the film
+
+                splatter.flush();
+                const uint64_t pc =
+                    total_particle_count += task_particle_count;
+
+                const real percent = real(100) * (task_id + 1)
+                                   / params_.particle_task_count;
+
                 if constexpr(REPORTER_WITH_PREVIEW)
                 {
-                    uint64_t pc;
-
-                    {
-                        std::lock_guard lk(output_img_mutex[i]);
-                        output_img[i] = *image;
-                        total_particle_count += task_particle_count;
-                        pc = total_particle_count;
-                    }
-                    
-                    auto get_img = [
-                        worker_count, &output_img, &output_img_mutex,
-                        &filter, pc]()
+                    auto get_img = [&particle_film, &filter, pc]()
                     {
-                        Image2D<Spectrum> ret(filter.height(), filter.width());
-                        for(int j = 0; j < worker_count; ++j)
-                        {
-                            std::lock_guard lk(output_img_mutex[j]);
-                            ret = ret + output_img[j];
-                        }
-
-                        real ratio = filter.width() * filter.height()
-                                   * (pc ? real(1) / pc : real(0));
-                        return ratio * ret;
+                        return particle_film.get_image(
+                            pc ? filter.width() * filter.height()
+                                   / static_cast<real>(pc) : real(0));
                     };
 
-                    const real percent = real(100) * (task_id + 1)
-                                       / params_.particle_task_count;
                     std::lock_guard lk(reporter_mutex);
                     reporter.progress(percent, get_img);
                 }
                 else
                 {
-                    total_particle_count += task_particle_count;
-
-                    const real percent = real(100) * (task_id + 1)
-                                       / params_.particle_task_count;
                     std::lock_guard lk(reporter_mutex);
                     reporter.progress(percent, {});
                 }
@@ -326,39 +328,24 @@ private:
         Arena sampler_arena;
 
         std::vector<std::thread> threads;
-        std::vector<Image2D<Spectrum>> images;
-
         threads.reserve(worker_count);
-        images.resize(worker_count, Image2D<Spectrum>(
-            filter.height(), filter.width()));
-
-        if constexpr(REPORTER_WITH_PREVIEW)
-        {
-            output_img_mutex = newBox<std::mutex[]>(worker_count);
-            output_img.resize(worker_count, Image2D<Spectrum>(
-                filter.height(), filter.width()));
-        }
 
         auto particle_sampler_prototype = newRC<NativeSampler>(42, false);
 
         for(int i = 0; i < worker_count; ++i)
         {
             auto sampler = particle_sampler_prototype->clone(i, sampler_arena);
-            threads.emplace_back(backward_func, sampler, &images[i], i);
+            threads.emplace_back(backward_func, sampler, i);
         }
 
         for(auto &t : threads)
             t.join();
 
-        const real scale = filter.width() * filter.height()
-                         / static_cast<real>(total_particle_count);
-
-        Image2D<Spectrum> ret(filter.height(), filter.width());
-        for(auto &img : images)
-            ret = ret + img;
-        ret = ret * scale;
+        const real scale = total_particle_count ?
+            filter.width() * filter.height()
+                / static_cast<real>(total_particle_count) : real(0);
 
-        return ret;
+        return particle_film.get_image(scale);
     }
 
     AdjointPTRendererParams params_;
@@ -22,7 +22,8 @@ public:
 
     explicit AORenderer(const AORendererParams &params)
         : PerPixelRenderer(
-            params.worker_count, params.task_grid_size, params.spp)
+            params.worker_count, params.task_grid_size, params.spp,
+            params.adaptive, params.sampler)
     {
         params_.background_color       = params.background_color;
         params_.low_color              = params.low_color;
@@ -1,7 +1,15 @@
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+
 #include <agz/tracer/core/camera.h>
 #include <agz/tracer/core/renderer_interactor.h>
 #include <agz/tracer/core/sampler.h>
 #include <agz/tracer/core/scene.h>
+#include <agz/tracer/utility/checkpoint.h>
 #include <agz/tracer/utility/parallel_grid.h>
 #include <agz/utility/thread.h>
 
@@ -10,8 +18,8 @@
 AGZ_TRACER_BEGIN
 
 void PerPixelRenderer::render_grid(
-    const Scene &scene, Sampler &sampler,
-    Grid &grid, const Vec2i &full_res, int spp) const
+    const Scene &scene, NativeSampler &sampler,
+    Grid &grid, const Vec2i &full_res, const GridTask &task) const
 {
     Arena arena;
     const Camera *camera = scene.get_camera();
@@ -21,26 +29,31 @@ void PerPixelRenderer::render_grid(
     {
         for(int px = sam_bound.low.x; px <= sam_bound.high.x; ++px)
         {
+            const int spp = task.spp_of(px, py);
             for(int i = 0; i < spp; ++i)
             {
-                const Sample2 film_sam = sampler.sample2();
+                Sampler &sam = task.begin_sample(sampler, px, py, i);
+
+                const Sample2 film_sam = sam.sample2();
                 const real pixel_x = px + film_sam.u;
                 const real pixel_y = py + film_sam.v;
                 const real film_x = pixel_x / full_res.x;
                 const real film_y = pixel_y / full_res.y;
 
                 auto cam_ray = camera->sample_we(
-                    { film_x, film_y }, sampler.sample2());
+                    { film_x, film_y }, sam.sample2());
 
                 const Ray ray(cam_ray.pos_on_cam, cam_ray.pos_to_out);
                 const render::Pixel pixel = eval_pixel(
-                    scene, ray, sampler, arena);
+                    scene, ray, sam, arena);
 
                 if(pixel.value.is_finite())
                 {
+                    const Spectrum value = cam_ray.throughput * pixel.value;
                     grid.apply(
-                        pixel_x, pixel_y, cam_ray.throughput * pixel.value, 1,
+                        pixel_x, pixel_y, value, 1,
                         pixel.albedo, pixel.normal, pixel.denoise);
+                    task.record(px, py, value);
                 }
 
                 arena.release();
@@ -53,17 +66,53 @@ void PerPixelRenderer::render_grid(
 }
 
 template<bool REPORTER_WITH_PREVIEW>
-RenderTarget PerPixelRenderer::render_impl(
-    FilmFilterApplier filter, Scene &scene, RendererInteractor &reporter)
+void PerPixelRenderer::render_impl(
+    FilmFilterApplier filter, Scene &scene, RendererInteractor &reporter,
+    const RenderPartition *partition, ImageBuffer &image_buffer)
 {
     const int thread_count = thread::actual_worker_count(worker_count_);
 
-    // prepare image buffer
+    // rendered part of the film
 
-    ImageBuffer image_buffer(filter.width(), filter.height());
+    Rect2i tile = { { 0, 0 }, { filter.width() - 1, filter.height() - 1 } };
+    int first_sample = 0, spp = spp_;
+
+    if(partition)
+    {
+        if(adaptive_.enabled)
+        {
+            throw std::runtime_error(
+                "adaptive sampling doesn't support partial rendering");
+        }
+
+        if(partition->has_tile)
+        {
+            tile.low.x  = (std::max)(tile.low.x,  partition->tile.low.x);
+            tile.low.y  = (std::max)(tile.low.y,  partition->tile.low.y);
+            tile.high.x = (std::min)(tile.high.x, partition->tile.high.x);
+            tile.high.y = (std::min)(tile.high.y, partition->tile.high.y);
+        }
+
+        first_sample = partition->sample_begin;
+        spp = (partition->sample_end > 0 ? partition->sample_end : spp_)
+            - first_sample;
+
+        if(tile.low.x > tile.high.x || tile.low.y > tile.high.y || spp <= 0 ||
+           first_sample < 0)
+            throw std::runtime_error("empty render partition");
+    }
+
+    const Vec2i tile_size = tile.high - tile.low + Vec2i(1);
+
+    // grids only write pixels owned by their tasks (samples are gathered
+    // from a border around the task instead), so merges of different tasks
+    // never touch the same pixel and only exclude the preview reader
+
+    std::shared_mutex image_mutex;
 
     auto get_img = std::function<Image2D<Spectrum>()>([&]()
     {
+        std::unique_lock lk(image_mutex);
         auto ratio = image_buffer.weight.map([](real w)
         {
             return w > 0 ? 1 / w : real(1);
@@ -75,7 +124,14 @@ RenderTarget PerPixelRenderer::render_impl(
 
     Arena sampler_arena;
     auto sampler_prototype = newRC<NativeSampler>(42, false);
-    std::vector<Sampler *> perthread_sampler;
+    if(partition)
+    {
+        // decorrelate pieces rendered by other processes in renderers
+        // that don't reseed per sample
+        sampler_prototype->set_seed(
+            GridTask::sample_seed(tile.low.x, tile.low.y, first_sample));
+    }
+    std::vector<NativeSampler *> perthread_sampler;
     for(int i = 0; i < thread_count; ++i)
         perthread_sampler.push_back(sampler_prototype->clone(i, sampler_arena));
 
@@ -84,44 +140,168 @@ RenderTarget PerPixelRenderer::render_impl(
     reporter.begin();
     reporter.new_stage();
 
+    // early termination
+
+    start_timer();
+
+    const bool track_variance = adaptive_.enabled || termination_.target_error > 0;
+    const double pixel_count = double(tile_size.x) * tile_size.y;
+    double finished_samples = 0;
+
+    // number of samples that can still be taken within the time budget
+    auto affordable_samples = [&]
+    {
+        if(termination_.time_budget <= 0 || finished_samples <= 0)
+            return std::numeric_limits<double>::max();
+        const double elapsed = elapsed_seconds();
+        const double seconds_per_sample = elapsed / finished_samples;
+        return (termination_.time_budget - elapsed) / seconds_per_sample;
+    };
+
+    auto is_target_error_reached = [&]
+    {
+        return termination_.target_error > 0 &&
+               average_relative_error(image_buffer.variance, tile)
+                    <= termination_.target_error;
+    };
+
+    // checkpoint
+
+    const std::string checkpoint_tag = "perpixel";
+
+    int finished_spp  = 0; // spp of uniform passes
+    int finished_pass = 0; // adaptive passes after the initial one
+
+    // per-pixel sample counts of adaptive sampling, which are also indices
+    // of the next samples of low discrepancy samplers
+    Image2D<int> pixel_sample_count(filter.height(), filter.width());
+
+    auto write_state = [&](CheckpointWriter &writer)
+    {
+        writer.write(int32_t(spp));
+        writer.write(int32_t(first_sample));
+        writer.write(tile);
+        writer.write(int32_t(adaptive_.enabled));
+        writer.write(int32_t(finished_spp));
+        writer.write(int32_t(finished_pass));
+        writer.write(finished_samples);
+
+        writer.write_image(image_buffer.value);
+        writer.write_image(image_buffer.weight);
+        writer.write_image(image_buffer.albedo);
+        writer.write_image(image_buffer.normal);
+        writer.write_image(image_buffer.denoise);
+        writer.write_image(image_buffer.variance);
+        writer.write_image(pixel_sample_count);
+
+        writer.write_samplers(perthread_sampler);
+    };
+
+    if(auto reader = open_checkpoint(checkpoint_tag))
+    {
+        const int32_t saved_spp          = reader->read<int32_t>();
+        const int32_t saved_first_sample = reader->read<int32_t>();
+        const Rect2i  saved_tile         = reader->read<Rect2i>();
+        const int32_t saved_adaptive     = reader->read<int32_t>();
+
+        if(saved_spp != spp || saved_first_sample != first_sample ||
+           saved_tile.low != tile.low || saved_tile.high != tile.high ||
+           saved_adaptive != int32_t(adaptive_.enabled))
+        {
+            throw CheckpointException(
+                "checkpoint is written with different sampling settings");
+        }
+
+        finished_spp     = reader->read<int32_t>();
+        finished_pass    = reader->read<int32_t>();
+        finished_samples = reader->read<double>();
+
+        reader->read_image(image_buffer.value);
+        reader->read_image(image_buffer.weight);
+        reader->read_image(image_buffer.albedo);
+        reader->read_image(image_buffer.normal);
+        reader->read_image(image_buffer.denoise);
+        reader->read_image(image_buffer.variance);
+        reader->read_image(pixel_sample_count);
+
+        reader->read_samplers(perthread_sampler, [&](int i)
+        {
+            return sampler_prototype->clone(i, sampler_arena);
+        });
+    }
+
+    // low discrepancy samplers. created after loading the checkpoint,
+    // which may add native samplers
+
+    std::vector<Sampler *> perthread_pixel_sampler;
+    for(size_t i = 0; i < perthread_sampler.size(); ++i)
+    {
+        perthread_pixel_sampler.push_back(
+            create_pixel_sampler(sampler_type_, sampler_arena));
+    }
+
+    // per-thread film grids, reused by tasks to avoid allocating images
+    // for every task
+
+    std::vector<std::optional<Grid>> perthread_grid(thread_count);
+
     // rendering iteration
 
     thread::thread_group_t thread_group(thread_count);
 
-    auto run_iter = [&](double prog_beg, double prog_end, int spp)
+    // grid costs measured in the last iteration, used to balance the next
+
+    GridCostHistory grid_costs;
+
+    auto run_iter = [&](
+        double prog_beg, double prog_end, int iter_spp,
+        const Image2D<int> *pixel_spp, int iter_first_sample)
     {
-        int finished_pixel_count = 0;
+        std::atomic<int> finished_pixel_count = 0;
 
         parallel_for_2d_grid(
-            thread_count, filter.width(), filter.height(),
-            task_grid_size_, task_grid_size_, thread_group,
-            [&] (int thread_index, const Rect2i &rect)
+            thread_count, tile_size.x, tile_size.y,
+            task_grid_size_, task_grid_size_, thread_group, grid_costs, pin_threads_,
+            [&] (int thread_index, const Rect2i &tile_rect)
         {
             auto &sampler = perthread_sampler[thread_index];
 
-            auto grid = filter.create_subgrid<
-                Spectrum, real, Spectrum, Vec3, real>(
-                    { rect.low, rect.high - Vec2i(1) });
+            const Rect2i rect = {
+                tile_rect.low + tile.low, tile_rect.high + tile.low
+            };
+
+            auto &grid_slot = perthread_grid[thread_index];
+            if(grid_slot)
+                grid_slot->set_pixel_range({ rect.low, rect.high - Vec2i(1) });
+            else
+            {
+                grid_slot.emplace(filter.create_subgrid<
+                    Spectrum, real, Spectrum, Vec3, real>(
+                        { rect.low, rect.high - Vec2i(1) }));
+            }
+            Grid &grid = *grid_slot;
+
+            GridTask task;
+            task.pixels             = { rect.low, rect.high - Vec2i(1) };
+            task.spp                = iter_spp;
+            task.pixel_spp          = pixel_spp;
+            task.variance           = track_variance ? &image_buffer.variance : nullptr;
+            task.first_sample       = iter_first_sample;
+            task.pixel_first_sample = pixel_spp ? &pixel_sample_count : nullptr;
+            task.reseed             = partition != nullptr;
+            task.pixel_sampler      = perthread_pixel_sampler[thread_index];
 
             render_grid(
                 scene, *sampler, grid,
-                { filter.width(), filter.height() }, spp);
-
-            const int total_pixel_count = filter.width() * filter.height();
+                { filter.width(), filter.height() }, task);
 
             if constexpr(REPORTER_WITH_PREVIEW)
             {
-                std::lock_guard lk(reporter_mutex);
+                std::shared_lock lk(image_mutex);
                 grid.merge_into(
                     image_buffer.value, image_buffer.weight,
                     image_buffer.albedo, image_buffer.normal,
                     image_buffer.denoise);
-
-                finished_pixel_count += (rect.high - rect.low).product();
-                const double percent = math::lerp(
-                    prog_beg, prog_end,
-                    double(finished_pixel_count) / total_pixel_count);
-                reporter.progress(percent, get_img);
             }
             else
             {
@@ -131,15 +311,30 @@ RenderTarget PerPixelRenderer::render_impl(
                     image_buffer.value, image_buffer.weight,
                     image_buffer.albedo, image_buffer.normal,
                     image_buffer.denoise);
+            }
+
+            // progress reporting doesn't block rendering. a report is
+            // skipped when another thread is reporting, except the last
+            // one of the iteration
+
+            const int total_pixel_count = tile_size.x * tile_size.y;
+            const int task_pixel_count  = (rect.high - rect.low).product();
+            const int finished = finished_pixel_count.fetch_add(
+                task_pixel_count) + task_pixel_count;
 
-                std::lock_guard lk(reporter_mutex);
+            std::unique_lock lk(reporter_mutex, std::defer_lock);
+            if(finished >= total_pixel_count)
+                lk.lock();
+            else if(!lk.try_lock())
+                return !stop_rendering_;
 
-                finished_pixel_count += (rect.high - rect.low).product();
-                const double percent = math::lerp(
-                    prog_beg, prog_end,
-                    double(finished_pixel_count) / total_pixel_count);
+            const double percent = math::lerp(
+                prog_beg, prog_end, double(finished) / total_pixel_count);
+
+            if constexpr(REPORTER_WITH_PREVIEW)
+                reporter.progress(percent, get_img);
+            else
                 reporter.progress(percent, {});
-            }
 
             return !stop_rendering_;
         });
@@ -147,35 +342,212 @@ RenderTarget PerPixelRenderer::render_impl(
 
     // start rendering
 
-    if(reporter.need_image_preview())
+    if(adaptive_.enabled)
     {
-        const double first_iter_prog_end = 100.0 / spp_;
-        run_iter(0, first_iter_prog_end, 1);
+        // uniform pass for initial error estimation
+
+        const int init_spp = math::clamp(adaptive_.init_spp, 2, (std::max)(2, spp));
+        const double total_budget = double(spp) * pixel_count;
+
+        if(finished_samples <= 0)
+        {
+            run_iter(0, 100 * init_spp * pixel_count / total_budget,
+                     init_spp, nullptr, 0);
+            finished_samples = init_spp * pixel_count;
+            pixel_sample_count = pixel_sample_count.map(
+                [&](int) { return init_spp; });
+            save_checkpoint_if_due(checkpoint_tag, write_state);
+        }
 
-        const int per_iter_spp = (std::max)(20, spp_ / 20);
-        int finished_spp = 1;
-        while(finished_spp < spp_)
+        // distribute remaining samples by estimated error
+
+        Image2D<int> pixel_spp(filter.height(), filter.width());
+        const int pass_count = (std::max)(1, adaptive_.pass_count);
+
+        for(int pass = finished_pass; pass < pass_count; ++pass)
         {
-            if(stop_rendering_)
+            if(stop_rendering_ || finished_samples >= total_budget ||
+               is_target_error_reached())
+                break;
+
+            const double pass_budget = (std::min)(
+                (total_budget - finished_samples) / (pass_count - pass),
+                affordable_samples());
+            if(pass_budget < 1)
+                break;
+
+            const double allocated = allocate_adaptive_samples(
+                image_buffer.variance, pass_budget, pixel_spp);
+            if(allocated <= 0)
                 break;
 
+            const double prog_beg = 100 * finished_samples / total_budget;
+            finished_samples += allocated;
+            const double prog_end = 100 * (std::min)(
+                finished_samples / total_budget, 1.0);
+
+            run_iter(prog_beg, prog_end, 0, &pixel_spp, 0);
+
+            for(int y = 0; y < pixel_spp.height(); ++y)
+            {
+                for(int x = 0; x < pixel_spp.width(); ++x)
+                    pixel_sample_count(y, x) += pixel_spp(y, x);
+            }
+
+            finished_pass = pass + 1;
+            save_checkpoint_if_due(checkpoint_tag, write_state);
+        }
+    }
+    else if(reporter.need_image_preview() || termination_.is_enabled() ||
+            checkpoint_.is_enabled())
+    {
+        if(!finished_spp)
+        {
+            const double first_iter_prog_end = 100.0 / spp;
+            run_iter(0, first_iter_prog_end, 1, nullptr, first_sample);
+            finished_spp = 1;
+            finished_samples = pixel_count;
+            save_checkpoint_if_due(checkpoint_tag, write_state);
+        }
+
+        const int per_iter_spp = reporter.need_image_preview() ?
+            (std::max)(20, spp / 20) : (std::max)(1, spp / 20);
+
+        while(finished_spp < spp)
+        {
+            if(stop_rendering_ || is_target_error_reached())
+                break;
+
+            // shrink the iteration to fit in the time budget
+
+            const int affordable_spp = static_cast<int>((std::min)(
+                affordable_samples() / pixel_count, double(spp)));
             const int new_finished_spp = (std::min)(
-                spp_, finished_spp + per_iter_spp);
+                spp, finished_spp + (std::min)(per_iter_spp, affordable_spp));
             const int delta_spp = new_finished_spp - finished_spp;
+            if(delta_spp <= 0)
+                break;
 
-            const double prog_beg = 100.0 * finished_spp / spp_;
-            const double prog_end = 100.0 * new_finished_spp / spp_;
+            const double prog_beg = 100.0 * finished_spp / spp;
+            const double prog_end = 100.0 * new_finished_spp / spp;
 
-            run_iter(prog_beg, prog_end, delta_spp);
+            run_iter(prog_beg, prog_end, delta_spp, nullptr,
+                     first_sample + finished_spp);
 
             finished_spp = new_finished_spp;
+            finished_samples = finished_spp * pixel_count;
+            save_checkpoint_if_due(checkpoint_tag, write_state);
         }
     }
     else
-        run_iter(0, 100, spp_);
+        run_iter(0, 100, spp, nullptr, first_sample);
 
     reporter.end_stage();
     reporter.end();
+}
+
+double PerPixelRenderer::allocate_adaptive_samples(
+    const Image2D<PixelVariance> &variance,
+    double pass_budget, Image2D<int> &pixel_spp) const
+{
+    const int width = variance.width(), height = variance.height();
+
+    // pixels below the error threshold are stopped
+
+    Image2D<real> error(height, width);
+    double error_sum = 0;
+    int active_count = 0;
+
+    for(int y = 0; y < height; ++y)
+    {
+        for(int x = 0; x < width; ++x)
+        {
+            real err = variance.at(y, x).relative_error();
+            if(err <= adaptive_.error_threshold)
+                err = 0;
+            else
+            {
+                // pixels with too few samples have unreliable estimates
+                if(!std::isfinite(err))
+                    err = 1;
+                ++active_count;
+            }
+
+            error.at(y, x) = err;
+            error_sum += err;
+        }
+    }
+
+    if(!active_count || error_sum <= 0)
+        return 0;
+
+    // split pass budget proportional to estimated error. a few noisy
+    // pixels can't take the whole budget
+
+    const double max_pixel_spp = 8 * pass_budget / active_count;
+
+    double allocated = 0, carry = 0;
+    for(int y = 0; y < height; ++y)
+    {
+        for(int x = 0; x < width; ++x)
+        {
+            const real err = error.at(y, x);
+            if(err <= 0)
+            {
+                pixel_spp.at(y, x) = 0;
+                continue;
+            }
+
+            // fractional shares are carried to following pixels so that
+            // the pass budget is neither exceeded nor wasted
+
+            carry += (std::min)(pass_budget * err / error_sum, max_pixel_spp);
+            const int spp = static_cast<int>(carry);
+            carry -= spp;
+
+            pixel_spp.at(y, x) = spp;
+            allocated += spp;
+        }
+    }
+
+    return allocated;
+}
+
+real PerPixelRenderer::average_relative_error(
+    const Image2D<PixelVariance> &variance, const Rect2i &pixels) const
+{
+    // errors of single pixels are clamped so that a few dark
+    // noisy pixels can't dominate the average
+
+    double sum = 0;
+    for(int y = pixels.low.y; y <= pixels.high.y; ++y)
+    {
+        for(int x = pixels.low.x; x <= pixels.high.x; ++x)
+            sum += (std::min)(variance.at(y, x).relative_error(), real(1));
+    }
+
+    const Vec2i size = pixels.high - pixels.low + Vec2i(1);
+    return static_cast<real>(sum / (double(size.x) * size.y));
+}
+
+PerPixelRenderer::PerPixelRenderer(
+    int worker_count, int task_grid_size, int spp,
+    const AdaptiveSamplingParams &adaptive, SamplerType sampler_type)
+    : worker_count_(worker_count), task_grid_size_(task_grid_size), spp_(spp),
+      adaptive_(adaptive), sampler_type_(sampler_type)
+{
+    
+}
+
+RenderTarget PerPixelRenderer::render(
+    FilmFilterApplier filter, Scene &scene, RendererInteractor &reporter)
+{
+    ImageBuffer image_buffer(filter.width(), filter.height());
+
+    if(reporter.need_image_preview())
+        render_impl<true>(filter, scene, reporter, nullptr, image_buffer);
+    else
+        render_impl<false>(filter, scene, reporter, nullptr, image_buffer);
 
     auto ratio = image_buffer.weight.map([](real w)
     {
@@ -191,19 +563,55 @@ RenderTarget PerPixelRenderer::render_impl(
     return render_target;
 }
 
-PerPixelRenderer::PerPixelRenderer(
-    int worker_count, int task_grid_size, int spp)
-    : worker_count_(worker_count), task_grid_size_(task_grid_size), spp_(spp)
+PartialRenderTarget PerPixelRenderer::render_partial(
+    FilmFilterApplier filter, Scene &scene,
+    RendererInteractor &reporter, const RenderPartition &partition)
 {
-    
-}
+    ImageBuffer image_buffer(filter.width(), filter.height());
 
-RenderTarget PerPixelRenderer::render(
-    FilmFilterApplier filter, Scene &scene, RendererInteractor &reporter)
-{
     if(reporter.need_image_preview())
-        return render_impl<true>(filter, scene, reporter);
-    return render_impl<false>(filter, scene, reporter);
+        render_impl<true>(filter, scene, reporter, &partition, image_buffer);
+    else
+        render_impl<false>(filter, scene, reporter, &partition, image_buffer);
+
+    // grids gather filtered samples from around their pixels and never
+    // write outside the tile, so the tile alone holds the complete result
+
+    Rect2i rect = { { 0, 0 }, { filter.width() - 1, filter.height() - 1 } };
+    if(partition.has_tile)
+    {
+        rect.low.x  = (std::max)(rect.low.x,  partition.tile.low.x);
+        rect.low.y  = (std::max)(rect.low.y,  partition.tile.low.y);
+        rect.high.x = (std::min)(rect.high.x, partition.tile.high.x);
+        rect.high.y = (std::min)(rect.high.y, partition.tile.high.y);
+    }
+
+    const int width  = rect.high.x - rect.low.x + 1;
+    const int height = rect.high.y - rect.low.y + 1;
+
+    PartialRenderTarget ret;
+    ret.full_res = { filter.width(), filter.height() };
+    ret.rect     = rect;
+    ret.value  .initialize(height, width);
+    ret.weight .initialize(height, width);
+    ret.albedo .initialize(height, width);
+    ret.normal .initialize(height, width);
+    ret.denoise.initialize(height, width);
+
+    for(int y = 0; y < height; ++y)
+    {
+        for(int x = 0; x < width; ++x)
+        {
+            const int fy = y + rect.low.y, fx = x + rect.low.x;
+            ret.value  (y, x) = image_buffer.value  (fy, fx);
+            ret.weight (y, x) = image_buffer.weight (fy, fx);
+            ret.albedo (y, x) = image_buffer.albedo (fy, fx);
+            ret.normal (y, x) = image_buffer.normal (fy, fx);
+            ret.denoise(y, x) = image_buffer.denoise(fy, fx);
+        }
+    }
+
+    return ret;
 }
 
 AGZ_TRACER_END
@@ -2,46 +2,189 @@
 
 #include <agz/tracer/core/renderer.h>
 #include <agz/tracer/core/render_target.h>
+#include <agz/tracer/core/sampler.h>
+#include <agz/tracer/create/renderer.h>
+#include <agz/tracer/create/sampler.h>
 #include <agz/tracer/render/path_tracing.h>
 
 AGZ_TRACER_BEGIN
 
 class PerPixelRenderer : public Renderer
 {
-    using ImageBuffer = ImageBufferTemplate<true, true, true, true, true>;
-
-    // image value, weight, albedo, normal, denoise
-    using Grid = FilmFilterApplier::FilmGrid<
-        Spectrum, real, Spectrum, Vec3, real>;
-
-    void render_grid(
-        const Scene &scene, Sampler &sampler,
-        Grid &grid, const Vec2i &full_res, int spp) const;
+    using ImageBuffer = ImageBufferTemplate<true, true, true, true, true, true>;
 
+    /**
+     * @brief accumulate samples into image_buffer
+     *
+     * partition is null when rendering the whole film
+     */
     template<bool REPORTER_WITH_PREVIEW>
-    RenderTarget render_impl(
-        FilmFilterApplier filter, Scene &scene, RendererInteractor &reporter);
+    void render_impl(
+        FilmFilterApplier filter, Scene &scene, RendererInteractor &reporter,
+        const RenderPartition *partition, ImageBuffer &image_buffer);
 
     int worker_count_;
     int task_grid_size_;
 
     int spp_;
 
+    AdaptiveSamplingParams adaptive_;
+
+    SamplerType sampler_type_;
+
+    /**
+     * @brief compute sample counts of the next adaptive pass
+     *
+     * @return number of allocated samples. 0 when all pixels are converged
+     */
+    double allocate_adaptive_samples(
+        const Image2D<PixelVariance> &variance,
+        double pass_budget, Image2D<int> &pixel_spp) const;
+
+    /**
+     * @brief average relative error of given pixels, used by the target error
+     */
+    real average_relative_error(
+        const Image2D<PixelVariance> &variance, const Rect2i &pixels) const;
+
 protected:
 
     using Pixel = render::Pixel;
 
+    // image value, weight, albedo, normal, denoise
+    using Grid = FilmFilterApplier::FilmGrid<
+        Spectrum, real, Spectrum, Vec3, real>;
+
+    /**
+     * @brief rendering task of a pixel block
+     */
+    struct GridTask
+    {
+        // pixels owned by this task
+        Rect2i pixels;
+
+        // samples of each pixel when pixel_spp is null
+        int spp = 1;
+
+        // per-pixel sample counts given by adaptive sampling
+        const Image2D<int> *pixel_spp = nullptr;
+
+        // receives sample values in owned pixels. can be null
+        Image2D<PixelVariance> *variance = nullptr;
+
+        // index of the first sample of each pixel when pixel_first_sample
+        // is null
+        int first_sample = 0;
+
+        // per-pixel indices of the first sample given by adaptive sampling
+        const Image2D<int> *pixel_first_sample = nullptr;
+
+        // reseed the native sampler per sample in partial rendering
+        bool reseed = false;
+
+        // low discrepancy sampler used instead of the native one. can be null
+        Sampler *pixel_sampler = nullptr;
+
+        int spp_of(int px, int py) const noexcept;
+
+        int first_sample_of(int px, int py) const noexcept;
+
+        /**
+         * @brief prepare samplers for the i-th sample of given pixel
+         *
+         * reseeding makes the sample only depend on its pixel and global
+         * sample index, so that sample ranges rendered by different
+         * processes are independent and reproducible
+         *
+         * @return sampler used by the sample
+         */
+        Sampler &begin_sample(
+            NativeSampler &sampler, int px, int py, int i) const noexcept;
+
+        static NativeSampler::seed_t sample_seed(
+            int px, int py, int sample_index) noexcept;
+
+        void record(int px, int py, const Spectrum &value) const noexcept;
+    };
+
+    /**
+     * @brief render task.spp_of(px, py) samples for each pixel in given grid
+     *
+     * default implementation traces samples one by one with eval_pixel
+     */
+    virtual void render_grid(
+        const Scene &scene, NativeSampler &sampler,
+        Grid &grid, const Vec2i &full_res, const GridTask &task) const;
+
     virtual Pixel eval_pixel(
         const Scene &scene, const Ray &ray,
         Sampler &sampler, Arena &arena) const = 0;
 
 public:
 
-    PerPixelRenderer(int worker_count, int task_grid_size, int spp);
+    PerPixelRenderer(
+        int worker_count, int task_grid_size, int spp,
+        const AdaptiveSamplingParams &adaptive = {},
+        SamplerType sampler_type = SamplerType::Native);
 
     RenderTarget render(
         FilmFilterApplier filter, Scene &scene,
         RendererInteractor &reporter) override;
+
+    PartialRenderTarget render_partial(
+        FilmFilterApplier filter, Scene &scene,
+        RendererInteractor &reporter,
+        const RenderPartition &partition) override;
 };
 
+inline int PerPixelRenderer::GridTask::spp_of(int px, int py) const noexcept
+{
+    if(!pixel_spp)
+        return spp;
+    px = math::clamp(px, 0, pixel_spp->width() - 1);
+    py = math::clamp(py, 0, pixel_spp->height() - 1);
+    return pixel_spp->at(py, px);
+}
+
+inline int PerPixelRenderer::GridTask::first_sample_of(
+    int px, int py) const noexcept
+{
+    if(!pixel_first_sample)
+        return first_sample;
+    px = math::clamp(px, 0, pixel_first_sample->width() - 1);
+    py = math::clamp(py, 0, pixel_first_sample->height() - 1);
+    return pixel_first_sample->at(py, px);
+}
+
+inline Sampler &PerPixelRenderer::GridTask::begin_sample(
+    NativeSampler &sampler, int px, int py, int i) const noexcept
+{
+    const int sample_index = first_sample_of(px, py) + i;
+
+    if(reseed)
+        sampler.set_seed(sample_seed(px, py, sample_index));
+
+    if(!pixel_sampler)
+        return sampler;
+
+    pixel_sampler->start_pixel_sample({ px, py }, sample_index);
+    return *pixel_sampler;
+}
+
+inline NativeSampler::seed_t PerPixelRenderer::GridTask::sample_seed(
+    int px, int py, int sample_index) noexcept
+{
+    return static_cast<NativeSampler::seed_t>(
+        hash_pixel_sample({ px, py }, sample_index));
+}
+
+inline void PerPixelRenderer::GridTask::record(
+    int px, int py, const Spectrum &value) const noexcept
+{
+    if(variance &&
+       pixels.low.x <= px && px <= pixels.high.x &&
+       pixels.low.y <= py && py <= pixels.high.y)
+        variance->at(py, px).add(value.lum());
+}
+
 AGZ_TRACER_END
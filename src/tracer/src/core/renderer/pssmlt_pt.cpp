@@ -5,41 +5,13 @@
 #include <agz/tracer/create/renderer.h>
 #include <agz/tracer/render/path_tracing.h>
 #include <agz/tracer/render/pssmlt.h>
+#include <agz/tracer/utility/checkpoint.h>
 #include <agz/tracer/utility/parallel_grid.h>
+#include <agz/tracer/utility/splat_film.h>
 #include <agz/utility/thread.h>
 
 AGZ_TRACER_BEGIN
 
-namespace
-{
-    struct AtomicSpectrum
-    {
-        std::atomic<real> channels[SPECTRUM_COMPONENT_COUNT] = { 0 };
-
-        AtomicSpectrum() = default;
-
-        AtomicSpectrum(const AtomicSpectrum &s) noexcept
-        {
-            for(int i = 0; i < SPECTRUM_COMPONENT_COUNT; ++i)
-                channels[i] = s.channels[i].load();
-        }
-
-        void add(const Spectrum &rhs) noexcept
-        {
-            for(int i = 0; i < SPECTRUM_COMPONENT_COUNT; ++i)
-                math::atomic_add(channels[i], rhs[i]);
-        }
-
-        Spectrum to_spectrum() const noexcept
-        {
-            Spectrum ret;
-            for(int i = 0; i < SPECTRUM_COMPONENT_COUNT; ++i)
-                ret[i] = channels[i].load();
-            return ret;
-        }
-    };
-}
-
 class PSSMLTPTRenderer : public Renderer
 {
     PSSMLTPTRendererParams params_;
@@ -102,6 +74,8 @@ RenderTarget PSSMLTPTRenderer::render(
     std::mutex reporter_mutex;
     reporter.begin();
 
+    start_timer();
+
     // per thread resources
 
     std::vector<Arena> perthread_arenas(thread_count);
@@ -173,20 +147,22 @@ RenderTarget PSSMLTPTRenderer::render(
 
     // film
 
-    Image2D<AtomicSpectrum> film(filter.height(), filter.width());
-
-    const Rect2i pixel_range = {
-        { 0, 0 },
-        { filter.width() - 1, filter.height() - 1 }
-    };
-
-    const real filter_radius = filter.radius();
+    SplatFilm film(filter, thread_count);
 
     // perthread native samplers
 
-    std::vector<NativeSampler> perthread_native_sampler;
+    Arena sampler_arena;
+    std::vector<NativeSampler *> perthread_native_sampler;
     for(int i = 0; i < thread_count; ++i)
-        perthread_native_sampler.push_back(NativeSampler(i, false));
+    {
+        perthread_native_sampler.push_back(
+            sampler_arena.create<NativeSampler>(i, false));
+    }
+
+    // mutations actually done. may be less than the total one
+    // when the time budget is exceeded
+
+    std::atomic<uint64_t> done_mut_cnt = 0;
 
     // how to run a markov chain
 
@@ -194,9 +170,14 @@ RenderTarget PSSMLTPTRenderer::render(
     {
         Arena &local_arena = perthread_arenas[thread_index];
 
+        // splats of a chain are flushed when it ends
+
+        SplatFilm::Splatter &splatter = film.splatter(thread_index);
+        AGZ_SCOPE_GUARD({ splatter.flush(); });
+
         // sample startup seed
 
-        auto &native_sampler = perthread_native_sampler[thread_index];
+        auto &native_sampler = *perthread_native_sampler[thread_index];
 
         // initialize mlt sampler
 
@@ -223,8 +204,20 @@ RenderTarget PSSMLTPTRenderer::render(
 
         for(uint64_t mut_idx = 0; mut_idx < mut_count; ++mut_idx)
         {
+            // splats of the done mutations are still flushed, so they
+            // must be counted
+
             if(stop_rendering_)
+            {
+                done_mut_cnt += mut_idx;
+                return false;
+            }
+
+            if(mut_idx % 1024 == 1023 && exceeds_time_budget())
+            {
+                done_mut_cnt += mut_idx;
                 return false;
+            }
 
             mlt_sampler.new_iteration();
 
@@ -257,30 +250,14 @@ RenderTarget PSSMLTPTRenderer::render(
                     proposed_spectrum * accept_prob / proposed_spectrum.lum();
 
                 if(proposed_add.is_finite())
-                {
-                    apply_image_filter(
-                        pixel_range, filter_radius, proposed_pixel_coord,
-                        [&](int px, int py, real x_rel, real y_rel)
-                    {
-                        const real w = filter.eval_filter(x_rel, y_rel);
-                        film(py, px).add(w * proposed_add);
-                    });
-                }
+                    splatter.splat(proposed_pixel_coord, proposed_add);
             }
 
             const Spectrum current_add =
                 current_spectrum * (1 - accept_prob) / current_spectrum.lum();
 
             if(current_add.is_finite())
-            {
-                apply_image_filter(
-                    pixel_range, filter_radius, current_pixel_coord,
-                    [&](int px, int py, real x_rel, real y_rel)
-                {
-                    const real w = filter.eval_filter(x_rel, y_rel);
-                    film(py, px).add(w * current_add);
-                });
-            }
+                splatter.splat(current_pixel_coord, current_add);
 
             // accept/reject
 
@@ -298,6 +275,7 @@ RenderTarget PSSMLTPTRenderer::render(
                 local_arena.release();
         }
 
+        done_mut_cnt += mut_count;
         return true;
     };
 
@@ -311,26 +289,75 @@ RenderTarget PSSMLTPTRenderer::render(
         uint64_t(filter.width()) *
         uint64_t(filter.height());
 
-    if(reporter.need_image_preview())
+    // checkpoint. chains are saved at batch boundaries where no chain is
+    // running. startup samples are deterministic and are recomputed
+
+    const std::string checkpoint_tag = "pssmlt_pt";
+
+    int first_chain_idx = 0;
+    uint64_t finished_mut_cnt = 0;
+
+    auto write_state = [&](CheckpointWriter &writer)
+    {
+        writer.write(int32_t(params_.mut_per_pixel));
+        writer.write(int32_t(params_.chain_count));
+        writer.write(b);
+        writer.write(int32_t(first_chain_idx));
+        writer.write(finished_mut_cnt);
+        writer.write(done_mut_cnt.load());
+
+        writer.write_image(film.get_image());
+
+        writer.write_samplers(perthread_native_sampler);
+    };
+
+    if(auto reader = open_checkpoint(checkpoint_tag))
+    {
+        if(reader->read<int32_t>() != params_.mut_per_pixel ||
+           reader->read<int32_t>() != params_.chain_count)
+        {
+            throw CheckpointException(
+                "checkpoint is written with different mutation settings");
+        }
+
+        const real saved_b = reader->read<real>();
+        if(std::abs(saved_b - b) > real(1e-4) * (std::max)(b, real(1)))
+            throw CheckpointException("checkpoint is written for another scene");
+
+        first_chain_idx  = reader->read<int32_t>();
+        finished_mut_cnt = reader->read<uint64_t>();
+        done_mut_cnt     = reader->read<uint64_t>();
+
+        Image2D<Spectrum> saved_film(filter.height(), filter.width());
+        reader->read_image(saved_film);
+        film.add_image(saved_film);
+
+        reader->read_samplers(perthread_native_sampler, [&](int i)
+        {
+            return sampler_arena.create<NativeSampler>(i, false);
+        });
+    }
+
+    if(reporter.need_image_preview() || checkpoint_.is_enabled())
     {
         const int chain_report_interval = math::clamp(
             params_.chain_count / 32, thread_count, 1000);
 
         thread::thread_group_t thread_group;
 
-        uint64_t finished_mut_cnt = 0;
-
-        for(int chain_idx = 0; chain_idx < params_.chain_count;
+        for(int chain_idx = first_chain_idx; chain_idx < params_.chain_count;
             chain_idx += chain_report_interval)
         {
-            if(stop_rendering_)
+            if(stop_rendering_ || exceeds_time_budget())
                 break;
 
             const int chain_end = (std::min)(chain_idx + chain_report_interval,
                                              params_.chain_count);
             const int chain_cnt = chain_end - chain_idx;
+            int finished_chain_cnt = 0;
 
-            parallel_for_1d_grid(thread_count, chain_cnt, 1, thread_group,
+            parallel_for_1d_grid(
+                thread_count, chain_cnt, 1, thread_group, pin_threads_,
                 [&](int thread_index, int beg, int end)
             {
                 assert(beg + 1 == end);
@@ -351,6 +378,7 @@ RenderTarget PSSMLTPTRenderer::render(
                 {
                     std::lock_guard lk(reporter_mutex);
                     finished_mut_cnt += mut_cnt;
+                    ++finished_chain_cnt;
 
                     const real percent = real(100) * finished_mut_cnt
                                                    / total_mut_cnt;
@@ -362,26 +390,34 @@ RenderTarget PSSMLTPTRenderer::render(
 
             auto get_img = [&]
             {
-                const real scale = b / params_.mut_per_pixel
-                                 * total_mut_cnt / finished_mut_cnt;
+                const real scale = done_mut_cnt ?
+                    b / params_.mut_per_pixel * total_mut_cnt / done_mut_cnt :
+                    real(0);
 
-                return film.map([scale](const AtomicSpectrum &s)
-                {
-                    return scale * s.to_spectrum();
-                });
+                return film.get_image(scale);
             };
             
             const real percent = real(100) * finished_mut_cnt
                                / total_mut_cnt;
             reporter.progress(percent, get_img);
+
+            // chains cut by stop_rendering or the time budget cannot be
+            // resumed, so the checkpoint stays at the last complete batch
+
+            if(finished_chain_cnt != chain_cnt)
+                break;
+
+            first_chain_idx = chain_end;
+            save_checkpoint_if_due(checkpoint_tag, write_state);
         }
     }
     else
     {
         int finished_chain_cnt = 0;
 
+        thread::thread_group_t thread_group;
         parallel_for_1d_grid(
-            thread_count, params_.chain_count, 1,
+            thread_count, params_.chain_count, 1, thread_group, pin_threads_,
             [&](int thread_index, int beg, int end)
         {
             assert(beg + 1 == end);
@@ -415,13 +451,11 @@ RenderTarget PSSMLTPTRenderer::render(
 
     // compute final image
 
-    const real scale = b / params_.mut_per_pixel;
+    const real scale = done_mut_cnt ?
+        b / params_.mut_per_pixel * total_mut_cnt / done_mut_cnt : real(0);
 
     RenderTarget ret;
-    ret.image = film.map([scale](const AtomicSpectrum &s)
-    {
-        return scale * s.to_spectrum();
-    });
+    ret.image = film.get_image(scale);
 
     return ret;
 }
@@ -18,7 +18,8 @@ public:
     explicit PathTracingRenderer(const PTRendererParams &params)
         : PerPixelRenderer(
             params.worker_count,
-            params.task_grid_size, params.spp)
+            params.task_grid_size, params.spp,
+            params.adaptive, params.sampler)
     {
         params_.min_depth = params.min_depth;
         params_.max_depth = params.max_depth;
@@ -4,6 +4,7 @@
 #include <agz/tracer/core/scene.h>
 #include <agz/tracer/create/renderer.h>
 #include <agz/tracer/render/photon_mapping.h>
+#include <agz/tracer/utility/checkpoint.h>
 #include <agz/tracer/utility/parallel_grid.h>
 #include <agz/utility/thread.h>
 
@@ -57,6 +58,15 @@ RenderTarget SPPMRenderer::render(
     Image2D<Vec3>     normal_buffer (filter.height(), filter.width());
     Image2D<real>     denoise_buffer(filter.height(), filter.width());
 
+    // camera pass results of the current iteration. they are added to the
+    // pixels and g-buffers only after the photon pass is done, so that an
+    // interrupted iteration leaves no samples behind
+
+    Image2D<Spectrum> iter_direct_illum(filter.height(), filter.width());
+    Image2D<Spectrum> iter_albedo      (filter.height(), filter.width());
+    Image2D<Vec3>     iter_normal      (filter.height(), filter.width());
+    Image2D<real>     iter_denoise     (filter.height(), filter.width());
+
     Image2D<render::sppm::Pixel> sppm_pixels(filter.height(), filter.width());
     for(int y = 0; y < filter.height(); ++y)
     {
@@ -69,7 +79,7 @@ RenderTarget SPPMRenderer::render(
     Arena sampler_arena;
     auto sampler_prototype = newRC<NativeSampler>(42, false);
 
-    std::vector<Sampler *> perthread_sampler;
+    std::vector<NativeSampler *> perthread_sampler;
     for(int i = 0; i < thread_count; ++i)
         perthread_sampler.push_back(sampler_prototype->clone(i, sampler_arena));
 
@@ -101,10 +111,101 @@ RenderTarget SPPMRenderer::render(
 
     thread::thread_group_t thread_group;
 
-    for(int iter = 0; iter < params_.iteration_count; ++iter)
+    // costs of forward grids measured in the last iteration
+
+    GridCostHistory forward_grid_costs;
+
+    start_timer();
+
+    int finished_iter_count = 0;
+
+    // checkpoint. visible points are rebuilt in every iteration and
+    // photon statistics are cleared by update_pixel_params, so only
+    // the progressive estimator of each pixel is saved
+
+    const std::string checkpoint_tag = "sppm";
+
+    struct SavedPixel
+    {
+        real radius;
+        real N;
+        Spectrum tau;
+        Spectrum direct_illum;
+    };
+
+    auto write_state = [&](CheckpointWriter &writer)
+    {
+        writer.write(int32_t(params_.photons_per_iteration));
+        writer.write(int32_t(finished_iter_count));
+        writer.write(max_radius);
+
+        Image2D<SavedPixel> saved_pixels(filter.height(), filter.width());
+        for(int y = 0; y < filter.height(); ++y)
+        {
+            for(int x = 0; x < filter.width(); ++x)
+            {
+                auto &pixel = sppm_pixels(y, x);
+                saved_pixels(y, x) = {
+                    pixel.radius, pixel.N, pixel.tau, pixel.direct_illum
+                };
+            }
+        }
+        writer.write_image(saved_pixels);
+
+        writer.write_image(albedo_buffer);
+        writer.write_image(normal_buffer);
+        writer.write_image(denoise_buffer);
+
+        writer.write_samplers(perthread_sampler);
+    };
+
+    if(auto reader = open_checkpoint(checkpoint_tag))
+    {
+        if(reader->read<int32_t>() != params_.photons_per_iteration)
+        {
+            throw CheckpointException(
+                "checkpoint is written with different photons_per_iteration");
+        }
+
+        finished_iter_count = reader->read<int32_t>();
+        max_radius          = reader->read<real>();
+
+        Image2D<SavedPixel> saved_pixels(filter.height(), filter.width());
+        reader->read_image(saved_pixels);
+        for(int y = 0; y < filter.height(); ++y)
+        {
+            for(int x = 0; x < filter.width(); ++x)
+            {
+                auto &pixel = sppm_pixels(y, x);
+                auto &saved = saved_pixels(y, x);
+                pixel.radius       = saved.radius;
+                pixel.N            = saved.N;
+                pixel.tau          = saved.tau;
+                pixel.direct_illum = saved.direct_illum;
+            }
+        }
+
+        reader->read_image(albedo_buffer);
+        reader->read_image(normal_buffer);
+        reader->read_image(denoise_buffer);
+
+        reader->read_samplers(perthread_sampler, [&](int i)
+        {
+            return sampler_prototype->clone(i, sampler_arena);
+        });
+    }
+
+    const int first_iter = finished_iter_count;
+    for(int iter = first_iter; iter < params_.iteration_count; ++iter)
     {
         if(stop_rendering_)
-            return {};
+            break;
+
+        // stop when the next iteration is expected to exceed the time budget.
+        // at least one iteration is always done
+
+        if(iter > 0 && exceeds_time_budget(elapsed_seconds() / iter))
+            break;
 
         if(reporter.need_image_preview())
             reporter.message("start iter " + std::to_string(iter + 1));
@@ -131,7 +232,7 @@ RenderTarget SPPMRenderer::render(
         parallel_for_2d_grid(
             thread_count, filter.width(), filter.height(),
             params_.forward_task_grid_size, params_.forward_task_grid_size,
-            thread_group,
+            thread_group, forward_grid_costs, pin_threads_,
             [&](int thread_index, const Rect2i &grid)
         {
             auto camera    = scene.get_camera();
@@ -156,17 +257,18 @@ RenderTarget SPPMRenderer::render(
                     render::GBufferPixel gpixel;
 
                     auto &pixel = sppm_pixels(y, x);
+                    iter_direct_illum(y, x) = Spectrum();
                     pixel.vp = render::sppm::tracer_vp(
                         params_.forward_max_depth, 1,
                         scene, ray, cam_sam.throughput,
-                        vp_arena, *sampler, &gpixel, pixel.direct_illum);
+                        vp_arena, *sampler, &gpixel, iter_direct_illum(y, x));
 
                     if(pixel.vp.is_valid())
                         vp_searcher.add_vp(pixel, vp_arena);
 
-                    albedo_buffer(y, x) += gpixel.albedo;
-                    normal_buffer(y, x) += gpixel.normal;
-                    denoise_buffer(y, x) += gpixel.denoise;
+                    iter_albedo (y, x) = gpixel.albedo;
+                    iter_normal (y, x) = gpixel.normal;
+                    iter_denoise(y, x) = gpixel.denoise;
                 }
 
                 if(stop_rendering_)
@@ -193,7 +295,7 @@ RenderTarget SPPMRenderer::render(
             thread_count,
             params_.photons_per_iteration,
             4096,
-            thread_group,
+            thread_group, pin_threads_,
             [&](int thread_index, int beg, int end)
         {
             auto sampler = perthread_sampler[thread_index];
@@ -224,7 +326,12 @@ RenderTarget SPPMRenderer::render(
             return true;
         });
 
-        // update pixel params
+        // an interrupted iteration is discarded
+
+        if(stop_rendering_)
+            break;
+
+        // commit the camera pass and update pixel params
 
         max_radius = 0;
         for(int y = 0; y < filter.height(); ++y)
@@ -250,6 +357,11 @@ RenderTarget SPPMRenderer::render(
             {
                 for(int x = 0; x < filter.width(); ++x)
                 {
+                    sppm_pixels(y, x).direct_illum += iter_direct_illum(y, x);
+                    albedo_buffer (y, x) += iter_albedo (y, x);
+                    normal_buffer (y, x) += iter_normal (y, x);
+                    denoise_buffer(y, x) += iter_denoise(y, x);
+
                     if(sppm_pixels(y, x).vp.is_valid())
                     {
                         update_pixel_params(
@@ -274,6 +386,9 @@ RenderTarget SPPMRenderer::render(
         }
         else
             reporter.progress(progress_end, {});
+
+        ++finished_iter_count;
+        save_checkpoint_if_due(checkpoint_tag, write_state);
     }
 
     reporter.end_stage();
@@ -283,11 +398,21 @@ RenderTarget SPPMRenderer::render(
 
     RenderTarget ret;
 
-    const uint64_t photon_count = uint64_t(params_.iteration_count)
+    if(!finished_iter_count)
+    {
+        // stopped in the first iteration
+        ret.image   = Image2D<Spectrum>(filter.height(), filter.width());
+        ret.albedo  = Image2D<Spectrum>(filter.height(), filter.width());
+        ret.normal  = Image2D<Vec3>    (filter.height(), filter.width());
+        ret.denoise = Image2D<real>    (filter.height(), filter.width());
+        return ret;
+    }
+
+    const uint64_t photon_count = uint64_t(finished_iter_count)
                                 * uint64_t(params_.photons_per_iteration);
-    ret.image = compute_image(params_.iteration_count, photon_count);
+    ret.image = compute_image(finished_iter_count, photon_count);
 
-    const real gbuffer_ratio = 1 / real(params_.iteration_count);
+    const real gbuffer_ratio = 1 / real(finished_iter_count);
     ret.albedo  = albedo_buffer  * gbuffer_ratio;
     ret.normal  = normal_buffer  * gbuffer_ratio;
     ret.denoise = denoise_buffer * gbuffer_ratio;
@@ -5,45 +5,13 @@
 #include <agz/tracer/core/scene.h>
 #include <agz/tracer/create/renderer.h>
 #include <agz/tracer/render/bidir_path_tracing.h>
+#include <agz/tracer/utility/checkpoint.h>
 #include <agz/tracer/utility/parallel_grid.h>
+#include <agz/tracer/utility/splat_film.h>
 #include <agz/utility/thread.h>
 
 AGZ_TRACER_BEGIN
 
-namespace
-{
-    struct AtomicSpectrum
-    {
-        std::atomic<real> channels[SPECTRUM_COMPONENT_COUNT];
-
-        AtomicSpectrum() noexcept
-        {
-            for(auto &c : channels)
-                c = real(0);
-        }
-
-        AtomicSpectrum(const AtomicSpectrum &s) noexcept
-        {
-            for(int i = 0; i < SPECTRUM_COMPONENT_COUNT; ++i)
-                channels[i] = s.channels[i].load();
-        }
-
-        void add(const Spectrum &s) noexcept
-        {
-            for(int i = 0; i < SPECTRUM_COMPONENT_COUNT; ++i)
-                math::atomic_add(channels[i], s[i]);
-        }
-
-        Spectrum to_spectrum() const noexcept
-        {
-            Spectrum ret;
-            for(int i = 0; i < SPECTRUM_COMPONENT_COUNT; ++i)
-                ret[i] = channels[i];
-            return ret;
-        }
-    };
-}
-
 class VolBDPTRenderer : public Renderer
 {
 public:
@@ -58,8 +26,6 @@ private:
 
     using ImageBuffer = ImageBufferTemplate<true, true, true, true, true>;
 
-    using ParticleImage = Image2D<AtomicSpectrum>;
-
     using FilmGridView = FilmFilterApplier::FilmGridView<
         Spectrum, real, Spectrum, Vec3, real>;
 
@@ -67,29 +33,45 @@ private:
     {
         const Scene &scene;
         FilmGridView &film_grid_view;
-        ParticleImage &particle_image;
-        FilmFilterApplier filter;
+        SplatFilm::Splatter &particle_splatter;
 
         Vec2 full_res;
 
         Rect2 particle_sample_pixel_bound;
-        Rect2i particle_pixel_range;
 
         render::bdpt::Vertex *camera_subpath_space = nullptr;
         render::bdpt::Vertex *light_subpath_space  = nullptr;
     };
 
+    /**
+     * @brief trace a bdpt path starting from given pixel
+     *
+     * light tracing splats are dropped when splat_particles is false
+     */
     template<bool USE_MIS>
-    int render_bdpt_path(
+    void render_bdpt_path(
         EvalPathParams &params,
-        int px, int py,
-        NativeSampler &sampler, Arena &arena);
-
+        int px, int py, bool splat_particles,
+        Sampler &sampler, Arena &arena);
+
+    /**
+     * @brief trace spp paths starting from each pixel in given grid
+     *
+     * pixel_sampler is used instead of sampler when it is not null. its
+     * sample indices of each pixel start from first_sample
+     *
+     * pixels around the grid are also sampled for the filter. their samples
+     * are traced by the neighboring task as well, so only samples of pixels
+     * owned by the grid splat particles, which are counted in the returned
+     * particle count
+     *
+     * particle splats are flushed before returning
+     */
     template<bool USE_MIS>
     int render_grid(
-        const Scene &scene, NativeSampler &sampler,
-        FilmGridView &film_grid_view, ParticleImage &particle_image,
-        FilmFilterApplier filter, int spp);
+        const Scene &scene, NativeSampler &sampler, Sampler *pixel_sampler,
+        FilmGridView &film_grid_view, SplatFilm::Splatter &particle_splatter,
+        FilmFilterApplier filter, int first_sample, int spp);
 
     template<bool REPORT_WITH_PREVIEW, bool USE_MIS>
     RenderTarget render_impl(
@@ -99,10 +81,10 @@ private:
 };
 
 template<bool USE_MIS>
-int VolBDPTRenderer::render_bdpt_path(
+void VolBDPTRenderer::render_bdpt_path(
     EvalPathParams &params,
-    int px, int py,
-    NativeSampler &sampler, Arena &arena)
+    int px, int py, bool splat_particles,
+    Sampler &sampler, Arena &arena)
 {
     // sample film coord
 
@@ -132,7 +114,7 @@ int VolBDPTRenderer::render_bdpt_path(
 
     const auto select_light = params.scene.sample_light(sampler.sample1());
     if(!select_light.light)
-        return 0;
+        return;
 
     const auto light_subpath = build_light_subpath(
         params_.lht_max_vtx_cnt, select_light, params.scene,
@@ -151,16 +133,8 @@ int VolBDPTRenderer::render_bdpt_path(
         light_subpath.vertices, light_subpath.vertex_count,
         select_light, [&](const Vec2 &particle_coord, const Spectrum &rad)
     {
-        if(rad.is_finite())
-        {
-            apply_image_filter(
-                params.particle_pixel_range, params.filter.radius(),
-                particle_coord, [&](int pix, int piy, real rel_x, real rel_y)
-            {
-                const real weight = params.filter.eval_filter(rel_x, rel_y);
-                params.particle_image(piy, pix).add(weight * rad);
-            });
-        }
+        if(splat_particles && rad.is_finite())
+            params.particle_splatter.splat(particle_coord, rad);
     });
 
     if(radiance.is_finite())
@@ -172,15 +146,13 @@ int VolBDPTRenderer::render_bdpt_path(
             camera_subpath.g_normal,
             camera_subpath.g_denoise);
     }
-
-    return 1;
 }
 
 template<bool USE_MIS>
 int VolBDPTRenderer::render_grid(
-    const Scene &scene, NativeSampler &sampler,
-    FilmGridView &film_grid_view, ParticleImage &particle_image,
-    FilmFilterApplier filter, int spp)
+    const Scene &scene, NativeSampler &sampler, Sampler *pixel_sampler,
+    FilmGridView &film_grid_view, SplatFilm::Splatter &particle_splatter,
+    FilmFilterApplier filter, int first_sample, int spp)
 {
     if(scene.lights().empty())
         return 0;
@@ -193,19 +165,12 @@ int VolBDPTRenderer::render_grid(
         { real(filter.width() - 1), real(filter.height() - 1) }
     };
 
-    const Rect2i particle_pixel_range = {
-        { 0, 0 },
-        { filter.width() - 1, filter.height() - 1 }
-    };
-
     EvalPathParams eval_params = {
         scene,
         film_grid_view,
-        particle_image,
-        filter,
+        particle_splatter,
         { real(filter.width()), real(filter.height()) },
         particle_sample_pixel_bound,
-        particle_pixel_range,
         cam_subpath.data(),
         lht_subpath.data()
     };
@@ -215,25 +180,45 @@ int VolBDPTRenderer::render_grid(
     Arena arena;
 
     const Rect2i sample_pixels = film_grid_view.sample_pixels();
+    const Rect2i owned_pixels  = film_grid_view.pixels();
 
     for(int py = sample_pixels.low.y; py <= sample_pixels.high.y; ++py)
     {
         for(int px = sample_pixels.low.x; px <= sample_pixels.high.x; ++px)
         {
+            const bool is_owned = owned_pixels.low.x <= px &&
+                                  px <= owned_pixels.high.x &&
+                                  owned_pixels.low.y <= py &&
+                                  py <= owned_pixels.high.y;
+
             for(int i = 0; i < spp; ++i)
             {
-                particle_count += render_bdpt_path<USE_MIS>(
-                    eval_params, px, py, sampler, arena);
+                Sampler *sam = &sampler;
+                if(pixel_sampler)
+                {
+                    pixel_sampler->start_pixel_sample(
+                        { px, py }, first_sample + i);
+                    sam = pixel_sampler;
+                }
+
+                render_bdpt_path<USE_MIS>(
+                    eval_params, px, py, is_owned, *sam, arena);
+                if(is_owned)
+                    ++particle_count;
 
                 if(arena.used_bytes() >= 32 * 1024 * 1024)
                     arena.release();
 
                 if(stop_rendering_)
+                {
+                    particle_splatter.flush();
                     return particle_count;
+                }
             }
         }
     }
 
+    particle_splatter.flush();
     return particle_count;
 }
 
@@ -244,7 +229,6 @@ RenderTarget VolBDPTRenderer::render_impl(
     // initialize image buffers
 
     ImageBuffer image_buffer(filter.width(), filter.height());
-    ParticleImage particle_image(filter.height(), filter.width());
 
     std::atomic<uint64_t> particle_count = 0;
 
@@ -253,6 +237,12 @@ RenderTarget VolBDPTRenderer::render_impl(
     const int thread_count = thread::actual_worker_count(params_.worker_count);
     thread::thread_group_t threads(thread_count);
 
+    // grid costs measured in the last progressive pass
+
+    GridCostHistory grid_costs;
+
+    SplatFilm particle_film(filter, thread_count);
+
     // per-thread samplers
 
     Arena sampler_arena;
@@ -271,13 +261,72 @@ RenderTarget VolBDPTRenderer::render_impl(
 
     std::mutex reporter_mutex;
 
+    start_timer();
+
+    // checkpoint
+
+    const std::string checkpoint_tag = "vol_bdpt";
+
+    int finished_spp = 0;
+
+    auto write_state = [&](CheckpointWriter &writer)
+    {
+        writer.write(int32_t(params_.spp));
+        writer.write(int32_t(finished_spp));
+        writer.write(particle_count.load());
+
+        writer.write_image(image_buffer.value);
+        writer.write_image(image_buffer.weight);
+        writer.write_image(image_buffer.albedo);
+        writer.write_image(image_buffer.normal);
+        writer.write_image(image_buffer.denoise);
+        writer.write_image(particle_film.get_image());
+
+        writer.write_samplers(perthread_samplers);
+    };
+
+    if(auto reader = open_checkpoint(checkpoint_tag))
+    {
+        if(reader->read<int32_t>() != params_.spp)
+            throw CheckpointException("checkpoint is written with different spp");
+
+        finished_spp   = reader->read<int32_t>();
+        particle_count = reader->read<uint64_t>();
+
+        reader->read_image(image_buffer.value);
+        reader->read_image(image_buffer.weight);
+        reader->read_image(image_buffer.albedo);
+        reader->read_image(image_buffer.normal);
+        reader->read_image(image_buffer.denoise);
+
+        Image2D<Spectrum> saved_particle_image(filter.height(), filter.width());
+        reader->read_image(saved_particle_image);
+        particle_film.add_image(saved_particle_image);
+
+        reader->read_samplers(perthread_samplers, [&](int i)
+        {
+            return sampler_prototype->clone(i, sampler_arena);
+        });
+    }
+
+    // low discrepancy samplers
+
+    std::vector<Sampler *> perthread_pixel_samplers;
+    for(size_t i = 0; i < perthread_samplers.size(); ++i)
+    {
+        perthread_pixel_samplers.push_back(
+            create_pixel_sampler(params_.sampler, sampler_arena));
+    }
+
     // do the real work
 
-    if constexpr(REPORT_WITH_PREVIEW)
+    if(REPORT_WITH_PREVIEW || termination_.time_budget > 0 ||
+       checkpoint_.is_enabled())
     {
         // 1. render 1 spp for fast previewing
         // 2. divide remaining spp(s) into tasks, then divide tasks into
-        //    iterations. sync all threads per iteration and update reporter
+        //    iterations. sync all threads per iteration and update reporter.
+        //    iterations are shrunk to fit in the time budget
 
         // previewing image computation
 
@@ -291,59 +340,76 @@ RenderTarget VolBDPTRenderer::render_impl(
 
             const real bwd_ratio = filter.width() * filter.height() *
                 (particle_count > 0 ? real(1) / particle_count : real(0));
-            const auto bwd_img = particle_image.map([&](const AtomicSpectrum &as)
-            {
-                return bwd_ratio * as.to_spectrum();
-            });
+            const auto bwd_img = particle_film.get_image(bwd_ratio);
 
             return fwd_img + bwd_img;
         };
 
         // render 1 spp for fast previewing
 
-        parallel_for_2d_grid(
-            thread_count,
-            filter.width(), filter.height(),
-            params_.task_grid_size, params_.task_grid_size,
-            threads, [&](int thread_index, const Rect2i &grid)
+        if(!finished_spp)
         {
-            auto view = filter.create_subgrid_view({
-                grid.low, grid.high - Vec2i(1)},
-                image_buffer.value, image_buffer.weight,
-                image_buffer.albedo,
-                image_buffer.normal,
-                image_buffer.denoise);
+            parallel_for_2d_grid(
+                thread_count,
+                filter.width(), filter.height(),
+                params_.task_grid_size, params_.task_grid_size,
+                threads, grid_costs, pin_threads_,
+                [&](int thread_index, const Rect2i &grid)
+            {
+                auto view = filter.create_subgrid_view({
+                    grid.low, grid.high - Vec2i(1)},
+                    image_buffer.value, image_buffer.weight,
+                    image_buffer.albedo,
+                    image_buffer.normal,
+                    image_buffer.denoise);
 
-            const int delta_pc = render_grid<USE_MIS>(
-                scene, *perthread_samplers[thread_index],
-                view, particle_image, filter, 1);
+                const int delta_pc = render_grid<USE_MIS>(
+                    scene, *perthread_samplers[thread_index],
+                    perthread_pixel_samplers[thread_index],
+                    view, particle_film.splatter(thread_index),
+                    filter, 0, 1);
 
-            particle_count += delta_pc;
+                particle_count += delta_pc;
 
-            return !stop_rendering_;
-        });
+                return !stop_rendering_;
+            });
+
+            reporter.progress(100.0 / params_.spp, get_img);
 
-        reporter.progress(100.0 / params_.spp, get_img);
+            finished_spp = 1;
+            save_checkpoint_if_due(checkpoint_tag, write_state);
+        }
 
         // render remaining spp
 
         const int preview_spp_interval = (std::max)(1, (params_.spp - 1) / 25);
 
-        int finished_spp = 1;
         while(finished_spp < params_.spp)
         {
             if(stop_rendering_)
                 break;
 
+            int iter_spp = preview_spp_interval;
+            if(termination_.time_budget > 0)
+            {
+                const double elapsed = elapsed_seconds();
+                const double seconds_per_spp = elapsed / finished_spp;
+                iter_spp = static_cast<int>((std::min)(double(iter_spp),
+                    (termination_.time_budget - elapsed) / seconds_per_spp));
+            }
+            if(iter_spp <= 0)
+                break;
+
             const int new_finished_spp = (std::min)(
-                params_.spp, finished_spp + preview_spp_interval);
+                params_.spp, finished_spp + iter_spp);
             const int delta_spp = new_finished_spp - finished_spp;
 
             parallel_for_2d_grid(
                 thread_count,
                 filter.width(), filter.height(),
                 params_.task_grid_size, params_.task_grid_size,
-                threads, [&](int thread_index, const Rect2i &grid)
+                threads, grid_costs, pin_threads_,
+                [&](int thread_index, const Rect2i &grid)
             {
                 auto view = filter.create_subgrid_view({
                     grid.low, grid.high - Vec2i(1) },
@@ -354,7 +420,9 @@ RenderTarget VolBDPTRenderer::render_impl(
 
                 const int delta_pc = render_grid<USE_MIS>(
                     scene, *perthread_samplers[thread_index],
-                    view, particle_image, filter, delta_spp);
+                    perthread_pixel_samplers[thread_index],
+                    view, particle_film.splatter(thread_index),
+                    filter, finished_spp, delta_spp);
 
                 particle_count += delta_pc;
 
@@ -362,6 +430,8 @@ RenderTarget VolBDPTRenderer::render_impl(
             });
 
             finished_spp = new_finished_spp;
+            save_checkpoint_if_due(checkpoint_tag, write_state);
+
             const double progress_percent = 100.0 * finished_spp / params_.spp;
 
             std::lock_guard lock(reporter_mutex);
@@ -379,7 +449,7 @@ RenderTarget VolBDPTRenderer::render_impl(
             thread_count,
             filter.width(), filter.height(),
             params_.task_grid_size, params_.task_grid_size,
-            threads, [&](int thread_index, const Rect2i &grid)
+            threads, pin_threads_, [&](int thread_index, const Rect2i &grid)
         {
             if(stop_rendering_)
                 return false;
@@ -393,7 +463,9 @@ RenderTarget VolBDPTRenderer::render_impl(
 
             const int delta_pc = render_grid<USE_MIS>(
                 scene, *perthread_samplers[thread_index],
-                view, particle_image, filter, params_.spp);
+                perthread_pixel_samplers[thread_index],
+                view, particle_film.splatter(thread_index),
+                filter, 0, params_.spp);
 
             particle_count += delta_pc;
 
@@ -433,11 +505,7 @@ RenderTarget VolBDPTRenderer::render_impl(
 
     const real bwd_ratio = filter.width() * filter.height() *
         (particle_count > 0 ? real(1) / particle_count : real(0));
-    render_target.image += particle_image.map(
-        [&](const AtomicSpectrum &as)
-    {
-        return bwd_ratio * as.to_spectrum();
-    });
+    render_target.image += particle_film.get_image(bwd_ratio);
 
     return render_target;
 }
@@ -0,0 +1,850 @@
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <agz/tracer/core/bsdf.h>
+#include <agz/tracer/core/bssrdf.h>
+#include <agz/tracer/core/camera.h>
+#include <agz/tracer/core/entity.h>
+#include <agz/tracer/core/light.h>
+#include <agz/tracer/core/material.h>
+#include <agz/tracer/core/medium.h>
+#include <agz/tracer/core/sampler.h>
+#include <agz/tracer/core/scene.h>
+#include <agz/tracer/create/renderer.h>
+
+#include "./perpixel_renderer.h"
+
+AGZ_TRACER_BEGIN
+
+namespace
+{
+
+    /**
+     * @brief state of a path in flight
+     */
+    struct PathState
+    {
+        int px = 0;
+        int py = 0;
+
+        real pixel_x = 0;
+        real pixel_y = 0;
+
+        // camera throughput, applied when the pixel is accumulated
+        Spectrum cam_throughput;
+
+        Ray ray;
+        Spectrum coef;
+
+        int depth            = 1;
+        int s_depth          = 1;
+        int scattering_count = 0;
+
+        bool is_active     = false;
+        bool is_terminated = false;
+
+        render::Pixel pixel;
+    };
+
+    /**
+     * @brief shadow ray of light sampling, whose contribution is added
+     *  when it is not occluded
+     */
+    struct ShadowRay
+    {
+        Ray ray;
+        Spectrum contrib;
+        int path = 0;
+    };
+
+    /**
+     * @brief bsdf/phase function sampled ray of mis direct illumination,
+     *  whose contribution depends on what it hits
+     */
+    struct DirectBSDFRay
+    {
+        Ray ray;
+
+        // coef * bsdf_f * abscos
+        Spectrum weight;
+        real bsdf_pdf = 1;
+        bool is_delta = false;
+
+        const Medium *medium = nullptr;
+
+        int path = 0;
+    };
+
+    /**
+     * @brief position of the next camera sample in a grid
+     */
+    struct SampleCursor
+    {
+        int px = 0;
+        int py = 0;
+
+        // index of the next sample in current pixel
+        int sample_index = 0;
+    };
+
+    /**
+     * @brief queues shared by all stages, reused between iterations
+     */
+    struct Wavefront
+    {
+        std::vector<PathState> paths;
+
+        std::vector<int>                extend_paths;
+        std::vector<Ray>                extend_rays;
+        std::vector<EntityIntersection> extend_incts;
+        std::unique_ptr<bool[]>         extend_results;
+
+        std::vector<int> hit_paths;
+
+        std::vector<ShadowRay>  shadow_rays;
+        std::vector<Ray>        shadow_ray_buffer;
+        std::unique_ptr<bool[]> shadow_results;
+        size_t                  shadow_results_size = 0;
+
+        std::vector<DirectBSDFRay>      direct_rays;
+        std::vector<Ray>                direct_ray_buffer;
+        std::vector<EntityIntersection> direct_incts;
+        std::unique_ptr<bool[]>         direct_results;
+        size_t                          direct_results_size = 0;
+
+        explicit Wavefront(int path_count)
+            : paths(path_count)
+        {
+            extend_paths.reserve(path_count);
+            extend_rays.reserve(path_count);
+            extend_incts.resize(path_count);
+            extend_results = std::make_unique<bool[]>(path_count);
+            hit_paths.reserve(path_count);
+        }
+    };
+
+    void ensure_result_buffer(
+        std::unique_ptr<bool[]> &buffer, size_t &size, size_t required)
+    {
+        if(size < required)
+        {
+            buffer = std::make_unique<bool[]>(required);
+            size = required;
+        }
+    }
+
+} // namespace anonymous
+
+class WavefrontPathTracingRenderer : public PerPixelRenderer
+{
+    render::TraceParams params_;
+    bool use_mis_;
+
+    int path_state_count_;
+
+    render::Pixel(*eval_func_)(
+        const render::TraceParams &, const Scene &,
+        const Ray &, Sampler &, Arena &);
+
+    /**
+     * @brief sample direct illumination at a surface point
+     *
+     * same as mis_sample_light + mis_sample_bsdf, except that the ray queries
+     * are pushed into queues instead of being done immediately
+     */
+    void sample_direct_illum(
+        const Scene &scene, const EntityIntersection &inct,
+        const ShadingPoint &shd, const Spectrum &coef, int path,
+        Sampler &sampler, Wavefront &wf) const
+    {
+        const real scale = real(1) / params_.direct_illum_sample_count;
+
+        for(int i = 0; i < params_.direct_illum_sample_count; ++i)
+        {
+            for(auto light : scene.lights())
+            {
+                const auto light_sample = light->sample(
+                    inct.pos, sampler.sample5());
+
+                if(light->is_area())
+                {
+                    if(!light_sample.radiance || !light_sample.pdf)
+                        continue;
+
+                    const real shadow_ray_len =
+                        (light_sample.pos - inct.pos).length() - EPS();
+                    if(shadow_ray_len <= EPS())
+                        continue;
+                    const Vec3 inct_to_light =
+                        (light_sample.pos - inct.pos).normalize();
+
+                    const auto med = inct.medium(inct_to_light);
+
+                    const auto bsdf_f = shd.bsdf->eval_all(
+                        inct_to_light, inct.wr, TransMode::Radiance);
+                    if(!bsdf_f)
+                        continue;
+
+                    const Spectrum f = med->tr(light_sample.pos, inct.pos, sampler)
+                                     * light_sample.radiance * bsdf_f
+                                     * std::abs(cos(inct_to_light, inct.geometry_coord.z));
+                    const real bsdf_pdf = shd.bsdf->pdf_all(inct_to_light, inct.wr);
+
+                    wf.shadow_rays.push_back({
+                        Ray(inct.pos, inct_to_light, EPS(), shadow_ray_len),
+                        scale * coef * f / (light_sample.pdf + bsdf_pdf),
+                        path });
+                }
+                else
+                {
+                    if(!light_sample.radiance)
+                        continue;
+
+                    const Vec3 ref_to_light = light_sample.ref_to_light();
+                    const Spectrum bsdf_f = shd.bsdf->eval_all(
+                        ref_to_light, inct.wr, TransMode::Radiance);
+                    if(!bsdf_f)
+                        continue;
+
+                    // no medium when envir light is visible
+
+                    const Spectrum f = light_sample.radiance * bsdf_f
+                                     * std::abs(cos(ref_to_light, inct.geometry_coord.z));
+                    const real bsdf_pdf = shd.bsdf->pdf_all(ref_to_light, inct.wr);
+
+                    const real dis = (light_sample.pos - inct.pos).length();
+                    wf.shadow_rays.push_back({
+                        Ray(inct.pos, (light_sample.pos - inct.pos).normalize(),
+                            EPS(), dis - EPS()),
+                        scale * coef * f / (light_sample.pdf + bsdf_pdf),
+                        path });
+                }
+            }
+
+            auto bsdf_sample = shd.bsdf->sample_all(
+                inct.wr, TransMode::Radiance, sampler.sample3());
+            if(!bsdf_sample.f)
+                continue;
+            bsdf_sample.dir = bsdf_sample.dir.normalize();
+
+            DirectBSDFRay direct_ray;
+            direct_ray.ray      = Ray(inct.eps_offset(bsdf_sample.dir), bsdf_sample.dir);
+            direct_ray.weight   = scale * coef * bsdf_sample.f
+                                * std::abs(dot(inct.geometry_coord.z, bsdf_sample.dir));
+            direct_ray.bsdf_pdf = bsdf_sample.pdf;
+            direct_ray.is_delta = bsdf_sample.is_delta;
+            direct_ray.medium   = inct.medium(bsdf_sample.dir);
+            direct_ray.path     = path;
+            wf.direct_rays.push_back(direct_ray);
+        }
+    }
+
+    /**
+     * @brief sample direct illumination at a medium scattering point
+     */
+    void sample_direct_illum(
+        const Scene &scene, const MediumScattering &scattering,
+        const BSDF *phase_function, const Spectrum &coef, int path,
+        Sampler &sampler, Wavefront &wf) const
+    {
+        const real scale = real(1) / params_.direct_illum_sample_count;
+
+        for(int i = 0; i < params_.direct_illum_sample_count; ++i)
+        {
+            // there is no medium when envir light is visible,
+            // so only area lights are sampled here
+
+            for(auto light : scene.lights())
+            {
+                if(!light->is_area())
+                    continue;
+
+                const auto light_sample = light->sample(
+                    scattering.pos, sampler.sample5());
+                if(!light_sample.radiance || !light_sample.pdf)
+                    continue;
+
+                const Vec3 inct_to_light =
+                    (light_sample.pos - scattering.pos).normalize();
+                const auto bsdf_f = phase_function->eval_all(
+                    inct_to_light, scattering.wr, TransMode::Radiance);
+                if(!bsdf_f)
+                    continue;
+
+                const Spectrum f = scattering.medium->tr(
+                                        scattering.pos, light_sample.pos, sampler)
+                                 * light_sample.radiance * bsdf_f;
+                const real bsdf_pdf = phase_function->pdf_all(
+                    inct_to_light, scattering.wr);
+
+                const real dis = (scattering.pos - light_sample.pos).length();
+                wf.shadow_rays.push_back({
+                    Ray(light_sample.pos,
+                        (scattering.pos - light_sample.pos).normalize(),
+                        EPS(), dis - EPS()),
+                    scale * coef * f / (light_sample.pdf + bsdf_pdf),
+                    path });
+            }
+
+            auto bsdf_sample = phase_function->sample_all(
+                scattering.wr, TransMode::Radiance, sampler.sample3());
+            if(!bsdf_sample.f)
+                continue;
+            bsdf_sample.dir = bsdf_sample.dir.normalize();
+
+            DirectBSDFRay direct_ray;
+            direct_ray.ray      = Ray(scattering.pos, bsdf_sample.dir);
+            direct_ray.weight   = scale * coef * bsdf_sample.f;
+            direct_ray.bsdf_pdf = bsdf_sample.pdf;
+            direct_ray.is_delta = bsdf_sample.is_delta;
+            direct_ray.medium   = scattering.medium;
+            direct_ray.path     = path;
+            wf.direct_rays.push_back(direct_ray);
+        }
+    }
+
+    /**
+     * @brief fill idle path states with new camera rays
+     *
+     * @return is there any active path
+     */
+    bool generate_stage(
+        const Camera &camera, const Grid &grid, const Vec2i &full_res,
+        const GridTask &task, SampleCursor &cursor,
+        Sampler &sampler, Wavefront &wf) const
+    {
+        const auto sam_bound = grid.sample_pixels();
+
+        bool has_active_path = false;
+        for(auto &path : wf.paths)
+        {
+            if(!path.is_active)
+            {
+                // skip pixels whose samples are all generated
+
+                while(cursor.py <= sam_bound.high.y &&
+                      cursor.sample_index >= task.spp_of(cursor.px, cursor.py))
+                {
+                    cursor.sample_index = 0;
+                    if(++cursor.px > sam_bound.high.x)
+                    {
+                        cursor.px = sam_bound.low.x;
+                        ++cursor.py;
+                    }
+                }
+
+                if(cursor.py <= sam_bound.high.y)
+                {
+                    ++cursor.sample_index;
+
+                    path.px = cursor.px;
+                    path.py = cursor.py;
+
+                    const Sample2 film_sam = sampler.sample2();
+                    path.pixel_x = path.px + film_sam.u;
+                    path.pixel_y = path.py + film_sam.v;
+                    const real film_x = path.pixel_x / full_res.x;
+                    const real film_y = path.pixel_y / full_res.y;
+
+                    const auto cam_ray = camera.sample_we(
+                        { film_x, film_y }, sampler.sample2());
+
+                    path.cam_throughput   = cam_ray.throughput;
+                    path.ray              = Ray(cam_ray.pos_on_cam, cam_ray.pos_to_out);
+                    path.coef             = Spectrum(1);
+                    path.depth            = 1;
+                    path.s_depth          = 1;
+                    path.scattering_count = 0;
+                    path.is_active        = true;
+                    path.is_terminated    = false;
+                    path.pixel            = render::Pixel();
+                }
+            }
+
+            has_active_path |= path.is_active;
+        }
+
+        return has_active_path;
+    }
+    /**
+     * @brief apply RR strategy and find closest intersections of all
+     *  path rays in one batch
+     */
+    void extend_stage(const Scene &scene, Sampler &sampler, Wavefront &wf) const
+    {
+        wf.extend_paths.clear();
+        wf.extend_rays.clear();
+
+        for(int i = 0; i < static_cast<int>(wf.paths.size()); ++i)
+        {
+            auto &path = wf.paths[i];
+            if(!path.is_active)
+                continue;
+
+            if(path.depth > params_.max_depth)
+            {
+                path.is_terminated = true;
+                continue;
+            }
+
+            if(path.depth > params_.min_depth)
+            {
+                if(sampler.sample1().u > params_.cont_prob)
+                {
+                    path.is_terminated = true;
+                    continue;
+                }
+                path.coef /= params_.cont_prob;
+            }
+
+            wf.extend_paths.push_back(i);
+            wf.extend_rays.push_back(path.ray);
+        }
+
+        scene.closest_intersection_n(
+            wf.extend_rays.data(), wf.extend_rays.size(),
+            wf.extend_incts.data(), wf.extend_results.get());
+    }
+
+    /**
+     * @brief handle escaped paths, and sort the others by hit material
+     *  so that the same material is shaded continuously
+     */
+    void sort_stage(const Scene &scene, Wavefront &wf) const
+    {
+        wf.hit_paths.clear();
+
+        for(size_t i = 0; i < wf.extend_paths.size(); ++i)
+        {
+            if(wf.extend_results[i])
+            {
+                wf.hit_paths.push_back(static_cast<int>(i));
+                continue;
+            }
+
+            auto &path = wf.paths[wf.extend_paths[i]];
+            if(!use_mis_ || path.depth == 1)
+            {
+                if(auto light = scene.envir_light())
+                {
+                    path.pixel.value += path.coef * light->radiance(
+                        path.ray.o, path.ray.d);
+                }
+            }
+            path.is_terminated = true;
+        }
+
+        std::sort(wf.hit_paths.begin(), wf.hit_paths.end(),
+            [&](int a, int b)
+        {
+            return std::less<const Material *>()(
+                wf.extend_incts[a].material, wf.extend_incts[b].material);
+        });
+    }
+
+    /**
+     * @brief shade a surface/medium vertex, and generate light sampling rays
+     *  and the next path ray
+     */
+    void shade(
+        const Scene &scene, const EntityIntersection &ent_inct, int path_index,
+        Sampler &sampler, Arena &arena, Wavefront &wf) const
+    {
+        auto &path = wf.paths[path_index];
+        auto &coef = path.coef;
+
+        // fill gbuffer
+
+        const ShadingPoint ent_shd = ent_inct.material->shade(ent_inct, arena);
+        if(path.depth == 1)
+        {
+            path.pixel.normal = ent_shd.shading_normal;
+            path.pixel.albedo = ent_shd.bsdf->albedo();
+            if(ent_inct.entity->get_no_denoise_flag())
+                path.pixel.denoise = 0;
+        }
+
+        // sample medium scattering
+
+        const auto medium = ent_inct.wr_medium();
+
+        if(path.scattering_count < medium->get_max_scattering_count())
+        {
+            const auto medium_sample = medium->sample_scattering(
+                path.ray.o, ent_inct.pos, sampler, arena);
+            coef *= medium_sample.throughput;
+
+            if(medium_sample.is_scattering_happened())
+            {
+                ++path.scattering_count;
+
+                const auto &scattering_point = medium_sample.scattering_point;
+                const auto phase_function = medium_sample.phase_function;
+
+                if(use_mis_)
+                {
+                    sample_direct_illum(
+                        scene, scattering_point, phase_function,
+                        coef, path_index, sampler, wf);
+                }
+
+                const auto phase_sample = phase_function->sample_all(
+                    scattering_point.wr, TransMode::Radiance, sampler.sample3());
+                if(!phase_sample.f || (use_mis_ && phase_sample.pdf < EPS()))
+                {
+                    path.is_terminated = true;
+                    return;
+                }
+
+                path.ray = Ray(scattering_point.pos, phase_sample.dir.normalize());
+                coef *= phase_sample.f / phase_sample.pdf;
+                ++path.depth;
+                return;
+            }
+        }
+        else
+        {
+            // continus scattering count is too large
+            // only account absorbtion here
+            coef *= medium->ab(path.ray.o, ent_inct.pos, sampler);
+        }
+
+        path.scattering_count = 0;
+
+        // process surface scattering
+
+        if(!use_mis_ || path.depth == 1)
+        {
+            if(auto light = ent_inct.entity->as_light())
+            {
+                path.pixel.value += coef * light->radiance(
+                    ent_inct.pos, ent_inct.geometry_coord.z,
+                    ent_inct.uv, ent_inct.wr);
+            }
+        }
+
+        if(use_mis_)
+        {
+            sample_direct_illum(
+                scene, ent_inct, ent_shd, coef, path_index, sampler, wf);
+        }
+
+        // sample bsdf
+
+        const auto bsdf_sample = ent_shd.bsdf->sample_all(
+            ent_inct.wr, TransMode::Radiance, sampler.sample3());
+        if(!bsdf_sample.f || (use_mis_ && bsdf_sample.pdf < EPS()))
+        {
+            path.is_terminated = true;
+            return;
+        }
+
+        bool is_new_sample_delta = bsdf_sample.is_delta;
+
+        const real abscos = std::abs(cos(
+            ent_inct.geometry_coord.z, bsdf_sample.dir));
+        coef *= bsdf_sample.f * abscos / bsdf_sample.pdf;
+
+        path.ray = Ray(ent_inct.eps_offset(bsdf_sample.dir),
+                       bsdf_sample.dir.normalize());
+
+        // bssrdf
+
+        if(ent_shd.bssrdf)
+        {
+            const bool pos_in = ent_inct.geometry_coord.in_positive_z_hemisphere(
+                bsdf_sample.dir);
+            const bool pos_out = ent_inct.geometry_coord.in_positive_z_hemisphere(
+                ent_inct.wr);
+
+            if(!pos_in && pos_out)
+            {
+                const auto bssrdf_sample = ent_shd.bssrdf->sample_pi(
+                    sampler.sample3(), arena);
+                if(!bssrdf_sample.coef)
+                {
+                    path.is_terminated = true;
+                    return;
+                }
+
+                coef *= bssrdf_sample.coef / bssrdf_sample.pdf;
+
+                auto &new_inct = bssrdf_sample.inct;
+                auto new_shd = new_inct.material->shade(new_inct, arena);
+
+                if(use_mis_)
+                {
+                    sample_direct_illum(
+                        scene, new_inct, new_shd, coef, path_index, sampler, wf);
+                }
+
+                const auto new_bsdf_sample = new_shd.bsdf->sample_all(
+                    new_inct.wr, TransMode::Radiance, sampler.sample3());
+                if(!new_bsdf_sample.f)
+                {
+                    path.is_terminated = true;
+                    return;
+                }
+
+                const real new_abscos = std::abs(cos(
+                    new_inct.geometry_coord.z, new_bsdf_sample.dir));
+                coef *= new_bsdf_sample.f * new_abscos / new_bsdf_sample.pdf;
+
+                path.ray = Ray(new_inct.eps_offset(new_bsdf_sample.dir),
+                               new_bsdf_sample.dir.normalize());
+
+                is_new_sample_delta = new_bsdf_sample.is_delta;
+            }
+        }
+
+        // specular scattering doesn't consume normal depth
+
+        if(is_new_sample_delta && path.depth >= 2 &&
+           path.s_depth <= params_.specular_depth)
+        {
+            --path.depth;
+            ++path.s_depth;
+        }
+
+        ++path.depth;
+    }
+
+    /**
+     * @brief test all shadow rays in one batch
+     */
+    void shadow_stage(const Scene &scene, Wavefront &wf) const
+    {
+        const size_t count = wf.shadow_rays.size();
+        if(!count)
+            return;
+
+        wf.shadow_ray_buffer.clear();
+        for(auto &shadow_ray : wf.shadow_rays)
+            wf.shadow_ray_buffer.push_back(shadow_ray.ray);
+
+        ensure_result_buffer(wf.shadow_results, wf.shadow_results_size, count);
+        scene.has_intersection_n(
+            wf.shadow_ray_buffer.data(), count, wf.shadow_results.get());
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(!wf.shadow_results[i])
+            {
+                auto &shadow_ray = wf.shadow_rays[i];
+                wf.paths[shadow_ray.path].pixel.value += shadow_ray.contrib;
+            }
+        }
+
+        wf.shadow_rays.clear();
+    }
+
+    /**
+     * @brief find what bsdf sampled rays of direct illumination hit
+     *  in one batch, and add their contributions
+     */
+    void direct_bsdf_stage(
+        const Scene &scene, Sampler &sampler, Wavefront &wf) const
+    {
+        const size_t count = wf.direct_rays.size();
+        if(!count)
+            return;
+
+        wf.direct_ray_buffer.clear();
+        for(auto &direct_ray : wf.direct_rays)
+            wf.direct_ray_buffer.push_back(direct_ray.ray);
+
+        if(wf.direct_incts.size() < count)
+            wf.direct_incts.resize(count);
+        ensure_result_buffer(wf.direct_results, wf.direct_results_size, count);
+
+        scene.closest_intersection_n(
+            wf.direct_ray_buffer.data(), count,
+            wf.direct_incts.data(), wf.direct_results.get());
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            const auto &direct_ray = wf.direct_rays[i];
+            const Ray &r = direct_ray.ray;
+            auto &pixel = wf.paths[direct_ray.path].pixel;
+
+            if(!wf.direct_results[i])
+            {
+                auto light = scene.envir_light();
+                if(!light)
+                    continue;
+
+                const Spectrum light_radiance = light->radiance(r.o, r.d);
+                if(!light_radiance)
+                    continue;
+
+                // no medium when there is no inct
+                const Spectrum f = light_radiance * direct_ray.weight;
+
+                if(direct_ray.is_delta)
+                    pixel.value += f / direct_ray.bsdf_pdf;
+                else
+                {
+                    const real light_pdf = light->pdf(r.o, r.d);
+                    pixel.value += f / (direct_ray.bsdf_pdf + light_pdf);
+                }
+
+                continue;
+            }
+
+            const auto &ent_inct = wf.direct_incts[i];
+            auto light = ent_inct.entity->as_light();
+            if(!light)
+                continue;
+
+            const Spectrum light_radiance = light->radiance(
+                ent_inct.pos, ent_inct.geometry_coord.z,
+                ent_inct.uv, ent_inct.wr);
+            if(!light_radiance)
+                continue;
+
+            const Spectrum tr = direct_ray.medium->tr(r.o, ent_inct.pos, sampler);
+            const Spectrum f = tr * light_radiance * direct_ray.weight;
+
+            if(direct_ray.is_delta)
+                pixel.value += f / direct_ray.bsdf_pdf;
+            else
+            {
+                const real light_pdf = light->pdf(
+                    r.o, ent_inct.pos, ent_inct.geometry_coord.z);
+                pixel.value += f / (direct_ray.bsdf_pdf + light_pdf);
+            }
+        }
+
+        wf.direct_rays.clear();
+    }
+
+    /**
+     * @brief accumulate terminated paths into the film grid and free their states
+     */
+    static void accumulate_stage(Grid &grid, const GridTask &task, Wavefront &wf)
+    {
+        for(auto &path : wf.paths)
+        {
+            if(!path.is_terminated)
+                continue;
+
+            const auto &pixel = path.pixel;
+            if(pixel.value.is_finite())
+            {
+                const Spectrum value = path.cam_throughput * pixel.value;
+                grid.apply(
+                    path.pixel_x, path.pixel_y, value, 1,
+                    pixel.albedo, pixel.normal, pixel.denoise);
+                task.record(path.px, path.py, value);
+            }
+
+            path.is_active     = false;
+            path.is_terminated = false;
+        }
+    }
+
+protected:
+
+    // paths of different samples share the sampler, so samples can't be
+    // reseeded one by one and task.first_sample is ignored. pieces of
+    // partial rendering are decorrelated by the sampler seed instead.
+    // for the same reason, low discrepancy samplers are not supported
+
+    void render_grid(
+        const Scene &scene, NativeSampler &sampler,
+        Grid &grid, const Vec2i &full_res, const GridTask &task) const override
+    {
+        const auto sam_bound = grid.sample_pixels();
+
+        int total_sample_count = 0;
+        for(int py = sam_bound.low.y; py <= sam_bound.high.y; ++py)
+        {
+            for(int px = sam_bound.low.x; px <= sam_bound.high.x; ++px)
+                total_sample_count += task.spp_of(px, py);
+        }
+        if(total_sample_count <= 0)
+            return;
+
+        const int path_count = (std::min)(path_state_count_, total_sample_count);
+        Wavefront wf(path_count);
+
+        const Camera *camera = scene.get_camera();
+
+        SampleCursor cursor;
+        cursor.px = sam_bound.low.x;
+        cursor.py = sam_bound.low.y;
+
+        Arena arena;
+
+        for(;;)
+        {
+            if(!generate_stage(
+                *camera, grid, full_res, task, cursor, sampler, wf))
+                break;
+
+            extend_stage(scene, sampler, wf);
+
+            sort_stage(scene, wf);
+
+            for(int i : wf.hit_paths)
+            {
+                shade(
+                    scene, wf.extend_incts[i], wf.extend_paths[i],
+                    sampler, arena, wf);
+            }
+
+            shadow_stage(scene, wf);
+
+            direct_bsdf_stage(scene, sampler, wf);
+
+            accumulate_stage(grid, task, wf);
+
+            arena.release();
+
+            if(stop_rendering_)
+                return;
+        }
+    }
+
+    Pixel eval_pixel(
+        const Scene &scene, const Ray &ray,
+        Sampler &sampler, Arena &arena) const override
+    {
+        // single path reference of the same integrator.
+        // not used by render_grid
+        return eval_func_(params_, scene, ray, sampler, arena);
+    }
+
+public:
+
+    explicit WavefrontPathTracingRenderer(const WavefrontPTRendererParams &params)
+        : PerPixelRenderer(
+            params.pt.worker_count,
+            params.pt.task_grid_size, params.pt.spp,
+            params.pt.adaptive)
+    {
+        params_.min_depth      = params.pt.min_depth;
+        params_.max_depth      = params.pt.max_depth;
+        params_.cont_prob      = params.pt.cont_prob;
+        params_.specular_depth = params.pt.specular_depth;
+
+        use_mis_ = params.pt.use_mis;
+
+        path_state_count_ = (std::max)(1, params.path_state_count);
+
+        if(use_mis_)
+            eval_func_ = &render::trace_std;
+        else
+            eval_func_ = &render::trace_nomis;
+    }
+};
+
+RC<Renderer> create_wavefront_pt_renderer(
+    const WavefrontPTRendererParams &params)
+{
+    return newRC<WavefrontPathTracingRenderer>(params);
+}
+
+AGZ_TRACER_END
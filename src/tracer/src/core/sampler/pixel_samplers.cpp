@@ -0,0 +1,489 @@
+#include <algorithm>
+#include <vector>
+
+#include <agz/tracer/create/sampler.h>
+
+AGZ_TRACER_BEGIN
+
+namespace
+{
+    constexpr real ONE_MINUS_EPS = real(0x1.fffffep-1);
+
+    uint32_t hash(uint32_t x) noexcept
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    uint32_t hash_combine(uint32_t seed, uint32_t v) noexcept
+    {
+        return hash(seed ^ (v * 0x9e3779b9u + 0x7f4a7c15u));
+    }
+
+    uint32_t reverse_bits(uint32_t x) noexcept
+    {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    /**
+     * @brief random permutation where each bit only depends on lower bits
+     *
+     * see 'Stratified Sampling for Stochastic Transparency', Laine & Karras
+     */
+    uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) noexcept
+    {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    /**
+     * @brief owen scrambling of a 0.32 fixed point number
+     *
+     * see 'Practical Hash-based Owen Scrambling', Burley. also used to
+     * shuffle sample indices, which keeps every power-of-two prefix of the
+     * sequence well stratified
+     */
+    uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) noexcept
+    {
+        x = reverse_bits(x);
+        x = laine_karras_permutation(x, seed);
+        return reverse_bits(x);
+    }
+
+    real to_real(uint32_t bits) noexcept
+    {
+        return (std::min)(real(bits) * real(0x1p-32), ONE_MINUS_EPS);
+    }
+
+    /**
+     * @brief shuffled and scrambled van der corput sequence
+     *
+     * used for dimensions without dedicated sequences
+     */
+    real padded_1d(uint32_t index, uint32_t seed) noexcept
+    {
+        const uint32_t shuffled = nested_uniform_scramble(
+            index, hash_combine(seed, 0));
+        return to_real(nested_uniform_scramble(
+            reverse_bits(shuffled), hash_combine(seed, 1)));
+    }
+
+    // sobol
+
+    struct SobolPolynomial
+    {
+        uint32_t degree;
+        uint32_t coefs;
+        uint32_t m[6];
+    };
+
+    // joe-kuo direction numbers of sobol dimensions 2 to 16
+    constexpr SobolPolynomial SOBOL_POLYNOMIALS[] = {
+        { 1, 0,  { 1                    } },
+        { 2, 1,  { 1, 3                 } },
+        { 3, 1,  { 1, 3, 1              } },
+        { 3, 2,  { 1, 1, 1              } },
+        { 4, 1,  { 1, 1, 3, 3           } },
+        { 4, 4,  { 1, 3, 5, 13          } },
+        { 5, 2,  { 1, 1, 5, 5, 17       } },
+        { 5, 4,  { 1, 1, 5, 5, 5        } },
+        { 5, 7,  { 1, 1, 7, 11, 19      } },
+        { 5, 11, { 1, 1, 5, 1, 1        } },
+        { 5, 13, { 1, 1, 1, 3, 11       } },
+        { 5, 14, { 1, 3, 5, 5, 31       } },
+        { 6, 1,  { 1, 3, 3, 9, 7, 49    } },
+        { 6, 13, { 1, 1, 1, 15, 21, 21  } },
+        { 6, 16, { 1, 3, 1, 13, 27, 49  } },
+    };
+
+    constexpr uint32_t SOBOL_DIM_COUNT = 16;
+
+    class SobolMatrices
+    {
+        uint32_t v_[SOBOL_DIM_COUNT][32] = {};
+
+    public:
+
+        SobolMatrices() noexcept
+        {
+            for(uint32_t i = 0; i < 32; ++i)
+                v_[0][i] = 1u << (31 - i);
+
+            for(uint32_t d = 1; d < SOBOL_DIM_COUNT; ++d)
+            {
+                const auto &p = SOBOL_POLYNOMIALS[d - 1];
+                const uint32_t s = p.degree;
+
+                for(uint32_t i = 0; i < s; ++i)
+                    v_[d][i] = p.m[i] << (31 - i);
+
+                for(uint32_t i = s; i < 32; ++i)
+                {
+                    uint32_t v = v_[d][i - s] ^ (v_[d][i - s] >> s);
+                    for(uint32_t k = 1; k < s; ++k)
+                    {
+                        if((p.coefs >> (s - 1 - k)) & 1)
+                            v ^= v_[d][i - k];
+                    }
+                    v_[d][i] = v;
+                }
+            }
+        }
+
+        uint32_t sample(uint32_t index, uint32_t dim) const noexcept
+        {
+            uint32_t ret = 0;
+            for(uint32_t i = 0; index; index >>= 1, ++i)
+            {
+                if(index & 1)
+                    ret ^= v_[dim][i];
+            }
+            return ret;
+        }
+    };
+
+    const SobolMatrices &sobol_matrices()
+    {
+        static const SobolMatrices ret;
+        return ret;
+    }
+
+    // halton
+
+    constexpr uint32_t HALTON_DIM_COUNT = 256;
+
+    const std::vector<uint32_t> &halton_primes()
+    {
+        static const std::vector<uint32_t> ret = []
+        {
+            std::vector<uint32_t> primes;
+            std::vector<bool> composite(2048, false);
+            for(uint32_t i = 2; primes.size() < HALTON_DIM_COUNT; ++i)
+            {
+                if(composite[i])
+                    continue;
+                primes.push_back(i);
+                for(uint32_t j = i * i; j < composite.size(); j += i)
+                    composite[j] = true;
+            }
+            return primes;
+        }();
+        return ret;
+    }
+
+    /**
+     * @brief the i-th element of a random permutation of [0, l)
+     *
+     * see 'Correlated Multi-Jittered Sampling', Kensler
+     */
+    uint32_t permutation_element(uint32_t i, uint32_t l, uint32_t p) noexcept
+    {
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do
+        {
+            i ^= p;
+            i *= 0xe170893du;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3fu;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69u;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303u;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3u;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3dfu;
+            i &= w;
+            i ^= i >> 5;
+        } while(i >= l);
+        return (i + p) % l;
+    }
+
+    /**
+     * @brief radical inverse with all digits (including the trailing zeros)
+     *        mapped by the same random permutation
+     *
+     * digits below 2^-32 are ignored, which also keeps 'reversed' from
+     * overflowing for large bases
+     */
+    double scrambled_radical_inverse(
+        uint32_t base, uint32_t a, uint32_t seed) noexcept
+    {
+        const double inv_base = 1.0 / base;
+        double inv_base_m = 1;
+        uint64_t reversed = 0;
+        while((base - 1) * inv_base_m > 0x1p-32)
+        {
+            const uint32_t next  = a / base;
+            const uint32_t digit = a - next * base;
+            reversed = reversed * base + permutation_element(digit, base, seed);
+            inv_base_m *= inv_base;
+            a = next;
+        }
+        return inv_base_m * reversed;
+    }
+
+    /**
+     * @brief base of samplers whose values are computed from
+     *        (pixel, sample index, dimension)
+     */
+    class PixelIndexedSampler : public Sampler
+    {
+    protected:
+
+        uint32_t pixel_seed_ = 0;
+        uint32_t index_      = 0;
+        uint32_t dim_        = 0;
+
+        virtual real next1d() = 0;
+
+        virtual Sample2 next2d()
+        {
+            const real u = next1d();
+            const real v = next1d();
+            return { u, v };
+        }
+
+    public:
+
+        void start_pixel_sample(const Vec2i &pixel, int sample_index) override
+        {
+            pixel_seed_ = hash_combine(
+                hash(static_cast<uint32_t>(pixel.x)),
+                static_cast<uint32_t>(pixel.y));
+            index_ = static_cast<uint32_t>(sample_index);
+            dim_   = 0;
+        }
+
+        Sample1 sample1() override
+        {
+            return { next1d() };
+        }
+
+        Sample2 sample2() override
+        {
+            return next2d();
+        }
+
+        Sample3 sample3() override
+        {
+            const Sample2 uv = next2d();
+            const real w = next1d();
+            return { uv.u, uv.v, w };
+        }
+
+        Sample4 sample4() override
+        {
+            const Sample2 uv = next2d();
+            const Sample2 wr = next2d();
+            return { uv.u, uv.v, wr.u, wr.v };
+        }
+
+        Sample5 sample5() override
+        {
+            const Sample2 uv = next2d();
+            const Sample2 wr = next2d();
+            const real s = next1d();
+            return { uv.u, uv.v, wr.u, wr.v, s };
+        }
+    };
+
+    /**
+     * @brief owen-scrambled sobol sequence
+     *
+     * the first 16 dimensions share a per-pixel shuffled index so that they
+     * are stratified jointly. the others are padded with 1d sequences
+     */
+    class SobolSampler : public PixelIndexedSampler
+    {
+    protected:
+
+        real next1d() override
+        {
+            const uint32_t dim = dim_++;
+            const uint32_t seed = hash_combine(pixel_seed_, dim);
+            if(dim >= SOBOL_DIM_COUNT)
+                return padded_1d(index_, seed);
+
+            const uint32_t shuffled = nested_uniform_scramble(index_, pixel_seed_);
+            return to_real(nested_uniform_scramble(
+                sobol_matrices().sample(shuffled, dim), seed));
+        }
+    };
+
+    /**
+     * @brief halton sequence with per-pixel random digit permutations
+     *
+     * dimensions beyond the prime table are padded with 1d sequences
+     */
+    class HaltonSampler : public PixelIndexedSampler
+    {
+    protected:
+
+        real next1d() override
+        {
+            const uint32_t dim = dim_++;
+            const uint32_t seed = hash_combine(pixel_seed_, dim);
+            if(dim >= HALTON_DIM_COUNT)
+                return padded_1d(index_, seed);
+
+            const double ret = scrambled_radical_inverse(
+                halton_primes()[dim], index_, seed);
+            return (std::min)(static_cast<real>(ret), ONE_MINUS_EPS);
+        }
+    };
+
+    /**
+     * @brief progressive multi-jittered (0, 2) sequence
+     *
+     * each pair of dimensions is an owen-scrambled 2d sobol sequence, which
+     * is a stochastic pmj02 sequence (see 'Stochastic Generation of (t, s)
+     * Sample Sequences', Helmer et al.). pairs are decorrelated by shuffling
+     * the sample index
+     */
+    class PMJ02Sampler : public PixelIndexedSampler
+    {
+    protected:
+
+        real next1d() override
+        {
+            return next2d().u;
+        }
+
+        Sample2 next2d() override
+        {
+            const uint32_t seed = hash_combine(pixel_seed_, dim_++);
+            const uint32_t shuffled = nested_uniform_scramble(
+                index_, hash_combine(seed, 0));
+
+            const uint32_t x = nested_uniform_scramble(
+                sobol_matrices().sample(shuffled, 0), hash_combine(seed, 1));
+            const uint32_t y = nested_uniform_scramble(
+                sobol_matrices().sample(shuffled, 1), hash_combine(seed, 2));
+
+            return { to_real(x), to_real(y) };
+        }
+    };
+
+    /**
+     * @brief counter-based random numbers
+     *
+     * the key is hashed from (pixel, sample index) and the counter is the
+     * dimension. values of a batch don't depend on each other, so the
+     * loops in generate are vectorized by the compiler
+     */
+    class CounterBasedSampler : public Sampler
+    {
+        uint32_t key_lo_  = 0;
+        uint32_t key_hi_  = 0;
+        uint32_t counter_ = 0;
+
+        uint32_t bits(uint32_t counter) const noexcept
+        {
+            return hash(hash(counter * 0x9e3779b9u + key_lo_) ^ key_hi_);
+        }
+
+        template<int N>
+        void generate(real (&out)[N]) noexcept
+        {
+            // high 24 bits are exactly representable and never round to 1
+
+            const uint32_t first = counter_;
+            counter_ += N;
+            for(int i = 0; i < N; ++i)
+            {
+                out[i] = static_cast<real>(bits(first + uint32_t(i)) >> 8)
+                       * real(0x1p-24);
+            }
+        }
+
+    public:
+
+        void start_pixel_sample(const Vec2i &pixel, int sample_index) override
+        {
+            const uint64_t h = hash_pixel_sample(pixel, sample_index);
+
+            key_lo_  = static_cast<uint32_t>(h);
+            key_hi_  = static_cast<uint32_t>(h >> 32);
+            counter_ = 0;
+        }
+
+        Sample1 sample1() override
+        {
+            real v[1];
+            generate(v);
+            return { v[0] };
+        }
+
+        Sample2 sample2() override
+        {
+            real v[2];
+            generate(v);
+            return { v[0], v[1] };
+        }
+
+        Sample3 sample3() override
+        {
+            real v[3];
+            generate(v);
+            return { v[0], v[1], v[2] };
+        }
+
+        Sample4 sample4() override
+        {
+            real v[4];
+            generate(v);
+            return { v[0], v[1], v[2], v[3] };
+        }
+
+        Sample5 sample5() override
+        {
+            real v[5];
+            generate(v);
+            return { v[0], v[1], v[2], v[3], v[4] };
+        }
+    };
+
+} // namespace anonymous
+
+Sampler *create_pixel_sampler(SamplerType type, Arena &arena)
+{
+    switch(type)
+    {
+    case SamplerType::Native:
+        return nullptr;
+    case SamplerType::Counter:
+        return arena.create<CounterBasedSampler>();
+    case SamplerType::Sobol:
+        return arena.create<SobolSampler>();
+    case SamplerType::Halton:
+        return arena.create<HaltonSampler>();
+    case SamplerType::PMJ02:
+        return arena.create<PMJ02Sampler>();
+    }
+    return nullptr;
+}
+
+AGZ_TRACER_END
@@ -1,4 +1,5 @@
-﻿#include <memory>
+﻿#include <atomic>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -14,6 +15,26 @@
 
 AGZ_TRACER_BEGIN
 
+namespace
+{
+
+    // last occluders of shadow rays towards each light in current thread
+    struct OccluderCache
+    {
+        uint64_t scene_id          = 0;
+        uint64_t entity_generation = 0;
+        std::vector<Occluder> light_occluders;
+    };
+
+    thread_local OccluderCache occluder_cache;
+
+    // identifies a scene in a rendering pass, so that stale occluders
+    // are never tested. occluders are also dropped when entities are
+    // removed from the aggregate (see Aggregate::entity_generation)
+    std::atomic<uint64_t> next_scene_id = 1;
+
+} // namespace anonymous
+
 class DefaultScene : public Scene
 {
     RC<Medium> void_medium_;
@@ -30,6 +51,10 @@ class DefaultScene : public Scene
     math::distribution::alias_sampler_t<real, size_t> light_selector_;
     std::vector<real> light_pdf_table_;
     std::unordered_map<const Light*, real> light_ptr_to_pdf_;
+    std::unordered_map<const Light*, size_t> light_ptr_to_index_;
+
+    bool occluder_cache_enabled_ = true;
+    uint64_t scene_id_ = 0;
 
     void construct_light_sampler()
     {
@@ -59,6 +84,10 @@ class DefaultScene : public Scene
             const real pdf = light_pdf_table_[i];
             light_ptr_to_pdf_.insert(std::make_pair(light, pdf));
         }
+
+        light_ptr_to_index_.clear();
+        for(size_t i = 0; i < lights_.size(); ++i)
+            light_ptr_to_index_.insert(std::make_pair(lights_[i], i));
     }
 
 public:
@@ -79,6 +108,8 @@ public:
 
         aggregate_ = params.aggregate;
         entities_ = params.entities;
+
+        occluder_cache_enabled_ = params.occluder_cache;
     }
 
     void set_camera(RC<const Camera> camera) override
@@ -140,12 +171,68 @@ public:
         return !has_intersection(shadow_ray);
     }
 
+    bool occluded(const Ray &r, const Light *light) const noexcept override
+    {
+        if(!occluder_cache_enabled_ || !scene_id_)
+            return has_intersection(r);
+
+        const auto it = light_ptr_to_index_.find(light);
+        if(it == light_ptr_to_index_.end())
+            return has_intersection(r);
+
+        auto &cache = occluder_cache;
+        const uint64_t entity_generation = aggregate_->entity_generation();
+        if(cache.scene_id != scene_id_ ||
+           cache.entity_generation != entity_generation)
+        {
+            cache.scene_id          = scene_id_;
+            cache.entity_generation = entity_generation;
+            cache.light_occluders.assign(lights_.size(), Occluder());
+        }
+
+        Occluder &last_occluder = cache.light_occluders[it->second];
+        if(last_occluder.entity &&
+           last_occluder.entity->is_occluded_by(r, last_occluder.primitive))
+            return true;
+
+        Occluder occluder;
+        if(!aggregate_->find_occluder(r, &occluder))
+            return false;
+
+        // occluders without primitive info are as expensive as a full test
+        if(occluder.entity && occluder.primitive != NO_OCCLUDER_PRIMITIVE)
+            last_occluder = occluder;
+
+        return true;
+    }
+
+    bool visible(
+        const Vec3 &A, const Vec3 &B, const Light *light) const noexcept override
+    {
+        const real dis = (A - B).length();
+        const Ray shadow_ray(A, (B - A).normalize(), EPS(), dis - EPS());
+        return !occluded(shadow_ray, light);
+    }
+
     bool closest_intersection(
         const Ray &r, EntityIntersection *inct) const noexcept override
     {
         return aggregate_->closest_intersection(r, inct);
     }
 
+    void has_intersection_n(
+        const Ray *rays, size_t count, bool *result) const noexcept override
+    {
+        aggregate_->has_intersection_n(rays, count, result);
+    }
+
+    void closest_intersection_n(
+        const Ray *rays, size_t count,
+        EntityIntersection *incts, bool *result) const noexcept override
+    {
+        aggregate_->closest_intersection_n(rays, count, incts, result);
+    }
+
     AABB world_bound() const noexcept override
     {
         AABB world_bound;
@@ -169,6 +256,8 @@ public:
             envir_light_->preprocess(world_bound);
 
         construct_light_sampler();
+
+        scene_id_ = next_scene_id++;
     }
 };
 
@@ -681,7 +681,8 @@ Spectrum unweighted_contrib_sx_t1(
 
     if(light_vtx.type == VertexType::AreaLight)
     {
-        if(!scene.visible(cam_end_pos, light_vtx.area_light.pos))
+        if(!scene.visible(
+            cam_end_pos, light_vtx.area_light.pos, light_vtx.area_light.light))
             return {};
 
         const Vec3 cam_to_light = light_vtx.area_light.pos - cam_end_pos;
@@ -718,7 +719,7 @@ Spectrum unweighted_contrib_sx_t1(
     const Vec3 cam_to_light = -light_vtx.env_light.light_to_out;
 
     const Ray shadow_ray(cam_end_pos, cam_to_light, EPS());
-    if(scene.has_intersection(shadow_ray))
+    if(scene.occluded(shadow_ray, scene.envir_light()))
         return {};
 
     const Spectrum light_rad = scene.envir_light()->radiance(
@@ -24,7 +24,7 @@ Spectrum mis_sample_area_light(
         return {};
     const Vec3 inct_to_light = (light_sample.pos - inct.pos).normalize();
     const Ray shadow_ray(inct.pos, inct_to_light, EPS(), shadow_ray_len);
-    if(scene.has_intersection(shadow_ray))
+    if(scene.occluded(shadow_ray, light))
         return {};
 
     const auto med = inct.medium(inct_to_light);
@@ -52,7 +52,7 @@ Spectrum mis_sample_area_light(
     if(!light_sample.radiance || !light_sample.pdf)
         return {};
 
-    if(!scene.visible(light_sample.pos, scattering.pos))
+    if(!scene.visible(light_sample.pos, scattering.pos, light))
         return {};
 
     const Vec3 inct_to_light = (light_sample.pos - scattering.pos).normalize();
@@ -80,7 +80,7 @@ Spectrum mis_sample_envir_light(
     if(!light_sample.radiance)
         return {};
 
-    if(!scene.visible(inct.pos, light_sample.pos))
+    if(!scene.visible(inct.pos, light_sample.pos, light))
         return {};
 
     const Vec3 ref_to_light = light_sample.ref_to_light();
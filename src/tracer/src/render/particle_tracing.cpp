@@ -84,11 +84,12 @@ void trace_particle(
     }
 }
 
-void trace_vol_particle(
+// splat(pixel_x, pixel_y, value) accumulates a camera connection
+template<typename SplatFunc>
+void trace_vol_particle_impl(
     const ParticleTraceParams &params,
     const Scene &scene, Sampler &sampler,
-    FilmFilterApplier::FilmGridView<Spectrum> &film,
-    Arena &arena)
+    Arena &arena, const SplatFunc &splat)
 {
     const auto [light, select_light_pdf] = scene.sample_light(sampler.sample1());
     if(!light)
@@ -151,7 +152,7 @@ void trace_vol_particle(
 
                         const Spectrum f = coef * bsdf_f * tr
                                          * cam_sam.we / cam_sam.pdf;
-                        film.apply(pixel_x, pixel_y, f);
+                        splat(pixel_x, pixel_y, f);
                     }
                 }
             }
@@ -196,7 +197,7 @@ void trace_vol_particle(
 
                     const Spectrum f = coef * bsdf_f * abscos * tr
                                      * camera_sample.we / camera_sample.pdf;
-                    film.apply(pixel_x, pixel_y, f);
+                    splat(pixel_x, pixel_y, f);
                 }
             }
         }
@@ -214,4 +215,32 @@ void trace_vol_particle(
     }
 }
 
+void trace_vol_particle(
+    const ParticleTraceParams &params,
+    const Scene &scene, Sampler &sampler,
+    FilmFilterApplier::FilmGridView<Spectrum> &film,
+    Arena &arena)
+{
+    trace_vol_particle_impl(
+        params, scene, sampler, arena,
+        [&](real pixel_x, real pixel_y, const Spectrum &f)
+    {
+        film.apply(pixel_x, pixel_y, f);
+    });
+}
+
+void trace_vol_particle(
+    const ParticleTraceParams &params,
+    const Scene &scene, Sampler &sampler,
+    SplatFilm::Splatter &splatter,
+    Arena &arena)
+{
+    trace_vol_particle_impl(
+        params, scene, sampler, arena,
+        [&](real pixel_x, real pixel_y, const Spectrum &f)
+    {
+        splatter.splat({ pixel_x, pixel_y }, f);
+    });
+}
+
 AGZ_TRACER_RENDER_END
@@ -0,0 +1,113 @@
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+
+#include <agz/tracer/utility/checkpoint.h>
+
+AGZ_TRACER_BEGIN
+
+namespace
+{
+    constexpr char     CHECKPOINT_MAGIC[8] = { 'A', 'T', 'R', 'C', 'C', 'K', 'P', 'T' };
+    constexpr uint32_t CHECKPOINT_VERSION  = 2;
+}
+
+CheckpointWriter::CheckpointWriter(
+    const std::string &filename, const std::string &tag)
+    : filename_(filename), tmp_filename_(filename + ".tmp"),
+      fout_(tmp_filename_, std::ios::binary | std::ios::trunc)
+{
+    write_bytes(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    write(CHECKPOINT_VERSION);
+    write_str(tag);
+}
+
+void CheckpointWriter::write_bytes(const void *data, size_t bytes)
+{
+    fout_.write(static_cast<const char*>(data),
+                static_cast<std::streamsize>(bytes));
+}
+
+void CheckpointWriter::write_str(const std::string &str)
+{
+    write(uint64_t(str.size()));
+    write_bytes(str.data(), str.size());
+}
+
+void CheckpointWriter::write_sampler(NativeSampler &sampler)
+{
+    std::ostringstream sout;
+    sout << sampler.rng();
+    write_str(sout.str());
+}
+
+void CheckpointWriter::write_samplers(
+    const std::vector<NativeSampler*> &samplers)
+{
+    write(uint64_t(samplers.size()));
+    for(auto sampler : samplers)
+        write_sampler(*sampler);
+}
+
+bool CheckpointWriter::commit()
+{
+    fout_.close();
+    if(!fout_)
+        return false;
+
+    std::error_code err;
+    std::filesystem::rename(tmp_filename_, filename_, err);
+    if(err)
+    {
+        std::filesystem::remove(tmp_filename_, err);
+        return false;
+    }
+
+    return true;
+}
+
+CheckpointReader::CheckpointReader(
+    const std::string &filename, const std::string &tag)
+    : filename_(filename), fin_(filename, std::ios::binary)
+{
+    if(!fin_)
+        throw CheckpointException("failed to open checkpoint: " + filename);
+
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    read_bytes(magic, sizeof(magic));
+    if(std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+       read<uint32_t>() != CHECKPOINT_VERSION)
+        throw CheckpointException("invalid checkpoint file: " + filename);
+
+    const std::string file_tag = read_str();
+    if(file_tag != tag)
+    {
+        throw CheckpointException(
+            "checkpoint " + filename + " is written by renderer " + file_tag +
+            " instead of " + tag);
+    }
+}
+
+void CheckpointReader::read_bytes(void *data, size_t bytes)
+{
+    fin_.read(static_cast<char*>(data), static_cast<std::streamsize>(bytes));
+    if(!fin_)
+        throw CheckpointException("truncated checkpoint file: " + filename_);
+}
+
+std::string CheckpointReader::read_str()
+{
+    std::string ret(static_cast<size_t>(read<uint64_t>()), '\0');
+    read_bytes(ret.data(), ret.size());
+    return ret;
+}
+
+void CheckpointReader::read_sampler(NativeSampler &sampler)
+{
+    std::istringstream sin(read_str());
+    sin >> sampler.rng();
+    if(!sin)
+        throw CheckpointException("invalid sampler state in " + filename_);
+}
+
+AGZ_TRACER_END
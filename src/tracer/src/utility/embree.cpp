@@ -1,5 +1,7 @@
 #ifdef USE_EMBREE
 
+#include <string>
+
 #include <agz/tracer/utility/embree.h>
 
 AGZ_TRACER_BEGIN
@@ -7,6 +9,21 @@ AGZ_TRACER_BEGIN
 namespace
 {
     RTCDevice g_device = nullptr;
+
+    std::string embree_err_str(RTCError err)
+    {
+        switch(err)
+        {
+        case RTC_ERROR_NONE:              return "no error occurred";
+        case RTC_ERROR_UNKNOWN:           return "an unknown error has occurred";
+        case RTC_ERROR_INVALID_ARGUMENT:  return "an invalid argument was specified";
+        case RTC_ERROR_INVALID_OPERATION: return "the operation is not allowed for the specified object";
+        case RTC_ERROR_OUT_OF_MEMORY:     return "there is not enough memory left to complete the operation";
+        case RTC_ERROR_UNSUPPORTED_CPU:   return "the CPU is not supported as it does not support the lowest ISA Embree is compiled for";
+        case RTC_ERROR_CANCELLED:         return "the operation got canceled by a memory monitor callback or progress monitor callback function";
+        default:                          return "unknown embree error code: " + std::to_string(err);
+        }
+    }
 }
 
 void init_embree_device()
@@ -27,6 +44,12 @@ RTCDevice embree_device()
     return g_device;
 }
 
+void throw_embree_error()
+{
+    const RTCError err = rtcGetDeviceError(embree_device());
+    throw ObjectConstructionException(embree_err_str(err));
+}
+
 AGZ_TRACER_END
 
 #endif // #ifndef USE_EMBREE
@@ -0,0 +1,136 @@
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <agz/tracer/utility/mapped_file.h>
+
+AGZ_TRACER_BEGIN
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &filename)
+{
+    close();
+
+    const HANDLE file = CreateFileA(
+        filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+    file_handle_ = file;
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || !file_size.QuadPart)
+    {
+        close();
+        return false;
+    }
+
+    const HANDLE mapping = CreateFileMappingA(
+        file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mapping)
+    {
+        close();
+        return false;
+    }
+    mapping_handle_ = mapping;
+
+    data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!data_)
+    {
+        close();
+        return false;
+    }
+
+    size_ = static_cast<size_t>(file_size.QuadPart);
+    return true;
+}
+
+void MappedFile::close() noexcept
+{
+    if(data_)
+        UnmapViewOfFile(data_);
+    if(mapping_handle_)
+        CloseHandle(mapping_handle_);
+    if(file_handle_)
+        CloseHandle(file_handle_);
+
+    data_           = nullptr;
+    size_           = 0;
+    mapping_handle_ = nullptr;
+    file_handle_    = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string &filename)
+{
+    close();
+
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if(fd_ < 0)
+        return false;
+
+    struct stat file_stat;
+    if(fstat(fd_, &file_stat) != 0 || file_stat.st_size <= 0)
+    {
+        close();
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if(data == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+
+    data_ = data;
+    size_ = size;
+    return true;
+}
+
+void MappedFile::close() noexcept
+{
+    if(data_)
+        munmap(const_cast<void*>(data_), size_);
+    if(fd_ >= 0)
+        ::close(fd_);
+
+    data_ = nullptr;
+    size_ = 0;
+    fd_   = -1;
+}
+
+#endif
+
+bool MappedFile::is_open() const noexcept
+{
+    return data_ != nullptr;
+}
+
+const void *MappedFile::data() const noexcept
+{
+    return data_;
+}
+
+size_t MappedFile::size() const noexcept
+{
+    return size_;
+}
+
+AGZ_TRACER_END
@@ -0,0 +1,109 @@
+#include <agz/tracer/utility/checkpoint.h>
+#include <agz/tracer/utility/partial_render.h>
+
+AGZ_TRACER_BEGIN
+
+namespace
+{
+    const std::string PARTIAL_RENDER_TAG = "partial_render";
+}
+
+void save_partial_render_target(
+    const std::string &filename, const PartialRenderTarget &target)
+{
+    CheckpointWriter writer(filename, PARTIAL_RENDER_TAG);
+
+    writer.write(target.full_res);
+    writer.write(target.rect);
+
+    writer.write_image(target.value);
+    writer.write_image(target.weight);
+    writer.write_image(target.albedo);
+    writer.write_image(target.normal);
+    writer.write_image(target.denoise);
+
+    if(!writer.commit())
+        throw CheckpointException("failed to write partial render: " + filename);
+}
+
+PartialRenderTarget load_partial_render_target(const std::string &filename)
+{
+    CheckpointReader reader(filename, PARTIAL_RENDER_TAG);
+
+    PartialRenderTarget ret;
+    ret.full_res = reader.read<Vec2i>();
+    ret.rect     = reader.read<Rect2i>();
+
+    const int width  = ret.rect.high.x - ret.rect.low.x + 1;
+    const int height = ret.rect.high.y - ret.rect.low.y + 1;
+    if(width <= 0 || height <= 0 ||
+       ret.rect.low.x < 0 || ret.rect.high.x >= ret.full_res.x ||
+       ret.rect.low.y < 0 || ret.rect.high.y >= ret.full_res.y)
+        throw CheckpointException("invalid partial render rect: " + filename);
+
+    ret.value  .initialize(height, width);
+    ret.weight .initialize(height, width);
+    ret.albedo .initialize(height, width);
+    ret.normal .initialize(height, width);
+    ret.denoise.initialize(height, width);
+
+    reader.read_image(ret.value);
+    reader.read_image(ret.weight);
+    reader.read_image(ret.albedo);
+    reader.read_image(ret.normal);
+    reader.read_image(ret.denoise);
+
+    return ret;
+}
+
+RenderTarget merge_partial_render_targets(
+    const std::vector<PartialRenderTarget> &parts)
+{
+    if(parts.empty())
+        throw std::runtime_error("no partial render to merge");
+
+    const Vec2i full_res = parts.front().full_res;
+
+    Image2D<Spectrum> value  (full_res.y, full_res.x);
+    Image2D<real>     weight (full_res.y, full_res.x);
+    Image2D<Spectrum> albedo (full_res.y, full_res.x);
+    Image2D<Vec3>     normal (full_res.y, full_res.x);
+    Image2D<real>     denoise(full_res.y, full_res.x);
+
+    for(auto &part : parts)
+    {
+        if(part.full_res != full_res)
+        {
+            throw std::runtime_error(
+                "partial renders with different resolutions");
+        }
+
+        for(int y = 0; y < part.value.height(); ++y)
+        {
+            for(int x = 0; x < part.value.width(); ++x)
+            {
+                const int fy = y + part.rect.low.y, fx = x + part.rect.low.x;
+                value  (fy, fx) += part.value  (y, x);
+                weight (fy, fx) += part.weight (y, x);
+                albedo (fy, fx) += part.albedo (y, x);
+                normal (fy, fx) += part.normal (y, x);
+                denoise(fy, fx) += part.denoise(y, x);
+            }
+        }
+    }
+
+    auto ratio = weight.map([](real w)
+    {
+        return w > 0 ? 1 / w : real(1);
+    });
+
+    RenderTarget ret;
+    ret.image   = value   * ratio;
+    ret.albedo  = albedo  * ratio;
+    ret.normal  = normal  * ratio;
+    ret.denoise = denoise * ratio;
+
+    return ret;
+}
+
+AGZ_TRACER_END
@@ -0,0 +1,138 @@
+#include <agz/tracer/utility/parallel_grid.h>
+#include <agz/tracer/utility/splat_film.h>
+
+AGZ_TRACER_BEGIN
+
+namespace
+{
+    // upper bound of the total memory used by shards
+    constexpr size_t MAX_SHARD_BYTES = size_t(1) << 30;
+
+    // rows per task when summing shards
+    constexpr int REDUCE_ROW_COUNT = 16;
+
+    int compute_shard_count(int width, int height, int thread_count)
+    {
+        const size_t shard_bytes =
+            sizeof(Spectrum) * size_t(width) * size_t(height);
+        const size_t max_count = MAX_SHARD_BYTES / (std::max)(
+            shard_bytes, size_t(1));
+        return static_cast<int>((std::min)(
+            (std::max)(max_count, size_t(1)), size_t(thread_count)));
+    }
+}
+
+SplatFilm::SplatFilm(const FilmFilterApplier &filter, int thread_count)
+    : filter_(filter), thread_count_((std::max)(thread_count, 1)),
+      shards_(compute_shard_count(filter.width(), filter.height(),
+                                  thread_count_))
+{
+    for(int i = 0; i < thread_count_; ++i)
+    {
+        Shard *shard = &shards_[i % shards_.size()];
+        splatters_.push_back(newBox<Splatter>(this, shard));
+    }
+}
+
+SplatFilm::~SplatFilm() = default;
+
+SplatFilm::Splatter &SplatFilm::splatter(int thread_index) noexcept
+{
+    return *splatters_[thread_index];
+}
+
+void SplatFilm::add_image(const Image2D<Spectrum> &image)
+{
+    assert(image.width() == width() && image.height() == height());
+
+    Shard &shard = shards_[0];
+    std::lock_guard lk(shard.mutex);
+
+    if(!shard.image.is_available())
+        shard.image.initialize(height(), width());
+    for(int y = 0; y < height(); ++y)
+    {
+        for(int x = 0; x < width(); ++x)
+            shard.image(y, x) += image(y, x);
+    }
+}
+
+Image2D<Spectrum> SplatFilm::get_image(real scale) const
+{
+    Image2D<Spectrum> ret(height(), width());
+
+    parallel_for_1d_grid(
+        thread_count_, height(), REDUCE_ROW_COUNT,
+        [&](int, int beg, int end)
+    {
+        for(auto &shard : shards_)
+        {
+            std::lock_guard lk(shard.mutex);
+            if(!shard.image.is_available())
+                continue;
+
+            for(int y = beg; y < end; ++y)
+            {
+                for(int x = 0; x < width(); ++x)
+                    ret(y, x) += shard.image(y, x);
+            }
+        }
+
+        for(int y = beg; y < end; ++y)
+        {
+            for(int x = 0; x < width(); ++x)
+                ret(y, x) = scale * ret(y, x);
+        }
+    });
+
+    return ret;
+}
+
+int SplatFilm::width() const noexcept
+{
+    return filter_.width();
+}
+
+int SplatFilm::height() const noexcept
+{
+    return filter_.height();
+}
+
+SplatFilm::Splatter::Splatter(SplatFilm *film, Shard *shard)
+    : film_(film), shard_(shard)
+{
+    staged_.reserve(STAGE_CAPACITY);
+}
+
+void SplatFilm::Splatter::flush()
+{
+    if(staged_.empty())
+        return;
+
+    const FilmFilterApplier &filter = film_->filter_;
+    const Rect2i pixel_range = {
+        { 0, 0 },
+        { filter.width() - 1, filter.height() - 1 }
+    };
+    const real radius = filter.radius();
+
+    std::lock_guard lk(shard_->mutex);
+
+    Image2D<Spectrum> &image = shard_->image;
+    if(!image.is_available())
+        image.initialize(filter.height(), filter.width());
+
+    for(auto &s : staged_)
+    {
+        apply_image_filter(
+            pixel_range, radius, s.pixel_coord,
+            [&](int px, int py, real rel_x, real rel_y)
+        {
+            image(py, px) += filter.eval_filter(rel_x, rel_y) * s.value;
+        });
+    }
+
+    staged_.clear();
+}
+
+AGZ_TRACER_END
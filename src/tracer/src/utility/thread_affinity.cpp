@@ -0,0 +1,189 @@
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <agz/tracer/utility/logger.h>
+#include <agz/tracer/utility/thread_affinity.h>
+
+AGZ_TRACER_BEGIN
+
+namespace
+{
+#ifdef __linux__
+
+    /**
+     * @brief parse linux cpu list like "0-15,32-47"
+     */
+    std::vector<int> parse_cpu_list(const std::string &str)
+    {
+        std::vector<int> ret;
+
+        size_t beg = 0;
+        while(beg < str.size())
+        {
+            size_t end = str.find(',', beg);
+            if(end == std::string::npos)
+                end = str.size();
+
+            const std::string range = str.substr(beg, end - beg);
+            const size_t dash = range.find('-');
+            try
+            {
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = dash == std::string::npos ?
+                                 first : std::stoi(range.substr(dash + 1));
+                for(int cpu = first; cpu <= last; ++cpu)
+                    ret.push_back(cpu);
+            }
+            catch(...)
+            {
+                // ignore malformed ranges and trailing newlines
+            }
+
+            beg = end + 1;
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief allowed cpus in the order of worker assignment
+     */
+    std::vector<int> compute_worker_cpus()
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return {};
+
+        // numa node of each cpu
+
+        std::vector<int> cpu_node(CPU_SETSIZE, 0);
+        for(int node = 0; ; ++node)
+        {
+            std::ifstream fin(
+                "/sys/devices/system/node/node" +
+                std::to_string(node) + "/cpulist");
+            if(!fin)
+                break;
+
+            std::string list;
+            std::getline(fin, list);
+            for(int cpu : parse_cpu_list(list))
+            {
+                if(0 <= cpu && cpu < CPU_SETSIZE)
+                    cpu_node[cpu] = node;
+            }
+        }
+
+        // rank of each cpu in its node. linux numbers hyperthread siblings
+        // after all physical cores, so low ranks are physical cores
+
+        struct CPU
+        {
+            int id;
+            int node;
+            int rank;
+        };
+
+        std::vector<CPU> cpus;
+        std::vector<int> node_cpu_count;
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if(!CPU_ISSET(cpu, &allowed))
+                continue;
+
+            const int node = cpu_node[cpu];
+            if(static_cast<int>(node_cpu_count.size()) <= node)
+                node_cpu_count.resize(node + 1, 0);
+            cpus.push_back({ cpu, node, node_cpu_count[node]++ });
+        }
+
+        std::stable_sort(cpus.begin(), cpus.end(),
+            [](const CPU &a, const CPU &b)
+        {
+            if(a.rank != b.rank)
+                return a.rank < b.rank;
+            return a.node < b.node;
+        });
+
+        std::vector<int> ret;
+        for(auto &cpu : cpus)
+            ret.push_back(cpu.id);
+        return ret;
+    }
+
+    std::once_flag worker_cpus_flag;
+    std::vector<int> worker_cpus;
+
+    /**
+     * @brief cpus of compute_worker_cpus, computed by the first pinned
+     *  worker before it is pinned
+     */
+    const std::vector<int> &get_worker_cpus()
+    {
+        std::call_once(worker_cpus_flag, []
+        {
+            worker_cpus = compute_worker_cpus();
+            AGZ_INFO("worker pinning over {} cpus", worker_cpus.size());
+        });
+        return worker_cpus;
+    }
+
+#endif
+
+} // namespace anonymous
+
+WorkerPinningScope::WorkerPinningScope(bool enabled, int worker_index)
+{
+#ifdef __linux__
+    if(!enabled || worker_index < 0)
+        return;
+
+    const std::vector<int> &cpus = get_worker_cpus();
+    if(cpus.empty())
+        return;
+
+    cpu_set_t old_set;
+    CPU_ZERO(&old_set);
+    if(sched_getaffinity(0, sizeof(old_set), &old_set) != 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[worker_index % cpus.size()], &set);
+    if(sched_setaffinity(0, sizeof(set), &set) != 0)
+        return;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &old_set))
+            old_cpus_.push_back(cpu);
+    }
+#else
+    AGZ_UNACCESSED(enabled);
+    AGZ_UNACCESSED(worker_index);
+#endif
+}
+
+WorkerPinningScope::~WorkerPinningScope()
+{
+#ifdef __linux__
+    if(old_cpus_.empty())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : old_cpus_)
+        CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+AGZ_TRACER_END